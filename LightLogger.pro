@@ -20,6 +20,11 @@ TEMPLATE = app
 
 SOURCES  += main.cpp
 HEADERS  += lc_logging.h
+HEADERS  += lc_logging_syslog.h
+HEADERS  += lc_logging_net.h
+HEADERS  += lc_logging_shm.h
+HEADERS  += lc_logging_json.h
+HEADERS  += lc_logging_trace.h
 
 DEFINES  += BUILD_LOG_LEVEL_INFORMATION ENABLE_CODE_LOCATION
 
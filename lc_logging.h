@@ -35,7 +35,8 @@
  *
  * Available conf macros:
  * 1. COLORING_ENABLED: if defined it forces coloring. If not defined, it is defined or
- *    not according to the platform.
+ *    not according to the platform. Escape sequences are then written to terminals
+ *    only, unless NO_COLOR or CLICOLOR_FORCE is set. See lc_set_color_mode().
  * 2. ENABLE_LOG_*: if defined, it enables the specific log level.
  * 3. BUILD_LOG_LEVEL_*: if defined it enables all the levels with equal or higher
  *    priority:
@@ -48,10 +49,43 @@
  * 4. BUILD_LOG_LEVEL_ALL: enables all the logs.
  * 5. XCODE_COLORING_ENABLED: Enables coloring with XCode coloring format. This also
  *    enables COLORING_ENABLED automatically.
- * 6. CUSTOM_LOG_FILE: path to the log file.
+ * 6. CUSTOM_LOG_FILE: path to the log file. %p is replaced by the id of the process, and
+ *    the file is reopened in children created with fork() (see LC_ForkGuard).
  * 7. ENABLE_CODE_LOCATION: prepends the location in the sources for all the logs.
+ *    Sinks also find it in LC_Log::m_file, m_line and m_function.
  * 8. LOG_TAG: tag to be used when printing logs (on Android this is the tag used by
  *    logcat).
+ * 9. LC_LOGGING_DISABLE_THREADING: removes any dependency on <mutex>; internal locks
+ *    become no-ops.
+ * 10. ENABLE_FLIGHT_RECORDER: keeps the most recent records of every level in memory,
+ *    independently of BUILD_LOG_LEVEL_*. See LC_FlightRecorder. FLIGHT_RECORDER_SIZE
+ *    sets the size of the ring in bytes (1 MB by default).
+ * 11. LC_STDOUT_PATTERN, LC_FILE_PATTERN: layouts used by log_to_stdout and by
+ *    log_to_file, see LC_Layout. They can also be changed at runtime through
+ *    stdout_layout() and file_layout().
+ * 12. LC_MAX_FIELDS: max number of key-value fields a record can carry (8 by
+ *    default). See log_info_kv().
+ * 13. LC_MAX_STACK_FRAMES: max number of frames log_stacktrace() captures (64 by
+ *    default).
+ * 14. ENABLE_LINE_RESOLUTION: adds the source file and line to the frames of stack
+ *    traces on Linux, read from the DWARF line tables of the modules (build with -g).
+ * 15. LC_USE_LIBUNWIND, LC_UNWIND_FRAME_POINTERS: unwind stack traces with libunwind
+ *    (link with -lunwind) or by walking frame pointers (build everything with
+ *    -fno-omit-frame-pointer) instead of backtrace(). See lc_unwinder().
+ * 16. ENABLE_LOGGER_METRICS: counts records, bytes, drops and flushes per level and per
+ *    sink, and times the stages of one record every LC_METRICS_SAMPLING (64 by
+ *    default) per thread. See LC_Metrics.
+ * 17. LC_RECORD_BUFFER_SIZE, LC_RECORD_POOL_SIZE, LC_RECORD_SPILL_SIZE,
+ *    LC_RECORD_SPILL_COUNT: size and number of the buffers each thread keeps to build
+ *    records without allocating. See LC_RecordPool.
+ * 18. LC_MAX_TAGS, LC_TAG_CACHE_SIZE: number of tags interned with their prefixes and
+ *    per-tag level, and of tags each thread finds without locking. See LC_TagRegistry.
+ * 19. LC_QML_QUEUE_LIMIT: max records of QML waiting for the writer thread. See
+ *    LC_QMLLogger.
+ * 20. LC_COALESCE_WINDOW: ms after which the count of a record repeated in the stdout
+ *    or file sink is reported while the repetitions go on. See LC_Coalescer.
+ * 21. LC_CALL_SITE_LEVEL: with ENABLE_CODE_LOCATION, the most verbose level whose
+ *    call sites are on by default. See LC_CallSiteRegistry.
  *
  * Chaging default logger delegate
  * LC_LogDef is a typedef used in all the convenience functions. By default its value is
@@ -77,13 +111,45 @@
 #include <iostream>
 #include <cstdlib>
 #include <ctime>
+#include <cerrno>
+#include <cstdint>
 #include <set>
+#include <vector>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LC_UTF16_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LC_UTF16_NEON
+#endif
+#ifndef LC_LOGGING_DISABLE_THREADING
+#include <mutex>
+#include <atomic>
+#endif
 #if !defined(_WIN32) && !defined(_WIN32_WCE)
-#include <libgen.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
 #endif
 #ifdef __linux__
 #include <execinfo.h>
-#endif
+#include <sys/syscall.h>
+#ifdef ENABLE_LINE_RESOLUTION
+#include <elf.h>
+#include <link.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // ENABLE_LINE_RESOLUTION
+#ifdef LC_USE_LIBUNWIND
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+#endif // LC_USE_LIBUNWIND
+#endif // __linux__
 #if !defined(_WIN32) && !defined(_WIN32_WCE) && !defined(__ANDROID__)
 #include <unistd.h>
 #include <cxxabi.h>
@@ -92,16 +158,44 @@
 #include <Windows.h>
 #include <DbgHelp.h>
 #include <datetimeapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Dbghelp.lib")
+#endif
 #endif // WINVER<0x0602
 #ifdef __ANDROID__
 #include <android/log.h>
+#include <unistd.h>
 #else
 #include <assert.h>
 #endif // __ANDROID__
 
+#ifdef ENABLE_FLIGHT_RECORDER
+#include <csignal>
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+#include <fcntl.h>
+#endif
+#endif // ENABLE_FLIGHT_RECORDER
+
+#ifdef QT_CORE_LIB
+#include <QThread>
+#include <QByteArray>
+#include <QVariant>
+#include <QPoint>
+#include <QSize>
+#include <QRect>
+#include <QDateTime>
+#endif // QT_CORE_LIB
+
 #ifdef QT_QML_LIB
 #include <QObject>
 #include <QQmlContext>
+#include <QVariant>
+#include <QJsonDocument>
+#include <QCoreApplication>
+#ifndef LC_LOGGING_DISABLE_THREADING
+#include <thread>
+#include <condition_variable>
+#endif
 #endif // QT_QML_LIB
 
 // Apple-specific portion
@@ -125,9 +219,15 @@
    __builtin_expect((x), 1)
 #define LC_UNLIKELY(x) \
    __builtin_expect((x), 0)
+#define LC_NOINLINE __attribute__((noinline))
 #else
 #define LC_LIKELY(x) (x)
 #define LC_UNLIKELY(x) (x)
+#ifdef _MSC_VER
+#define LC_NOINLINE __declspec(noinline)
+#else
+#define LC_NOINLINE
+#endif // _MSC_VER
 #endif // __GNUC__
 
 // Coloring is automatically enabled if XCODE_COLORING_ENABLED is defined.
@@ -200,6 +300,28 @@
 #define ENABLE_LOG_DEBUG
 #endif // BUILD_LOG_LEVEL_ALL
 
+// Functions are generated for the enabled levels only. With the flight recorder all
+// of them are generated: the output threshold is then checked at runtime, so that
+// the recorder can see the levels that are not printed.
+#if defined(ENABLE_LOG_CRITICAL) || defined(ENABLE_FLIGHT_RECORDER)
+#define LC_GENERATE_LOG_CRITICAL
+#endif
+#if defined(ENABLE_LOG_ERROR) || defined(ENABLE_FLIGHT_RECORDER)
+#define LC_GENERATE_LOG_ERROR
+#endif
+#if defined(ENABLE_LOG_WARNING) || defined(ENABLE_FLIGHT_RECORDER)
+#define LC_GENERATE_LOG_WARNING
+#endif
+#if defined(ENABLE_LOG_INFORMATION) || defined(ENABLE_FLIGHT_RECORDER)
+#define LC_GENERATE_LOG_INFORMATION
+#endif
+#if defined(ENABLE_LOG_VERBOSE) || defined(ENABLE_FLIGHT_RECORDER)
+#define LC_GENERATE_LOG_VERBOSE
+#endif
+#if defined(ENABLE_LOG_DEBUG) || defined(ENABLE_FLIGHT_RECORDER)
+#define LC_GENERATE_LOG_DEBUG
+#endif
+
 namespace lightlogger {
 
 /*------------------------------------------------------------------------------
@@ -334,6 +456,211 @@ inline const NSString* lc_xc_col(const int& index)
 #endif // XCODE_COLORING_ENABLED
 
 inline std::string lc_current_time();
+inline unsigned long long lc_thread_id();
+inline const char* lc_thread_name();
+
+// Attributes as a bitmask, e.g. lc_attrib_bit(LC_LOG_ATTR_BLINK) |
+// lc_attrib_bit(LC_LOG_ATTR_UNDERLINE).
+typedef unsigned int LC_LogAttribMask;
+
+/*------------------------------------------------------------------------------
+|    lc_attrib_bit
++-----------------------------------------------------------------------------*/
+inline constexpr LC_LogAttribMask lc_attrib_bit(LC_LogAttrib attrib)
+{
+   return 1u << attrib;
+}
+
+enum LC_ColorMode {
+   LC_COLORS_AUTO,   // Only on terminals.
+   LC_COLORS_ALWAYS,
+   LC_COLORS_NEVER
+};
+
+/*------------------------------------------------------------------------------
+|    lc_color_mode_storage
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_color_mode_storage The mode is initially LC_COLORS_NEVER if NO_COLOR is set,
+* LC_COLORS_ALWAYS if CLICOLOR_FORCE is set and not "0", else LC_COLORS_AUTO.
+*/
+#ifndef LC_LOGGING_DISABLE_THREADING
+inline std::atomic<int>& lc_color_mode_storage()
+#else
+inline int& lc_color_mode_storage()
+#endif // LC_LOGGING_DISABLE_THREADING
+{
+   struct Initial {
+      static int mode() {
+         const char* force = getenv("CLICOLOR_FORCE");
+         if (getenv("NO_COLOR"))
+            return LC_COLORS_NEVER;
+         if (force && strcmp(force, "0"))
+            return LC_COLORS_ALWAYS;
+         return LC_COLORS_AUTO;
+      }
+   };
+
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static std::atomic<int> mode(Initial::mode());
+#else
+   static int mode = Initial::mode();
+#endif // LC_LOGGING_DISABLE_THREADING
+   return mode;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_set_color_mode
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_set_color_mode Sets when the escape sequences of colors and attributes are
+* written, see lc_colors_enabled().
+*/
+inline void lc_set_color_mode(LC_ColorMode mode)
+{
+   lc_color_mode_storage() = (int)mode;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_colors_enabled
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_colors_enabled Returns true if escape sequences are to be written to f: by
+* default only if it is a terminal, so that redirected output has none. Whether
+* stdout and stderr are terminals is checked once.
+*/
+inline bool lc_colors_enabled(FILE* f)
+{
+   const int mode = lc_color_mode_storage();
+   if (mode != LC_COLORS_AUTO)
+      return mode == LC_COLORS_ALWAYS;
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static const bool out = isatty(STDOUT_FILENO) == 1;
+   static const bool err = isatty(STDERR_FILENO) == 1;
+   const int fd = fileno(f);
+   if (fd == STDOUT_FILENO)
+      return out;
+   if (fd == STDERR_FILENO)
+      return err;
+   return fd >= 0 && isatty(fd) == 1;
+#else
+   (void)f;
+   return true;
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+}
+
+/*------------------------------------------------------------------------------
+|    lc_sgr_param
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_sgr_param Returns code, an attribute or a color, as text, from a table
+* instead of formatting it. length is set to its length.
+*/
+inline const char* lc_sgr_param(unsigned int code, size_t& length)
+{
+   static const char table[108][4] = {
+      "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11",
+      "12", "13", "14", "15", "16", "17", "18", "19", "20", "21", "22", "23",
+      "24", "25", "26", "27", "28", "29", "30", "31", "32", "33", "34", "35",
+      "36", "37", "38", "39", "40", "41", "42", "43", "44", "45", "46", "47",
+      "48", "49", "50", "51", "52", "53", "54", "55", "56", "57", "58", "59",
+      "60", "61", "62", "63", "64", "65", "66", "67", "68", "69", "70", "71",
+      "72", "73", "74", "75", "76", "77", "78", "79", "80", "81", "82", "83",
+      "84", "85", "86", "87", "88", "89", "90", "91", "92", "93", "94", "95",
+      "96", "97", "98", "99", "100", "101", "102", "103", "104", "105", "106", "107"
+   };
+
+   if (code >= 108)
+      code = C_RESET;
+   length = code < 10 ? 1 : (code < 100 ? 2 : 3);
+   return table[code];
+}
+
+/*------------------------------------------------------------------------------
+|    lc_sgr
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_sgr Writes the escape sequence selecting codes to out, e.g. "\x1B[0;31;49m",
+* without terminator. out must hold 3 + 4*count bytes.
+* @return The length of the sequence.
+*/
+inline size_t lc_sgr(char* out, const unsigned int* codes, size_t count)
+{
+   char* p = out;
+   *p++ = (char)0x1B;
+   *p++ = '[';
+   for (size_t i = 0; i < count; i++) {
+      size_t length;
+      const char* param = lc_sgr_param(codes[i], length);
+      if (i)
+         *p++ = ';';
+      memcpy(p, param, length);
+      p += length;
+   }
+   *p++ = 'm';
+   return (size_t)(p - out);
+}
+
+/*------------------------------------------------------------------------------
+|    lc_level_sgr
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_level_sgr Returns the escape sequence of the records of level: attributes
+* reset, color of the level, default background. length is set to its length.
+*/
+inline const char* lc_level_sgr(LC_LogLevel level, size_t& length)
+{
+   // Same colors as get_color_for_level().
+   static const char* const table[] = {
+      "\x1B[0;31;49m",
+      "\x1B[0;31;49m",
+      "\x1B[0;33;49m",
+      "\x1B[0;32;49m",
+      "\x1B[0;37;49m",
+      "\x1B[0;34;49m"
+   };
+
+   length = sizeof("\x1B[0;31;49m") - 1;
+   return table[(unsigned int)level <= LC_LOG_DEBUG ? level : LC_LOG_INFO];
+}
+
+/*------------------------------------------------------------------------------
+|    lc_write_sgr
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_write_sgr Writes the escape sequence selecting codes to f in one call, if
+* lc_colors_enabled(f).
+*/
+inline void lc_write_sgr(FILE* f, const unsigned int* codes, size_t count)
+{
+   if (!lc_colors_enabled(f))
+      return;
+
+   char sequence[3 + 4*16];
+   fwrite(sequence, 1, lc_sgr(sequence, codes, std::min(count, (size_t)16)), f);
+}
+
+/*------------------------------------------------------------------------------
+|    lc_font_change
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_font_change Changes font attributes. These will be used for the text
+* following this call.
+* @param f The FILE* on which the color change should be written.
+* @param attribs Attributes to enable, see lc_attrib_bit().
+* @param color A color.
+* @param foreground The background color.
+*/
+inline void lc_font_change(FILE* f, LC_LogAttribMask attribs, LC_LogColor color, LC_BackColor foreground)
+{
+   unsigned int codes[2 + C_STRIKETHROUGH + 1] = { (unsigned int)color, (unsigned int)foreground };
+   size_t count = 2;
+   for (unsigned int attrib = C_RESET; attrib <= C_STRIKETHROUGH; attrib++)
+      if (attribs & (1u << attrib))
+         codes[count++] = attrib;
+   lc_write_sgr(f, codes, count);
+}
 
 /*------------------------------------------------------------------------------
 |    lc_font_change
@@ -346,12 +673,12 @@ inline std::string lc_current_time();
 * @param color A color.
 * @param foreground The background color.
 */
-inline void lc_font_change(FILE* f, std::set<LC_LogAttrib> attribs, LC_LogColor color, LC_BackColor foreground)
+inline void lc_font_change(FILE* f, const std::set<LC_LogAttrib>& attribs, LC_LogColor color, LC_BackColor foreground)
 {
-    fprintf(f, "%c[%d;%d", 0x1B, color, foreground);
-    for (const LC_LogAttrib& attrib : attribs)
-        fprintf(f, ";%d", attrib);
-    fprintf(f, "m");
+   LC_LogAttribMask mask = 0;
+   for (const LC_LogAttrib& attrib : attribs)
+      mask |= lc_attrib_bit(attrib);
+   lc_font_change(f, mask, color, foreground);
 }
 
 /*------------------------------------------------------------------------------
@@ -367,7 +694,8 @@ inline void lc_font_change(FILE* f, std::set<LC_LogAttrib> attribs, LC_LogColor
 */
 inline void lc_font_change(FILE* f, LC_LogAttrib attrib, LC_LogColor color, LC_BackColor foreground)
 {
-    fprintf(f, "%c[%d;%dm%c[%dm", 0x1B, attrib, color, 0x1B, foreground);
+   const unsigned int codes[] = { (unsigned int)attrib, (unsigned int)color, (unsigned int)foreground };
+   lc_write_sgr(f, codes, 3);
 }
 
 /*------------------------------------------------------------------------------
@@ -382,7 +710,8 @@ inline void lc_font_change(FILE* f, LC_LogAttrib attrib, LC_LogColor color, LC_B
 */
 inline void lc_font_change(FILE* f, LC_LogAttrib attrib, LC_LogColor color)
 {
-   fprintf(f, "%c[%d;%dm", 0x1B, attrib, color);
+   const unsigned int codes[] = { (unsigned int)attrib, (unsigned int)color };
+   lc_write_sgr(f, codes, 2);
 }
 
 /*------------------------------------------------------------------------------
@@ -394,7 +723,8 @@ inline void lc_font_change(FILE* f, LC_LogAttrib attrib, LC_LogColor color)
 */
 inline void lc_font_reset(FILE* f)
 {
-   fprintf(f, "%c[%dm", 0x1B, C_RESET);
+   const unsigned int codes[] = { C_RESET };
+   lc_write_sgr(f, codes, 1);
 }
 
 /*------------------------------------------------------------------------------
@@ -415,7 +745,8 @@ inline void lc_color_change(FILE* f, LC_LogColor color)
 +-----------------------------------------------------------------------------*/
 /**
 * @brief lc_formatted_printf printf-like function accepting attributes and color for
-* the text being written.
+* the text being written. The escape sequences are left out if
+* lc_colors_enabled(f) is false.
 * @param f The output file descriptor to use.
 * @param attrib Attribute to use for the font.
 * @param color Color to use for the font.
@@ -423,19 +754,131 @@ inline void lc_color_change(FILE* f, LC_LogColor color)
 */
 inline void lc_formatted_printf(FILE* f, LC_LogAttrib attrib, LC_LogColor color, LC_BackColor foreground, const char* format, ...)
 {
-   std::stringstream sink;
-   sink << (char) 0x1B
-      << "[" << (int) attrib << ";"
-      << (int)color << "m";
-   sink << (char) 0x1B
-      << "[" << (int) attrib << ";"
-      << (int)foreground << "m";
-   sink << format;
-   sink << (char) 0x1B
-      << "[" << (int) LC_LOG_ATTR_RESET << "m";
-   std::string final = sink.str();
+   if (!lc_colors_enabled(f)) {
+      VA_LIST_CONTEXT(format, vfprintf(f, format, args));
+      return;
+   }
+
+   // A single vfprintf(), so that the text is not split by other threads.
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local std::string sequence;
+#else
+   static std::string sequence;
+#endif // LC_LOGGING_DISABLE_THREADING
+   char prefix[3 + 4*3];
+   const unsigned int codes[] = { (unsigned int)attrib, (unsigned int)color, (unsigned int)foreground };
+   sequence.assign(prefix, lc_sgr(prefix, codes, 3));
+   sequence.append(format);
+   sequence.append("\x1B[0m");
+
+   VA_LIST_CONTEXT(format, vfprintf(f, sequence.c_str(), args));
+}
+
+/*------------------------------------------------------------------------------
+|    lc_file_name
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_file_name Returns the last component of path, which is not modified.
+*/
+inline const char* lc_file_name(const char* path)
+{
+   const char* name = path;
+   for (const char* p = path; *p; p++)
+      if (*p == '/' || *p == '\\')
+         name = p + 1;
+   return name;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_append_location
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_append_location Appends the "[file:line/function] " prefix to out.
+*/
+inline void lc_append_location(std::string& out, const char* file, int line, const char* f)
+{
+   // lc_file_name() is reentrant, unlike basename() and the static buffers that were
+   // used with _splitpath_s().
+   char digits[12];
+   int i = sizeof(digits);
+   unsigned int value = line < 0 ? 0 : (unsigned int)line;
+   do {
+      digits[--i] = (char)('0' + value % 10);
+      value /= 10;
+   } while (value);
+
+   out.push_back('[');
+   out.append(lc_file_name(file));
+   out.push_back(':');
+   out.append(digits + i, sizeof(digits) - i);
+   out.push_back('/');
+   out.append(f ? f : "");
+   out.append("] ");
+}
+
+/*------------------------------------------------------------------------------
+|    lc_append_utf16
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_append_utf16 Appends the UTF-16 text s of size code units to out as UTF-8.
+* Runs of ASCII are narrowed 8 units at a time with SSE2 or NEON; unpaired surrogates
+* become U+FFFD.
+*/
+inline void lc_append_utf16(std::string& out, const unsigned short* s, size_t size)
+{
+   if (!size)
+      return;
+
+   // At most 3 bytes per unit: a surrogate pair is 4 bytes for 2 units.
+   const size_t start = out.size();
+   out.resize(start + size*3);
+   unsigned char* d = (unsigned char*)&out[start];
+
+   size_t i = 0;
+   while (i < size) {
+#if defined(LC_UTF16_SSE2)
+      const __m128i high = _mm_set1_epi16((short)0xFF80);
+      for (; i + 8 <= size; i += 8, d += 8) {
+         const __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+         if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, high), _mm_setzero_si128())) != 0xFFFF)
+            break;
+         _mm_storel_epi64((__m128i*)d, _mm_packus_epi16(v, v));
+      }
+#elif defined(LC_UTF16_NEON)
+      for (; i + 8 <= size; i += 8, d += 8) {
+         const uint16x8_t v = vld1q_u16(s + i);
+         if (vmaxvq_u16(v) >= 0x80)
+            break;
+         vst1_u8(d, vmovn_u16(v));
+      }
+#endif
+      if (i == size)
+         break;
+
+      unsigned int c = s[i++];
+      if (c < 0x80)
+         *d++ = (unsigned char)c;
+      else if (c < 0x800) {
+         *d++ = (unsigned char)(0xC0 | (c >> 6));
+         *d++ = (unsigned char)(0x80 | (c & 0x3F));
+      }
+      else if ((c & 0xFC00) == 0xD800 && i < size && (s[i] & 0xFC00) == 0xDC00) {
+         c = 0x10000 + ((c - 0xD800) << 10) + (s[i++] - 0xDC00);
+         *d++ = (unsigned char)(0xF0 | (c >> 18));
+         *d++ = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+         *d++ = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+         *d++ = (unsigned char)(0x80 | (c & 0x3F));
+      }
+      else {
+         if ((c & 0xF800) == 0xD800)
+            c = 0xFFFD;
+         *d++ = (unsigned char)(0xE0 | (c >> 12));
+         *d++ = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+         *d++ = (unsigned char)(0x80 | (c & 0x3F));
+      }
+   }
 
-   VA_LIST_CONTEXT(format, vfprintf(f, final.c_str(), args));
+   out.resize((size_t)((char*)d - &out[0]));
 }
 
 /*------------------------------------------------------------------------------
@@ -443,20 +886,10 @@ inline void lc_formatted_printf(FILE* f, LC_LogAttrib attrib, LC_LogColor color,
 +-----------------------------------------------------------------------------*/
 inline std::string prepend_location(const char* file, int line, const char* f, const char* format)
 {
-   std::stringstream ss;
-#ifndef _WIN32
-	ss << "[" << basename(const_cast<char*>(file));
-#else
-	static char fname[_MAX_FNAME];
-	static char ext[_MAX_EXT];
-	if (0 != _splitpath_s(file, NULL, 0, NULL, 0, fname, _MAX_FNAME, ext, _MAX_EXT))
-		ss << "[" << "-";
-	else
-		ss << "[" << fname << ext;
-#endif // _WIN32
-
-	ss << ":" << line << "/" << f << "] " << format;
-   return ss.str();
+   std::string s;
+   lc_append_location(s, file, line, f);
+   s.append(format);
+   return s;
 }
 
 #if defined(__APPLE__) && __OBJC__ == 1
@@ -466,20 +899,23 @@ inline std::string prepend_location(const char* file, int line, const char* f, c
 inline std::string prepend_location(const char* file, int line, const char* f, NSString* format)
 {
    std::stringstream ss;
-   ss << "[" << basename(const_cast<char*>(file)) << ":";
+   ss << "[" << lc_file_name(file) << ":";
    ss << line << "/" << f << "] " << [format cStringUsingEncoding:NSUTF8StringEncoding];
    return ss.str();
 }
 #endif // defined(__APPLE__) && __OBJC__ == 1
 
-#define log_location_t_v(logfunc, tag, format, args) \
-   (logfunc(tag, lightlogger::prepend_location(__FILE__, __LINE__, __FUNCTION__, format).data(), args))
-#define log_location_t(logfunc, tag, format, ...) \
-   (logfunc(tag, lightlogger::prepend_location(__FILE__, __LINE__, __FUNCTION__, format).data(), ##__VA_ARGS__))
-#define log_location_v(logfunc, format, args) \
-   (logfunc(lightlogger::prepend_location(__FILE__, __LINE__, __FUNCTION__, format).data(), args))
-#define log_location(logfunc, format, ...) \
-   (logfunc(lightlogger::prepend_location(__FILE__, __LINE__, __FUNCTION__, format).data(), ##__VA_ARGS__))
+// The location is stored in the record (see LC_Log::setLocation) by the *_at variants
+// of logfunc: text sinks get it prepended to the format, structured sinks can emit it
+// as separate fields. Each call has its LC_CallSite, see LC_CallSiteRegistry.
+#define log_location_t_v(logfunc, level, tag, format, args) \
+   LC_CALL_SITE(level, tag, format, logfunc ##_at(__FILE__, __LINE__, lc_site_function, tag, format, args))
+#define log_location_t(logfunc, level, tag, format, ...) \
+   LC_CALL_SITE(level, tag, format, logfunc ##_at(__FILE__, __LINE__, lc_site_function, tag, format, ##__VA_ARGS__))
+#define log_location_v(logfunc, level, format, args) \
+   LC_CALL_SITE(level, LOG_TAG, format, logfunc ##_at(__FILE__, __LINE__, lc_site_function, format, args))
+#define log_location(logfunc, level, format, ...) \
+   LC_CALL_SITE(level, LOG_TAG, format, logfunc ##_at(__FILE__, __LINE__, lc_site_function, format, ##__VA_ARGS__))
 
 #ifdef ENABLE_CODE_LOCATION
 #define FUNC(name) f_log_ ##name
@@ -535,6 +971,70 @@ inline std::string prepend_location(const char* file, int line, const char* f, N
       return retval;                                                                    \
    }
 
+#define GENERATE_LEVEL_LOCATION(name, enumname, retval)                                    \
+   inline bool FUNC(name ##_t_v_at)(const char* file, int line, const char* function,      \
+                                    const char* log_tag, const char* format, va_list args) \
+   {                                                                                       \
+      LC_Log logger(log_tag, enumname);                                                    \
+      logger.setLocation(file, line, function);                                            \
+      logger.printf(format, args);                                                         \
+      return retval;                                                                       \
+   }                                                                                       \
+                                                                                           \
+   inline bool FUNC(name ##_t_at)(const char* file, int line, const char* function,        \
+                                  const char* log_tag, const char* format, ...)            \
+   {                                                                                       \
+      VA_LIST_CONTEXT(format, FUNC(name ##_t_v_at)(file, line, function, log_tag, format, args)); \
+      return retval;                                                                       \
+   }                                                                                       \
+                                                                                           \
+   inline bool FUNC(name ##_v_at)(const char* file, int line, const char* function,        \
+                                  const char* format, va_list args)                        \
+   {                                                                                       \
+      return FUNC(name ##_t_v_at)(file, line, function, LOG_TAG, format, args);            \
+   }                                                                                       \
+                                                                                           \
+   inline bool FUNC(name ##_at)(const char* file, int line, const char* function,          \
+                                const char* format, ...)                                   \
+   {                                                                                       \
+      VA_LIST_CONTEXT(format, FUNC(name ##_t_v_at)(file, line, function, LOG_TAG, format, args)); \
+      return retval;                                                                       \
+   }
+
+#if defined(__APPLE__) && __OBJC__ == 1
+#define GENERATE_LEVEL_OBJC_LOCATION(name, enumname, retval)                               \
+   inline bool FUNC(name ##_t_v_at)(const char* file, int line, const char* function,      \
+                                    const char* log_tag, NSString* format, va_list args)   \
+   {                                                                                       \
+      LC_Log logger(log_tag, enumname);                                                    \
+      logger.setLocation(file, line, function);                                            \
+      logger.printf(format, args);                                                         \
+      return retval;                                                                       \
+   }                                                                                       \
+                                                                                           \
+   inline bool FUNC(name ##_t_at)(const char* file, int line, const char* function,        \
+                                  const char* log_tag, NSString* format, ...)              \
+   {                                                                                       \
+      VA_LIST_CONTEXT(format, FUNC(name ##_t_v_at)(file, line, function, log_tag, format, args)); \
+      return retval;                                                                       \
+   }                                                                                       \
+                                                                                           \
+   inline bool FUNC(name ##_v_at)(const char* file, int line, const char* function,        \
+                                  NSString* format, va_list args)                          \
+   {                                                                                       \
+      return FUNC(name ##_t_v_at)(file, line, function, LOG_TAG, format, args);            \
+   }                                                                                       \
+                                                                                           \
+   inline bool FUNC(name ##_at)(const char* file, int line, const char* function,          \
+                                NSString* format, ...)                                     \
+   {                                                                                       \
+      VA_LIST_CONTEXT(format, FUNC(name ##_t_v_at)(file, line, function, LOG_TAG, format, args)); \
+      return retval;                                                                       \
+   }
+#else
+#define GENERATE_LEVEL_OBJC_LOCATION(name, enumname, retval)
+#endif // defined(__APPLE__) && __OBJC__ == 1
+
 #if defined(__APPLE__) && __OBJC__ == 1
 #define GENERATE_LEVEL_OBJC(name, enumname, retval)                                   \
    inline bool FUNC(name ##_t_v)(const char* log_tag, NSString* format, va_list args) \
@@ -583,1245 +1083,7509 @@ inline std::string prepend_location(const char* file, int line, const char* f, N
 #endif
 
 /*------------------------------------------------------------------------------
-|    LC_NullStreamBuf class
+|    LC_Mutex class
 +-----------------------------------------------------------------------------*/
 /**
-* @brief The LC_NullStreamBuf class implements a null sink for a char stream.
+* @brief The LC_Mutex class is the lock used internally by the sinks. It is a no-op
+* when LC_LOGGING_DISABLE_THREADING is defined.
 */
-class LC_NullStreamBuf : public std::basic_streambuf<char> {};
+#ifndef LC_LOGGING_DISABLE_THREADING
+typedef std::mutex LC_Mutex;
+#else
+class LC_Mutex
+{
+public:
+   void lock() {}
+   void unlock() {}
+   bool try_lock() { return true; }
+};
+#endif // LC_LOGGING_DISABLE_THREADING
 
 /*------------------------------------------------------------------------------
-|    LC_NullStream class
+|    LC_MutexLocker class
 +-----------------------------------------------------------------------------*/
-/**
-* @brief The LC_NullStream struct A type that can be used as a null stream. This should
-* be optimized by the compiler.
-*/
-class LC_NullStream : public std::ostream {
+class LC_MutexLocker
+{
 public:
-   LC_NullStream() : std::ostream(&buf) {}
+   explicit LC_MutexLocker(LC_Mutex& mutex) : m_mutex(mutex) { m_mutex.lock(); }
+   ~LC_MutexLocker() { m_mutex.unlock(); }
+
 private:
-   LC_NullStreamBuf buf;
+   LC_MutexLocker(const LC_MutexLocker&);
+   LC_MutexLocker& operator =(const LC_MutexLocker&);
+
+   LC_Mutex& m_mutex;
 };
 
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
 /*------------------------------------------------------------------------------
-|    LC_LogPriv class
+|    LC_ForkHandler struct
 +-----------------------------------------------------------------------------*/
 /**
-* Internal class used for logging. This class is used to prepare the string that
-* will be printed by some other delegate class.
+* @brief The LC_ForkHandler struct holds the callbacks LC_ForkGuard runs around
+* fork(), with context as argument. Any of them can be NULL.
 */
-class LC_Log
+struct LC_ForkHandler
 {
-public:
-   LC_Log(LC_LogLevel level, bool nl = true);
-   LC_Log(LC_LogColor color, bool nl = true);
-   LC_Log(const char* log_tag, bool nl = true);
-   LC_Log(const char* log_tag, LC_LogLevel level, bool nl = true);
-   LC_Log(const char* log_tag, LC_LogAttrib attrib, LC_LogColor color, bool nl = true);
-   LC_Log(const char* log_tag, LC_LogAttrib attrib, LC_LogColor color, LC_BackColor foreground, bool nl = true);
+   void (*prepare)(void* context);
+   void (*parent)(void* context);
+   void (*child)(void* context);
+   void* context;
+};
 
-   ~LC_Log();
+inline void lc_reset_thread_id();
+inline void lc_reopen_log_file();
+inline LC_Mutex& lc_time_mutex();
 
-   std::ostream& stream();
+/*------------------------------------------------------------------------------
+|    LC_ForkGuard class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_ForkGuard class makes fork() safe while other threads are logging.
+* Before fork() the sinks take their locks, so no record is left half written and no
+* lock is held forever in the child, and stdio buffers are flushed, so they are not
+* written twice. After fork() the locks are released in both processes; in the child
+* the sinks drop the queues of the parent and start their writer threads again when
+* first used, the cached thread id is reset and a log file with a per-process name
+* (see CUSTOM_LOG_FILE) is reopened.
+* No thread can be converting a time with the C library, which locks the time zone
+* data and would leave the lock taken in the child (see lc_local_time()).
+* It registers itself with pthread_atfork() when first used by a sink, by file_stream()
+* or by lc_thread_id().
+*/
+class LC_ForkGuard
+{
+public:
+   static LC_ForkGuard& instance();
 
-   void printf(const char* format, ...);
-   void printf(const char* format, va_list args);
+   void add(const LC_ForkHandler& handler);
+   void remove(void* context);
 
-#if defined(__APPLE__) && defined(__OBJC__)
-   void printf(NSString* format, ...);
-   void printf(NSString* format, va_list args);
-#endif
+private:
+   LC_ForkGuard();
+   LC_ForkGuard(const LC_ForkGuard&);
+   LC_ForkGuard& operator =(const LC_ForkGuard&);
 
-   static std::string toString(LC_LogLevel level);
-   static LC_LogLevel fromString(const std::string& level);
+   static void prepare();
+   static void parent();
+   static void child();
 
-   void prependHeader(std::string& s);
-   void prependLogTagIfNeeded(std::string& s);
+   LC_Mutex m_mutex;
+   std::vector<LC_ForkHandler> m_handlers;
+};
 
-   std::string m_string;
+/*------------------------------------------------------------------------------
+|    LC_ForkGuard::LC_ForkGuard
++-----------------------------------------------------------------------------*/
+inline LC_ForkGuard::LC_ForkGuard()
+{
+   pthread_atfork(&LC_ForkGuard::prepare, &LC_ForkGuard::parent, &LC_ForkGuard::child);
+}
 
-   // If level is set, then attrib and color are not unless level
-   // is none.
-   LC_LogLevel m_level;
-   const char* m_log_tag;
-   LC_LogAttrib m_attrib;
-   LC_LogColor m_color;
-   LC_BackColor m_background;
-   bool m_nl;
+/*------------------------------------------------------------------------------
+|    LC_ForkGuard::instance
++-----------------------------------------------------------------------------*/
+inline LC_ForkGuard& LC_ForkGuard::instance()
+{
+   static LC_ForkGuard instance;
+   return instance;
+}
 
-private:
-   LC_Log(const LC_Log&);
-   LC_Log& operator =(const LC_Log&);
+/*------------------------------------------------------------------------------
+|    LC_ForkGuard::add
++-----------------------------------------------------------------------------*/
+inline void LC_ForkGuard::add(const LC_ForkHandler& handler)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_handlers.push_back(handler);
+}
 
-   void initForLevel(const LC_LogLevel& level);
+/*------------------------------------------------------------------------------
+|    LC_ForkGuard::remove
++-----------------------------------------------------------------------------*/
+/**
+* @brief remove Removes the handlers registered with context.
+*/
+inline void LC_ForkGuard::remove(void* context)
+{
+   LC_MutexLocker locker(m_mutex);
+   for (size_t i = m_handlers.size(); i > 0; i--)
+      if (m_handlers[i - 1].context == context)
+         m_handlers.erase(m_handlers.begin() + (i - 1));
+}
 
-   std::ostringstream m_stream;
-};
+/*------------------------------------------------------------------------------
+|    LC_ForkGuard::prepare
++-----------------------------------------------------------------------------*/
+inline void LC_ForkGuard::prepare()
+{
+   // The lock is held until fork() returns, in both processes.
+   LC_ForkGuard& guard = instance();
+   guard.m_mutex.lock();
+   for (size_t i = guard.m_handlers.size(); i > 0; i--)
+      if (guard.m_handlers[i - 1].prepare)
+         guard.m_handlers[i - 1].prepare(guard.m_handlers[i - 1].context);
+   lc_time_mutex().lock();
+   fflush(NULL);
+}
 
-typedef void (*custom_log_func)(LC_Log&, va_list);
-extern custom_log_func global_log_func;
+/*------------------------------------------------------------------------------
+|    LC_ForkGuard::parent
++-----------------------------------------------------------------------------*/
+inline void LC_ForkGuard::parent()
+{
+   LC_ForkGuard& guard = instance();
+   for (size_t i = 0; i < guard.m_handlers.size(); i++)
+      if (guard.m_handlers[i].parent)
+         guard.m_handlers[i].parent(guard.m_handlers[i].context);
+   lc_time_mutex().unlock();
+   guard.m_mutex.unlock();
+}
 
-#ifdef ENABLE_LOG_CRITICAL
+/*------------------------------------------------------------------------------
+|    LC_ForkGuard::child
++-----------------------------------------------------------------------------*/
+inline void LC_ForkGuard::child()
+{
+   LC_ForkGuard& guard = instance();
+   lc_time_mutex().unlock();
+   lc_reset_thread_id();
+   lc_reopen_log_file();
+   for (size_t i = 0; i < guard.m_handlers.size(); i++)
+      if (guard.m_handlers[i].child)
+         guard.m_handlers[i].child(guard.m_handlers[i].context);
+   guard.m_mutex.unlock();
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+/*------------------------------------------------------------------------------
+|    lc_time_mutex
++-----------------------------------------------------------------------------*/
+inline LC_Mutex& lc_time_mutex()
+{
+   static LC_Mutex mutex;
+   return mutex;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_utc_time
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_utc_time Same as gmtime_r(), computed here: the C library would take the
+* time zone lock.
+*/
+inline void lc_utc_time(time_t secs, struct tm& out)
+{
+   static const int yearDays[] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+   long long days = (long long)secs/86400;
+   long long rem = (long long)secs%86400;
+   if (rem < 0) {
+      rem += 86400;
+      days--;
+   }
+   out.tm_hour = (int)(rem/3600);
+   out.tm_min = (int)(rem%3600/60);
+   out.tm_sec = (int)(rem%60);
+   out.tm_wday = (int)(((days + 4)%7 + 7)%7);
+   out.tm_isdst = 0;
+
+   // Civil date from the days since 1970-01-01, counting from 0000-03-01.
+   days += 719468;
+   const long long era = (days >= 0 ? days : days - 146096)/146097;
+   const long long doe = days - era*146097;
+   const long long yoe = (doe - doe/1460 + doe/36524 - doe/146096)/365;
+   const long long doy = doe - (365*yoe + yoe/4 - yoe/100);
+   const long long mp = (5*doy + 2)/153;
+   const int day = (int)(doy - (153*mp + 2)/5 + 1);
+   const int month = (int)(mp < 10 ? mp + 3 : mp - 9);
+   const long long year = yoe + era*400 + (month <= 2);
+   const bool leap = (year%4 == 0 && year%100 != 0) || year%400 == 0;
+
+   out.tm_year = (int)(year - 1900);
+   out.tm_mon = month - 1;
+   out.tm_mday = day;
+   out.tm_yday = yearDays[month - 1] + day - 1 + ((leap && month > 2) ? 1 : 0);
+}
+
+/*------------------------------------------------------------------------------
+|    lc_local_time
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_local_time Same as localtime_r(), cached per thread for the current second.
+* The conversions hold lc_time_mutex(), which LC_ForkGuard takes before fork(): the time
+* zone lock of the C library is never inherited taken by a child.
+*/
+inline void lc_local_time(time_t secs, struct tm& out)
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local time_t cachedSecs = (time_t)-1;
+   static thread_local struct tm cached;
+#else
+   static time_t cachedSecs = (time_t)-1;
+   static struct tm cached;
+#endif // LC_LOGGING_DISABLE_THREADING
+   if (LC_UNLIKELY(secs != cachedSecs)) {
+#if defined(_WIN32) || defined(_WIN32_WCE)
+      LC_MutexLocker locker(lc_time_mutex());
+      localtime_s(&cached, &secs);
+#else
+      LC_ForkGuard::instance();
+      LC_MutexLocker locker(lc_time_mutex());
+      localtime_r(&secs, &cached);
+#endif
+      cachedSecs = secs;
+   }
+   out = cached;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NullStreamBuf class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_NullStreamBuf class implements a null sink for a char stream.
+*/
+class LC_NullStreamBuf : public std::basic_streambuf<char> {};
+
+/*------------------------------------------------------------------------------
+|    LC_NullStream class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_NullStream struct A type that can be used as a null stream. This should
+* be optimized by the compiler.
+*/
+class LC_NullStream : public std::ostream {
+public:
+   LC_NullStream() : std::ostream(&buf) {}
+private:
+   LC_NullStreamBuf buf;
+};
+
+#ifndef LC_RECORD_BUFFER_SIZE
+#define LC_RECORD_BUFFER_SIZE 512
+#endif
+#ifndef LC_RECORD_POOL_SIZE
+#define LC_RECORD_POOL_SIZE 8
+#endif
+#ifndef LC_RECORD_SPILL_SIZE
+#define LC_RECORD_SPILL_SIZE (64*1024)
+#endif
+#ifndef LC_RECORD_SPILL_COUNT
+#define LC_RECORD_SPILL_COUNT 2
+#endif
+
+/*------------------------------------------------------------------------------
+|    LC_RecordBuf class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_RecordBuf class is a stream buffer appending to a string. Unlike
+* std::stringbuf, the capacity of the string is kept when it is cleared.
+*/
+class LC_RecordBuf : public std::streambuf
+{
+public:
+   explicit LC_RecordBuf(std::string& out) : m_out(out) {}
+
+protected:
+   virtual int_type overflow(int_type c);
+   virtual std::streamsize xsputn(const char* s, std::streamsize n);
+
+private:
+   LC_RecordBuf(const LC_RecordBuf&);
+   LC_RecordBuf& operator =(const LC_RecordBuf&);
+
+   std::string& m_out;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_RecordBuf::overflow
++-----------------------------------------------------------------------------*/
+inline LC_RecordBuf::int_type LC_RecordBuf::overflow(int_type c)
+{
+   if (traits_type::eq_int_type(c, traits_type::eof()))
+      return traits_type::not_eof(c);
+
+   m_out.push_back(traits_type::to_char_type(c));
+   return c;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordBuf::xsputn
++-----------------------------------------------------------------------------*/
+inline std::streamsize LC_RecordBuf::xsputn(const char* s, std::streamsize n)
+{
+   m_out.append(s, (size_t)n);
+   return n;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordSlot struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_RecordSlot struct is the memory of a record: the text, and the stream
+* writing into it for LC_Log::stream(). See LC_RecordPool.
+*/
+struct LC_RecordSlot
+{
+   LC_RecordSlot();
+
+   void reset();
+
+   std::string text;
+   LC_RecordBuf buf;
+   std::ostream stream;
+   LC_RecordSlot* next;
+
+private:
+   LC_RecordSlot(const LC_RecordSlot&);
+   LC_RecordSlot& operator =(const LC_RecordSlot&);
+};
+
+/*------------------------------------------------------------------------------
+|    LC_RecordSlot::LC_RecordSlot
++-----------------------------------------------------------------------------*/
+inline LC_RecordSlot::LC_RecordSlot() :
+     buf(text)
+   , stream(&buf)
+   , next(NULL)
+{
+   text.reserve(LC_RECORD_BUFFER_SIZE);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordSlot::reset
++-----------------------------------------------------------------------------*/
+/**
+* @brief reset Empties the text and restores the default state of the stream, so that
+* manipulators used by a record do not leak into the next one.
+*/
+inline void LC_RecordSlot::reset()
+{
+   text.clear();
+   stream.clear();
+   stream.flags(std::ios_base::skipws | std::ios_base::dec);
+   stream.precision(6);
+   stream.width(0);
+   stream.fill(' ');
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordPool class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_RecordPool class keeps the slots of the records of a thread, so that
+* once warmed up records are built without touching the heap, and the allocator is
+* not contended by threads that log. Up to LC_RECORD_POOL_SIZE slots of
+* LC_RECORD_BUFFER_SIZE bytes are kept; slots that grew for long messages are kept
+* apart, up to LC_RECORD_SPILL_COUNT slots of LC_RECORD_SPILL_SIZE bytes, so that they
+* do not inflate the memory of every thread. Larger slots are freed.
+*/
+class LC_RecordPool
+{
+public:
+   static LC_RecordSlot* acquire();
+   static void release(LC_RecordSlot* slot);
+
+private:
+   LC_RecordPool();
+   ~LC_RecordPool();
+   LC_RecordPool(const LC_RecordPool&);
+   LC_RecordPool& operator =(const LC_RecordPool&);
+
+   static LC_RecordPool& local();
+   static bool& alive();
+
+   LC_RecordSlot* m_free;
+   unsigned int m_freeCount;
+   LC_RecordSlot* m_spill;
+   unsigned int m_spillCount;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_RecordPool::LC_RecordPool
++-----------------------------------------------------------------------------*/
+inline LC_RecordPool::LC_RecordPool() :
+     m_free(NULL)
+   , m_freeCount(0)
+   , m_spill(NULL)
+   , m_spillCount(0)
+{
+   // Do nothing.
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordPool::~LC_RecordPool
++-----------------------------------------------------------------------------*/
+inline LC_RecordPool::~LC_RecordPool()
+{
+   while (LC_RecordSlot* slot = m_free) {
+      m_free = slot->next;
+      delete slot;
+   }
+   while (LC_RecordSlot* slot = m_spill) {
+      m_spill = slot->next;
+      delete slot;
+   }
+   m_freeCount = 0;
+   m_spillCount = 0;
+   alive() = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordPool::local
++-----------------------------------------------------------------------------*/
+inline LC_RecordPool& LC_RecordPool::local()
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local LC_RecordPool pool;
+#else
+   static LC_RecordPool pool;
+#endif
+   return pool;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordPool::alive
++-----------------------------------------------------------------------------*/
+/**
+* @brief alive False once the pool of the thread was destroyed: records logged by
+* destructors that run later use slots that are not pooled. It is trivially
+* destructible, so it can still be read then.
+*/
+inline bool& LC_RecordPool::alive()
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local bool alive = true;
+#else
+   static bool alive = true;
+#endif
+   return alive;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordPool::acquire
++-----------------------------------------------------------------------------*/
+/**
+* @brief acquire Returns an empty slot, allocated only if the pool of the thread has
+* none left.
+*/
+inline LC_RecordSlot* LC_RecordPool::acquire()
+{
+   if (LC_UNLIKELY(!alive()))
+      return new LC_RecordSlot;
+
+   LC_RecordPool& pool = local();
+   LC_RecordSlot* slot = NULL;
+   if (pool.m_free) {
+      slot = pool.m_free;
+      pool.m_free = slot->next;
+      pool.m_freeCount--;
+   }
+   else if (pool.m_spill) {
+      slot = pool.m_spill;
+      pool.m_spill = slot->next;
+      pool.m_spillCount--;
+   }
+   else
+      return new LC_RecordSlot;
+
+   slot->reset();
+   slot->next = NULL;
+   return slot;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_RecordPool::release
++-----------------------------------------------------------------------------*/
+inline void LC_RecordPool::release(LC_RecordSlot* slot)
+{
+   if (LC_UNLIKELY(!alive())) {
+      delete slot;
+      return;
+   }
+
+   LC_RecordPool& pool = local();
+   const size_t capacity = slot->text.capacity();
+   if (capacity <= LC_RECORD_BUFFER_SIZE && pool.m_freeCount < LC_RECORD_POOL_SIZE) {
+      slot->next = pool.m_free;
+      pool.m_free = slot;
+      pool.m_freeCount++;
+   }
+   else if (capacity > LC_RECORD_BUFFER_SIZE && capacity <= LC_RECORD_SPILL_SIZE
+            && pool.m_spillCount < LC_RECORD_SPILL_COUNT) {
+      slot->next = pool.m_spill;
+      pool.m_spill = slot;
+      pool.m_spillCount++;
+   }
+   else
+      delete slot;
+}
+
+#ifndef LC_MAX_TAGS
+#define LC_MAX_TAGS 1024
+#endif
+#ifndef LC_TAG_CACHE_SIZE
+#define LC_TAG_CACHE_SIZE 64
+#endif
+
+/*------------------------------------------------------------------------------
+|    LC_Tag class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_Tag class is an interned log tag: its name, the "[name]: " prefix
+* written by the text sinks, precomputed with their lengths, a hash and the per-tag
+* settings. Tags are created by LC_TagRegistry and live as long as it does.
+*/
+class LC_Tag
+{
+public:
+   unsigned int id() const { return m_id; }
+   const char* name() const { return m_name.c_str(); }
+   size_t length() const { return m_name.size(); }
+   const char* prefix() const { return m_prefix.c_str(); }
+   size_t prefixLength() const { return m_prefix.size(); }
+   size_t hash() const { return m_hash; }
+
+   LC_LogLevel level() const;
+   void setLevel(LC_LogLevel level);
+
+private:
+   friend class LC_TagRegistry;
+
+   LC_Tag(unsigned int id, const char* name, size_t length, size_t hash);
+   LC_Tag(const LC_Tag&);
+   LC_Tag& operator =(const LC_Tag&);
+
+   unsigned int m_id;
+   std::string m_name;
+   std::string m_prefix;
+   size_t m_hash;
+   // Records of higher levels are not printed.
+#ifndef LC_LOGGING_DISABLE_THREADING
+   std::atomic<int> m_level;
+#else
+   int m_level;
+#endif
+};
+
+/*------------------------------------------------------------------------------
+|    LC_Tag::LC_Tag
++-----------------------------------------------------------------------------*/
+inline LC_Tag::LC_Tag(unsigned int id, const char* name, size_t length, size_t hash) :
+     m_id(id)
+   , m_name(name, length)
+   , m_hash(hash)
+   , m_level(LC_LOG_DEBUG)
+{
+   m_prefix.reserve(length + 4);
+   m_prefix.push_back('[');
+   m_prefix.append(m_name);
+   m_prefix.append("]: ");
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Tag::level
++-----------------------------------------------------------------------------*/
+inline LC_LogLevel LC_Tag::level() const
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   return (LC_LogLevel)m_level.load(std::memory_order_relaxed);
+#else
+   return (LC_LogLevel)m_level;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Tag::setLevel
++-----------------------------------------------------------------------------*/
+/**
+* @brief setLevel Prints only the records of this tag with equal or higher priority
+* than level, in addition to BUILD_LOG_LEVEL_*. The flight recorder still gets them.
+*/
+inline void LC_Tag::setLevel(LC_LogLevel level)
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   m_level.store((int)level, std::memory_order_relaxed);
+#else
+   m_level = (int)level;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_TagRegistry class interns the tags of the records, so that sinks get
+* their lengths and prefixes without measuring or building them. Tags are looked up by
+* content: they can be literals or strings that change, like the names of the Qt
+* categories. Each thread caches the tags it used by address, and a hit is verified
+* against the content, so no lock is taken once a thread has seen a tag. At most
+* LC_MAX_TAGS tags are interned; records with further tags have no LC_Tag and sinks
+* use the string.
+*/
+class LC_TagRegistry
+{
+public:
+   static LC_TagRegistry& instance();
+   static const LC_Tag* intern(const char* name);
+
+   LC_Tag* tag(const char* name);
+   LC_Tag* tag(unsigned int id);
+   size_t count();
+
+private:
+   LC_TagRegistry();
+   ~LC_TagRegistry();
+   LC_TagRegistry(const LC_TagRegistry&);
+   LC_TagRegistry& operator =(const LC_TagRegistry&);
+
+   static size_t hash(const char* name, size_t& length);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* registry);
+   static void unlockAfterFork(void* registry);
+#endif
+
+   LC_Mutex m_mutex;
+   std::vector<LC_Tag*> m_tags;
+   std::unordered_multimap<size_t, LC_Tag*> m_index;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::LC_TagRegistry
++-----------------------------------------------------------------------------*/
+inline LC_TagRegistry::LC_TagRegistry()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_TagRegistry::lockForFork,
+                              &LC_TagRegistry::unlockAfterFork,
+                              &LC_TagRegistry::unlockAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::~LC_TagRegistry
++-----------------------------------------------------------------------------*/
+inline LC_TagRegistry::~LC_TagRegistry()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+   for (size_t i = 0; i < m_tags.size(); i++)
+      delete m_tags[i];
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::instance
++-----------------------------------------------------------------------------*/
+inline LC_TagRegistry& LC_TagRegistry::instance()
+{
+   static LC_TagRegistry instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::hash
++-----------------------------------------------------------------------------*/
+/**
+* @brief hash FNV-1a of name, whose length is stored in length.
+*/
+inline size_t LC_TagRegistry::hash(const char* name, size_t& length)
+{
+   unsigned long long h = 14695981039346656037ULL;
+   const char* p = name;
+   for (; *p; p++) {
+      h ^= (unsigned char)*p;
+      h *= 1099511628211ULL;
+   }
+   length = (size_t)(p - name);
+   return (size_t)h;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::intern
++-----------------------------------------------------------------------------*/
+/**
+* @brief intern Returns the tag named name, interning it if needed, or NULL if name
+* is NULL or LC_MAX_TAGS tags were interned already.
+*/
+inline const LC_Tag* LC_TagRegistry::intern(const char* name)
+{
+   if (!name)
+      return NULL;
+
+   struct Entry {
+      const char* key;
+      const LC_Tag* tag;
+   };
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local Entry cache[LC_TAG_CACHE_SIZE];
+#else
+   static Entry cache[LC_TAG_CACHE_SIZE];
+#endif
+   Entry& entry = cache[((uintptr_t)name >> 3) % LC_TAG_CACHE_SIZE];
+   if (entry.key == name && !strncmp(name, entry.tag->name(), entry.tag->length() + 1))
+      return entry.tag;
+
+   const LC_Tag* tag = instance().tag(name);
+   if (tag) {
+      entry.key = name;
+      entry.tag = tag;
+   }
+   return tag;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::tag
++-----------------------------------------------------------------------------*/
+/**
+* @brief tag Returns the tag named name, interning it if needed. Use it to change the
+* settings of a tag, e.g. LC_TagRegistry::instance().tag("net")->setLevel(LC_LOG_WARN).
+* @return NULL if LC_MAX_TAGS tags were interned already.
+*/
+inline LC_Tag* LC_TagRegistry::tag(const char* name)
+{
+   if (!name)
+      name = "";
+   size_t length;
+   const size_t h = hash(name, length);
+
+   LC_MutexLocker locker(m_mutex);
+   typedef std::unordered_multimap<size_t, LC_Tag*>::const_iterator Iterator;
+   const std::pair<Iterator, Iterator> range = m_index.equal_range(h);
+   for (Iterator i = range.first; i != range.second; ++i)
+      if (i->second->length() == length && !memcmp(i->second->name(), name, length))
+         return i->second;
+
+   if (m_tags.size() >= LC_MAX_TAGS)
+      return NULL;
+
+   LC_Tag* tag = new LC_Tag((unsigned int)m_tags.size(), name, length, h);
+   m_tags.push_back(tag);
+   m_index.insert(std::make_pair(h, tag));
+   return tag;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::tag
++-----------------------------------------------------------------------------*/
+/**
+* @brief tag Returns the tag with the given id, or NULL.
+*/
+inline LC_Tag* LC_TagRegistry::tag(unsigned int id)
+{
+   LC_MutexLocker locker(m_mutex);
+   return id < m_tags.size() ? m_tags[id] : NULL;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::count
++-----------------------------------------------------------------------------*/
+inline size_t LC_TagRegistry::count()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_tags.size();
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_TagRegistry::lockForFork(void* registry)
+{
+   static_cast<LC_TagRegistry*>(registry)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TagRegistry::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_TagRegistry::unlockAfterFork(void* registry)
+{
+   static_cast<LC_TagRegistry*>(registry)->m_mutex.unlock();
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+#ifdef ENABLE_CODE_LOCATION
+#ifndef LC_CALL_SITE_LEVEL
+#define LC_CALL_SITE_LEVEL LC_LOG_DEBUG
+#endif
+
+enum LC_CallSiteState {
+   LC_SITE_OFF,
+   LC_SITE_ON,
+   LC_SITE_NEW
+};
+
+/*------------------------------------------------------------------------------
+|    LC_CallSite class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_CallSite class is the switch of a log_* call site, a static of the
+* call expanded by the macros (see LC_CALL_SITE). It is constant initialized, so
+* a disabled site costs a relaxed load and a branch: no record is built. The site
+* is added to LC_CallSiteRegistry, which sets it on or off, the first time it runs.
+*/
+class LC_CallSite
+{
+public:
+   constexpr LC_CallSite(const char* file, int line, LC_LogLevel level) :
+        m_state(LC_SITE_NEW)
+      , m_file(file)
+      , m_line(line)
+      , m_level(level)
+      , m_function(NULL)
+      , m_tag(NULL)
+      , m_format(NULL)
+   {}
+
+   bool isOff() const;
+   bool isNew() const;
+   bool isEnabled() const;
+   bool add(const char* function, const char* tag, const char* format);
+#if defined(__APPLE__) && __OBJC__ == 1
+   bool add(const char* function, const char* tag, NSString* format);
+#endif
+
+   const char* file() const { return m_file; }
+   int line() const { return m_line; }
+   LC_LogLevel level() const { return m_level; }
+   const char* function() const { return m_function; }
+   const LC_Tag* tag() const { return m_tag; }
+   const char* format() const { return m_format; }
+
+private:
+   friend class LC_CallSiteRegistry;
+
+   LC_CallSite(const LC_CallSite&);
+   LC_CallSite& operator =(const LC_CallSite&);
+
+   void setState(LC_CallSiteState state);
+
+#ifndef LC_LOGGING_DISABLE_THREADING
+   std::atomic<int> m_state;
+#else
+   int m_state;
+#endif
+   const char* m_file;
+   int m_line;
+   LC_LogLevel m_level;
+   // Set when added to the registry.
+   const char* m_function;
+   const LC_Tag* m_tag;
+   const char* m_format;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_CallSiteRegistry class lists the call sites that ran, and turns them
+* on and off by glob patterns ('*' and '?'). A pattern selects the sites whose
+* "file:line" (file name or path), function or tag it matches, e.g. "net.cpp:*",
+* "*.cpp:120", "parse*" or "net". Patterns are kept as rules and also apply to the
+* sites that did not run yet, in the order they were given. Sites of levels more
+* verbose than defaultLevel() start off: with setDefaultLevel(LC_LOG_INFO), debug and
+* verbose records are printed only by the sites turned on. At startup the rules in
+* the LC_CALL_SITES environment variable are applied, see apply().
+*/
+class LC_CallSiteRegistry
+{
+public:
+   static LC_CallSiteRegistry& instance();
+
+   bool add(LC_CallSite& site, const char* function, const char* tag, const char* format);
+   size_t setEnabled(const char* pattern, bool enabled);
+   bool apply(const char* rules);
+   void setDefaultLevel(LC_LogLevel level);
+   LC_LogLevel defaultLevel();
+   void reset();
+
+   size_t count();
+   std::string toString();
+
+private:
+   LC_CallSiteRegistry();
+   ~LC_CallSiteRegistry();
+   LC_CallSiteRegistry(const LC_CallSiteRegistry&);
+   LC_CallSiteRegistry& operator =(const LC_CallSiteRegistry&);
+
+   struct Rule {
+      std::string pattern;
+      bool enabled;
+   };
+
+   static bool matches(const LC_CallSite& site, const char* pattern);
+   LC_CallSiteState evaluate(const LC_CallSite& site) const;
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* registry);
+   static void unlockAfterFork(void* registry);
+#endif
+
+   LC_Mutex m_mutex;
+   std::vector<LC_CallSite*> m_sites;
+   std::vector<std::string*> m_formats;
+   std::vector<Rule> m_rules;
+   LC_LogLevel m_defaultLevel;
+};
+
+/*------------------------------------------------------------------------------
+|    lc_site_result
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_site_result What the log_* functions of level return.
+*/
+constexpr bool lc_site_result(LC_LogLevel level)
+{
+   return level > LC_LOG_WARN;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_glob_match
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_glob_match Returns true if text matches pattern, where '*' is any
+* sequence of characters and '?' any character.
+*/
+inline bool lc_glob_match(const char* pattern, const char* text)
+{
+   const char* star = NULL;
+   const char* resume = NULL;
+   while (*text) {
+      if (*pattern == '*') {
+         star = pattern++;
+         resume = text;
+      }
+      else if (*pattern == '?' || *pattern == *text) {
+         pattern++;
+         text++;
+      }
+      else if (star) {
+         pattern = star + 1;
+         text = ++resume;
+      }
+      else
+         return false;
+   }
+
+   while (*pattern == '*')
+      pattern++;
+   return !*pattern;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSite::isOff
++-----------------------------------------------------------------------------*/
+inline bool LC_CallSite::isOff() const
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   return m_state.load(std::memory_order_relaxed) == LC_SITE_OFF;
+#else
+   return m_state == LC_SITE_OFF;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSite::isNew
++-----------------------------------------------------------------------------*/
+inline bool LC_CallSite::isNew() const
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   return m_state.load(std::memory_order_relaxed) == LC_SITE_NEW;
+#else
+   return m_state == LC_SITE_NEW;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSite::isEnabled
++-----------------------------------------------------------------------------*/
+inline bool LC_CallSite::isEnabled() const
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   return m_state.load(std::memory_order_relaxed) == LC_SITE_ON;
+#else
+   return m_state == LC_SITE_ON;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSite::setState
++-----------------------------------------------------------------------------*/
+inline void LC_CallSite::setState(LC_CallSiteState state)
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   m_state.store(state, std::memory_order_relaxed);
+#else
+   m_state = state;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSite::add
++-----------------------------------------------------------------------------*/
+/**
+* @brief add Adds the site to the registry, if needed. Returns true if it is on.
+*/
+inline bool LC_CallSite::add(const char* function, const char* tag, const char* format)
+{
+   return LC_CallSiteRegistry::instance().add(*this, function, tag, format);
+}
+
+#if defined(__APPLE__) && __OBJC__ == 1
+/*------------------------------------------------------------------------------
+|    LC_CallSite::add
++-----------------------------------------------------------------------------*/
+inline bool LC_CallSite::add(const char* function, const char* tag, NSString* format)
+{
+   return add(function, tag, [format cStringUsingEncoding:NSUTF8StringEncoding]);
+}
+#endif // defined(__APPLE__) && __OBJC__ == 1
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::LC_CallSiteRegistry
++-----------------------------------------------------------------------------*/
+inline LC_CallSiteRegistry::LC_CallSiteRegistry() :
+   m_defaultLevel(LC_CALL_SITE_LEVEL)
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_CallSiteRegistry::lockForFork,
+                              &LC_CallSiteRegistry::unlockAfterFork,
+                              &LC_CallSiteRegistry::unlockAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+
+   const char* rules = getenv("LC_CALL_SITES");
+   if (rules)
+      apply(rules);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::~LC_CallSiteRegistry
++-----------------------------------------------------------------------------*/
+inline LC_CallSiteRegistry::~LC_CallSiteRegistry()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+   for (size_t i = 0; i < m_formats.size(); i++)
+      delete m_formats[i];
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::instance
++-----------------------------------------------------------------------------*/
+inline LC_CallSiteRegistry& LC_CallSiteRegistry::instance()
+{
+   static LC_CallSiteRegistry instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::add
++-----------------------------------------------------------------------------*/
+/**
+* @brief add Adds site, that ran for the first time in function with tag and format,
+* and sets it on or off. Returns true if it is on.
+*/
+inline bool LC_CallSiteRegistry::add(LC_CallSite& site, const char* function, const char* tag,
+                                     const char* format)
+{
+   // Outside the lock: the tag registry may log.
+   const LC_Tag* interned = tag ? LC_TagRegistry::instance().tag(tag) : NULL;
+
+   LC_MutexLocker locker(m_mutex);
+   if (!site.isNew())
+      return site.isEnabled();
+
+   m_formats.push_back(new std::string(format ? format : ""));
+   site.m_function = function;
+   site.m_tag = interned;
+   site.m_format = m_formats.back()->c_str();
+   m_sites.push_back(&site);
+
+   const LC_CallSiteState state = evaluate(site);
+   site.setState(state);
+   return state == LC_SITE_ON;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::setEnabled
++-----------------------------------------------------------------------------*/
+/**
+* @brief setEnabled Turns on or off the sites matching pattern, including those that
+* will run later.
+* @return The number of matching sites that ran already.
+*/
+inline size_t LC_CallSiteRegistry::setEnabled(const char* pattern, bool enabled)
+{
+   Rule rule;
+   rule.pattern = pattern ? pattern : "";
+   rule.enabled = enabled;
+
+   LC_MutexLocker locker(m_mutex);
+   m_rules.push_back(rule);
+
+   size_t count = 0;
+   for (size_t i = 0; i < m_sites.size(); i++) {
+      if (!matches(*m_sites[i], rule.pattern.c_str()))
+         continue;
+      m_sites[i]->setState(enabled ? LC_SITE_ON : LC_SITE_OFF);
+      count++;
+   }
+   return count;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::apply
++-----------------------------------------------------------------------------*/
+/**
+* @brief apply Applies a list of rules separated by spaces or commas: "+pattern"
+* turns sites on, "-pattern" off, e.g. "-* +net.cpp:* +parse*". A pattern with no
+* sign turns sites on.
+* @return false if a rule had an empty pattern; the others are applied anyway.
+*/
+inline bool LC_CallSiteRegistry::apply(const char* rules)
+{
+   bool ok = true;
+   const char* p = rules;
+   while (p && *p) {
+      while (*p == ' ' || *p == '\t' || *p == ',')
+         p++;
+      if (!*p)
+         break;
+
+      bool enabled = true;
+      if (*p == '+' || *p == '-')
+         enabled = (*p++ == '+');
+
+      const char* end = p;
+      while (*end && *end != ' ' && *end != '\t' && *end != ',')
+         end++;
+      if (end == p)
+         ok = false;
+      else
+         setEnabled(std::string(p, end).c_str(), enabled);
+      p = end;
+   }
+
+   return ok;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::setDefaultLevel
++-----------------------------------------------------------------------------*/
+/**
+* @brief setDefaultLevel Sets the most verbose level whose sites are on unless a
+* rule turns them off. The rules still apply.
+*/
+inline void LC_CallSiteRegistry::setDefaultLevel(LC_LogLevel level)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_defaultLevel = level;
+   for (size_t i = 0; i < m_sites.size(); i++)
+      m_sites[i]->setState(evaluate(*m_sites[i]));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::defaultLevel
++-----------------------------------------------------------------------------*/
+inline LC_LogLevel LC_CallSiteRegistry::defaultLevel()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_defaultLevel;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::reset
++-----------------------------------------------------------------------------*/
+/**
+* @brief reset Drops the rules, so the sites follow defaultLevel() only.
+*/
+inline void LC_CallSiteRegistry::reset()
+{
+   LC_MutexLocker locker(m_mutex);
+   m_rules.clear();
+   for (size_t i = 0; i < m_sites.size(); i++)
+      m_sites[i]->setState(evaluate(*m_sites[i]));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::count
++-----------------------------------------------------------------------------*/
+inline size_t LC_CallSiteRegistry::count()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_sites.size();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::toString
++-----------------------------------------------------------------------------*/
+/**
+* @brief toString Lists the sites that ran, one per line:
+* file:line [function] level tag =on|=off "format"
+*/
+inline std::string LC_CallSiteRegistry::toString()
+{
+   static const char* const levels[] = { "critical", "error", "warning", "info", "verbose", "debug" };
+
+   std::string s;
+   LC_MutexLocker locker(m_mutex);
+   for (size_t i = 0; i < m_sites.size(); i++) {
+      const LC_CallSite& site = *m_sites[i];
+      char line[32];
+      snprintf(line, sizeof(line), ":%d [", site.line());
+      s.append(site.file()).append(line).append(site.function() ? site.function() : "");
+      s.append("] ");
+      s.append((unsigned)site.level() < sizeof(levels)/sizeof(levels[0]) ? levels[site.level()] : "none");
+      s.push_back(' ');
+      s.append(site.tag() ? site.tag()->name() : "-");
+      s.append(site.isEnabled() ? " =on \"" : " =off \"");
+      for (const char* c = site.format(); *c; c++) {
+         if (*c == '\n')
+            s.append("\\n");
+         else {
+            if (*c == '"' || *c == '\\')
+               s.push_back('\\');
+            s.push_back(*c);
+         }
+      }
+      s.append("\"\n");
+   }
+
+   return s;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::matches
++-----------------------------------------------------------------------------*/
+inline bool LC_CallSiteRegistry::matches(const LC_CallSite& site, const char* pattern)
+{
+   char line[16];
+   snprintf(line, sizeof(line), ":%d", site.line());
+   const std::string path = std::string(site.file()) + line;
+   if (lc_glob_match(pattern, path.c_str()))
+      return true;
+   if (lc_glob_match(pattern, path.c_str() + (lc_file_name(site.file()) - site.file())))
+      return true;
+   if (site.function() && lc_glob_match(pattern, site.function()))
+      return true;
+   return site.tag() && lc_glob_match(pattern, site.tag()->name());
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::evaluate
++-----------------------------------------------------------------------------*/
+/**
+* @brief evaluate Returns the state of site given by the default level and by the
+* last rule matching it.
+*/
+inline LC_CallSiteState LC_CallSiteRegistry::evaluate(const LC_CallSite& site) const
+{
+   for (size_t i = m_rules.size(); i > 0; i--)
+      if (matches(site, m_rules[i - 1].pattern.c_str()))
+         return m_rules[i - 1].enabled ? LC_SITE_ON : LC_SITE_OFF;
+   return site.level() <= m_defaultLevel ? LC_SITE_ON : LC_SITE_OFF;
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_CallSiteRegistry::lockForFork(void* registry)
+{
+   static_cast<LC_CallSiteRegistry*>(registry)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CallSiteRegistry::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_CallSiteRegistry::unlockAfterFork(void* registry)
+{
+   static_cast<LC_CallSiteRegistry*>(registry)->m_mutex.unlock();
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+// Runs call, which can use lc_site_function, unless the call site is off. tag and
+// format are evaluated only if it is on, and again for the first call.
+#define LC_CALL_SITE(level, tag, format, call)                                       \
+   ([&](const char* lc_site_function) -> bool {                                      \
+      static lightlogger::LC_CallSite lc_site(__FILE__, __LINE__, level);            \
+      if (lc_site.isOff())                                                           \
+         return lightlogger::lc_site_result(level);                                  \
+      if (lc_site.isNew() && !lc_site.add(lc_site_function, tag, format))            \
+         return lightlogger::lc_site_result(level);                                  \
+      return call;                                                                   \
+   }(__FUNCTION__))
+#endif // ENABLE_CODE_LOCATION
+
+#ifndef LC_MAX_FIELDS
+#define LC_MAX_FIELDS 8
+#endif
+
+enum LC_FieldType {
+   LC_KV_INT,
+   LC_KV_UINT,
+   LC_KV_DOUBLE,
+   LC_KV_BOOL,
+   LC_KV_STRING
+};
+
+/*------------------------------------------------------------------------------
+|    LC_Field struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_Field struct is a typed key-value pair attached to a record, see kv().
+* Key and string values are not copied: they must be valid until the log call
+* returns.
+*/
+struct LC_Field
+{
+   const char* key;
+   LC_FieldType type;
+   union {
+      long long i;
+      unsigned long long u;
+      double d;
+      bool b;
+      struct {
+         const char* data;
+         size_t size;
+      } s;
+   } value;
+};
+
+/*------------------------------------------------------------------------------
+|    kv
++-----------------------------------------------------------------------------*/
+inline LC_Field kv(const char* key, long long value)
+{
+   LC_Field field;
+   field.key = key;
+   field.type = LC_KV_INT;
+   field.value.i = value;
+   return field;
+}
+
+inline LC_Field kv(const char* key, unsigned long long value)
+{
+   LC_Field field;
+   field.key = key;
+   field.type = LC_KV_UINT;
+   field.value.u = value;
+   return field;
+}
+
+inline LC_Field kv(const char* key, double value)
+{
+   LC_Field field;
+   field.key = key;
+   field.type = LC_KV_DOUBLE;
+   field.value.d = value;
+   return field;
+}
+
+inline LC_Field kv(const char* key, bool value)
+{
+   LC_Field field;
+   field.key = key;
+   field.type = LC_KV_BOOL;
+   field.value.b = value;
+   return field;
+}
+
+inline LC_Field kv(const char* key, const char* value, size_t size)
+{
+   LC_Field field;
+   field.key = key;
+   field.type = LC_KV_STRING;
+   field.value.s.data = value ? value : "";
+   field.value.s.size = value ? size : 0;
+   return field;
+}
+
+inline LC_Field kv(const char* key, const char* value)
+{
+   return kv(key, value, value ? strlen(value) : 0);
+}
+
+inline LC_Field kv(const char* key, const std::string& value)
+{
+   return kv(key, value.data(), value.size());
+}
+
+inline LC_Field kv(const char* key, int value)                { return kv(key, (long long)value); }
+inline LC_Field kv(const char* key, long value)               { return kv(key, (long long)value); }
+inline LC_Field kv(const char* key, short value)              { return kv(key, (long long)value); }
+inline LC_Field kv(const char* key, unsigned int value)       { return kv(key, (unsigned long long)value); }
+inline LC_Field kv(const char* key, unsigned long value)      { return kv(key, (unsigned long long)value); }
+inline LC_Field kv(const char* key, unsigned short value)     { return kv(key, (unsigned long long)value); }
+inline LC_Field kv(const char* key, float value)              { return kv(key, (double)value); }
+
+/*------------------------------------------------------------------------------
+|    lc_append_field_value
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_append_field_value Appends the value of field to out as text, without
+* quoting or escaping. Integers are converted without printf.
+*/
+inline void lc_append_field_value(std::string& out, const LC_Field& field)
+{
+   char buffer[32];
+   int i = sizeof(buffer);
+   unsigned long long u;
+   switch (field.type) {
+   case LC_KV_STRING:
+      out.append(field.value.s.data, field.value.s.size);
+      return;
+   case LC_KV_BOOL:
+      out.append(field.value.b ? "true" : "false");
+      return;
+   case LC_KV_DOUBLE:
+      i = snprintf(buffer, sizeof(buffer), "%.17g", field.value.d);
+      if (i > 0)
+         out.append(buffer, (size_t)i);
+      return;
+   case LC_KV_INT:
+      u = field.value.i < 0 ? 0ULL - (unsigned long long)field.value.i : (unsigned long long)field.value.i;
+      break;
+   case LC_KV_UINT:
+      u = field.value.u;
+      break;
+   default:
+      return;
+   }
+
+   do {
+      buffer[--i] = (char)('0' + u % 10);
+      u /= 10;
+   } while (u);
+   if (field.type == LC_KV_INT && field.value.i < 0)
+      buffer[--i] = '-';
+   out.append(buffer + i, sizeof(buffer) - i);
+}
+
+#ifndef LC_MAX_STACK_FRAMES
+#define LC_MAX_STACK_FRAMES 64
+#endif
+
+/*------------------------------------------------------------------------------
+|    LC_StackTrace struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_StackTrace struct holds the return addresses of a stack trace, as
+* captured. The sinks symbolize them through LC_SymbolCache.
+*/
+struct LC_StackTrace
+{
+   unsigned int size;
+   void* frames[LC_MAX_STACK_FRAMES];
+};
+
+/*------------------------------------------------------------------------------
+|    LC_ScopeNode struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_ScopeNode struct is an entry of the per-thread context stack. Nodes
+* live in LC_LogScope or LC_LogContextScope objects on the stack of the thread.
+*/
+struct LC_ScopeNode
+{
+   LC_Field field;
+   const LC_ScopeNode* parent;
+};
+
+/*------------------------------------------------------------------------------
+|    lc_scope_top
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_scope_top Returns the innermost context entry of the calling thread.
+*/
+inline const LC_ScopeNode*& lc_scope_top()
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local const LC_ScopeNode* top = NULL;
+#else
+   static const LC_ScopeNode* top = NULL;
+#endif // LC_LOGGING_DISABLE_THREADING
+   return top;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogScope class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_LogScope class adds a field to every record logged by the current
+* thread while it is alive, e.g.:
+*    LC_LogScope ctx("req", id);
+* Scopes nest and must be destroyed in reverse order, which is what happens to
+* local variables. Records only keep a pointer to the innermost entry, so entering a
+* scope and logging inside it cost no copy. The key is not copied: use literals.
+* String values are copied.
+*/
+class LC_LogScope
+{
+public:
+   LC_LogScope(const char* key, const char* value);
+   LC_LogScope(const char* key, char* value);
+   LC_LogScope(const char* key, const std::string& value);
+   template<typename T>
+   LC_LogScope(const char* key, T value);
+   ~LC_LogScope();
+
+private:
+   LC_LogScope(const LC_LogScope&);
+   LC_LogScope& operator =(const LC_LogScope&);
+
+   void push(const LC_Field& field);
+
+   std::string m_value;
+   LC_ScopeNode m_node;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_LogScope::LC_LogScope
++-----------------------------------------------------------------------------*/
+inline LC_LogScope::LC_LogScope(const char* key, const char* value) :
+   m_value(value ? value : "")
+{
+   push(kv(key, m_value));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogScope::LC_LogScope
++-----------------------------------------------------------------------------*/
+/**
+* @brief LC_LogScope Copies value like the const char* overload, which the template
+* would otherwise hide for char* and char arrays.
+*/
+inline LC_LogScope::LC_LogScope(const char* key, char* value) :
+   m_value(value ? value : "")
+{
+   push(kv(key, m_value));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogScope::LC_LogScope
++-----------------------------------------------------------------------------*/
+inline LC_LogScope::LC_LogScope(const char* key, const std::string& value) :
+   m_value(value)
+{
+   push(kv(key, m_value));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogScope::LC_LogScope
++-----------------------------------------------------------------------------*/
+template<typename T>
+inline LC_LogScope::LC_LogScope(const char* key, T value)
+{
+   push(kv(key, value));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogScope::~LC_LogScope
++-----------------------------------------------------------------------------*/
+inline LC_LogScope::~LC_LogScope()
+{
+   lc_scope_top() = m_node.parent;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogScope::push
++-----------------------------------------------------------------------------*/
+inline void LC_LogScope::push(const LC_Field& field)
+{
+   const LC_ScopeNode*& top = lc_scope_top();
+   m_node.field = field;
+   m_node.parent = top;
+   top = &m_node;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogContext class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_LogContext class is a copy of the context of a thread, to be used
+* where records outlive the scopes: asynchronous backends and tasks run by other
+* threads. Strings are packed in a single buffer. See LC_LogContextScope and
+* lc_bind_context().
+*/
+class LC_LogContext
+{
+public:
+   static LC_LogContext capture();
+
+   bool empty() const;
+
+private:
+   friend class LC_LogContextScope;
+
+   // Outermost first. The data of string fields is at the offset in m_offsets.
+   std::vector<LC_Field> m_fields;
+   std::vector<size_t> m_offsets;
+   std::string m_data;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_LogContext::capture
++-----------------------------------------------------------------------------*/
+/**
+* @brief capture Copies the context of the calling thread.
+*/
+inline LC_LogContext LC_LogContext::capture()
+{
+   LC_LogContext context;
+   for (const LC_ScopeNode* node = lc_scope_top(); node; node = node->parent) {
+      const LC_Field& field = node->field;
+      context.m_fields.insert(context.m_fields.begin(), field);
+      context.m_offsets.insert(context.m_offsets.begin(), context.m_data.size());
+      if (field.type == LC_KV_STRING)
+         context.m_data.append(field.value.s.data, field.value.s.size);
+   }
+
+   return context;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogContext::empty
++-----------------------------------------------------------------------------*/
+inline bool LC_LogContext::empty() const
+{
+   return m_fields.empty();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogContextScope class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_LogContextScope class pushes a captured context on the context of the
+* current thread while it is alive. context must outlive it.
+*/
+class LC_LogContextScope
+{
+public:
+   explicit LC_LogContextScope(const LC_LogContext& context);
+   ~LC_LogContextScope();
+
+private:
+   LC_LogContextScope(const LC_LogContextScope&);
+   LC_LogContextScope& operator =(const LC_LogContextScope&);
+
+   std::vector<LC_ScopeNode> m_nodes;
+   const LC_ScopeNode* m_previous;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_LogContextScope::LC_LogContextScope
++-----------------------------------------------------------------------------*/
+inline LC_LogContextScope::LC_LogContextScope(const LC_LogContext& context) :
+     m_nodes(context.m_fields.size())
+   , m_previous(lc_scope_top())
+{
+   const LC_ScopeNode* parent = m_previous;
+   for (size_t i = 0; i < m_nodes.size(); i++) {
+      m_nodes[i].field = context.m_fields[i];
+      if (m_nodes[i].field.type == LC_KV_STRING)
+         m_nodes[i].field.value.s.data = context.m_data.data() + context.m_offsets[i];
+      m_nodes[i].parent = parent;
+      parent = &m_nodes[i];
+   }
+
+   lc_scope_top() = parent;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LogContextScope::~LC_LogContextScope
++-----------------------------------------------------------------------------*/
+inline LC_LogContextScope::~LC_LogContextScope()
+{
+   lc_scope_top() = m_previous;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ContextTask class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_ContextTask class runs a callable with a captured context, see
+* lc_bind_context().
+*/
+template<typename F>
+class LC_ContextTask
+{
+public:
+   LC_ContextTask(const F& function, const LC_LogContext& context) :
+        m_function(function)
+      , m_context(context)
+   {
+      // Do nothing.
+   }
+
+   template<typename... Args>
+   void operator()(Args&&... args)
+   {
+      LC_LogContextScope scope(m_context);
+      m_function(std::forward<Args>(args)...);
+   }
+
+private:
+   F m_function;
+   LC_LogContext m_context;
+};
+
+/*------------------------------------------------------------------------------
+|    lc_bind_context
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_bind_context Wraps function so that it runs with the context of the
+* calling thread, wherever it is invoked, e.g.:
+*    pool.submit(lc_bind_context([] { log_info("done"); }));
+*/
+template<typename F>
+inline LC_ContextTask<F> lc_bind_context(const F& function)
+{
+   return LC_ContextTask<F>(function, LC_LogContext::capture());
+}
+
+#ifdef QT_CORE_LIB
+class LC_QtStream;
+#endif // QT_CORE_LIB
+
+/*------------------------------------------------------------------------------
+|    LC_LogPriv class
++-----------------------------------------------------------------------------*/
+/**
+* Internal class used for logging. This class is used to prepare the string that
+* will be printed by some other delegate class.
+*/
+class LC_Log
+{
+public:
+   LC_Log(LC_LogLevel level, bool nl = true);
+   LC_Log(LC_LogColor color, bool nl = true);
+   LC_Log(const char* log_tag, bool nl = true);
+   LC_Log(const char* log_tag, LC_LogLevel level, bool nl = true);
+   LC_Log(const char* log_tag, LC_LogAttrib attrib, LC_LogColor color, bool nl = true);
+   LC_Log(const char* log_tag, LC_LogAttrib attrib, LC_LogColor color, LC_BackColor foreground, bool nl = true);
+
+   ~LC_Log();
+
+   std::ostream& stream();
+#ifdef QT_CORE_LIB
+   LC_QtStream qstream();
+#endif // QT_CORE_LIB
+
+   void printf(const char* format, ...);
+   void printf(const char* format, va_list args);
+
+#if defined(__APPLE__) && defined(__OBJC__)
+   void printf(NSString* format, ...);
+   void printf(NSString* format, va_list args);
+#endif
+
+   static std::string toString(LC_LogLevel level);
+   static LC_LogLevel fromString(const std::string& level);
+   static bool isOutputEnabled(LC_LogLevel level);
+
+   bool isEnabled() const;
+
+   void setLocation(const char* file, int line, const char* function);
+   const char* message() const;
+
+   void addField(const LC_Field& field);
+   void addFields() {}
+   template<typename... Fields>
+   void addFields(const LC_Field& field, const Fields&... fields);
+   bool hasFields() const;
+   template<typename Visitor>
+   void visitFields(Visitor visitor) const;
+   void appendFields(std::string& out) const;
+   void appendStackTrace(std::string& out) const;
+
+   void prependHeader(std::string& s);
+   void prependLogTagIfNeeded(std::string& s);
+   size_t tagLength() const;
+
+   std::string m_string;
+
+   // If level is set, then attrib and color are not unless level
+   // is none.
+   LC_LogLevel m_level;
+   const char* m_log_tag;
+   // m_log_tag interned, set by printf(). NULL without a tag or beyond LC_MAX_TAGS.
+   const LC_Tag* m_tag;
+   LC_LogAttrib m_attrib;
+   LC_LogColor m_color;
+   LC_BackColor m_background;
+   bool m_nl;
+
+   // Location in the sources, set with ENABLE_CODE_LOCATION. m_string then starts
+   // with the "[file:line/function] " prefix, which is m_locationLength long.
+   const char* m_file;
+   int m_line;
+   const char* m_function;
+   size_t m_locationLength;
+
+   // Key-value fields, see log_info_kv(). Fields beyond LC_MAX_FIELDS are dropped.
+   LC_Field m_fields[LC_MAX_FIELDS];
+   unsigned int m_fieldCount;
+   // Innermost entry of the context of the thread when the record was created, see
+   // LC_LogScope.
+   const LC_ScopeNode* m_scope;
+   // Stack trace logged with the record, see log_stacktrace(). Not owned.
+   const LC_StackTrace* m_stack;
+
+private:
+#ifdef QT_CORE_LIB
+   friend class LC_QtStream;
+#endif // QT_CORE_LIB
+
+   LC_Log(const LC_Log&);
+   LC_Log& operator =(const LC_Log&);
+
+   void initForLevel(const LC_LogLevel& level);
+   template<typename Visitor>
+   static void visitScope(const LC_ScopeNode* node, Visitor& visitor);
+
+   // Taken from LC_RecordPool when first needed: the storage of m_string, swapped in,
+   // and the text written to stream().
+   LC_RecordSlot* m_textSlot;
+   LC_RecordSlot* m_streamSlot;
+};
+
+typedef void (*custom_log_func)(LC_Log&, va_list);
+extern custom_log_func global_log_func;
+
+#ifdef LC_GENERATE_LOG_CRITICAL
 GENERATE_LEVEL(critical, LC_LOG_CRITICAL, false)
 GENERATE_LEVEL_OBJC(critical, LC_LOG_CRITICAL, NO)
 #ifdef ENABLE_CODE_LOCATION
-#define log_critical_t_v(tag, format, args) \
-   log_location_t_v(f_log_critical_t_v, tag, format, args)
-#define log_critical_t(tag, format, ...) \
-   log_location_t(lightlogger::f_log_critical_t, tag, format, ##__VA_ARGS__)
-#define log_critical_v(format, args) \
-   log_location_v(f_log_critical_v, format, args)
-#define log_critical(format, ...) \
-   log_location(lightlogger::f_log_critical, format, ##__VA_ARGS__)
+GENERATE_LEVEL_LOCATION(critical, LC_LOG_CRITICAL, false)
+GENERATE_LEVEL_OBJC_LOCATION(critical, LC_LOG_CRITICAL, NO)
+#define log_critical_t_v(tag, format, args) \
+   log_location_t_v(lightlogger::f_log_critical_t_v, lightlogger::LC_LOG_CRITICAL, tag, format, args)
+#define log_critical_t(tag, format, ...) \
+   log_location_t(lightlogger::f_log_critical_t, lightlogger::LC_LOG_CRITICAL, tag, format, ##__VA_ARGS__)
+#define log_critical_v(format, args) \
+   log_location_v(lightlogger::f_log_critical_v, lightlogger::LC_LOG_CRITICAL, format, args)
+#define log_critical(format, ...) \
+   log_location(lightlogger::f_log_critical, lightlogger::LC_LOG_CRITICAL, format, ##__VA_ARGS__)
+#endif // ENABLE_CODE_LOCATION
+#else
+GENERATE_LEVEL_CUSTOM(critical, bool, return false)
+#endif // LC_GENERATE_LOG_CRITICAL
+
+#ifdef LC_GENERATE_LOG_ERROR
+GENERATE_LEVEL(err, LC_LOG_ERROR, false)
+GENERATE_LEVEL_OBJC(err, LC_LOG_ERROR, NO)
+#ifdef ENABLE_CODE_LOCATION
+GENERATE_LEVEL_LOCATION(err, LC_LOG_ERROR, false)
+GENERATE_LEVEL_OBJC_LOCATION(err, LC_LOG_ERROR, NO)
+#define log_err_t_v(tag, format, args) \
+   log_location_t_v(lightlogger::f_log_err_t_v, lightlogger::LC_LOG_ERROR, tag, format, args)
+#define log_err_t(tag, format, ...) \
+   log_location_t(lightlogger::f_log_err_t, lightlogger::LC_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define log_err_v(format, args) \
+   log_location_v(lightlogger::f_log_err_v, lightlogger::LC_LOG_ERROR, format, args)
+#define log_err(format, ...) \
+   log_location(lightlogger::f_log_err, lightlogger::LC_LOG_ERROR, format, ##__VA_ARGS__)
+#endif // ENABLE_CODE_LOCATION
+#else
+GENERATE_LEVEL_CUSTOM(err, bool, return false)
+#endif // LC_GENERATE_LOG_ERROR
+
+#ifdef LC_GENERATE_LOG_WARNING
+GENERATE_LEVEL(warn, LC_LOG_WARN, false)
+GENERATE_LEVEL_OBJC(warn, LC_LOG_WARN, NO)
+#ifdef ENABLE_CODE_LOCATION
+GENERATE_LEVEL_LOCATION(warn, LC_LOG_WARN, false)
+GENERATE_LEVEL_OBJC_LOCATION(warn, LC_LOG_WARN, NO)
+#define log_warn_t_v(tag, format, args) \
+   log_location_t_v(lightlogger::f_log_warn_t_v, lightlogger::LC_LOG_WARN, tag, format, args)
+#define log_warn_t(tag, format, ...) \
+   log_location_t(lightlogger::f_log_warn_t, lightlogger::LC_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define log_warn_v(format, args) \
+   log_location_v(lightlogger::f_log_warn_v, lightlogger::LC_LOG_WARN, format, args)
+#define log_warn(format, ...) \
+   log_location(lightlogger::f_log_warn, lightlogger::LC_LOG_WARN, format, ##__VA_ARGS__)
+#endif // ENABLE_CODE_LOCATION
+#else
+GENERATE_LEVEL_CUSTOM(warn, bool, return false)
+#endif // LC_GENERATE_LOG_WARNING
+
+#ifdef LC_GENERATE_LOG_INFORMATION
+GENERATE_LEVEL(info, LC_LOG_INFO, true)
+GENERATE_LEVEL_OBJC(info, LC_LOG_INFO, YES)
+#ifdef ENABLE_CODE_LOCATION
+GENERATE_LEVEL_LOCATION(info, LC_LOG_INFO, true)
+GENERATE_LEVEL_OBJC_LOCATION(info, LC_LOG_INFO, YES)
+#define log_info_t_v(tag, format, args) \
+   log_location_t_v(lightlogger::f_log_info_t_v, lightlogger::LC_LOG_INFO, tag, format, args)
+#define log_info_t(tag, format, ...) \
+   log_location_t(lightlogger::f_log_info_t, lightlogger::LC_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define log_info_v(format, args) \
+   log_location_v(lightlogger::f_log_info_v, lightlogger::LC_LOG_INFO, format, args)
+#define log_info(format, ...) \
+   log_location(lightlogger::f_log_info, lightlogger::LC_LOG_INFO, format, ##__VA_ARGS__)
+#endif // ENABLE_CODE_LOCATION
+#else
+GENERATE_LEVEL_CUSTOM(info, bool, return true)
+#endif // LC_GENERATE_LOG_INFORMATION
+
+#ifdef ENABLE_LOG_INFORMATION
+/*------------------------------------------------------------------------------
+|    log_formatted_t
++-----------------------------------------------------------------------------*/
+inline bool log_formatted_t_v(const char* log_tag, LC_LogAttrib a, LC_LogColor c, const char* format, va_list args)
+{
+   LC_Log(log_tag, a, c).printf(format, args);
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    log_formatted_t
++-----------------------------------------------------------------------------*/
+inline bool log_formatted_t(const char* log_tag, LC_LogAttrib a, LC_LogColor c, const char* format, ...)
+{
+   VA_LIST_CONTEXT(format, LC_Log(log_tag, a, c).printf(format, args));
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    log_formatted_v
++-----------------------------------------------------------------------------*/
+inline bool log_formatted_v(LC_LogAttrib a, LC_LogColor c, const char* format, va_list args)
+{
+   LC_Log(LOG_TAG, a, c).printf(format, args);
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    log_formatted
++-----------------------------------------------------------------------------*/
+inline bool log_formatted(LC_LogAttrib a, LC_LogColor c, const char* format, ...)
+{
+   VA_LIST_CONTEXT(format, LC_Log(LOG_TAG, a, c).printf(format, args));
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    log_formatted
++-----------------------------------------------------------------------------*/
+inline bool log_formatted(LC_LogColor c, const char* format, ...)
+{
+   VA_LIST_CONTEXT(format, LC_Log(LOG_TAG, LC_LOG_ATTR_RESET, c).printf(format, args));
+   return true;
+}
+
+#if defined(__APPLE__) && __OBJC__ == 1
+/*------------------------------------------------------------------------------
+|    log_formatted_t
++-----------------------------------------------------------------------------*/
+inline bool log_formatted_t(const char* log_tag, LC_LogAttrib a, LC_LogColor c, NSString* format, va_list args)
+{
+   LC_Log(log_tag, a, c).printf(format, args);
+   return YES;
+}
+
+/*------------------------------------------------------------------------------
+|    log_formatted
++-----------------------------------------------------------------------------*/
+inline bool log_formatted_t(const char* log_tag, LC_LogAttrib a, LC_LogColor c, NSString* format, ...)
+{
+   VA_LIST_CONTEXT(format, LC_Log(log_tag, a, c).printf(format, args));
+   return YES;
+}
+
+/*------------------------------------------------------------------------------
+|    log_formatted
++-----------------------------------------------------------------------------*/
+inline bool log_formatted(LC_LogAttrib a, LC_LogColor c, NSString* format, ...)
+{
+   VA_LIST_CONTEXT(format, log_formatted_t(LOG_TAG, a, c, format, args));
+   return YES;
+}
+
+/*------------------------------------------------------------------------------
+|    log_formatted
++-----------------------------------------------------------------------------*/
+inline bool log_formatted(LC_LogColor c, NSString* format, ...)
+{
+   VA_LIST_CONTEXT(format, log_formatted_t(LOG_TAG, LC_LOG_ATTR_RESET, c, format, args));
+   return YES;
+}
+#endif // defined(__APPLE__) && __OBJC__ == 1
+#else
+inline bool log_formatted_t_v(...) { return true; }
+inline bool log_formatted_t(...)   { return true; }
+inline bool log_formatted_v(...)   { return true; }
+inline bool log_formatted(...)     { return true; }
+#endif // ENABLE_LOG_INFORMATION
+
+#ifdef LC_GENERATE_LOG_VERBOSE
+GENERATE_LEVEL(verbose, LC_LOG_VERBOSE, true)
+GENERATE_LEVEL_OBJC(verbose, LC_LOG_VERBOSE, YES)
+#ifdef ENABLE_CODE_LOCATION
+GENERATE_LEVEL_LOCATION(verbose, LC_LOG_VERBOSE, true)
+GENERATE_LEVEL_OBJC_LOCATION(verbose, LC_LOG_VERBOSE, YES)
+#define log_verbose_t_v(tag, format, args) \
+   log_location_t_v(lightlogger::f_log_verbose_t_v, lightlogger::LC_LOG_VERBOSE, tag, format, args)
+#define log_verbose_t(tag, format, ...) \
+   log_location_t(lightlogger::f_log_verbose_t, lightlogger::LC_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+#define log_verbose_v(format, args) \
+   log_location_v(lightlogger::f_log_verbose_v, lightlogger::LC_LOG_VERBOSE, format, args)
+#define log_verbose(format, ...) \
+   log_location(lightlogger::f_log_verbose, lightlogger::LC_LOG_VERBOSE, format, ##__VA_ARGS__)
+#endif // ENABLE_CODE_LOCATION
+#else
+GENERATE_LEVEL_CUSTOM(verbose, bool, return true)
+#endif // LC_GENERATE_LOG_VERBOSE
+
+#ifdef LC_GENERATE_LOG_DEBUG
+GENERATE_LEVEL(debug, LC_LOG_DEBUG, true)
+GENERATE_LEVEL_OBJC(debug, LC_LOG_DEBUG, YES)
+#ifdef ENABLE_CODE_LOCATION
+GENERATE_LEVEL_LOCATION(debug, LC_LOG_DEBUG, true)
+GENERATE_LEVEL_OBJC_LOCATION(debug, LC_LOG_DEBUG, YES)
+#define log_debug_t_v(tag, format, args) \
+   log_location_t_v(lightlogger::f_log_debug_t_v, lightlogger::LC_LOG_DEBUG, tag, format, args)
+#define log_debug_t(tag, format, ...) \
+   log_location_t(lightlogger::f_log_debug_t, lightlogger::LC_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define log_debug_v(format, args) \
+   log_location_v(lightlogger::f_log_debug_v, lightlogger::LC_LOG_DEBUG, format, args)
+#define log_debug(format, ...) \
+   log_location(lightlogger::f_log_debug, lightlogger::LC_LOG_DEBUG, format, ##__VA_ARGS__)
+#endif // ENABLE_CODE_LOCATION
+#else
+GENERATE_LEVEL_CUSTOM(debug, bool, return true)
+#endif // LC_GENERATE_LOG_DEBUG
+
+GENERATE_LEVEL_CUSTOM(disabled, bool, return true)
+
+#if defined(__APPLE__) && __OBJC__ == 1
+/*------------------------------------------------------------------------------
+|    log_disabled_t_v
++-----------------------------------------------------------------------------*/
+inline bool log_disabled_t_v(const char* log_tag, NSString* format, va_list args)
+{
+   LOG_UNUSED(log_tag);
+   LOG_UNUSED(format);
+   LOG_UNUSED(args);
+
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    log_disabled_t
++-----------------------------------------------------------------------------*/
+inline bool log_disabled_t(const char* log_tag, NSString* format, ...)
+{
+   LOG_UNUSED(log_tag);
+   LOG_UNUSED(format);
+
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    log_disabled_v
++-----------------------------------------------------------------------------*/
+inline bool log_disabled_v(NSString* format, va_list args)
+{
+   LOG_UNUSED(format);
+   LOG_UNUSED(args);
+
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    log_disabled
++-----------------------------------------------------------------------------*/
+inline bool log_disabled(NSString* format, ...)
+{
+   LOG_UNUSED(format);
+
+   return true;
+}
+#endif // defined(__APPLE__) && __OBJC__ == 1
+
+/*------------------------------------------------------------------------------
+|    lc_log_kv
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_log_kv Logs message, which is not a format, with the given key-value
+* fields. Use the log_*_kv macros, e.g.:
+*    log_info_kv("request done", kv("status", code), kv("bytes", n));
+* The fields are kept typed in the record: text sinks render them as key=value after
+* the message, structured sinks as separate fields.
+*/
+template<typename... Fields>
+inline bool lc_log_kv(const char* file, int line, const char* function, const char* log_tag,
+                      LC_LogLevel level, const char* message, const Fields&... fields)
+{
+   LC_Log logger(log_tag, level);
+   if (logger.isEnabled()) {
+      if (file)
+         logger.setLocation(file, line, function);
+      logger.addFields(fields...);
+      if (strchr(message, '%'))
+         logger.printf("%s", message);
+      else
+         logger.printf(message);
+   }
+
+   return level > LC_LOG_WARN;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_log_kv_disabled
++-----------------------------------------------------------------------------*/
+template<typename... Args>
+inline bool lc_log_kv_disabled(bool retval, const Args&...)
+{
+   return retval;
+}
+
+#ifdef ENABLE_CODE_LOCATION
+#define LC_KV_CALL(tag, level, message, ...)                                                      \
+   LC_CALL_SITE(level, tag, message,                                                              \
+                lightlogger::lc_log_kv(__FILE__, __LINE__, lc_site_function, tag, level, message, \
+                                       ##__VA_ARGS__))
+#else
+#define LC_KV_CALL(tag, level, message, ...) \
+   lightlogger::lc_log_kv(NULL, 0, NULL, tag, level, message, ##__VA_ARGS__)
 #endif // ENABLE_CODE_LOCATION
+
+#ifdef LC_GENERATE_LOG_CRITICAL
+#define log_critical_kv_t(tag, message, ...) \
+   LC_KV_CALL(tag, lightlogger::LC_LOG_CRITICAL, message, ##__VA_ARGS__)
+#define log_critical_kv(message, ...) \
+   LC_KV_CALL(LOG_TAG, lightlogger::LC_LOG_CRITICAL, message, ##__VA_ARGS__)
+#else
+#define log_critical_kv_t(tag, message, ...) \
+   lightlogger::lc_log_kv_disabled(false, tag, message, ##__VA_ARGS__)
+#define log_critical_kv(message, ...) \
+   lightlogger::lc_log_kv_disabled(false, message, ##__VA_ARGS__)
+#endif // LC_GENERATE_LOG_CRITICAL
+
+#ifdef LC_GENERATE_LOG_ERROR
+#define log_err_kv_t(tag, message, ...) \
+   LC_KV_CALL(tag, lightlogger::LC_LOG_ERROR, message, ##__VA_ARGS__)
+#define log_err_kv(message, ...) \
+   LC_KV_CALL(LOG_TAG, lightlogger::LC_LOG_ERROR, message, ##__VA_ARGS__)
+#else
+#define log_err_kv_t(tag, message, ...) \
+   lightlogger::lc_log_kv_disabled(false, tag, message, ##__VA_ARGS__)
+#define log_err_kv(message, ...) \
+   lightlogger::lc_log_kv_disabled(false, message, ##__VA_ARGS__)
+#endif // LC_GENERATE_LOG_ERROR
+
+#ifdef LC_GENERATE_LOG_WARNING
+#define log_warn_kv_t(tag, message, ...) \
+   LC_KV_CALL(tag, lightlogger::LC_LOG_WARN, message, ##__VA_ARGS__)
+#define log_warn_kv(message, ...) \
+   LC_KV_CALL(LOG_TAG, lightlogger::LC_LOG_WARN, message, ##__VA_ARGS__)
+#else
+#define log_warn_kv_t(tag, message, ...) \
+   lightlogger::lc_log_kv_disabled(false, tag, message, ##__VA_ARGS__)
+#define log_warn_kv(message, ...) \
+   lightlogger::lc_log_kv_disabled(false, message, ##__VA_ARGS__)
+#endif // LC_GENERATE_LOG_WARNING
+
+#ifdef LC_GENERATE_LOG_INFORMATION
+#define log_info_kv_t(tag, message, ...) \
+   LC_KV_CALL(tag, lightlogger::LC_LOG_INFO, message, ##__VA_ARGS__)
+#define log_info_kv(message, ...) \
+   LC_KV_CALL(LOG_TAG, lightlogger::LC_LOG_INFO, message, ##__VA_ARGS__)
+#else
+#define log_info_kv_t(tag, message, ...) \
+   lightlogger::lc_log_kv_disabled(true, tag, message, ##__VA_ARGS__)
+#define log_info_kv(message, ...) \
+   lightlogger::lc_log_kv_disabled(true, message, ##__VA_ARGS__)
+#endif // LC_GENERATE_LOG_INFORMATION
+
+#ifdef LC_GENERATE_LOG_VERBOSE
+#define log_verbose_kv_t(tag, message, ...) \
+   LC_KV_CALL(tag, lightlogger::LC_LOG_VERBOSE, message, ##__VA_ARGS__)
+#define log_verbose_kv(message, ...) \
+   LC_KV_CALL(LOG_TAG, lightlogger::LC_LOG_VERBOSE, message, ##__VA_ARGS__)
+#else
+#define log_verbose_kv_t(tag, message, ...) \
+   lightlogger::lc_log_kv_disabled(true, tag, message, ##__VA_ARGS__)
+#define log_verbose_kv(message, ...) \
+   lightlogger::lc_log_kv_disabled(true, message, ##__VA_ARGS__)
+#endif // LC_GENERATE_LOG_VERBOSE
+
+#ifdef LC_GENERATE_LOG_DEBUG
+#define log_debug_kv_t(tag, message, ...) \
+   LC_KV_CALL(tag, lightlogger::LC_LOG_DEBUG, message, ##__VA_ARGS__)
+#define log_debug_kv(message, ...) \
+   LC_KV_CALL(LOG_TAG, lightlogger::LC_LOG_DEBUG, message, ##__VA_ARGS__)
+#else
+#define log_debug_kv_t(tag, message, ...) \
+   lightlogger::lc_log_kv_disabled(true, tag, message, ##__VA_ARGS__)
+#define log_debug_kv(message, ...) \
+   lightlogger::lc_log_kv_disabled(true, message, ##__VA_ARGS__)
+#endif // LC_GENERATE_LOG_DEBUG
+
+// Convenience macros. The same as using the inlined functions.
+#ifdef __GNUC__
+#define LOG_CRITICAL(tag, f, ...) \
+   log_critical_t(tag, f, ##__VA_ARGS__)
+#define LOG_ERROR(tag, f, ...) \
+   log_err_t(tag, f, ##__VA_ARGS__)
+#define LOG_WARNING(tag, f, ...) \
+   log_warn_t(tag, f, ##__VA_ARGS__)
+#define LOG_INFORMATION(tag, f, ...) \
+   log_info_t(tag, f, ##__VA_ARGS__)
+#define LOG_VERBOSE(tag, f, ...) \
+   log_verbose_t(tag, f, ##__VA_ARGS__)
+#define LOG_DEBUG(tag, f, ...) \
+   log_debug_t(tag, f, ##__VA_ARGS__)
+#endif
+
+#define log_func \
+   lightlogger::log_debug("Entering: %s.", __PRETTY_FUNCTION__)
+#define log_info_func \
+   lightlogger::log_info("Entering: %s.", __PRETTY_FUNCTION__)
+#define log_verbose_func \
+   lightlogger::log_verbose("Entering: %s.", __PRETTY_FUNCTION__)
+#define log_debug_func \
+   lightlogger::log_debug("Entering: %s.", __PRETTY_FUNCTION__)
+
+#if defined(ENABLE_LINE_RESOLUTION) && defined(__linux__)
+/*------------------------------------------------------------------------------
+|    LC_LineTable class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_LineTable class maps the addresses of an ELF file to source file and
+* line, from its DWARF line tables (.debug_line, DWARF 2 to 5): build with -g. Compressed
+* debug sections and split DWARF are not supported. The whole table is kept in memory,
+* about 24 bytes per row.
+*/
+class LC_LineTable
+{
+public:
+   LC_LineTable();
+
+   bool load(const char* path);
+   bool find(uintptr_t address, std::string& out) const;
+
+private:
+   struct Row {
+      uintptr_t address;
+      unsigned int file;
+      unsigned int line;
+      bool end;
+   };
+
+   struct Section {
+      const unsigned char* data;
+      size_t size;
+   };
+
+   // Little-endian reader of a section; reads past the end yield 0.
+   struct Reader {
+      const unsigned char* p;
+      const unsigned char* end;
+
+      unsigned long long u(size_t n);
+      unsigned long long uleb();
+      long long sleb();
+      const char* str();
+   };
+
+   void parseUnit(Reader& r, const Section& strs, const Section& lineStrs);
+   static bool readForm(Reader& r, unsigned long long form, bool dwarf64, const Section& strs,
+                        const Section& lineStrs, const char*& string);
+   unsigned int addFile(const char* path);
+
+   std::vector<Row> m_rows;
+   std::vector<std::string> m_files;
+   std::unordered_map<std::string, unsigned int> m_fileIds;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::LC_LineTable
++-----------------------------------------------------------------------------*/
+inline LC_LineTable::LC_LineTable()
+{
+   // Do nothing.
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::Reader::u
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_LineTable::Reader::u(size_t n)
+{
+   if ((size_t)(end - p) < n) {
+      p = end;
+      return 0;
+   }
+
+   unsigned long long value = 0;
+   for (size_t i = 0; i < n; i++)
+      value |= (unsigned long long)p[i] << (8*i);
+   p += n;
+   return value;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::Reader::uleb
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_LineTable::Reader::uleb()
+{
+   unsigned long long value = 0;
+   unsigned int shift = 0;
+   while (p < end) {
+      const unsigned char byte = *p++;
+      if (shift < 64)
+         value |= (unsigned long long)(byte & 0x7F) << shift;
+      shift += 7;
+      if (!(byte & 0x80))
+         break;
+   }
+   return value;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::Reader::sleb
++-----------------------------------------------------------------------------*/
+inline long long LC_LineTable::Reader::sleb()
+{
+   unsigned long long value = 0;
+   unsigned int shift = 0;
+   unsigned char byte = 0;
+   while (p < end) {
+      byte = *p++;
+      if (shift < 64)
+         value |= (unsigned long long)(byte & 0x7F) << shift;
+      shift += 7;
+      if (!(byte & 0x80))
+         break;
+   }
+   if (shift < 64 && (byte & 0x40))
+      value |= ~0ULL << shift;
+   return (long long)value;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::Reader::str
++-----------------------------------------------------------------------------*/
+inline const char* LC_LineTable::Reader::str()
+{
+   const unsigned char* s = p;
+   while (p < end && *p)
+      p++;
+   if (p == end)
+      return "";
+   p++;
+   return (const char*)s;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::load
++-----------------------------------------------------------------------------*/
+/**
+* @brief load Reads the line tables of the ELF file at path.
+* @return false if the file cannot be read or has no line tables.
+*/
+inline bool LC_LineTable::load(const char* path)
+{
+   const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      return false;
+
+   struct stat st;
+   void* map = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ElfW(Ehdr)))
+      map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   ::close(fd);
+   if (map == MAP_FAILED)
+      return false;
+
+   const unsigned char* base = (const unsigned char*)map;
+   const size_t size = (size_t)st.st_size;
+   const ElfW(Ehdr)* header = (const ElfW(Ehdr)*)base;
+   Section line = { NULL, 0 };
+   Section strs = { NULL, 0 };
+   Section lineStrs = { NULL, 0 };
+
+   const bool valid = memcmp(header->e_ident, ELFMAG, SELFMAG) == 0
+         && header->e_ident[EI_CLASS] == (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32)
+         && header->e_shentsize == sizeof(ElfW(Shdr))
+         && header->e_shoff < size
+         && header->e_shnum <= (size - header->e_shoff)/sizeof(ElfW(Shdr))
+         && header->e_shstrndx < header->e_shnum;
+   if (valid) {
+      const ElfW(Shdr)* sections = (const ElfW(Shdr)*)(base + header->e_shoff);
+      const ElfW(Shdr)& names = sections[header->e_shstrndx];
+      for (unsigned int i = 0; i < header->e_shnum && names.sh_offset < size; i++) {
+         const ElfW(Shdr)& s = sections[i];
+         if (s.sh_type == SHT_NOBITS || (s.sh_flags & SHF_COMPRESSED)
+               || s.sh_offset > size || s.sh_size > size - s.sh_offset
+               || s.sh_name >= names.sh_size || s.sh_name >= size - names.sh_offset)
+            continue;
+
+         const char* name = (const char*)(base + names.sh_offset + s.sh_name);
+         const size_t maxLength = size - names.sh_offset - s.sh_name;
+         Section section = { base + s.sh_offset, (size_t)s.sh_size };
+         if (!strncmp(name, ".debug_line", maxLength))
+            line = section;
+         else if (!strncmp(name, ".debug_str", maxLength))
+            strs = section;
+         else if (!strncmp(name, ".debug_line_str", maxLength))
+            lineStrs = section;
+      }
+   }
+
+   Reader r = { line.data, line.data + line.size };
+   while (line.data && r.p < r.end)
+      parseUnit(r, strs, lineStrs);
+   munmap(map, size);
+
+   // At equal addresses the end of a sequence comes first, so that the start of the
+   // next one is found.
+   std::stable_sort(m_rows.begin(), m_rows.end(), [](const Row& a, const Row& b) {
+      return a.address < b.address || (a.address == b.address && a.end && !b.end);
+   });
+   return !m_rows.empty();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::find
++-----------------------------------------------------------------------------*/
+/**
+* @brief find Appends "file:line" of address, relative to the file, to out.
+*/
+inline bool LC_LineTable::find(uintptr_t address, std::string& out) const
+{
+   std::vector<Row>::const_iterator it = std::upper_bound(m_rows.begin(), m_rows.end(), address,
+                                                          [](uintptr_t a, const Row& row) {
+      return a < row.address;
+   });
+   if (it == m_rows.begin())
+      return false;
+
+   --it;
+   if (it->end || !it->line)
+      return false;
+
+   char buffer[16];
+   snprintf(buffer, sizeof(buffer), ":%u", it->line);
+   out.append(m_files[it->file]).append(buffer);
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::addFile
++-----------------------------------------------------------------------------*/
+inline unsigned int LC_LineTable::addFile(const char* path)
+{
+   const std::string name = lc_file_name(path);
+   std::unordered_map<std::string, unsigned int>::iterator it = m_fileIds.find(name);
+   if (it != m_fileIds.end())
+      return it->second;
+
+   m_files.push_back(name);
+   m_fileIds[name] = (unsigned int)m_files.size() - 1;
+   return (unsigned int)m_files.size() - 1;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::readForm
++-----------------------------------------------------------------------------*/
+/**
+* @brief readForm Reads an attribute of a DWARF 5 directory or file entry; string is set
+* for string forms.
+* @return false for forms that cannot appear in line tables.
+*/
+inline bool LC_LineTable::readForm(Reader& r, unsigned long long form, bool dwarf64,
+                                   const Section& strs, const Section& lineStrs, const char*& string)
+{
+   string = NULL;
+   switch (form) {
+   case 0x08: // DW_FORM_string
+      string = r.str();
+      return true;
+   case 0x0e:   // DW_FORM_strp
+   case 0x1f: { // DW_FORM_line_strp
+      const Section& s = (form == 0x0e) ? strs : lineStrs;
+      const unsigned long long offset = r.u(dwarf64 ? 8 : 4);
+      if (s.data && offset < s.size && memchr(s.data + offset, 0, s.size - offset))
+         string = (const char*)s.data + offset;
+      return true;
+   }
+   case 0x0b: r.u(1); return true;             // DW_FORM_data1
+   case 0x05: r.u(2); return true;             // DW_FORM_data2
+   case 0x06: r.u(4); return true;             // DW_FORM_data4
+   case 0x07: r.u(8); return true;             // DW_FORM_data8
+   case 0x1e: r.u(8); r.u(8); return true;     // DW_FORM_data16
+   case 0x0f: r.uleb(); return true;           // DW_FORM_udata
+   case 0x09: {                                // DW_FORM_block
+      const unsigned long long length = r.uleb();
+      r.p += std::min(length, (unsigned long long)(r.end - r.p));
+      return true;
+   }
+   default:
+      return false;
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_LineTable::parseUnit
++-----------------------------------------------------------------------------*/
+/**
+* @brief parseUnit Runs the line number program of the unit at r, adding its rows. r is
+* left at the next unit.
+*/
+inline void LC_LineTable::parseUnit(Reader& r, const Section& strs, const Section& lineStrs)
+{
+   bool dwarf64 = false;
+   unsigned long long length = r.u(4);
+   if (length == 0xFFFFFFFFULL) {
+      dwarf64 = true;
+      length = r.u(8);
+   }
+   if (length > (unsigned long long)(r.end - r.p)) {
+      r.p = r.end;
+      return;
+   }
+
+   Reader unit = { r.p, r.p + length };
+   r.p = unit.end;
+
+   const unsigned int version = (unsigned int)unit.u(2);
+   if (version < 2 || version > 5)
+      return;
+
+   size_t addressSize = sizeof(void*);
+   if (version >= 5) {
+      addressSize = (size_t)unit.u(1);
+      unit.u(1);
+   }
+   const unsigned long long headerLength = unit.u(dwarf64 ? 8 : 4);
+   if (headerLength > (unsigned long long)(unit.end - unit.p))
+      return;
+   const unsigned char* program = unit.p + headerLength;
+
+   const unsigned int minLength = (unsigned int)unit.u(1);
+   if (version >= 4)
+      unit.u(1);
+   unit.u(1);
+   const int lineBase = (int)(signed char)unit.u(1);
+   const unsigned int lineRange = (unsigned int)unit.u(1);
+   const unsigned int opcodeBase = (unsigned int)unit.u(1);
+   if (!lineRange || !opcodeBase)
+      return;
+
+   unsigned char lengths[256] = { 0 };
+   for (unsigned int i = 1; i < opcodeBase; i++)
+      lengths[i] = (unsigned char)unit.u(1);
+
+   // Files are numbered from 1 before DWARF 5, from 0 since.
+   std::vector<unsigned int> files;
+   const unsigned int unknown = addFile("?");
+   unsigned int firstFile = 1;
+   if (version < 5) {
+      while (unit.p < program && *unit.str())
+         ;
+      while (unit.p < program) {
+         const char* name = unit.str();
+         if (!*name)
+            break;
+         unit.uleb();
+         unit.uleb();
+         unit.uleb();
+         files.push_back(addFile(name));
+      }
+   }
+   else {
+      firstFile = 0;
+      const char* string;
+      for (int table = 0; table < 2; table++) {
+         std::vector<std::pair<unsigned long long, unsigned long long> > formats(unit.u(1));
+         for (size_t i = 0; i < formats.size(); i++) {
+            formats[i].first = unit.uleb();
+            formats[i].second = unit.uleb();
+         }
+
+         const unsigned long long count = unit.uleb();
+         for (unsigned long long e = 0; e < count && unit.p < program; e++) {
+            const char* name = "?";
+            for (size_t i = 0; i < formats.size(); i++) {
+               if (!readForm(unit, formats[i].second, dwarf64, strs, lineStrs, string))
+                  return;
+               if (formats[i].first == 1 && string) // DW_LNCT_path
+                  name = string;
+            }
+            if (table == 1)
+               files.push_back(addFile(name));
+         }
+      }
+   }
+
+   unit.p = program;
+   uintptr_t address = 0;
+   unsigned int file = 1;
+   unsigned int line = 1;
+   while (unit.p < unit.end) {
+      const unsigned int opcode = (unsigned int)unit.u(1);
+      bool emit = false;
+      bool end = false;
+
+      if (opcode >= opcodeBase) {
+         const unsigned int adjusted = opcode - opcodeBase;
+         address += (adjusted/lineRange)*minLength;
+         line += lineBase + (int)(adjusted%lineRange);
+         emit = true;
+      }
+      else if (opcode == 0) {
+         const unsigned long long size = unit.uleb();
+         if (!size || size > (unsigned long long)(unit.end - unit.p))
+            break;
+         const unsigned char* next = unit.p + size;
+         switch (unit.u(1)) {
+         case 1: // DW_LNE_end_sequence
+            emit = end = true;
+            break;
+         case 2: // DW_LNE_set_address
+            address = (uintptr_t)unit.u(std::min((size_t)(size - 1), addressSize));
+            break;
+         case 3: // DW_LNE_define_file
+            files.push_back(addFile(unit.str()));
+            break;
+         default:
+            break;
+         }
+         unit.p = next;
+      }
+      else {
+         switch (opcode) {
+         case 1:  // DW_LNS_copy
+            emit = true;
+            break;
+         case 2:  // DW_LNS_advance_pc
+            address += (uintptr_t)(unit.uleb()*minLength);
+            break;
+         case 3:  // DW_LNS_advance_line
+            line += (int)unit.sleb();
+            break;
+         case 4:  // DW_LNS_set_file
+            file = (unsigned int)unit.uleb();
+            break;
+         case 8:  // DW_LNS_const_add_pc
+            address += ((255 - opcodeBase)/lineRange)*minLength;
+            break;
+         case 9:  // DW_LNS_fixed_advance_pc
+            address += (uintptr_t)unit.u(2);
+            break;
+         default:
+            for (unsigned int i = 0; i < lengths[opcode]; i++)
+               unit.uleb();
+            break;
+         }
+      }
+
+      if (emit) {
+         Row row;
+         row.address = address;
+         row.file = (file >= firstFile && file - firstFile < files.size()) ? files[file - firstFile] : unknown;
+         row.line = line;
+         row.end = end;
+         m_rows.push_back(row);
+      }
+      if (end) {
+         address = 0;
+         file = 1;
+         line = 1;
+      }
+   }
+}
+#endif // defined(ENABLE_LINE_RESOLUTION) && defined(__linux__)
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_SymbolCache class turns return addresses into text, caching the result
+* for the life of the process: a frame already seen costs a hash lookup. Symbols are
+* demangled once per function. On Linux, the symbols of the executable are only
+* available when linking with -rdynamic. With ENABLE_LINE_RESOLUTION, the source file
+* and line are appended from the DWARF line tables of the module, see LC_LineTable.
+*/
+class LC_SymbolCache
+{
+public:
+   static LC_SymbolCache& instance();
+
+   void resolve(std::string& out, void* address);
+   void append(std::string& out, const LC_StackTrace& trace);
+
+private:
+   LC_SymbolCache();
+   ~LC_SymbolCache();
+   LC_SymbolCache(const LC_SymbolCache&);
+   LC_SymbolCache& operator =(const LC_SymbolCache&);
+
+   const std::string& lookup(void* address);
+   void symbolize(std::string& out, void* address);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* cache);
+   static void unlockAfterFork(void* cache);
+#endif
+
+   LC_Mutex m_mutex;
+   std::unordered_map<void*, std::string> m_frames;
+#if !defined(_WIN32) && !defined(_WIN32_WCE) && !defined(__ANDROID__)
+   // Demangled names by symbol name pointer, which dladdr() returns from the symbol
+   // table of the module.
+   std::unordered_map<const char*, std::string> m_names;
+#if defined(ENABLE_LINE_RESOLUTION) && defined(__linux__)
+   // Line tables by module path, loaded on first use.
+   std::unordered_map<std::string, LC_LineTable> m_lines;
+#endif
+#elif defined(_WIN32) || defined(_WIN32_WCE)
+   HANDLE m_process;
+#endif
+};
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::LC_SymbolCache
++-----------------------------------------------------------------------------*/
+inline LC_SymbolCache::LC_SymbolCache()
+{
+#if defined(_WIN32) || defined(_WIN32_WCE)
+   m_process = GetCurrentProcess();
+   SymInitialize(m_process, NULL, TRUE);
+#else
+   LC_ForkHandler handler = { &LC_SymbolCache::lockForFork,
+                              &LC_SymbolCache::unlockAfterFork,
+                              &LC_SymbolCache::unlockAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::~LC_SymbolCache
++-----------------------------------------------------------------------------*/
+inline LC_SymbolCache::~LC_SymbolCache()
+{
+#if defined(_WIN32) || defined(_WIN32_WCE)
+   SymCleanup(m_process);
+#else
+   LC_ForkGuard::instance().remove(this);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::instance
++-----------------------------------------------------------------------------*/
+inline LC_SymbolCache& LC_SymbolCache::instance()
+{
+   static LC_SymbolCache instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::resolve
++-----------------------------------------------------------------------------*/
+/**
+* @brief resolve Appends the text of the frame at address to out.
+*/
+inline void LC_SymbolCache::resolve(std::string& out, void* address)
+{
+   LC_MutexLocker locker(m_mutex);
+   out.append(lookup(address));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::append
++-----------------------------------------------------------------------------*/
+/**
+* @brief append Appends the frames of trace to out, each on a new line.
+*/
+inline void LC_SymbolCache::append(std::string& out, const LC_StackTrace& trace)
+{
+   LC_MutexLocker locker(m_mutex);
+   for (unsigned int i = 0; i < trace.size; i++) {
+      out.append("\n  ");
+      out.append(lookup(trace.frames[i]));
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::lookup
++-----------------------------------------------------------------------------*/
+inline const std::string& LC_SymbolCache::lookup(void* address)
+{
+   std::unordered_map<void*, std::string>::iterator it = m_frames.find(address);
+   if (LC_LIKELY(it != m_frames.end()))
+      return it->second;
+
+   std::string& text = m_frames[address];
+   symbolize(text, address);
+   return text;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::symbolize
++-----------------------------------------------------------------------------*/
+/**
+* @brief symbolize Writes "module: function+0xoffset (file:line)" for address, or what
+* is known of it.
+*/
+inline void LC_SymbolCache::symbolize(std::string& out, void* address)
+{
+   char buffer[32];
+   snprintf(buffer, sizeof(buffer), "%p", address);
+
+#if defined(_WIN32) || defined(_WIN32_WCE)
+   char storage[sizeof(SYMBOL_INFO) + 256];
+   SYMBOL_INFO* symbol = (SYMBOL_INFO*)storage;
+   memset(storage, 0, sizeof(storage));
+   symbol->MaxNameLen = 255;
+   symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+   DWORD64 displacement = 0;
+   if (SymFromAddr(m_process, (DWORD64)(intptr_t)address, &displacement, symbol)) {
+      out.append(symbol->Name);
+      snprintf(buffer, sizeof(buffer), "+0x%llx", (unsigned long long)displacement);
+   }
+   out.append(buffer);
+#else
+   Dl_info info;
+#if defined(ENABLE_LINE_RESOLUTION) && defined(__linux__)
+   struct link_map* module = NULL;
+   if (!dladdr1(address, &info, (void**)&module, RTLD_DL_LINKMAP) || !info.dli_fname) {
+#else
+   if (!dladdr(address, &info) || !info.dli_fname) {
+#endif
+      out.append("[").append(buffer).append("]");
+      return;
+   }
+
+   out.append(lc_file_name(info.dli_fname));
+   out.append(": ");
+   if (!info.dli_sname)
+      out.append("[").append(buffer).append("]");
+   else {
+#ifndef __ANDROID__
+      std::unordered_map<const char*, std::string>::iterator it = m_names.find(info.dli_sname);
+      if (it == m_names.end()) {
+         int status = 0;
+         char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+         it = m_names.insert(std::make_pair(info.dli_sname,
+                                            std::string(status == 0 ? demangled : info.dli_sname))).first;
+         free(demangled);
+      }
+      out.append(it->second);
+#else
+      out.append(info.dli_sname);
+#endif // __ANDROID__
+
+      snprintf(buffer, sizeof(buffer), "+0x%lx",
+               (unsigned long)((const char*)address - (const char*)info.dli_saddr));
+      out.append(buffer);
+   }
+
+#if defined(ENABLE_LINE_RESOLUTION) && defined(__linux__)
+   if (!module)
+      return;
+
+   // The main executable has an empty name in the link map.
+   const std::string path = *module->l_name ? module->l_name : "/proc/self/exe";
+   std::unordered_map<std::string, LC_LineTable>::iterator table = m_lines.find(path);
+   if (table == m_lines.end()) {
+      table = m_lines.insert(std::make_pair(path, LC_LineTable())).first;
+      table->second.load(path.c_str());
+   }
+
+   // A return address points past the call: look up the call instruction.
+   std::string location;
+   if (table->second.find((uintptr_t)address - 1 - module->l_addr, location))
+      out.append(" (").append(location).append(")");
+#endif // defined(ENABLE_LINE_RESOLUTION) && defined(__linux__)
+#endif // defined(_WIN32) || defined(_WIN32_WCE)
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_SymbolCache::lockForFork(void* cache)
+{
+   static_cast<LC_SymbolCache*>(cache)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SymbolCache::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_SymbolCache::unlockAfterFork(void* cache)
+{
+   static_cast<LC_SymbolCache*>(cache)->m_mutex.unlock();
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_StackTraceTable class deduplicates the traces of log_stacktrace(). Traces
+* are identified by a hash of their return addresses: the first occurrence is logged in
+* full as "stack #id", the following ones as "stack #id (seen N times)" only. Every
+* summary interval, the next log_stacktrace() also logs the most frequent traces and
+* how many times they were seen since the previous summary.
+* Up to 4096 distinct traces are tracked; the others are always logged in full.
+*/
+class LC_StackTraceTable
+{
+public:
+   static LC_StackTraceTable& instance();
+
+   void setEnabled(bool enabled);
+   void setSummary(unsigned int intervalSeconds, unsigned int top);
+   void clear();
+
+   unsigned int add(const LC_StackTrace& trace, unsigned long long& seen, bool& summaryDue);
+   void logSummary(const char* log_tag, LC_LogLevel level);
+
+private:
+   LC_StackTraceTable();
+   ~LC_StackTraceTable();
+   LC_StackTraceTable(const LC_StackTraceTable&);
+   LC_StackTraceTable& operator =(const LC_StackTraceTable&);
+
+   typedef std::chrono::steady_clock Clock;
+
+   struct Entry {
+      unsigned int id;
+      unsigned long long count;
+      unsigned long long reported;
+      std::vector<void*> frames;
+   };
+
+   static unsigned long long hash(const LC_StackTrace& trace);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* table);
+   static void unlockAfterFork(void* table);
+#endif
+
+   LC_Mutex m_mutex;
+   bool m_enabled;
+   std::unordered_map<unsigned long long, Entry> m_entries;
+   unsigned int m_nextId;
+   unsigned int m_summaryInterval;
+   unsigned int m_summaryTop;
+   Clock::time_point m_nextSummary;
+   bool m_repeated;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::LC_StackTraceTable
++-----------------------------------------------------------------------------*/
+inline LC_StackTraceTable::LC_StackTraceTable() :
+     m_enabled(true)
+   , m_nextId(1)
+   , m_summaryInterval(60)
+   , m_summaryTop(5)
+   , m_nextSummary(Clock::now() + std::chrono::seconds(60))
+   , m_repeated(false)
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_StackTraceTable::lockForFork,
+                              &LC_StackTraceTable::unlockAfterFork,
+                              &LC_StackTraceTable::unlockAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::~LC_StackTraceTable
++-----------------------------------------------------------------------------*/
+inline LC_StackTraceTable::~LC_StackTraceTable()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::instance
++-----------------------------------------------------------------------------*/
+inline LC_StackTraceTable& LC_StackTraceTable::instance()
+{
+   static LC_StackTraceTable instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::setEnabled
++-----------------------------------------------------------------------------*/
+/**
+* @brief setEnabled Enables deduplication (default). When disabled, every trace is
+* logged in full.
+*/
+inline void LC_StackTraceTable::setEnabled(bool enabled)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_enabled = enabled;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::setSummary
++-----------------------------------------------------------------------------*/
+/**
+* @brief setSummary Sets how often the summary is logged (60 s by default, 0 to never
+* log it automatically) and how many traces it lists (5 by default).
+*/
+inline void LC_StackTraceTable::setSummary(unsigned int intervalSeconds, unsigned int top)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_summaryInterval = intervalSeconds;
+   m_summaryTop = top;
+   m_nextSummary = Clock::now() + std::chrono::seconds(intervalSeconds);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::clear
++-----------------------------------------------------------------------------*/
+/**
+* @brief clear Forgets all the traces: the next occurrence of each is logged in full.
+*/
+inline void LC_StackTraceTable::clear()
+{
+   LC_MutexLocker locker(m_mutex);
+   m_entries.clear();
+   m_repeated = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::hash
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_StackTraceTable::hash(const LC_StackTrace& trace)
+{
+   // FNV-1a over the addresses.
+   unsigned long long h = 14695981039346656037ULL;
+   for (unsigned int i = 0; i < trace.size; i++) {
+      h ^= (unsigned long long)(uintptr_t)trace.frames[i];
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::add
++-----------------------------------------------------------------------------*/
+/**
+* @brief add Counts an occurrence of trace.
+* @param seen Set to the number of occurrences, this one included.
+* @param summaryDue Set to true if logSummary() should be called now.
+* @return The id of the trace, or 0 if it is not tracked.
+*/
+inline unsigned int LC_StackTraceTable::add(const LC_StackTrace& trace, unsigned long long& seen, bool& summaryDue)
+{
+   seen = 1;
+   summaryDue = false;
+
+   LC_MutexLocker locker(m_mutex);
+   if (!m_enabled)
+      return 0;
+
+   const unsigned long long key = hash(trace);
+   std::unordered_map<unsigned long long, Entry>::iterator it = m_entries.find(key);
+   if (it == m_entries.end()) {
+      if (m_entries.size() >= 4096)
+         return 0;
+
+      Entry& entry = m_entries[key];
+      entry.id = m_nextId++;
+      entry.count = 1;
+      entry.reported = 0;
+      entry.frames.assign(trace.frames, trace.frames + trace.size);
+      return entry.id;
+   }
+
+   Entry& entry = it->second;
+   if (entry.frames.size() != trace.size
+         || !std::equal(entry.frames.begin(), entry.frames.end(), trace.frames))
+      return 0;
+
+   seen = ++entry.count;
+   m_repeated = true;
+   if (m_summaryInterval && Clock::now() >= m_nextSummary) {
+      m_nextSummary = Clock::now() + std::chrono::seconds(m_summaryInterval);
+      summaryDue = true;
+   }
+   return entry.id;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::logSummary
++-----------------------------------------------------------------------------*/
+/**
+* @brief logSummary Logs the traces seen more than once, most frequent first, with
+* their innermost frame. Nothing is logged if no trace repeated since the last summary.
+*/
+inline void LC_StackTraceTable::logSummary(const char* log_tag, LC_LogLevel level)
+{
+   LC_Log logger(log_tag, level);
+   if (!logger.isEnabled())
+      return;
+
+   std::vector<std::pair<unsigned long long, const Entry*> > top;
+   std::string text;
+   {
+      LC_MutexLocker locker(m_mutex);
+      if (!m_repeated)
+         return;
+      m_repeated = false;
+
+      for (std::unordered_map<unsigned long long, Entry>::const_iterator it = m_entries.begin();
+           it != m_entries.end(); ++it)
+         if (it->second.count > 1)
+            top.push_back(std::make_pair(it->second.count, &it->second));
+      const size_t count = std::min(top.size(), (size_t)m_summaryTop);
+      std::partial_sort(top.begin(), top.begin() + count, top.end(),
+                        [](const std::pair<unsigned long long, const Entry*>& a,
+                           const std::pair<unsigned long long, const Entry*>& b) {
+         return a.first > b.first;
+      });
+
+      char buffer[96];
+      snprintf(buffer, sizeof(buffer), "stack traces: %u distinct, %u repeated",
+               (unsigned int)m_entries.size(), (unsigned int)top.size());
+      text.append(buffer);
+      for (size_t i = 0; i < count; i++) {
+         Entry& entry = const_cast<Entry&>(*top[i].second);
+         snprintf(buffer, sizeof(buffer), "\n  #%u: seen %llu times (+%llu) at ",
+                  entry.id, entry.count, entry.count - entry.reported);
+         text.append(buffer);
+         entry.reported = entry.count;
+         if (entry.frames.empty())
+            text.append("?");
+         else
+            LC_SymbolCache::instance().resolve(text, entry.frames[0]);
+      }
+   }
+
+   logger.printf("%s", text.c_str());
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_StackTraceTable::lockForFork(void* table)
+{
+   static_cast<LC_StackTraceTable*>(table)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StackTraceTable::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_StackTraceTable::unlockAfterFork(void* table)
+{
+   static_cast<LC_StackTraceTable*>(table)->m_mutex.unlock();
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+/* Unfortunately backtrace() is not supported by Bionic */
+#if !defined(__ANDROID__) && (defined(__linux__) || defined(_WIN32) || defined(_WIN32_WCE))
+
+#ifdef __linux__
+/**
+* Unwinders store the return addresses of their caller's frames, the innermost first,
+* into frames and return how many were stored. They must not be inlined, so that
+* frames[0] is the return address into the caller. lc_unwinder() selects the one
+* lc_capture_stacktrace() uses.
+*/
+typedef unsigned int (*lc_unwind_func)(void** frames, unsigned int max_frames);
+
+/*------------------------------------------------------------------------------
+|    lc_unwind_backtrace
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_unwind_backtrace Unwinds with glibc backtrace(), which reads the DWARF
+* unwind tables: it works with any build flags but is the slowest.
+*/
+LC_NOINLINE inline unsigned int lc_unwind_backtrace(void** frames, unsigned int max_frames)
+{
+   void* buffer[LC_MAX_STACK_FRAMES + 18];
+   max_frames = std::min(max_frames, (unsigned int)LC_MAX_STACK_FRAMES + 17);
+   const int count = backtrace(buffer, (int)max_frames + 1);
+   if (count <= 1)
+      return 0;
+
+   memcpy(frames, buffer + 1, (count - 1)*sizeof(void*));
+   return (unsigned int)count - 1;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_stack_bounds
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_stack_bounds Returns the stack range of the calling thread, cached per
+* thread, or false if it is unknown.
+*/
+inline bool lc_stack_bounds(uintptr_t& low, uintptr_t& high)
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local uintptr_t bounds[2] = { 0, 0 };
+#else
+   static uintptr_t bounds[2] = { 0, 0 };
+#endif
+   if (LC_UNLIKELY(!bounds[1])) {
+      pthread_attr_t attr;
+      if (pthread_getattr_np(pthread_self(), &attr) != 0)
+         return false;
+
+      void* address = NULL;
+      size_t size = 0;
+      if (pthread_attr_getstack(&attr, &address, &size) == 0) {
+         bounds[0] = (uintptr_t)address;
+         bounds[1] = (uintptr_t)address + size;
+      }
+      pthread_attr_destroy(&attr);
+      if (!bounds[1])
+         return false;
+   }
+
+   low = bounds[0];
+   high = bounds[1];
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_unwind_frame_pointers
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_unwind_frame_pointers Follows the chain of saved frame pointers, a couple of
+* loads per frame. The whole program, libraries included, must be built with
+* -fno-omit-frame-pointer: the walk stops at the first frame without one, or earlier if
+* the chain leaves the stack of the thread. Falls back to lc_unwind_backtrace() where the
+* frame layout is unknown.
+*/
+LC_NOINLINE inline unsigned int lc_unwind_frame_pointers(void** frames, unsigned int max_frames)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__))
+   uintptr_t low;
+   uintptr_t high;
+   if (!lc_stack_bounds(low, high))
+      return lc_unwind_backtrace(frames, max_frames);
+
+   // Each frame starts with the caller's frame pointer followed by the return address.
+   uintptr_t fp = (uintptr_t)__builtin_frame_address(0);
+   unsigned int count = 0;
+   while (count < max_frames) {
+      if (fp < low || fp > high - 2*sizeof(void*) || (fp & (sizeof(void*) - 1)))
+         break;
+
+      void** frame = (void**)fp;
+      if (!frame[1])
+         break;
+      frames[count++] = frame[1];
+
+      const uintptr_t next = (uintptr_t)frame[0];
+      if (next <= fp)
+         break;
+      fp = next;
+   }
+
+   return count;
+#else
+   return lc_unwind_backtrace(frames, max_frames);
+#endif
+}
+
+#ifdef LC_USE_LIBUNWIND
+/*------------------------------------------------------------------------------
+|    lc_unwind_libunwind
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_unwind_libunwind Unwinds with libunwind (link with -lunwind), which reads the
+* same tables as backtrace() but caches them, so it works with any build flags at a
+* fraction of the cost.
+*/
+LC_NOINLINE inline unsigned int lc_unwind_libunwind(void** frames, unsigned int max_frames)
+{
+   void* buffer[LC_MAX_STACK_FRAMES + 18];
+   max_frames = std::min(max_frames, (unsigned int)LC_MAX_STACK_FRAMES + 17);
+   const int count = unw_backtrace(buffer, (int)max_frames + 1);
+   if (count <= 1)
+      return 0;
+
+   memcpy(frames, buffer + 1, (count - 1)*sizeof(void*));
+   return (unsigned int)count - 1;
+}
+#endif // LC_USE_LIBUNWIND
+
+/*------------------------------------------------------------------------------
+|    lc_unwinder
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_unwinder Returns the unwinder used to capture stack traces, which can be
+* replaced at runtime, e.g. lc_unwinder() = lc_unwind_backtrace. Defaults to
+* lc_unwind_libunwind with LC_USE_LIBUNWIND, to lc_unwind_frame_pointers with
+* LC_UNWIND_FRAME_POINTERS, to lc_unwind_backtrace otherwise.
+*/
+inline lc_unwind_func& lc_unwinder()
+{
+#if defined(LC_USE_LIBUNWIND)
+   static lc_unwind_func unwinder = lc_unwind_libunwind;
+#elif defined(LC_UNWIND_FRAME_POINTERS)
+   static lc_unwind_func unwinder = lc_unwind_frame_pointers;
+#else
+   static lc_unwind_func unwinder = lc_unwind_backtrace;
+#endif
+   return unwinder;
+}
+#endif // __linux__
+
+/*------------------------------------------------------------------------------
+|    lc_capture_stacktrace
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_capture_stacktrace Stores the return addresses of the calling thread in
+* trace, without symbolizing them.
+* @param skip Number of innermost frames to leave out, beyond this function.
+* @param max_frames Max number of frames to keep, up to LC_MAX_STACK_FRAMES.
+* @return The number of frames stored.
+*/
+// Not inlined, so that the frames to skip are known.
+LC_NOINLINE inline unsigned int lc_capture_stacktrace(LC_StackTrace& trace, unsigned int skip, unsigned int max_frames)
+{
+   max_frames = std::min(max_frames, (unsigned int)LC_MAX_STACK_FRAMES);
+   skip = std::min(skip, 16u) + 1;
+
+#ifdef __linux__
+   void* frames[LC_MAX_STACK_FRAMES + 17];
+   const unsigned int count = lc_unwinder()(frames, max_frames + skip);
+   trace.size = (count > skip) ? count - skip : 0;
+   memcpy(trace.frames, frames + skip, trace.size*sizeof(void*));
+#else
+   trace.size = CaptureStackBackTrace(skip, max_frames, trace.frames, NULL);
+#endif // __linux__
+
+   return trace.size;
+}
+
+/*------------------------------------------------------------------------------
+|    log_stacktrace
++-----------------------------------------------------------------------------*/
+/**
+* Logs a stack backtrace of the caller function. Only the return addresses are
+* captured here: the sinks symbolize them through LC_SymbolCache. Repeated traces are
+* logged as a reference, see LC_StackTraceTable. On Linux, remember to build adding the
+* flag -rdynamic.
+*
+* @param log_tag The log tag to be placed in the log line.
+* @param level The log level of the log.
+* @param max_frames The maximum number of lines of stack trace to log.
+*/
+LC_NOINLINE inline void log_stacktrace(const char* log_tag, LC_LogLevel level, unsigned int max_frames)
+{
+   LC_Log logger(log_tag, level);
+   if (!logger.isEnabled())
+      return;
+
+   LC_StackTrace trace;
+   if (!lc_capture_stacktrace(trace, 1, max_frames)) {
+      logger.printf("%s", "\n<empty, possibly corrupt>");
+      return;
+   }
+
+   unsigned long long seen;
+   bool summaryDue;
+   const unsigned int id = LC_StackTraceTable::instance().add(trace, seen, summaryDue);
+   if (!id) {
+      logger.m_stack = &trace;
+      logger.printf("%s", "");
+   }
+   else if (seen == 1) {
+      logger.m_stack = &trace;
+      logger.printf("stack #%u", id);
+   }
+   else
+      logger.printf("stack #%u (seen %llu times)", id, seen);
+
+   if (summaryDue)
+      LC_StackTraceTable::instance().logSummary(log_tag, level);
+}
+
+/*------------------------------------------------------------------------------
+|    log_stacktrace
++-----------------------------------------------------------------------------*/
+inline void log_stacktrace(LC_LogLevel level, unsigned int max_frames)
+{
+   log_stacktrace(LOG_TAG, level, max_frames);
+}
+
+/*------------------------------------------------------------------------------
+|    log_stacktrace
++-----------------------------------------------------------------------------*/
+inline void log_stacktrace(unsigned int max_frames)
+{
+   log_stacktrace(LOG_TAG, LC_LOG_DEBUG, max_frames);
+}
+
+/*------------------------------------------------------------------------------
+|    log_stacktrace
++-----------------------------------------------------------------------------*/
+inline void log_stacktrace(const char* log_tag, unsigned int max_frames)
+{
+   log_stacktrace(log_tag, LC_LOG_DEBUG, max_frames);
+}
+#endif // !defined(__ANDROID__) && (!defined(WINVER) || WINVER < 0x0602)
+
+/*------------------------------------------------------------------------------
+|    metrics
++-----------------------------------------------------------------------------*/
+// Sinks and stages accounted by the metrics, see LC_Metrics.
+enum LC_MetricsSink {
+   LC_SINK_STDOUT,
+   LC_SINK_FILE,
+   LC_SINK_JSON,
+   LC_SINK_LOGFMT,
+   LC_SINK_SYSLOG,
+   LC_SINK_NET,
+   LC_SINK_SHM,
+   LC_SINK_FLIGHT_RECORDER,
+   LC_SINK_COUNT
+};
+
+enum LC_MetricsStage {
+   LC_STAGE_RECORD,    // The whole record, from printf() to the return of the sink.
+   LC_STAGE_TIMESTAMP, // Reading the clock and converting it to calendar time.
+   LC_STAGE_FORMAT,    // Building the line or the frame, timestamp included.
+   LC_STAGE_WRITE,     // Handing it over: write(), fwrite(), sendmmsg() or a queue.
+   LC_STAGE_COUNT
+};
+
+#ifdef ENABLE_LOGGER_METRICS
+#ifndef LC_METRICS_SAMPLING
+#define LC_METRICS_SAMPLING 64
+#endif
+
+#define LC_METRICS_LEVELS  7  // The six levels and LC_LOG_NONE.
+#define LC_METRICS_BUCKETS 32 // Bucket i counts the samples in [2^i, 2^(i+1)) ns.
+
+/*------------------------------------------------------------------------------
+|    LC_MetricsCounter class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_MetricsCounter class is a counter written by a single thread and read
+* by any: increments are a plain load and store, no locked instruction.
+*/
+class LC_MetricsCounter
+{
+public:
+   LC_MetricsCounter() : m_value(0) {}
+
+#ifndef LC_LOGGING_DISABLE_THREADING
+   void add(unsigned long long n) {
+      m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+   }
+   unsigned long long get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+   std::atomic<unsigned long long> m_value;
+#else
+   void add(unsigned long long n) { m_value += n; }
+   unsigned long long get() const { return m_value; }
+
+private:
+   unsigned long long m_value;
+#endif // LC_LOGGING_DISABLE_THREADING
+};
+
+/*------------------------------------------------------------------------------
+|    LC_MetricsSnapshot struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_MetricsSnapshot struct holds the totals of all threads at a point in
+* time, see LC_Metrics::snapshot(). Records are counted when accepted by the logger,
+* sink records when handed to the sink; drops are records the sink failed to deliver.
+* Flushes count writes to the file or the socket. Queue high-water marks are in records.
+* Timings are sampled on one record every LC_METRICS_SAMPLING per thread.
+*/
+struct LC_MetricsSnapshot
+{
+   struct Sink {
+      unsigned long long records;
+      unsigned long long bytes;
+      unsigned long long drops;
+      unsigned long long flushes;
+      unsigned long long queueHighWater;
+   };
+
+   struct Stage {
+      unsigned long long samples;
+      unsigned long long nanos;
+      unsigned long long histogram[LC_METRICS_BUCKETS];
+
+      unsigned long long percentile(double p) const;
+   };
+
+   LC_MetricsSnapshot();
+
+   unsigned long long records[LC_METRICS_LEVELS];
+   Sink sinks[LC_SINK_COUNT];
+   Stage stages[LC_STAGE_COUNT];
+
+   std::string toString() const;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_ThreadMetrics struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_ThreadMetrics struct holds the counters of a thread. It is aligned to
+* the cache line, so that threads never write the same line.
+*/
+struct alignas(64) LC_ThreadMetrics
+{
+   enum { RECORDS, BYTES, DROPS, FLUSHES, SINK_COUNTERS };
+
+   LC_ThreadMetrics();
+   ~LC_ThreadMetrics();
+
+   void addTo(LC_MetricsSnapshot& snapshot) const;
+
+   LC_MetricsCounter records[LC_METRICS_LEVELS];
+   LC_MetricsCounter sinks[LC_SINK_COUNT][SINK_COUNTERS];
+   LC_MetricsCounter nanos[LC_STAGE_COUNT];
+   LC_MetricsCounter histogram[LC_STAGE_COUNT][LC_METRICS_BUCKETS];
+
+   // Records left before the next sampled one, whether the current record is sampled
+   // and the stages being timed.
+   unsigned int countdown;
+   bool sampling;
+   unsigned char timing;
+
+   LC_ThreadMetrics* prev;
+   LC_ThreadMetrics* next;
+
+private:
+   LC_ThreadMetrics(const LC_ThreadMetrics&);
+   LC_ThreadMetrics& operator =(const LC_ThreadMetrics&);
+};
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_Metrics class accounts for the cost of the logger itself: records per
+* level, records, bytes, drops and flushes per sink, queue high-water marks and sampled
+* timing histograms of the stages of a record (see LC_MetricsStage). Counters are kept
+* per thread and summed by snapshot(), which is the only operation taking a lock. The
+* counts of exited threads are kept. With setReport() the metrics are logged
+* periodically as a record.
+*/
+class LC_Metrics
+{
+public:
+   static LC_Metrics& instance();
+   static LC_ThreadMetrics& local();
+
+   void snapshot(LC_MetricsSnapshot& out);
+   void setReport(unsigned int intervalSeconds, const char* log_tag = "LightLogger",
+                  LC_LogLevel level = LC_LOG_INFO);
+   void queueDepth(LC_MetricsSink sink, unsigned long long depth);
+   void reportIfDue(std::chrono::steady_clock::time_point now);
+
+private:
+   friend struct LC_ThreadMetrics;
+
+   LC_Metrics();
+   ~LC_Metrics();
+   LC_Metrics(const LC_Metrics&);
+   LC_Metrics& operator =(const LC_Metrics&);
+
+   void add(LC_ThreadMetrics* metrics);
+   void remove(LC_ThreadMetrics* metrics);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* metrics);
+   static void unlockAfterFork(void* metrics);
+#endif
+
+   LC_Mutex m_mutex;
+   LC_ThreadMetrics* m_threads;
+   LC_MetricsSnapshot m_exited;
+
+   // Report interval in ns, 0 if disabled, and time of the next one.
+#ifndef LC_LOGGING_DISABLE_THREADING
+   std::atomic<unsigned long long> m_highWater[LC_SINK_COUNT];
+   std::atomic<long long> m_reportInterval;
+   std::atomic<long long> m_nextReport;
+#else
+   unsigned long long m_highWater[LC_SINK_COUNT];
+   long long m_reportInterval;
+   long long m_nextReport;
+#endif
+   const char* m_reportTag;
+   LC_LogLevel m_reportLevel;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_MetricsSnapshot::LC_MetricsSnapshot
++-----------------------------------------------------------------------------*/
+inline LC_MetricsSnapshot::LC_MetricsSnapshot()
+{
+   memset(this, 0, sizeof(*this));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_MetricsSnapshot::Stage::percentile
++-----------------------------------------------------------------------------*/
+/**
+* @brief percentile Returns the upper bound in ns of the bucket holding percentile p,
+* in [0, 1].
+*/
+inline unsigned long long LC_MetricsSnapshot::Stage::percentile(double p) const
+{
+   if (!samples)
+      return 0;
+
+   const unsigned long long rank = (unsigned long long)(p*(double)(samples - 1)) + 1;
+   unsigned long long seen = 0;
+   for (unsigned int i = 0; i < LC_METRICS_BUCKETS; i++) {
+      seen += histogram[i];
+      if (seen >= rank)
+         return 2ULL << i;
+   }
+   return 2ULL << (LC_METRICS_BUCKETS - 1);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_MetricsSnapshot::toString
++-----------------------------------------------------------------------------*/
+/**
+* @brief toString Returns the snapshot as text, one line per sink and per stage. Sinks
+* never used are left out.
+*/
+inline std::string LC_MetricsSnapshot::toString() const
+{
+   static const char* const levels[LC_METRICS_LEVELS] = {
+      "critical", "error", "warning", "info", "verbose", "debug", "none"
+   };
+   static const char* const sinkNames[LC_SINK_COUNT] = {
+      "stdout", "file", "json", "logfmt", "syslog", "net", "shm", "flight recorder"
+   };
+   static const char* const stageNames[LC_STAGE_COUNT] = {
+      "record", "timestamp", "format", "write"
+   };
+
+   char buffer[256];
+   std::string out("logger metrics, records:");
+   for (unsigned int i = 0; i < LC_METRICS_LEVELS; i++) {
+      snprintf(buffer, sizeof(buffer), "%s %s %llu", i ? "," : "", levels[i], records[i]);
+      out.append(buffer);
+   }
+
+   for (unsigned int i = 0; i < LC_SINK_COUNT; i++) {
+      const Sink& s = sinks[i];
+      if (!s.records && !s.drops)
+         continue;
+      snprintf(buffer, sizeof(buffer), "\n  %s: %llu records, %llu bytes, %llu drops, %llu flushes",
+               sinkNames[i], s.records, s.bytes, s.drops, s.flushes);
+      out.append(buffer);
+      if (s.queueHighWater) {
+         snprintf(buffer, sizeof(buffer), ", queue high-water %llu", s.queueHighWater);
+         out.append(buffer);
+      }
+   }
+
+   for (unsigned int i = 0; i < LC_STAGE_COUNT; i++) {
+      const Stage& s = stages[i];
+      if (!s.samples)
+         continue;
+      snprintf(buffer, sizeof(buffer), "\n  %s: %llu samples, mean %llu ns, p50 < %llu ns, "
+                                       "p99 < %llu ns, p99.9 < %llu ns",
+               stageNames[i], s.samples, s.nanos/s.samples, s.percentile(0.5),
+               s.percentile(0.99), s.percentile(0.999));
+      out.append(buffer);
+   }
+
+   return out;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ThreadMetrics::LC_ThreadMetrics
++-----------------------------------------------------------------------------*/
+inline LC_ThreadMetrics::LC_ThreadMetrics() :
+     countdown(1)
+   , sampling(false)
+   , timing(0)
+   , prev(NULL)
+   , next(NULL)
+{
+   LC_Metrics::instance().add(this);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ThreadMetrics::~LC_ThreadMetrics
++-----------------------------------------------------------------------------*/
+inline LC_ThreadMetrics::~LC_ThreadMetrics()
+{
+   LC_Metrics::instance().remove(this);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ThreadMetrics::addTo
++-----------------------------------------------------------------------------*/
+inline void LC_ThreadMetrics::addTo(LC_MetricsSnapshot& snapshot) const
+{
+   for (unsigned int i = 0; i < LC_METRICS_LEVELS; i++)
+      snapshot.records[i] += records[i].get();
+
+   for (unsigned int i = 0; i < LC_SINK_COUNT; i++) {
+      snapshot.sinks[i].records += sinks[i][RECORDS].get();
+      snapshot.sinks[i].bytes += sinks[i][BYTES].get();
+      snapshot.sinks[i].drops += sinks[i][DROPS].get();
+      snapshot.sinks[i].flushes += sinks[i][FLUSHES].get();
+   }
+
+   for (unsigned int i = 0; i < LC_STAGE_COUNT; i++) {
+      snapshot.stages[i].nanos += nanos[i].get();
+      for (unsigned int b = 0; b < LC_METRICS_BUCKETS; b++) {
+         const unsigned long long count = histogram[i][b].get();
+         snapshot.stages[i].histogram[b] += count;
+         snapshot.stages[i].samples += count;
+      }
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::LC_Metrics
++-----------------------------------------------------------------------------*/
+inline LC_Metrics::LC_Metrics() :
+     m_threads(NULL)
+   , m_reportInterval(0)
+   , m_nextReport(0)
+   , m_reportTag("LightLogger")
+   , m_reportLevel(LC_LOG_INFO)
+{
+   for (unsigned int i = 0; i < LC_SINK_COUNT; i++)
+      m_highWater[i] = 0;
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_Metrics::lockForFork,
+                              &LC_Metrics::unlockAfterFork,
+                              &LC_Metrics::unlockAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::~LC_Metrics
++-----------------------------------------------------------------------------*/
+inline LC_Metrics::~LC_Metrics()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::instance
++-----------------------------------------------------------------------------*/
+inline LC_Metrics& LC_Metrics::instance()
+{
+   static LC_Metrics instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::local
++-----------------------------------------------------------------------------*/
+/**
+* @brief local Returns the counters of the calling thread.
+*/
+inline LC_ThreadMetrics& LC_Metrics::local()
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local LC_ThreadMetrics metrics;
+#else
+   static LC_ThreadMetrics metrics;
+#endif
+   return metrics;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::add
++-----------------------------------------------------------------------------*/
+inline void LC_Metrics::add(LC_ThreadMetrics* metrics)
+{
+   LC_MutexLocker locker(m_mutex);
+   metrics->next = m_threads;
+   if (m_threads)
+      m_threads->prev = metrics;
+   m_threads = metrics;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::remove
++-----------------------------------------------------------------------------*/
+/**
+* @brief remove Called when a thread exits: its counts are kept in m_exited.
+*/
+inline void LC_Metrics::remove(LC_ThreadMetrics* metrics)
+{
+   LC_MutexLocker locker(m_mutex);
+   metrics->addTo(m_exited);
+   if (metrics->prev)
+      metrics->prev->next = metrics->next;
+   else
+      m_threads = metrics->next;
+   if (metrics->next)
+      metrics->next->prev = metrics->prev;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::snapshot
++-----------------------------------------------------------------------------*/
+/**
+* @brief snapshot Stores in out the totals of all the threads, exited ones included.
+* Counters of running threads are read while they change: each one is exact, but they
+* may not be consistent with each other.
+*/
+inline void LC_Metrics::snapshot(LC_MetricsSnapshot& out)
+{
+   LC_MutexLocker locker(m_mutex);
+   out = m_exited;
+   for (LC_ThreadMetrics* t = m_threads; t; t = t->next)
+      t->addTo(out);
+   for (unsigned int i = 0; i < LC_SINK_COUNT; i++)
+      out.sinks[i].queueHighWater = m_highWater[i];
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::setReport
++-----------------------------------------------------------------------------*/
+/**
+* @brief setReport Logs the metrics every intervalSeconds with the given tag and level.
+* The check is made on sampled records, so no report is logged while the application is
+* not logging. 0 disables the report, which is the default.
+*/
+inline void LC_Metrics::setReport(unsigned int intervalSeconds, const char* log_tag, LC_LogLevel level)
+{
+   using namespace std::chrono;
+   const long long interval = (long long)intervalSeconds*1000000000LL;
+   {
+      LC_MutexLocker locker(m_mutex);
+      m_reportTag = log_tag;
+      m_reportLevel = level;
+   }
+   m_nextReport = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() + interval;
+   m_reportInterval = interval;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::queueDepth
++-----------------------------------------------------------------------------*/
+/**
+* @brief queueDepth Called by asynchronous sinks with the number of records queued,
+* to keep the high-water mark.
+*/
+inline void LC_Metrics::queueDepth(LC_MetricsSink sink, unsigned long long depth)
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   unsigned long long current = m_highWater[sink].load(std::memory_order_relaxed);
+   while (depth > current && !m_highWater[sink].compare_exchange_weak(current, depth))
+      ;
+#else
+   m_highWater[sink] = std::max(m_highWater[sink], depth);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::reportIfDue
++-----------------------------------------------------------------------------*/
+inline void LC_Metrics::reportIfDue(std::chrono::steady_clock::time_point now)
+{
+   const long long interval = m_reportInterval;
+   if (LC_LIKELY(!interval))
+      return;
+
+   const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+   long long next = m_nextReport;
+   if (ns < next)
+      return;
+#ifndef LC_LOGGING_DISABLE_THREADING
+   // Only one thread reports.
+   if (!m_nextReport.compare_exchange_strong(next, ns + interval))
+      return;
+#else
+   m_nextReport = ns + interval;
+#endif
+
+   LC_MetricsSnapshot metrics;
+   snapshot(metrics);
+   const char* log_tag;
+   LC_LogLevel level;
+   {
+      LC_MutexLocker locker(m_mutex);
+      log_tag = m_reportTag;
+      level = m_reportLevel;
+   }
+   LC_Log(log_tag, level).printf("%s", metrics.toString().c_str());
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_Metrics::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_Metrics::lockForFork(void* metrics)
+{
+   static_cast<LC_Metrics*>(metrics)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Metrics::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_Metrics::unlockAfterFork(void* metrics)
+{
+   static_cast<LC_Metrics*>(metrics)->m_mutex.unlock();
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+/*------------------------------------------------------------------------------
+|    LC_MetricsRecord class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_MetricsRecord class counts a record and decides whether it is sampled,
+* in which case it is timed as LC_STAGE_RECORD and the stages it goes through are
+* timed by LC_StageTimer. Records logged while handling another one are only counted.
+*/
+class LC_MetricsRecord
+{
+public:
+   explicit LC_MetricsRecord(LC_LogLevel level);
+   ~LC_MetricsRecord();
+
+private:
+   LC_MetricsRecord(const LC_MetricsRecord&);
+   LC_MetricsRecord& operator =(const LC_MetricsRecord&);
+
+   LC_ThreadMetrics& m_metrics;
+   bool m_sampled;
+   std::chrono::steady_clock::time_point m_start;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_StageTimer class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_StageTimer class times a stage of a sampled record. A stage nested in
+* itself is timed once.
+*/
+class LC_StageTimer
+{
+public:
+   explicit LC_StageTimer(LC_MetricsStage stage);
+   ~LC_StageTimer();
+
+   static void add(LC_ThreadMetrics& metrics, LC_MetricsStage stage, long long nanos);
+
+private:
+   LC_StageTimer(const LC_StageTimer&);
+   LC_StageTimer& operator =(const LC_StageTimer&);
+
+   LC_ThreadMetrics* m_metrics;
+   LC_MetricsStage m_stage;
+   std::chrono::steady_clock::time_point m_start;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_MetricsRecord::LC_MetricsRecord
++-----------------------------------------------------------------------------*/
+inline LC_MetricsRecord::LC_MetricsRecord(LC_LogLevel level) :
+     m_metrics(LC_Metrics::local())
+   , m_sampled(false)
+{
+   m_metrics.records[(level >= LC_LOG_CRITICAL && level <= LC_LOG_DEBUG) ? level : LC_METRICS_LEVELS - 1].add(1);
+   if (m_metrics.sampling || --m_metrics.countdown)
+      return;
+
+   m_metrics.countdown = LC_METRICS_SAMPLING;
+   m_metrics.sampling = true;
+   m_sampled = true;
+   m_start = std::chrono::steady_clock::now();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_MetricsRecord::~LC_MetricsRecord
++-----------------------------------------------------------------------------*/
+inline LC_MetricsRecord::~LC_MetricsRecord()
+{
+   if (LC_LIKELY(!m_sampled))
+      return;
+
+   const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+   LC_StageTimer::add(m_metrics, LC_STAGE_RECORD,
+                      std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_start).count());
+   m_metrics.sampling = false;
+   LC_Metrics::instance().reportIfDue(now);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StageTimer::LC_StageTimer
++-----------------------------------------------------------------------------*/
+inline LC_StageTimer::LC_StageTimer(LC_MetricsStage stage) :
+     m_metrics(NULL)
+   , m_stage(stage)
+{
+   LC_ThreadMetrics& metrics = LC_Metrics::local();
+   if (LC_LIKELY(!metrics.sampling) || (metrics.timing & (1 << stage)))
+      return;
+
+   metrics.timing |= (unsigned char)(1 << stage);
+   m_metrics = &metrics;
+   m_start = std::chrono::steady_clock::now();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StageTimer::~LC_StageTimer
++-----------------------------------------------------------------------------*/
+inline LC_StageTimer::~LC_StageTimer()
+{
+   if (LC_LIKELY(!m_metrics))
+      return;
+
+   m_metrics->timing &= (unsigned char)~(1 << m_stage);
+   add(*m_metrics, m_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - m_start).count());
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StageTimer::add
++-----------------------------------------------------------------------------*/
+inline void LC_StageTimer::add(LC_ThreadMetrics& metrics, LC_MetricsStage stage, long long nanos)
+{
+   unsigned int bucket = 0;
+   for (unsigned long long n = (unsigned long long)std::max(nanos, 1LL); n > 1 && bucket < LC_METRICS_BUCKETS - 1; n >>= 1)
+      bucket++;
+
+   metrics.nanos[stage].add((unsigned long long)std::max(nanos, 0LL));
+   metrics.histogram[stage][bucket].add(1);
+}
+
+/*------------------------------------------------------------------------------
+|    lc_metrics_write
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_metrics_write Counts a record handed to sink: size bytes if written, a drop
+* otherwise. flushes is the number of writes it took.
+*/
+inline void lc_metrics_write(LC_MetricsSink sink, size_t size, bool written, unsigned int flushes = 1)
+{
+   LC_ThreadMetrics& metrics = LC_Metrics::local();
+   metrics.sinks[sink][LC_ThreadMetrics::RECORDS].add(1);
+   if (LC_LIKELY(written))
+      metrics.sinks[sink][LC_ThreadMetrics::BYTES].add(size);
+   else
+      metrics.sinks[sink][LC_ThreadMetrics::DROPS].add(1);
+   metrics.sinks[sink][LC_ThreadMetrics::FLUSHES].add(flushes);
+}
+
+/*------------------------------------------------------------------------------
+|    lc_metrics_flush
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_metrics_flush Counts a write of a batch by sink, and the records it dropped.
+*/
+inline void lc_metrics_flush(LC_MetricsSink sink, unsigned long long drops = 0)
+{
+   LC_ThreadMetrics& metrics = LC_Metrics::local();
+   metrics.sinks[sink][LC_ThreadMetrics::FLUSHES].add(1);
+   if (drops)
+      metrics.sinks[sink][LC_ThreadMetrics::DROPS].add(drops);
+}
+
+/*------------------------------------------------------------------------------
+|    lc_metrics_queue
++-----------------------------------------------------------------------------*/
+inline void lc_metrics_queue(LC_MetricsSink sink, unsigned long long depth)
+{
+   LC_Metrics::instance().queueDepth(sink, depth);
+}
+#else
+// Without ENABLE_LOGGER_METRICS the hooks compile to nothing.
+class LC_MetricsRecord
+{
+public:
+   explicit LC_MetricsRecord(LC_LogLevel) {}
+};
+
+class LC_StageTimer
+{
+public:
+   explicit LC_StageTimer(LC_MetricsStage) {}
+};
+
+inline void lc_metrics_write(LC_MetricsSink, size_t, bool, unsigned int = 1) {}
+inline void lc_metrics_flush(LC_MetricsSink, unsigned long long = 0) {}
+inline void lc_metrics_queue(LC_MetricsSink, unsigned long long) {}
+#endif // ENABLE_LOGGER_METRICS
+
+#ifdef ENABLE_FLIGHT_RECORDER
+#ifndef FLIGHT_RECORDER_SIZE
+#define FLIGHT_RECORDER_SIZE (1024*1024)
+#endif
+#ifndef FLIGHT_RECORDER_MAX_RECORD
+#define FLIGHT_RECORDER_MAX_RECORD 4096
+#endif
+
+#define LC_FLIGHT_DUMP_MAGIC   "LCFR"
+#define LC_FLIGHT_DUMP_VERSION 1
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecord struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_FlightRecord struct is the header of a record in the flight recorder.
+* It is followed by the tag and the message, not null-terminated. Binary dumps use
+* the byte order of the host.
+*/
+struct LC_FlightRecord {
+   unsigned int size;           // Size of the record, header included. Multiple of 8.
+   unsigned int length;         // Size of the message.
+   unsigned long long time;     // us since epoch.
+   unsigned long long sequence;
+   int level;
+   unsigned short tagLength;
+   unsigned short reserved;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_FlightRecorder class keeps the most recent records in a ring in memory,
+* overwriting the oldest ones. It has its own threshold (LC_LOG_DEBUG by default), so
+* it also keeps the levels excluded by BUILD_LOG_LEVEL_*. Recording formats the message
+* on the stack and copies it into the ring: there is no I/O until the ring is dumped,
+* with dump() or from the handlers set with installHandlers().
+*/
+class LC_FlightRecorder
+{
+public:
+   static LC_FlightRecorder& instance();
+   static bool convert(const char* binaryPath, FILE* out);
+
+   void setEnabled(bool enabled);
+   void setThreshold(LC_LogLevel level);
+   LC_LogLevel threshold() const;
+   bool accepts(LC_LogLevel level) const;
+
+   void setCapacity(size_t bytes);
+   void clear();
+   size_t count();
+
+   void record(const LC_Log& logger, const char* format, va_list args);
+
+   bool dump(FILE* f);
+   bool dump(const char* path, bool binary = false);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   bool installHandlers(const char* path, bool onCrash = true, int dumpSignal = SIGUSR1);
+#endif
+
+private:
+   LC_FlightRecorder();
+   ~LC_FlightRecorder();
+   LC_FlightRecorder(const LC_FlightRecorder&);
+   LC_FlightRecorder& operator =(const LC_FlightRecorder&);
+
+   char* reserve(size_t size);
+   void evict();
+   static void writeText(FILE* f, const LC_FlightRecord* r);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   bool dumpBinary(int fd);
+   static void signalHandler(int sig);
+   static void lockForFork(void* recorder);
+   static void unlockAfterFork(void* recorder);
+#endif
+
+   LC_Mutex m_mutex;
+#ifndef LC_LOGGING_DISABLE_THREADING
+   std::atomic<int> m_threshold;
+   std::atomic<bool> m_enabled;
+#else
+   int m_threshold;
+   bool m_enabled;
+#endif
+   char* m_buffer;
+   size_t m_capacity;
+   // Records are in [m_begin, m_end) or, if m_wrapped, in [m_begin, m_wrapEnd)
+   // followed by [0, m_end).
+   size_t m_begin;
+   size_t m_end;
+   size_t m_wrapEnd;
+   bool m_wrapped;
+   size_t m_count;
+   unsigned long long m_sequence;
+
+   char m_dumpPath[512];
+   int m_dumpSignal;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::LC_FlightRecorder
++-----------------------------------------------------------------------------*/
+inline LC_FlightRecorder::LC_FlightRecorder() :
+     m_threshold(LC_LOG_DEBUG)
+   , m_enabled(true)
+   , m_buffer(NULL)
+   , m_capacity(0)
+   , m_begin(0)
+   , m_end(0)
+   , m_wrapEnd(0)
+   , m_wrapped(false)
+   , m_count(0)
+   , m_sequence(0)
+   , m_dumpSignal(0)
+{
+   m_dumpPath[0] = '\0';
+   setCapacity(FLIGHT_RECORDER_SIZE);
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_FlightRecorder::lockForFork,
+                              &LC_FlightRecorder::unlockAfterFork,
+                              &LC_FlightRecorder::unlockAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::~LC_FlightRecorder
++-----------------------------------------------------------------------------*/
+inline LC_FlightRecorder::~LC_FlightRecorder()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+   free(m_buffer);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::instance
++-----------------------------------------------------------------------------*/
+inline LC_FlightRecorder& LC_FlightRecorder::instance()
+{
+   static LC_FlightRecorder instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::setEnabled
++-----------------------------------------------------------------------------*/
+inline void LC_FlightRecorder::setEnabled(bool enabled)
+{
+   m_enabled = enabled;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::setThreshold
++-----------------------------------------------------------------------------*/
+/**
+* @brief setThreshold Sets the most verbose level recorded. Logs with no level are
+* always recorded.
+*/
+inline void LC_FlightRecorder::setThreshold(LC_LogLevel level)
+{
+   m_threshold = (int)level;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::threshold
++-----------------------------------------------------------------------------*/
+inline LC_LogLevel LC_FlightRecorder::threshold() const
+{
+   return (LC_LogLevel)(int)m_threshold;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::accepts
++-----------------------------------------------------------------------------*/
+inline bool LC_FlightRecorder::accepts(LC_LogLevel level) const
+{
+   return m_enabled && (level == LC_LOG_NONE || (int)level <= m_threshold);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::setCapacity
++-----------------------------------------------------------------------------*/
+/**
+* @brief setCapacity Resizes the ring. The records are discarded.
+*/
+inline void LC_FlightRecorder::setCapacity(size_t bytes)
+{
+   LC_MutexLocker locker(m_mutex);
+   free(m_buffer);
+   m_capacity = bytes & ~(size_t)7;
+   m_buffer = m_capacity ? (char*)malloc(m_capacity) : NULL;
+   if (!m_buffer)
+      m_capacity = 0;
+   m_begin = m_end = m_wrapEnd = m_count = 0;
+   m_wrapped = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::clear
++-----------------------------------------------------------------------------*/
+inline void LC_FlightRecorder::clear()
+{
+   LC_MutexLocker locker(m_mutex);
+   m_begin = m_end = m_wrapEnd = m_count = 0;
+   m_wrapped = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::count
++-----------------------------------------------------------------------------*/
+inline size_t LC_FlightRecorder::count()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_count;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::record
++-----------------------------------------------------------------------------*/
+/**
+* @brief record Copies the record into the ring if its level is accepted. Messages
+* longer than FLIGHT_RECORDER_MAX_RECORD are truncated.
+*/
+inline void LC_FlightRecorder::record(const LC_Log& logger, const char* format, va_list args)
+{
+   if (!accepts(logger.m_level))
+      return;
+
+   LC_StageTimer timer(LC_STAGE_FORMAT);
+   char message[FLIGHT_RECORDER_MAX_RECORD];
+   va_list copy;
+   va_copy(copy, args);
+   int length = vsnprintf(message, sizeof(message), format, copy);
+   va_end(copy);
+   if (length < 0)
+      return;
+   if ((size_t)length >= sizeof(message))
+      length = (int)sizeof(message) - 1;
+   if (logger.hasFields() || logger.m_stack) {
+#ifndef LC_LOGGING_DISABLE_THREADING
+      static thread_local std::string fields;
+#else
+      static std::string fields;
+#endif // LC_LOGGING_DISABLE_THREADING
+      fields.clear();
+      logger.appendFields(fields);
+      logger.appendStackTrace(fields);
+      const size_t size = std::min(fields.size(), sizeof(message) - 1 - (size_t)length);
+      memcpy(message + length, fields.data(), size);
+      length += (int)size;
+   }
+
+   LC_FlightRecord header;
+   header.length = (unsigned int)length;
+   header.time = (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+   header.level = (int)logger.m_level;
+   header.tagLength = (unsigned short)std::min(logger.tagLength(), (size_t)255);
+   header.reserved = 0;
+   header.size = (unsigned int)((sizeof(header) + header.tagLength + header.length + 7) & ~(size_t)7);
+
+   LC_StageTimer writeTimer(LC_STAGE_WRITE);
+   LC_MutexLocker locker(m_mutex);
+   lc_metrics_write(LC_SINK_FLIGHT_RECORDER, header.size, header.size <= m_capacity/4, 0);
+   if (LC_UNLIKELY(header.size > m_capacity/4))
+      return;
+
+   header.sequence = m_sequence++;
+   char* p = reserve(header.size);
+   memcpy(p, &header, sizeof(header));
+   memcpy(p + sizeof(header), logger.m_log_tag, header.tagLength);
+   memcpy(p + sizeof(header) + header.tagLength, message, header.length);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::reserve
++-----------------------------------------------------------------------------*/
+/**
+* @brief reserve Returns contiguous space for size bytes, evicting the oldest records.
+* Records never wrap: when the end of the ring is reached writing restarts at 0.
+*/
+inline char* LC_FlightRecorder::reserve(size_t size)
+{
+   for (;;) {
+      if (m_count == 0) {
+         m_begin = m_end = m_wrapEnd = 0;
+         m_wrapped = false;
+      }
+
+      if (!m_wrapped) {
+         if (m_capacity - m_end >= size)
+            break;
+         m_wrapEnd = m_end;
+         m_end = 0;
+         m_wrapped = true;
+      }
+
+      if (m_begin - m_end >= size)
+         break;
+      evict();
+   }
+
+   char* p = m_buffer + m_end;
+   m_end += size;
+   m_count++;
+   return p;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::evict
++-----------------------------------------------------------------------------*/
+inline void LC_FlightRecorder::evict()
+{
+   const LC_FlightRecord* r = (const LC_FlightRecord*)(m_buffer + m_begin);
+   m_begin += r->size;
+   m_count--;
+   if (m_wrapped && m_begin >= m_wrapEnd) {
+      m_begin = 0;
+      m_wrapped = false;
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::writeText
++-----------------------------------------------------------------------------*/
+inline void LC_FlightRecorder::writeText(FILE* f, const LC_FlightRecord* r)
+{
+   const char* tag = (const char*)(r + 1);
+   const char* message = tag + r->tagLength;
+
+   const time_t secs = (time_t)(r->time/1000000ULL);
+   struct tm timeinfo;
+#ifdef _WIN32
+   localtime_s(&timeinfo, &secs);
+#else
+   localtime_r(&secs, &timeinfo);
+#endif
+   char buffer[16];
+   strftime(buffer, sizeof(buffer), "%H:%M:%S", &timeinfo);
+
+   if (r->tagLength)
+      fprintf(f, "[%.*s]: ", (int)r->tagLength, tag);
+   fprintf(f, "%s.%03u ", buffer, (unsigned int)((r->time/1000ULL) % 1000ULL));
+   if (r->level >= LC_LOG_CRITICAL && r->level <= LC_LOG_DEBUG)
+      fprintf(f, "%s:\t ", LC_Log::toString((LC_LogLevel)r->level).c_str());
+   fwrite(message, 1, r->length, f);
+   fputc('\n', f);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::dump
++-----------------------------------------------------------------------------*/
+/**
+* @brief dump Writes the records, oldest first, as text lines with the layout used by
+* log_to_file. The ring is left untouched.
+*/
+inline bool LC_FlightRecorder::dump(FILE* f)
+{
+   if (!f)
+      return false;
+
+   LC_MutexLocker locker(m_mutex);
+   size_t offset = m_begin;
+   bool wrapped = m_wrapped;
+   for (size_t i = 0; i < m_count; i++) {
+      if (wrapped && offset >= m_wrapEnd) {
+         offset = 0;
+         wrapped = false;
+      }
+
+      const LC_FlightRecord* r = (const LC_FlightRecord*)(m_buffer + offset);
+      writeText(f, r);
+      offset += r->size;
+   }
+
+   return fflush(f) == 0;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::dump
++-----------------------------------------------------------------------------*/
+/**
+* @brief dump Writes the records to a file.
+* @param path Path of the file, overwritten if it exists.
+* @param binary If true, the records are written as they are stored in memory. This
+* is what the signal handlers write; use convert() to read them.
+*/
+inline bool LC_FlightRecorder::dump(const char* path, bool binary)
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   if (binary) {
+      const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+         return false;
+
+      bool ok;
+      {
+         LC_MutexLocker locker(m_mutex);
+         ok = dumpBinary(fd);
+      }
+      return (::close(fd) == 0) && ok;
+   }
+#else
+   LOG_UNUSED(binary);
+#endif
+
+   FILE* f = fopen(path, "w");
+   if (!f)
+      return false;
+
+   const bool ok = dump(f);
+   return (fclose(f) == 0) && ok;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::convert
++-----------------------------------------------------------------------------*/
+/**
+* @brief convert Prints a binary dump as text lines.
+*/
+inline bool LC_FlightRecorder::convert(const char* binaryPath, FILE* out)
+{
+   FILE* f = fopen(binaryPath, "rb");
+   if (!f)
+      return false;
+
+   char magic[4];
+   unsigned int version;
+   bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, LC_FLIGHT_DUMP_MAGIC, 4) == 0
+         && fread(&version, sizeof(version), 1, f) == 1 && version == LC_FLIGHT_DUMP_VERSION;
+
+   char buffer[sizeof(LC_FlightRecord) + 256 + FLIGHT_RECORDER_MAX_RECORD + 8];
+   LC_FlightRecord* r = (LC_FlightRecord*)buffer;
+   while (ok && fread(r, sizeof(LC_FlightRecord), 1, f) == 1) {
+      // A dump written while crashing may be torn: stop at the first bad record.
+      if (r->size < sizeof(LC_FlightRecord) || r->size > sizeof(buffer)
+            || sizeof(LC_FlightRecord) + r->tagLength + r->length > r->size
+            || fread(r + 1, 1, r->size - sizeof(LC_FlightRecord), f) != r->size - sizeof(LC_FlightRecord))
+         break;
+      writeText(out, r);
+   }
+
+   fclose(f);
+   return ok;
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::dumpBinary
++-----------------------------------------------------------------------------*/
+/**
+* @brief dumpBinary Writes a binary dump to fd. Only write() is used, so this can be
+* called from a signal handler.
+*/
+inline bool LC_FlightRecorder::dumpBinary(int fd)
+{
+   const unsigned int version = LC_FLIGHT_DUMP_VERSION;
+   bool ok = ::write(fd, LC_FLIGHT_DUMP_MAGIC, 4) == 4
+         && ::write(fd, &version, sizeof(version)) == (ssize_t)sizeof(version);
+
+   if (ok && m_count > 0) {
+      const size_t first = m_wrapped ? m_wrapEnd : m_end;
+      ok = ::write(fd, m_buffer + m_begin, first - m_begin) == (ssize_t)(first - m_begin);
+      if (ok && m_wrapped)
+         ok = ::write(fd, m_buffer, m_end) == (ssize_t)m_end;
+   }
+
+   return ok;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::signalHandler
++-----------------------------------------------------------------------------*/
+inline void LC_FlightRecorder::signalHandler(int sig)
+{
+   LC_FlightRecorder& recorder = instance();
+   const int fd = ::open(recorder.m_dumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd >= 0) {
+      // If the lock is taken, the thread holding it may be the one that crashed:
+      // dump anyway, convert() stops at a torn record.
+      const bool locked = recorder.m_mutex.try_lock();
+      recorder.dumpBinary(fd);
+      if (locked)
+         recorder.m_mutex.unlock();
+      ::close(fd);
+   }
+
+   // Crash handlers are reset when invoked: raising again gets the default action.
+   if (sig != recorder.m_dumpSignal)
+      raise(sig);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_FlightRecorder::lockForFork(void* recorder)
+{
+   static_cast<LC_FlightRecorder*>(recorder)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_FlightRecorder::unlockAfterFork(void* recorder)
+{
+   static_cast<LC_FlightRecorder*>(recorder)->m_mutex.unlock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_FlightRecorder::installHandlers
++-----------------------------------------------------------------------------*/
+/**
+* @brief installHandlers Installs signal handlers writing a binary dump to path.
+* @param path Path of the dump.
+* @param onCrash If true, dumps on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT, then
+* lets the default action take place.
+* @param dumpSignal Signal requesting a dump, 0 for none. The process goes on.
+* @return false if path is too long or a handler could not be installed.
+*/
+inline bool LC_FlightRecorder::installHandlers(const char* path, bool onCrash, int dumpSignal)
+{
+   if (strlen(path) >= sizeof(m_dumpPath))
+      return false;
+   strcpy(m_dumpPath, path);
+   m_dumpSignal = dumpSignal;
+
+   // Run the crash handlers on an alternate stack, so a stack overflow is dumped too.
+   static char altStack[64*1024];
+   stack_t ss;
+   memset(&ss, 0, sizeof(ss));
+   ss.ss_sp = altStack;
+   ss.ss_size = sizeof(altStack);
+   sigaltstack(&ss, NULL);
+
+   struct sigaction sa;
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = &LC_FlightRecorder::signalHandler;
+   sigemptyset(&sa.sa_mask);
+
+   bool ok = true;
+   if (dumpSignal) {
+      sa.sa_flags = SA_RESTART;
+      ok = sigaction(dumpSignal, &sa, NULL) == 0;
+   }
+
+   if (onCrash) {
+      static const int signals [] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+      sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+      for (size_t i = 0; i < sizeof(signals)/sizeof(signals[0]); i++)
+         ok = (sigaction(signals[i], &sa, NULL) == 0) && ok;
+   }
+
+   return ok;
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+#endif // ENABLE_FLIGHT_RECORDER
+
+/*------------------------------------------------------------------------------
+|    LC_Log::LC_Log
++-----------------------------------------------------------------------------*/
+inline LC_Log::LC_Log(LC_LogColor color, bool nl) :
+    m_level(LC_LOG_NONE)
+  , m_log_tag(LOG_TAG)
+  , m_tag(NULL)
+  , m_attrib(LC_LOG_ATTR_RESET)
+  , m_color(color)
+  , m_background(LC_BACK_COL_DEFAULT)
+  , m_nl(nl)
+  , m_file(NULL)
+  , m_line(0)
+  , m_function(NULL)
+  , m_locationLength(0)
+  , m_fieldCount(0)
+  , m_scope(lc_scope_top())
+  , m_stack(NULL)
+  , m_textSlot(NULL)
+  , m_streamSlot(NULL)
+{
+   // Do nothing.
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::LC_Log
++-----------------------------------------------------------------------------*/
+inline LC_Log::LC_Log(const char* log_tag, LC_LogLevel level, bool nl) :
+    m_level(level)
+  , m_log_tag(log_tag)
+  , m_tag(NULL)
+  , m_attrib(LC_LOG_ATTR_RESET)
+  , m_color(get_color_for_level(level))
+  , m_background(LC_BACK_COL_DEFAULT)
+  , m_nl(nl)
+  , m_file(NULL)
+  , m_line(0)
+  , m_function(NULL)
+  , m_locationLength(0)
+  , m_fieldCount(0)
+  , m_scope(lc_scope_top())
+  , m_stack(NULL)
+  , m_textSlot(NULL)
+  , m_streamSlot(NULL)
+{
+   // Do nothing.
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::LC_Log
++-----------------------------------------------------------------------------*/
+inline LC_Log::LC_Log(const char *log_tag, bool nl) :
+    m_level(LC_LOG_INFO)
+  , m_log_tag(log_tag)
+  , m_tag(NULL)
+  , m_attrib(LC_LOG_ATTR_RESET)
+  , m_color(get_color_for_level(LC_LOG_INFO))
+  , m_background(LC_BACK_COL_DEFAULT)
+  , m_nl(nl)
+  , m_file(NULL)
+  , m_line(0)
+  , m_function(NULL)
+  , m_locationLength(0)
+  , m_fieldCount(0)
+  , m_scope(lc_scope_top())
+  , m_stack(NULL)
+  , m_textSlot(NULL)
+  , m_streamSlot(NULL)
+{
+    // Do nothing.
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::LC_Log
++-----------------------------------------------------------------------------*/
+inline LC_Log::LC_Log(LC_LogLevel level, bool nl) :
+    m_level(level)
+  , m_log_tag(LOG_TAG)
+  , m_tag(NULL)
+  , m_attrib(LC_LOG_ATTR_RESET)
+  , m_color(get_color_for_level(level))
+  , m_background(LC_BACK_COL_DEFAULT)
+  , m_nl(nl)
+  , m_file(NULL)
+  , m_line(0)
+  , m_function(NULL)
+  , m_locationLength(0)
+  , m_fieldCount(0)
+  , m_scope(lc_scope_top())
+  , m_stack(NULL)
+  , m_textSlot(NULL)
+  , m_streamSlot(NULL)
+{
+   // Do nothing.
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::LC_Log
++-----------------------------------------------------------------------------*/
+inline LC_Log::LC_Log(const char* log_tag, LC_LogAttrib attrib, LC_LogColor color, bool nl) :
+    m_level(LC_LOG_NONE)
+  , m_log_tag(log_tag)
+  , m_tag(NULL)
+  , m_attrib(attrib)
+  , m_color(color)
+  , m_background(LC_BACK_COL_DEFAULT)
+  , m_nl(nl)
+  , m_file(NULL)
+  , m_line(0)
+  , m_function(NULL)
+  , m_locationLength(0)
+  , m_fieldCount(0)
+  , m_scope(lc_scope_top())
+  , m_stack(NULL)
+  , m_textSlot(NULL)
+  , m_streamSlot(NULL)
+{
+    // Do nothing.
+}
+
+inline LC_Log::LC_Log(const char* log_tag, LC_LogAttrib attrib, LC_LogColor color, LC_BackColor foreground, bool nl) :
+    m_level(LC_LOG_NONE)
+  , m_log_tag(log_tag)
+  , m_tag(NULL)
+  , m_attrib(attrib)
+  , m_color(color)
+  , m_background(foreground)
+  , m_nl(nl)
+  , m_file(NULL)
+  , m_line(0)
+  , m_function(NULL)
+  , m_locationLength(0)
+  , m_fieldCount(0)
+  , m_scope(lc_scope_top())
+  , m_stack(NULL)
+  , m_textSlot(NULL)
+  , m_streamSlot(NULL)
+{
+    // Do nothing.
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::setLocation
++-----------------------------------------------------------------------------*/
+/**
+* @brief setLocation Sets the location in the sources this log comes from. The
+* pointers must outlive the record: __FILE__ and __FUNCTION__ are meant here.
+*/
+inline void LC_Log::setLocation(const char* file, int line, const char* function)
+{
+   m_file = file;
+   m_line = line;
+   m_function = function;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::message
++-----------------------------------------------------------------------------*/
+/**
+* @brief message Returns the format of the message without the location prefix.
+* Only valid inside a custom_log_func.
+*/
+inline const char* LC_Log::message() const
+{
+   return m_string.c_str() + m_locationLength;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::addField
++-----------------------------------------------------------------------------*/
+inline void LC_Log::addField(const LC_Field& field)
+{
+   if (LC_LIKELY(m_fieldCount < LC_MAX_FIELDS))
+      m_fields[m_fieldCount++] = field;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::addFields
++-----------------------------------------------------------------------------*/
+template<typename... Fields>
+inline void LC_Log::addFields(const LC_Field& field, const Fields&... fields)
+{
+   addField(field);
+   addFields(fields...);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::hasFields
++-----------------------------------------------------------------------------*/
+/**
+* @brief hasFields Returns true if the record has key-value fields, its own or from
+* the context of the thread.
+*/
+inline bool LC_Log::hasFields() const
+{
+   return m_fieldCount || m_scope;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::visitScope
++-----------------------------------------------------------------------------*/
+template<typename Visitor>
+inline void LC_Log::visitScope(const LC_ScopeNode* node, Visitor& visitor)
+{
+   if (!node)
+      return;
+   visitScope(node->parent, visitor);
+   visitor(node->field);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::visitFields
++-----------------------------------------------------------------------------*/
+/**
+* @brief visitFields Calls visitor(const LC_Field&) for the fields of the context,
+* outermost first, and then for the fields of the record.
+*/
+template<typename Visitor>
+inline void LC_Log::visitFields(Visitor visitor) const
+{
+   visitScope(m_scope, visitor);
+   for (unsigned int i = 0; i < m_fieldCount; i++)
+      visitor(m_fields[i]);
+}
+
+/*------------------------------------------------------------------------------
+|    lc_append_text_field
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_append_text_field Appends field to out as " key=value". String values are
+* quoted if they are empty or contain spaces, '=' or '"'.
+*/
+inline void lc_append_text_field(std::string& out, const LC_Field& field)
+{
+   out.push_back(' ');
+   out.append(field.key);
+   out.push_back('=');
+
+   if (field.type != LC_KV_STRING) {
+      lc_append_field_value(out, field);
+      return;
+   }
+
+   const char* data = field.value.s.data;
+   const size_t size = field.value.s.size;
+   bool quote = (size == 0);
+   for (size_t j = 0; j < size && !quote; j++)
+      quote = (data[j] == ' ' || data[j] == '=' || data[j] == '"');
+   if (!quote) {
+      out.append(data, size);
+      return;
+   }
+
+   out.push_back('"');
+   for (size_t j = 0; j < size; j++) {
+      if (data[j] == '"' || data[j] == '\\')
+         out.push_back('\\');
+      out.push_back(data[j]);
+   }
+   out.push_back('"');
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::appendFields
++-----------------------------------------------------------------------------*/
+/**
+* @brief appendFields Appends all the fields to out as " key=value" for text sinks.
+*/
+inline void LC_Log::appendFields(std::string& out) const
+{
+   visitFields([&out](const LC_Field& field) { lc_append_text_field(out, field); });
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::appendStackTrace
++-----------------------------------------------------------------------------*/
+/**
+* @brief appendStackTrace Appends the stack trace, if any, to out for text sinks: one
+* symbolized frame per line.
+*/
+inline void LC_Log::appendStackTrace(std::string& out) const
+{
+   if (LC_UNLIKELY(m_stack != NULL))
+      LC_SymbolCache::instance().append(out, *m_stack);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::appendHeader
++-----------------------------------------------------------------------------*/
+inline void LC_Log::prependHeader(std::string& s)
+{
+   if (LC_LIKELY(m_level != LC_LOG_NONE))
+      s.insert(0, toString(m_level) + ":\t ");
+   s.insert(0, lc_current_time() + " ");
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::appendlog_tagIfNeeded
++-----------------------------------------------------------------------------*/
+inline void LC_Log::prependLogTagIfNeeded(std::string& s)
+{
+   if (!m_log_tag)
+      return;
+
+   if (const LC_Tag* tag = m_tag ? m_tag : LC_TagRegistry::intern(m_log_tag))
+      s.insert(0, tag->prefix(), tag->prefixLength());
+   else
+      s.insert(0, std::string("[") + m_log_tag + "]: ");
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::tagLength
++-----------------------------------------------------------------------------*/
+/**
+* @brief tagLength Returns the length of m_log_tag, 0 if there is none.
+*/
+inline size_t LC_Log::tagLength() const
+{
+   if (m_tag)
+      return m_tag->length();
+   return m_log_tag ? strlen(m_log_tag) : 0;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::printf
++-----------------------------------------------------------------------------*/
+inline void LC_Log::printf(const char* format, ...)
+{
+   if (!isEnabled())
+      return;
+
+   VA_LIST_CONTEXT(format, this->printf(format, args));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::printf
++-----------------------------------------------------------------------------*/
+inline void LC_Log::printf(const char* format, va_list args)
+{
+   if (!isEnabled())
+      return;
+
+   LC_MetricsRecord metrics(m_level);
+   if (!m_textSlot) {
+      m_textSlot = LC_RecordPool::acquire();
+      m_string.swap(m_textSlot->text);
+   }
+   m_string.clear();
+   m_locationLength = 0;
+   if (m_file) {
+      lc_append_location(m_string, m_file, m_line, m_function);
+      m_locationLength = m_string.size();
+   }
+   m_string.append(format);
+   m_tag = LC_TagRegistry::intern(m_log_tag);
+
+#ifdef ENABLE_FLIGHT_RECORDER
+   LC_FlightRecorder::instance().record(*this, m_string.c_str(), args);
+#endif // ENABLE_FLIGHT_RECORDER
+
+   if (!isOutputEnabled(m_level))
+      return;
+   if (m_tag && m_level != LC_LOG_NONE && m_level > m_tag->level())
+      return;
+
+   // Delegate log handling.
+   if (global_log_func)
+      global_log_func(*this, args);
+}
+
+#if defined(__APPLE__) && (__OBJC__ == 1)
+/*------------------------------------------------------------------------------
+|    LC_Log::printf
++-----------------------------------------------------------------------------*/
+inline void LC_Log::printf(NSString* format, ...)
+{
+   if (!isEnabled())
+      return;
+
+   VA_LIST_CONTEXT(format, printf(format, args));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::printf
++-----------------------------------------------------------------------------*/
+inline void LC_Log::printf(NSString* format, va_list args)
+{
+   if (!isEnabled())
+      return;
+
+   // Build the NSString from the format. This includes NSString's in args.
+   NSString* s1 = [NSString stringWithUTF8String : m_string.str().c_str()];
+#if __has_feature(objc_arc)
+   NSString* s2 = [[NSString alloc] initWithFormat:format arguments : args];
+#else
+   NSString* s2 = [[[NSString alloc] initWithFormat:format arguments : args] autorelease];
+#endif // __has_feature(objc_arc)
+   NSString* s = [NSString stringWithFormat : @"%@%@", s1, s2];
+
+   printf([s cStringUsingEncoding : NSUTF8StringEncoding]);
+}
+#endif // defined(__APPLE__) && (__OBJC__ == 1)
+
+/*------------------------------------------------------------------------------
+|    LC_Log::~LC_Log
++-----------------------------------------------------------------------------*/
+inline LC_Log::~LC_Log()
+{
+   // The streamed text is logged as it is, not as a format.
+   if (m_streamSlot) {
+      if (!m_streamSlot->text.empty())
+         printf("%s", m_streamSlot->text.c_str());
+      LC_RecordPool::release(m_streamSlot);
+   }
+
+   if (m_textSlot) {
+      m_string.swap(m_textSlot->text);
+      LC_RecordPool::release(m_textSlot);
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::stream
++-----------------------------------------------------------------------------*/
+inline std::ostream& LC_Log::stream()
+{
+   static LC_NullStream nullStream;
+
+   if (!isEnabled())
+      return nullStream;
+
+   if (!m_streamSlot)
+      m_streamSlot = LC_RecordPool::acquire();
+   return m_streamSlot->stream;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::isOutputEnabled
++-----------------------------------------------------------------------------*/
+/**
+* @brief isOutputEnabled Returns true if level is printed according to the
+* BUILD_LOG_LEVEL_* macros. Logs with no level are always printed.
+*/
+inline bool LC_Log::isOutputEnabled(LC_LogLevel level)
+{
+   if (LC_UNLIKELY(level == LC_LOG_NONE))
+      return true;
+
+#ifdef BUILD_LOG_LEVEL_DEBUG
+   return true;
+#elif defined(BUILD_LOG_LEVEL_VERBOSE)
+   return level <= LC_LOG_VERBOSE;
+#elif defined(BUILD_LOG_LEVEL_INFORMATION)
+   return level <= LC_LOG_INFO;
+#elif defined(BUILD_LOG_LEVEL_WARNING)
+   return level <= LC_LOG_WARN;
+#elif defined(BUILD_LOG_LEVEL_ERROR)
+   return level <= LC_LOG_ERROR;
+#elif defined(BUILD_LOG_LEVEL_CRITICAL)
+   return level <= LC_LOG_CRITICAL;
+#else
+   return true;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::isEnabled
++-----------------------------------------------------------------------------*/
+/**
+* @brief isEnabled Returns true if this log is printed or recorded by the flight
+* recorder.
+*/
+inline bool LC_Log::isEnabled() const
+{
+#ifdef ENABLE_FLIGHT_RECORDER
+   if (LC_FlightRecorder::instance().accepts(m_level))
+      return true;
+#endif // ENABLE_FLIGHT_RECORDER
+
+   return isOutputEnabled(m_level);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::toString
++-----------------------------------------------------------------------------*/
+inline std::string LC_Log::toString(LC_LogLevel level)
+{
+   static const char* const buffer [] = {
+       "CRIT",
+       "ERR",
+       "WARN",
+       "INFO",
+       "VERB",
+       "DBG"
+   };
+
+   return buffer[level];
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Log::fromString
++-----------------------------------------------------------------------------*/
+inline LC_LogLevel LC_Log::fromString(const std::string& level)
+{
+   if (level == "DEBUG")
+      return LC_LOG_DEBUG;
+   if (level == "VERBOSE")
+      return LC_LOG_VERBOSE;
+   if (level == "INFO")
+      return LC_LOG_INFO;
+   if (level == "WARNING")
+      return LC_LOG_WARN;
+   if (level == "ERROR")
+      return LC_LOG_ERROR;
+   if (level == "CRITICAL")
+      return LC_LOG_CRITICAL;
+
+   // TODO
+   //LC_Log().prependHeader(LC_LOG_WARN)
+   //   << "Unknown logging level '" << level << "'. Using INFO level as default.";
+   return LC_LOG_INFO;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_vformat
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_vformat Appends the expansion of format to out. args is copied, so the
+* caller can still use it afterwards.
+* @param out The string the formatted text is appended to.
+* @param format printf-like format.
+* @param args The arguments.
+*/
+inline void lc_vformat(std::string& out, const char* format, va_list args)
+{
+   // Nothing to expand: skip vsnprintf.
+   if (!strchr(format, '%')) {
+      out.append(format);
+      return;
+   }
+
+   char buffer[512];
+   va_list copy;
+   va_copy(copy, args);
+   int n = vsnprintf(buffer, sizeof(buffer), format, copy);
+   va_end(copy);
+   if (n < 0)
+      return;
+   if ((size_t)n < sizeof(buffer)) {
+      out.append(buffer, (size_t)n);
+      return;
+   }
+
+   const size_t offset = out.size();
+   out.resize(offset + (size_t)n + 1);
+   va_copy(copy, args);
+   vsnprintf(&out[offset], (size_t)n + 1, format, copy);
+   va_end(copy);
+   out.resize(offset + (size_t)n);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Layout class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_Layout class assembles the line written by a text sink from a pattern.
+* The pattern is compiled once into a list of operations; fields that the pattern
+* does not use are never computed (e.g. the clock is not read without a time field).
+*
+* Fields:
+*    %D    date, YYYY-MM-DD (local time);
+*    %T    time, HH:MM:SS (local time);
+*    %ms   milliseconds, 3 digits;
+*    %us   microseconds, 6 digits;
+*    %L    level as returned by LC_Log::toString();
+*    %tag  log tag;
+*    %t    thread id as returned by lc_thread_id();
+*    %N    thread name as returned by lc_thread_name();
+*    %loc  location in the sources, file:line/function (ENABLE_CODE_LOCATION);
+*    %m    the message, followed by the key-value fields unless %kv is used and by
+*          the stack trace of log_stacktrace();
+*    %kv   key-value fields, as key=value separated by spaces;
+*    %c    starts the color of the record (ANSI escape sequence);
+*    %r    resets the color;
+*    %%    a literal %.
+*
+* The text between %( and %) is written only if the tag, the level, the location, the
+* thread name and the key-value fields used inside it are available, e.g.
+* "%([%tag]: %)" writes nothing for untagged logs. Any other text is copied verbatim.
+*
+* setPattern() is not synchronized with format(): set patterns before logging.
+*/
+class LC_Layout
+{
+public:
+   explicit LC_Layout(const char* pattern);
+
+   void setPattern(const char* pattern);
+   const std::string& pattern() const;
+
+   void format(std::string& out, const LC_Log& logger, va_list args, bool colors = true,
+               std::pair<size_t, size_t>* message = NULL) const;
+
+private:
+   enum OpType {
+      LC_OP_LITERAL,
+      LC_OP_GROUP,
+      LC_OP_GROUP_END,
+      LC_OP_DATE,
+      LC_OP_TIME,
+      LC_OP_MILLIS,
+      LC_OP_MICROS,
+      LC_OP_LEVEL,
+      LC_OP_TAG,
+      LC_OP_TAG_PREFIX,
+      LC_OP_THREAD,
+      LC_OP_THREAD_NAME,
+      LC_OP_LOCATION,
+      LC_OP_MESSAGE,
+      LC_OP_FIELDS,
+      LC_OP_COLOR,
+      LC_OP_RESET
+   };
+
+   // Fields a group depends on, and whether the clock is needed.
+   enum Field {
+      LC_FIELD_TAG =      1,
+      LC_FIELD_LEVEL =    2,
+      LC_FIELD_LOCATION = 4,
+      LC_FIELD_KV =       8,
+      LC_FIELD_TIME =     16,
+      LC_FIELD_THREAD =   32
+   };
+
+   struct Op {
+      unsigned char type;
+      unsigned char fields;
+      unsigned int a;
+      unsigned int b;
+   };
+
+   void addOp(unsigned char type, unsigned int a = 0, unsigned int b = 0);
+   void appendLiteral(char c);
+   static void appendNumber(std::string& out, unsigned long long value, int digits);
+   unsigned char availableFields(const LC_Log& logger) const;
+
+   std::string m_pattern;
+   std::string m_literals;
+   std::vector<Op> m_ops;
+   unsigned char m_fields;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_Layout::LC_Layout
++-----------------------------------------------------------------------------*/
+inline LC_Layout::LC_Layout(const char* pattern) :
+   m_fields(0)
+{
+   setPattern(pattern);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Layout::addOp
++-----------------------------------------------------------------------------*/
+inline void LC_Layout::addOp(unsigned char type, unsigned int a, unsigned int b)
+{
+   Op op;
+   op.type = type;
+   op.fields = 0;
+   op.a = a;
+   op.b = b;
+   m_ops.push_back(op);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Layout::appendLiteral
++-----------------------------------------------------------------------------*/
+inline void LC_Layout::appendLiteral(char c)
+{
+   // Consecutive text is a single operation.
+   if (m_ops.empty() || m_ops.back().type != LC_OP_LITERAL)
+      addOp(LC_OP_LITERAL, (unsigned int)m_literals.size(), 0);
+   m_ops.back().b++;
+   m_literals.push_back(c);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Layout::setPattern
++-----------------------------------------------------------------------------*/
+/**
+* @brief setPattern Compiles pattern. Unknown % sequences and unbalanced %) are
+* copied as text; groups left open are closed at the end.
+*/
+inline void LC_Layout::setPattern(const char* pattern)
+{
+   static const struct {
+      const char* token;
+      unsigned char type;
+      unsigned char fields;
+   } tokens[] = {
+      // Longest first: %tag and %t, %ms and %m.
+      { "tag", LC_OP_TAG,         LC_FIELD_TAG },
+      { "loc", LC_OP_LOCATION,    LC_FIELD_LOCATION },
+      { "kv",  LC_OP_FIELDS,      LC_FIELD_KV },
+      { "ms",  LC_OP_MILLIS,      LC_FIELD_TIME },
+      { "us",  LC_OP_MICROS,      LC_FIELD_TIME },
+      { "D",   LC_OP_DATE,        LC_FIELD_TIME },
+      { "T",   LC_OP_TIME,        LC_FIELD_TIME },
+      { "L",   LC_OP_LEVEL,       LC_FIELD_LEVEL },
+      { "t",   LC_OP_THREAD,      0 },
+      { "N",   LC_OP_THREAD_NAME, LC_FIELD_THREAD },
+      { "m",   LC_OP_MESSAGE,     0 },
+      { "c",   LC_OP_COLOR,       0 },
+      { "r",   LC_OP_RESET,       0 }
+   };
+
+   m_pattern = pattern ? pattern : "";
+   m_literals.clear();
+   m_ops.clear();
+   m_fields = 0;
+
+   std::vector<size_t> groups;
+   const char* p = m_pattern.c_str();
+   while (*p) {
+      if (*p != '%' || p[1] == '%') {
+         appendLiteral(*p);
+         p += (*p == '%') ? 2 : 1;
+         continue;
+      }
+
+      p++;
+      if (*p == '(') {
+         groups.push_back(m_ops.size());
+         addOp(LC_OP_GROUP);
+         p++;
+         continue;
+      }
+      if (*p == ')' && !groups.empty()) {
+         // "%([%tag]: %)" is the prefix of the interned tag, copied at once.
+         const size_t start = groups.back() + 1;
+         if (m_ops.size() == start + 3
+               && m_ops[start].type == LC_OP_LITERAL && !m_literals.compare(m_ops[start].a, m_ops[start].b, "[")
+               && m_ops[start + 1].type == LC_OP_TAG
+               && m_ops[start + 2].type == LC_OP_LITERAL && !m_literals.compare(m_ops[start + 2].a, m_ops[start + 2].b, "]: ")) {
+            m_ops.resize(start);
+            addOp(LC_OP_TAG_PREFIX);
+         }
+         m_ops[groups.back()].a = (unsigned int)m_ops.size();
+         addOp(LC_OP_GROUP_END);
+         groups.pop_back();
+         p++;
+         continue;
+      }
+
+      size_t i = 0;
+      const size_t count = sizeof(tokens)/sizeof(tokens[0]);
+      for (; i < count; i++)
+         if (!strncmp(p, tokens[i].token, strlen(tokens[i].token)))
+            break;
+      if (i == count) {
+         // Unknown: keep the % as text.
+         appendLiteral('%');
+         continue;
+      }
+
+      addOp(tokens[i].type);
+      m_fields |= tokens[i].fields;
+      for (size_t g = 0; g < groups.size(); g++)
+         m_ops[groups[g]].fields |= tokens[i].fields & ~LC_FIELD_TIME;
+      p += strlen(tokens[i].token);
+   }
+
+   while (!groups.empty()) {
+      m_ops[groups.back()].a = (unsigned int)m_ops.size();
+      addOp(LC_OP_GROUP_END);
+      groups.pop_back();
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Layout::pattern
++-----------------------------------------------------------------------------*/
+inline const std::string& LC_Layout::pattern() const
+{
+   return m_pattern;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Layout::appendNumber
++-----------------------------------------------------------------------------*/
+inline void LC_Layout::appendNumber(std::string& out, unsigned long long value, int digits)
+{
+   char buffer[24];
+   int i = sizeof(buffer);
+   do {
+      buffer[--i] = (char)('0' + value % 10);
+      value /= 10;
+      digits--;
+   } while ((value || digits > 0) && i > 0);
+   out.append(buffer + i, sizeof(buffer) - i);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Layout::availableFields
++-----------------------------------------------------------------------------*/
+inline unsigned char LC_Layout::availableFields(const LC_Log& logger) const
+{
+   unsigned char fields = 0;
+   if (logger.m_log_tag)
+      fields |= LC_FIELD_TAG;
+   if (logger.m_level != LC_LOG_NONE)
+      fields |= LC_FIELD_LEVEL;
+   if (logger.m_file)
+      fields |= LC_FIELD_LOCATION;
+   if (logger.hasFields())
+      fields |= LC_FIELD_KV;
+   // The first lookup on a thread asks the system: only done when the pattern has %N.
+   if ((m_fields & LC_FIELD_THREAD) && *lc_thread_name())
+      fields |= LC_FIELD_THREAD;
+   return fields;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Layout::format
++-----------------------------------------------------------------------------*/
+/**
+* @brief format Appends the line for logger to out, without the trailing newline.
+* @param colors false to leave out %c and %r, see lc_colors_enabled().
+* @param message If not NULL, set to the begin and end in out of what %m wrote.
+*/
+inline void LC_Layout::format(std::string& out, const LC_Log& logger, va_list args, bool colors,
+                              std::pair<size_t, size_t>* message) const
+{
+   LC_StageTimer timer(LC_STAGE_FORMAT);
+   struct tm timeinfo = tm();
+   unsigned long long micros = 0;
+   if (m_fields & LC_FIELD_TIME) {
+      using namespace std::chrono;
+      LC_StageTimer timestampTimer(LC_STAGE_TIMESTAMP);
+      micros = (unsigned long long)
+            duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+      lc_local_time((time_t)(micros/1000000ULL), timeinfo);
+   }
+
+   const unsigned char available = availableFields(logger);
+   for (size_t i = 0; i < m_ops.size(); i++) {
+      const Op& op = m_ops[i];
+      switch (op.type) {
+      case LC_OP_LITERAL:
+         out.append(m_literals, op.a, op.b);
+         break;
+      case LC_OP_GROUP:
+         if ((op.fields & available) != op.fields)
+            i = op.a;
+         break;
+      case LC_OP_GROUP_END:
+         break;
+      case LC_OP_DATE:
+         appendNumber(out, (unsigned long long)(timeinfo.tm_year + 1900), 4);
+         out.push_back('-');
+         appendNumber(out, (unsigned long long)(timeinfo.tm_mon + 1), 2);
+         out.push_back('-');
+         appendNumber(out, (unsigned long long)timeinfo.tm_mday, 2);
+         break;
+      case LC_OP_TIME:
+         appendNumber(out, (unsigned long long)timeinfo.tm_hour, 2);
+         out.push_back(':');
+         appendNumber(out, (unsigned long long)timeinfo.tm_min, 2);
+         out.push_back(':');
+         appendNumber(out, (unsigned long long)timeinfo.tm_sec, 2);
+         break;
+      case LC_OP_MILLIS:
+         appendNumber(out, (micros/1000ULL) % 1000ULL, 3);
+         break;
+      case LC_OP_MICROS:
+         appendNumber(out, micros % 1000000ULL, 6);
+         break;
+      case LC_OP_LEVEL:
+         if (available & LC_FIELD_LEVEL)
+            out.append(LC_Log::toString(logger.m_level));
+         break;
+      case LC_OP_TAG:
+         if (available & LC_FIELD_TAG)
+            out.append(logger.m_log_tag, logger.tagLength());
+         break;
+      case LC_OP_TAG_PREFIX:
+         if (logger.m_tag)
+            out.append(logger.m_tag->prefix(), logger.m_tag->prefixLength());
+         else if (available & LC_FIELD_TAG) {
+            out.push_back('[');
+            out.append(logger.m_log_tag);
+            out.append("]: ");
+         }
+         break;
+      case LC_OP_THREAD:
+         appendNumber(out, lc_thread_id(), 1);
+         break;
+      case LC_OP_THREAD_NAME:
+         out.append(lc_thread_name());
+         break;
+      case LC_OP_LOCATION:
+         if (available & LC_FIELD_LOCATION) {
+            out.append(lc_file_name(logger.m_file));
+            out.push_back(':');
+            appendNumber(out, (unsigned long long)logger.m_line, 1);
+            out.push_back('/');
+            out.append(logger.m_function ? logger.m_function : "");
+         }
+         break;
+      case LC_OP_MESSAGE:
+         if (message)
+            message->first = out.size();
+         lc_vformat(out, logger.message(), args);
+         if (!(m_fields & LC_FIELD_KV))
+            logger.appendFields(out);
+         logger.appendStackTrace(out);
+         if (message)
+            message->second = out.size();
+         break;
+      case LC_OP_FIELDS: {
+         const size_t start = out.size();
+         logger.appendFields(out);
+         if (out.size() > start)
+            out.erase(start, 1);
+         break;
+      }
+      case LC_OP_COLOR: {
+         if (!colors)
+            break;
+         // Records with a level use the color of the level only.
+         const bool level = (available & LC_FIELD_LEVEL) != 0;
+         if (level && logger.m_color == get_color_for_level(logger.m_level)) {
+            size_t length;
+            const char* sequence = lc_level_sgr(logger.m_level, length);
+            out.append(sequence, length);
+            break;
+         }
+         char sequence[3 + 4*3];
+         const unsigned int codes[] = {
+            (unsigned int)(level ? LC_LOG_ATTR_RESET : logger.m_attrib),
+            (unsigned int)logger.m_color,
+            (unsigned int)(level ? LC_BACK_COL_DEFAULT : logger.m_background)
+         };
+         out.append(sequence, lc_sgr(sequence, codes, 3));
+         break;
+      }
+      case LC_OP_RESET:
+         if (colors)
+            out.append("\x1B[0m");
+         break;
+      }
+   }
+}
+
+#ifndef LC_COALESCE_WINDOW
+#define LC_COALESCE_WINDOW 10000
+#endif
+
+/*------------------------------------------------------------------------------
+|    lc_hash_bytes
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_hash_bytes 64 bit hash of size bytes at data, 8 bytes per step, mixed into
+* seed.
+*/
+inline unsigned long long lc_hash_bytes(const void* data, size_t size, unsigned long long seed)
+{
+   const unsigned long long m = 0x9E3779B97F4A7C15ULL;
+   const unsigned char* p = static_cast<const unsigned char*>(data);
+   unsigned long long h = seed ^ (size*m);
+   for (; size >= 8; size -= 8, p += 8) {
+      unsigned long long word;
+      memcpy(&word, p, 8);
+      h = (h ^ word)*m;
+      h ^= h >> 32;
+   }
+   unsigned long long tail = 0;
+   memcpy(&tail, p, size);
+   h = (h ^ tail)*m;
+   return h ^ (h >> 29);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_CoalescedRun struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_CoalescedRun struct is a run of repetitions that ended, to be reported
+* with the level and tag of the repeated record. repeats is 0 if none ended.
+*/
+struct LC_CoalescedRun
+{
+   LC_CoalescedRun() :
+        repeats(0)
+      , level(LC_LOG_NONE)
+      , tag(NULL)
+   {}
+
+   unsigned long long repeats;
+   LC_LogLevel level;
+   const LC_Tag* tag;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_Coalescer class collapses the consecutive repetitions of a record in a
+* sink into a "last message repeated N times" record. Records are compared by key():
+* a hash of the call site (with ENABLE_CODE_LOCATION), level, tag and rendered message,
+* never by comparing the text. The count is reported when a different record arrives,
+* and by the first repetition after LC_COALESCE_WINDOW ms, so that long runs show up
+* while they last; repetitions at the end of a run are reported by flush() or by the
+* next record. Disabled by default, see stdout_coalescer() and file_coalescer().
+*/
+class LC_Coalescer
+{
+public:
+   LC_Coalescer();
+   ~LC_Coalescer();
+
+   bool isEnabled() const;
+   void setEnabled(bool enabled);
+   void setWindow(unsigned int ms);
+
+   static unsigned long long key(const LC_Log& logger, const char* message, size_t length);
+   bool accept(const LC_Log& logger, unsigned long long key, LC_CoalescedRun& ended);
+   void flush(LC_CoalescedRun& ended);
+
+private:
+   LC_Coalescer(const LC_Coalescer&);
+   LC_Coalescer& operator =(const LC_Coalescer&);
+
+   typedef std::chrono::steady_clock Clock;
+
+   void end(LC_CoalescedRun& ended);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* coalescer);
+   static void unlockAfterFork(void* coalescer);
+#endif
+
+#ifndef LC_LOGGING_DISABLE_THREADING
+   std::atomic<bool> m_enabled;
 #else
-GENERATE_LEVEL_CUSTOM(critical, bool, return false)
-#endif // ENABLE_LOG_CRITICAL
+   bool m_enabled;
+#endif
+   LC_Mutex m_mutex;
+   Clock::duration m_window;
+   // The last record written, and the repetitions dropped since then.
+   unsigned long long m_key;
+   unsigned long long m_repeats;
+   LC_LogLevel m_level;
+   const LC_Tag* m_tag;
+   Clock::time_point m_start;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::LC_Coalescer
++-----------------------------------------------------------------------------*/
+inline LC_Coalescer::LC_Coalescer() :
+     m_enabled(false)
+   , m_window(std::chrono::milliseconds(LC_COALESCE_WINDOW))
+   , m_key(0)
+   , m_repeats(0)
+   , m_level(LC_LOG_NONE)
+   , m_tag(NULL)
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_Coalescer::lockForFork,
+                              &LC_Coalescer::unlockAfterFork,
+                              &LC_Coalescer::unlockAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::~LC_Coalescer
++-----------------------------------------------------------------------------*/
+inline LC_Coalescer::~LC_Coalescer()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::isEnabled
++-----------------------------------------------------------------------------*/
+inline bool LC_Coalescer::isEnabled() const
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   return m_enabled.load(std::memory_order_relaxed);
+#else
+   return m_enabled;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::setEnabled
++-----------------------------------------------------------------------------*/
+inline void LC_Coalescer::setEnabled(bool enabled)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_enabled = enabled;
+   m_key = 0;
+   m_repeats = 0;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::setWindow
++-----------------------------------------------------------------------------*/
+/**
+* @brief setWindow Sets how often the count of a run is reported while it lasts.
+*/
+inline void LC_Coalescer::setWindow(unsigned int ms)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_window = std::chrono::milliseconds(ms);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::key
++-----------------------------------------------------------------------------*/
+/**
+* @brief key Returns the key of logger, whose rendered message is the length bytes at
+* message. Records with equal keys are repetitions.
+*/
+inline unsigned long long LC_Coalescer::key(const LC_Log& logger, const char* message, size_t length)
+{
+   const struct {
+      const void* file;
+      const void* tag;
+      long long line;
+      long long level;
+   } site = { logger.m_file, logger.m_tag ? (const void*)logger.m_tag : (const void*)logger.m_log_tag,
+              logger.m_line, logger.m_level };
+   const unsigned long long h = lc_hash_bytes(&site, sizeof(site), 0);
+   // 0 is "no previous record".
+   return lc_hash_bytes(message, length, h) | 1;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::accept
++-----------------------------------------------------------------------------*/
+/**
+* @brief accept Returns false if the record with key repeats the previous one and is
+* not to be written. ended is set to the run to report before it, if any.
+*/
+inline bool LC_Coalescer::accept(const LC_Log& logger, unsigned long long key, LC_CoalescedRun& ended)
+{
+   ended.repeats = 0;
+
+   LC_MutexLocker locker(m_mutex);
+   if (key == m_key) {
+      m_repeats++;
+      if (Clock::now() - m_start >= m_window)
+         end(ended);
+      return false;
+   }
+
+   end(ended);
+   m_key = key;
+   m_level = logger.m_level;
+   m_tag = logger.m_tag;
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::flush
++-----------------------------------------------------------------------------*/
+/**
+* @brief flush Sets ended to the run of repetitions that was not reported yet.
+*/
+inline void LC_Coalescer::flush(LC_CoalescedRun& ended)
+{
+   ended.repeats = 0;
+
+   LC_MutexLocker locker(m_mutex);
+   end(ended);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::end
++-----------------------------------------------------------------------------*/
+inline void LC_Coalescer::end(LC_CoalescedRun& ended)
+{
+   if (m_repeats) {
+      ended.repeats = m_repeats;
+      ended.level = m_level;
+      ended.tag = m_tag;
+   }
+   m_repeats = 0;
+   m_start = Clock::now();
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_Coalescer::lockForFork(void* coalescer)
+{
+   static_cast<LC_Coalescer*>(coalescer)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Coalescer::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_Coalescer::unlockAfterFork(void* coalescer)
+{
+   static_cast<LC_Coalescer*>(coalescer)->m_mutex.unlock();
+}
+#endif
+
+/*------------------------------------------------------------------------------
+|    lc_format_args
++-----------------------------------------------------------------------------*/
+inline void lc_format_args(const LC_Layout* layout, std::string* out, const LC_Log* logger, int colors, ...)
+{
+   va_list args;
+   va_start(args, colors);
+   layout->format(*out, *logger, args, colors != 0);
+   va_end(args);
+}
+
+/*------------------------------------------------------------------------------
+|    lc_format_repeats
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_format_repeats Appends the "last message repeated N times" record of run
+* to out, formatted by layout, with the newline.
+*/
+inline void lc_format_repeats(const LC_Layout& layout, std::string& out, const LC_CoalescedRun& run, bool colors)
+{
+   char text[64];
+   snprintf(text, sizeof(text), "last message repeated %llu times", run.repeats);
+
+   LC_Log logger(run.tag ? run.tag->name() : NULL, run.level);
+   logger.m_tag = run.tag;
+   logger.m_string = text;
+   lc_format_args(&layout, &out, &logger, colors);
+   out.push_back('\n');
+}
+
+/*------------------------------------------------------------------------------
+|    lc_coalesce
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_coalesce Passes the record formatted in line to coalescer, message being
+* what %m wrote; the whole line is compared if the layout has no %m. Appends to
+* repeats the record reporting the run that ended, if any.
+* @return false if line is a repetition, not to be written.
+*/
+inline bool lc_coalesce(LC_Coalescer& coalescer, const LC_Layout& layout, const LC_Log& logger,
+                        const std::string& line, const std::pair<size_t, size_t>& message,
+                        std::string& repeats, bool colors)
+{
+   const bool found = message.second > message.first;
+   const unsigned long long key = LC_Coalescer::key(logger,
+                                                    line.data() + (found ? message.first : 0),
+                                                    found ? message.second - message.first : line.size());
+   LC_CoalescedRun ended;
+   const bool accepted = coalescer.accept(logger, key, ended);
+   if (ended.repeats)
+      lc_format_repeats(layout, repeats, ended, colors);
+   return accepted;
+}
+
+#ifndef LC_STDOUT_PATTERN
+#ifdef COLORING_ENABLED
+#define LC_STDOUT_PATTERN "%([%tag]: %)%(%L:\t%)%T.%ms <%t%(:%N%)> %c%([%loc] %)%m%r"
+#else
+#define LC_STDOUT_PATTERN "%([%loc] %)%m"
+#endif // COLORING_ENABLED
+#endif // LC_STDOUT_PATTERN
+
+#ifndef LC_FILE_PATTERN
+#define LC_FILE_PATTERN "%([%tag]: %)%T.%ms %(%L:\t %)<%t%(:%N%)> %([%loc] %)%m"
+#endif // LC_FILE_PATTERN
+
+/*------------------------------------------------------------------------------
+|    stdout_layout
++-----------------------------------------------------------------------------*/
+inline LC_Layout& stdout_layout()
+{
+   static LC_Layout layout(LC_STDOUT_PATTERN);
+   return layout;
+}
+
+/*------------------------------------------------------------------------------
+|    file_layout
++-----------------------------------------------------------------------------*/
+inline LC_Layout& file_layout()
+{
+   static LC_Layout layout(LC_FILE_PATTERN);
+   return layout;
+}
+
+/*------------------------------------------------------------------------------
+|    stdout_coalescer
++-----------------------------------------------------------------------------*/
+/**
+* @brief stdout_coalescer Collapses repetitions written by log_to_stdout(), when
+* enabled: stdout_coalescer().setEnabled(true).
+*/
+inline LC_Coalescer& stdout_coalescer()
+{
+   static LC_Coalescer coalescer;
+   return coalescer;
+}
+
+/*------------------------------------------------------------------------------
+|    file_coalescer
++-----------------------------------------------------------------------------*/
+/**
+* @brief file_coalescer Collapses repetitions written by log_to_file(), when enabled.
+*/
+inline LC_Coalescer& file_coalescer()
+{
+   static LC_Coalescer coalescer;
+   return coalescer;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_write_line
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_write_line Writes a whole record to f. On POSIX systems this is a single
+* write() on the descriptor: records from other threads or processes cannot end up in
+* the middle of it on files opened with O_APPEND, and on pipes up to PIPE_BUF bytes.
+* Anything still buffered in f is flushed before, to keep the order. Elsewhere it is
+* a single fwrite(), which holds the lock of f.
+* @return false if the line could not be written.
+*/
+inline bool lc_write_line(FILE* f, const std::string& line)
+{
+   LC_StageTimer timer(LC_STAGE_WRITE);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   fflush(f);
+
+   const int fd = fileno(f);
+   const char* data = line.data();
+   size_t size = line.size();
+   while (size) {
+      const ssize_t written = ::write(fd, data, size);
+      if (written < 0) {
+         if (errno == EINTR)
+            continue;
+         return false;
+      }
+      data += written;
+      size -= (size_t)written;
+   }
+   return true;
+#else
+   // I prefer to flush to avoid missing buffered logs in case of crash.
+   const bool written = fwrite(line.data(), 1, line.size(), f) == line.size();
+   return fflush(f) == 0 && written;
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+}
+
+/*------------------------------------------------------------------------------
+|    log_to_stdout
++-----------------------------------------------------------------------------*/
+inline void log_to_stdout(LC_Log& logger, va_list args)
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local std::string line;
+#else
+   static std::string line;
+#endif // LC_LOGGING_DISABLE_THREADING
+   line.clear();
+   FILE* stdOut = stdout;
+   if (logger.m_level == LC_LOG_ERROR || logger.m_level == LC_LOG_CRITICAL)
+      stdOut = stderr;
+
+   const bool colors = lc_colors_enabled(stdOut);
+   LC_Coalescer& coalescer = stdout_coalescer();
+   std::pair<size_t, size_t> message(0, 0);
+   stdout_layout().format(line, logger, args, colors, coalescer.isEnabled() ? &message : NULL);
+   if (LC_LIKELY(logger.m_nl))
+      line.push_back('\n');
+
+   if (LC_UNLIKELY(coalescer.isEnabled())) {
+      std::string repeats;
+      const bool accepted = lc_coalesce(coalescer, stdout_layout(), logger, line, message, repeats, colors);
+      if (!repeats.empty())
+         lc_write_line(stdOut, repeats);
+      if (!accepted)
+         return;
+   }
+
+   lc_metrics_write(LC_SINK_STDOUT, line.size(), lc_write_line(stdOut, line));
+}
+
+/*------------------------------------------------------------------------------
+|    log_flush_stdout
++-----------------------------------------------------------------------------*/
+/**
+* @brief log_flush_stdout Reports the repetitions held by stdout_coalescer().
+*/
+inline void log_flush_stdout()
+{
+   LC_CoalescedRun ended;
+   stdout_coalescer().flush(ended);
+   if (!ended.repeats)
+      return;
+
+   FILE* stdOut = (ended.level == LC_LOG_ERROR || ended.level == LC_LOG_CRITICAL) ? stderr : stdout;
+   std::string line;
+   lc_format_repeats(stdout_layout(), line, ended, lc_colors_enabled(stdOut));
+   lc_write_line(stdOut, line);
+}
+
+#ifndef CUSTOM_LOG_FILE
+#define CUSTOM_LOG_FILE "output.log"
+#endif
+
+/*------------------------------------------------------------------------------
+|    lc_log_file_path
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_log_file_path Returns CUSTOM_LOG_FILE with the first %p replaced by the
+* id of the process.
+*/
+inline std::string lc_log_file_path()
+{
+   std::string path = CUSTOM_LOG_FILE;
+   const size_t i = path.find("%p");
+   if (i != std::string::npos) {
+#if defined(_WIN32) || defined(_WIN32_WCE)
+      const unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+      const unsigned long pid = (unsigned long)getpid();
+#endif
+      char buffer[24];
+      snprintf(buffer, sizeof(buffer), "%lu", pid);
+      path.replace(i, 2, buffer);
+   }
+   return path;
+}
 
-#ifdef ENABLE_LOG_ERROR
-GENERATE_LEVEL(err, LC_LOG_ERROR, false)
-GENERATE_LEVEL_OBJC(err, LC_LOG_ERROR, NO)
-#ifdef ENABLE_CODE_LOCATION
-#define log_err_t_v(tag, format, args) \
-   log_location_t_v(f_log_err_t_v, tag, format, args)
-#define log_err_t(tag, format, ...) \
-   log_location_t(f_log_err_t, tag, format, ##__VA_ARGS__)
-#define log_err_v(format, args) \
-   log_location_v(f_log_err_v, format, args)
-#define log_err(format, ...) \
-   log_location(lightlogger::f_log_err, format, ##__VA_ARGS__)
-#endif // ENABLE_CODE_LOCATION
+/*------------------------------------------------------------------------------
+|    lc_open_log_file
++-----------------------------------------------------------------------------*/
+inline FILE* lc_open_log_file()
+{
+   const std::string path = lc_log_file_path();
+
+   // "a" opens with O_APPEND: every write() lands at the current end of the file,
+   // also when other processes append to it.
+#ifdef _MSC_VER
+   FILE* f = NULL;
+   if (errno_t err = fopen_s(&f, path.c_str(), "a"))
+      ::printf("Failed to open %s: %d,", path.c_str(), err);
+   return f;
 #else
-GENERATE_LEVEL_CUSTOM(err, bool, return false)
-#endif // ENABLE_LOG_ERROR
+   LC_ForkGuard::instance();
+   return fopen(path.c_str(), "a");
+#endif // _MSC_VER
+}
 
-#ifdef ENABLE_LOG_WARNING
-GENERATE_LEVEL(warn, LC_LOG_WARN, false)
-GENERATE_LEVEL_OBJC(warn, LC_LOG_WARN, NO)
-#ifdef ENABLE_CODE_LOCATION
-#define log_warn_t_v(tag, format, args) \
-   log_location_t_v(f_log_warn_t_v, tag, format, args)
-#define log_warn_t(tag, format, ...) \
-   log_location_t(f_log_warn_t, tag, format, ##__VA_ARGS__)
-#define log_warn_v(format, args) \
-   log_location_v(f_log_warn_v, format, args)
-#define log_warn(format, ...) \
-   log_location(lightlogger::f_log_warn, format, ##__VA_ARGS__)
-#endif // ENABLE_CODE_LOCATION
+/*------------------------------------------------------------------------------
+|    lc_default_log_file
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_default_log_file The file opened by file_stream(), also if it was replaced.
+*/
+inline FILE*& lc_default_log_file()
+{
+   static FILE* pStream = NULL;
+   return pStream;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Output2File::stream
++-----------------------------------------------------------------------------*/
+/**
+* @brief file_stream Returns the file used by log_to_file. It is opened on first use,
+* so it does not depend on the order of static initialization, and the
+* initialization is thread-safe. It can be replaced by assigning to it.
+*/
+inline FILE*& file_stream()
+{
+   static FILE* pStream = (lc_default_log_file() = lc_open_log_file());
+   return pStream;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_reopen_log_file
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_reopen_log_file Called in the child after fork(): if CUSTOM_LOG_FILE contains
+* %p, file_stream() is switched to the file of the new process. A file assigned to
+* file_stream() by the application is left alone.
+*/
+inline void lc_reopen_log_file()
+{
+   FILE*& opened = lc_default_log_file();
+   if (!opened || !strstr(CUSTOM_LOG_FILE, "%p"))
+      return;
+
+   FILE*& stream = file_stream();
+   if (stream != opened)
+      return;
+
+   fclose(opened);
+   opened = lc_open_log_file();
+   stream = opened;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Output2File::output
++-----------------------------------------------------------------------------*/
+inline void log_to_file(LC_Log& logger, va_list args)
+{
+   FILE* pStream = file_stream();
+   if (!pStream) {
+      lc_metrics_write(LC_SINK_FILE, 0, false, 0);
+      return;
+   }
+
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local std::string line;
 #else
-GENERATE_LEVEL_CUSTOM(warn, bool, return false)
-#endif // ENABLE_LOG_WARNING
+   static std::string line;
+#endif // LC_LOGGING_DISABLE_THREADING
+   line.clear();
+   LC_Coalescer& coalescer = file_coalescer();
+   std::pair<size_t, size_t> message(0, 0);
+   file_layout().format(line, logger, args, true, coalescer.isEnabled() ? &message : NULL);
+   line.push_back('\n');
+
+   if (LC_UNLIKELY(coalescer.isEnabled())) {
+      // The count goes in the same write as the record that ended the run.
+      std::string repeats;
+      if (!lc_coalesce(coalescer, file_layout(), logger, line, message, repeats, true)) {
+         if (!repeats.empty())
+            lc_write_line(pStream, repeats);
+         return;
+      }
+      if (!repeats.empty()) {
+         repeats.append(line);
+         line.swap(repeats);
+      }
+   }
 
-#ifdef ENABLE_LOG_INFORMATION
-GENERATE_LEVEL(info, LC_LOG_INFO, true)
-GENERATE_LEVEL_OBJC(info, LC_LOG_INFO, YES)
-#ifdef ENABLE_CODE_LOCATION
-#define log_info_t_v(tag, format, args) \
-   log_location_t_v(lightlogger::f_log_info_t_v, tag, format, args)
-#define log_info_t(tag, format, ...) \
-   log_location_t(lightlogger::f_log_info_t, tag, format, ##__VA_ARGS__)
-#define log_info_v(format, args) \
-   log_location_v(lightlogger::f_log_info_v, format, args)
-#define log_info(format, ...) \
-   log_location(lightlogger::f_log_info, format, ##__VA_ARGS__)
-#endif // ENABLE_CODE_LOCATION
+   lc_metrics_write(LC_SINK_FILE, line.size(), lc_write_line(pStream, line));
+}
 
 /*------------------------------------------------------------------------------
-|    log_formatted_t
+|    log_flush_file
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted_t_v(const char* log_tag, LC_LogAttrib a, LC_LogColor c, const char* format, va_list args)
+/**
+* @brief log_flush_file Reports the repetitions held by file_coalescer().
+*/
+inline void log_flush_file()
 {
-   LC_Log(log_tag, a, c).printf(format, args);
-   return true;
+   FILE* pStream = file_stream();
+   LC_CoalescedRun ended;
+   file_coalescer().flush(ended);
+   if (!pStream || !ended.repeats)
+      return;
+
+   std::string line;
+   lc_format_repeats(file_layout(), line, ended, true);
+   lc_write_line(pStream, line);
 }
 
+#ifdef ENABLE_MSVS_OUTPUT
+#include <memory>
 /*------------------------------------------------------------------------------
-|    log_formatted_t
+|    string_format
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted_t(const char* log_tag, LC_LogAttrib a, LC_LogColor c, const char* format, ...)
+inline std::string string_format(const std::string fmt_str, va_list ap)
 {
-   VA_LIST_CONTEXT(format, LC_Log(log_tag, a, c).printf(format, args));
-   return true;
+	size_t final_n, n = fmt_str.size() * 2;
+	std::string str;
+	std::unique_ptr<char[]> formatted;
+	while (1) {
+		formatted.reset(new char[n]);
+		strcpy_s(&formatted[0], n, fmt_str.c_str());
+		final_n = vsnprintf_s(&formatted[0], n, n - 1, fmt_str.c_str(), ap);
+		if (final_n < 0 || final_n >= n)
+			n += abs((long long)(final_n - n + 1));
+		else
+			break;
+	}
+	return std::string(formatted.get());
 }
 
 /*------------------------------------------------------------------------------
-|    log_formatted_v
+|    msvs_layout
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted_v(LC_LogAttrib a, LC_LogColor c, const char* format, va_list args)
+inline LC_Layout& msvs_layout()
 {
-   LC_Log(LOG_TAG, a, c).printf(format, args);
-   return true;
+   static LC_Layout layout(LC_FILE_PATTERN);
+   return layout;
 }
 
 /*------------------------------------------------------------------------------
-|    log_formatted
+|    LC_Output2MSVS::printf
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted(LC_LogAttrib a, LC_LogColor c, const char* format, ...)
+inline void log_to_msvs(LC_Log& logger, va_list args)
 {
-   VA_LIST_CONTEXT(format, LC_Log(LOG_TAG, a, c).printf(format, args));
-   return true;
+   std::string final;
+   msvs_layout().format(final, logger, args);
+   final.append("\n");
+
+   OutputDebugStringA(final.c_str());
 }
+#endif // ENABLE_MSVS_OUTPUT
 
+#ifdef __ANDROID__
 /*------------------------------------------------------------------------------
-|    log_formatted
+|    LC_OutputAndroid::printf
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted(LC_LogColor c, const char* format, ...)
+inline void log_to_logcat(LC_Log& logger, va_list args)
 {
-   VA_LIST_CONTEXT(format, LC_Log(LOG_TAG, LC_LOG_ATTR_RESET, c).printf(format, args));
-   return true;
+   static const android_LogPriority android_logPriority [] = {
+      // Do not mess with the order. Must map the LC_LogLevel enum.
+      ANDROID_LOG_FATAL,
+      ANDROID_LOG_ERROR,
+      ANDROID_LOG_WARN,
+      ANDROID_LOG_INFO,
+      ANDROID_LOG_VERBOSE,
+      ANDROID_LOG_DEBUG
+   };
+
+   android_LogPriority p = (logger.m_level > 5 || logger.m_level < 0) ? ANDROID_LOG_INFO : android_logPriority[logger.m_level];
+   __android_log_vprint(
+      p,
+      logger.m_log_tag,
+      logger.m_string.c_str(),
+      args);
 }
+#endif // __ANDROID__
 
-#if defined(__APPLE__) && __OBJC__ == 1
+#ifdef XCODE_COLORING_ENABLED
 /*------------------------------------------------------------------------------
-|    log_formatted_t
+|    LC_Output2XCodeColors::printf
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted_t(const char* log_tag, LC_LogAttrib a, LC_LogColor c, NSString* format, va_list args)
+inline void log_to_xcodecolors(LC_Log& logger, va_list args)
 {
-   LC_Log(log_tag, a, c).printf(format, args);
-   return YES;
+#define XC_COL_ESC_MAC @"\033["
+#define XC_COL_ESC_IOS @"\xC2\xA0["
+
+#define XC_COL_ESC XC_COL_ESC_MAC
+
+#define XC_COL_RESET_FG XC_COL_ESC @"fg;" // Clear any foreground color
+#define XC_COL_RESET_BG XC_COL_ESC @"bg;" // Clear any background color
+#define XC_COL_RESET XC_COL_ESC @";"      // Clear any foreground or background color
+
+   std::string final = logger.m_string.str();
+   logger.prependHeader(final);
+   logger.prependLogTagIfNeeded(final);
+
+   const NSString* colorCode;
+   if (logger.m_level == LC_LOG_NONE)
+      colorCode = lc_xc_col((int)logger.m_color);
+   else
+      colorCode = getColorForLevel(logger.m_level);
+
+   NSString* s;
+#ifdef XCODE_COLORING_ENABLED
+   //if (checkEnv())
+      s = [NSString stringWithFormat : XC_COL_ESC @"%@%s" XC_COL_RESET @"\n", colorCode, final.c_str()];
+#else
+   //else
+      s = [NSString stringWithFormat : @"%s\n", final.c_str()];
+#endif // XCODE_COLORING_ENABLED
+
+   ::printf("%s", [s cStringUsingEncoding : NSUTF8StringEncoding]);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_Output2XCodeColors::checkEnv
++-----------------------------------------------------------------------------*/
+inline bool LC_Output2XCodeColors::checkEnv()
+{
+   static bool checkPerformed = false;
+   static bool available = true;
+   if (checkPerformed)
+      return available;
+
+#define XCODE_COLORS "XcodeColors"
+
+   char* xcode_colors = getenv(XCODE_COLORS);
+   if (!(xcode_colors && (strcmp(xcode_colors, "YES") == 0))) {
+      NSLog(@"XCodeColors not available.");
+      checkPerformed = true;
+      available = false;
+   }
+
+   return available;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_OutputXCodeColors::getColorForLevel
++-----------------------------------------------------------------------------*/
+inline NSString* LC_Output2XCodeColors::getColorForLevel(LC_LogLevel level)
+{
+   switch (level) {
+   case LC_LOG_VERBOSE:
+      return @"fg0,0,0;";   // Black here. XCode is commonly on light bg.
+   case LC_LOG_DEBUG:
+      return @"fg0,0,255;";
+   case LC_LOG_INFO:
+      return @"fg34,139,34;";
+   case LC_LOG_NONE:
+      return @"fg0,0,0;";
+   case LC_LOG_WARN:
+      return @"fg255,165,0;";
+   case LC_LOG_ERROR:
+      return @"fg255,0,0;";
+   case LC_LOG_CRITICAL:
+      return @"fg255,0,0;";
+   default:
+      return @"fg0,0,255;";
+   }
+
+   return nil;
+}
+#endif // XCODE_COLORING_ENABLED
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+inline int gettimeofday(struct ::timeval * tp, struct timezone * tzp)
+{
+    (void)tzp;
+
+    // Note: some broken versions only have 8 trailing zero's, the correct epoch has 9 trailing zero's
+    // This magic number is the number of 100 nanosecond intervals since January 1, 1601 (UTC)
+    // until 00:00:00 January 1, 1970
+    static const uint64_t EPOCH = ((uint64_t) 116444736000000000ULL);
+
+    SYSTEMTIME  system_time;
+    FILETIME    file_time;
+    uint64_t    time;
+
+    GetSystemTime( &system_time );
+    SystemTimeToFileTime( &system_time, &file_time );
+    time =  ((uint64_t)file_time.dwLowDateTime )      ;
+    time += ((uint64_t)file_time.dwHighDateTime) << 32;
+
+    tp->tv_sec  = (long) ((time - EPOCH) / 10000000L);
+    tp->tv_usec = (long) (system_time.wMilliseconds * 1000);
+    return 0;
 }
+#else
+#include <sys/time.h>
+#endif // WIN32
 
 /*------------------------------------------------------------------------------
-|    log_formatted
+|    lc_current_time
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted_t(const char* log_tag, LC_LogAttrib a, LC_LogColor c, NSString* format, ...)
+inline std::string lc_current_time()
 {
-   VA_LIST_CONTEXT(format, LC_Log(log_tag, a, c).printf(format, args));
-   return YES;
+   // Seconds and milliseconds from the same sample.
+   struct timeval tv;
+   gettimeofday(&tv, 0);
+   struct tm timeinfo;
+   lc_local_time((time_t)tv.tv_sec, timeinfo);
+
+   char result[100] = { 0 };
+   std::snprintf(result, 100, "%02d:%02d:%02d.%03ld", timeinfo.tm_hour, timeinfo.tm_min,
+                 timeinfo.tm_sec, (long) tv.tv_usec / 1000);
+
+   return result;
 }
 
 /*------------------------------------------------------------------------------
-|    log_formatted
+|    lc_thread_id_storage
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted(LC_LogAttrib a, LC_LogColor c, NSString* format, ...)
+inline unsigned long long& lc_thread_id_storage()
 {
-   VA_LIST_CONTEXT(format, log_formatted_t(LOG_TAG, a, c, format, args));
-   return YES;
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local unsigned long long tid = 0;
+#else
+   static unsigned long long tid = 0;
+#endif // LC_LOGGING_DISABLE_THREADING
+   return tid;
 }
 
 /*------------------------------------------------------------------------------
-|    log_formatted
+|    lc_thread_id
 +-----------------------------------------------------------------------------*/
-inline bool log_formatted(LC_LogColor c, NSString* format, ...)
+/**
+* @brief lc_thread_id Returns the id the OS uses for the calling thread (the one shown
+* by top, gdb or the debugger). It is cached per thread after the first call.
+*/
+inline unsigned long long lc_thread_id()
 {
-   VA_LIST_CONTEXT(format, log_formatted_t(LOG_TAG, LC_LOG_ATTR_RESET, c, format, args));
-   return YES;
-}
-#endif // defined(__APPLE__) && __OBJC__ == 1
-#else
-GENERATE_LEVEL_CUSTOM(info, bool, return true)
-inline bool log_formatted_t_v(...) { return true; }
-inline bool log_formatted_t(...)   { return true; }
-inline bool log_formatted_v(...)   { return true; }
-inline bool log_formatted(...)     { return true; }
-#endif // ENABLE_LOG_INFORMATION
+   unsigned long long& tid = lc_thread_id_storage();
+   if (LC_LIKELY(tid))
+      return tid;
 
-#ifdef ENABLE_LOG_VERBOSE
-GENERATE_LEVEL(verbose, LC_LOG_VERBOSE, true)
-GENERATE_LEVEL_OBJC(verbose, LC_LOG_VERBOSE, YES)
-#ifdef ENABLE_CODE_LOCATION
-#define log_verbose_t_v(tag, format, args) \
-   log_location_t_v(f_log_verbose_t_v, tag, format, args)
-#define log_verbose_t(tag, format, ...) \
-   log_location_t(f_log_verbose_t, tag, format, ##__VA_ARGS__)
-#define log_verbose_v(format, args) \
-   log_location_v(f_log_verbose_v, format, args)
-#define log_verbose(format, ...) \
-   log_location(f_log_verbose, format, ##__VA_ARGS__)
-#endif // ENABLE_CODE_LOCATION
-#else
-GENERATE_LEVEL_CUSTOM(verbose, bool, return true)
-#endif // ENABLE_LOG_VERBOSE
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   // The thread that calls fork() has a different id in the child.
+   LC_ForkGuard::instance();
+#endif
 
-#ifdef ENABLE_LOG_DEBUG
-GENERATE_LEVEL(debug, LC_LOG_DEBUG, true)
-GENERATE_LEVEL_OBJC(debug, LC_LOG_DEBUG, YES)
-#ifdef ENABLE_CODE_LOCATION
-#define log_debug_t_v(tag, format, args) \
-   log_location_t_v(f_log_debug_t_v, tag, format, args)
-#define log_debug_t(tag, format, ...) \
-   log_location_t(f_log_debug_t, tag, format, ##__VA_ARGS__)
-#define log_debug_v(format, args) \
-   log_location_v(f_log_debug_v, format, args)
-#define log_debug(format, ...) \
-   log_location(f_log_debug, format, ##__VA_ARGS__)
-#endif // ENABLE_CODE_LOCATION
+#if defined(_WIN32) || defined(_WIN32_WCE)
+   tid = (unsigned long long)GetCurrentThreadId();
+#elif defined(__ANDROID__)
+   tid = (unsigned long long)gettid();
+#elif defined(__linux__)
+   tid = (unsigned long long)syscall(SYS_gettid);
+#elif defined(__APPLE__)
+   uint64_t id = 0;
+   pthread_threadid_np(NULL, &id);
+   tid = (unsigned long long)id;
 #else
-GENERATE_LEVEL_CUSTOM(debug, bool, return true)
-#endif // ENABLE_LOG_DEBUG
-
-GENERATE_LEVEL_CUSTOM(disabled, bool, return true)
-
-#if defined(__APPLE__) && __OBJC__ == 1
-/*------------------------------------------------------------------------------
-|    log_disabled_t_v
-+-----------------------------------------------------------------------------*/
-inline bool log_disabled_t_v(const char* log_tag, NSString* format, va_list args)
-{
-   LOG_UNUSED(log_tag);
-   LOG_UNUSED(format);
-   LOG_UNUSED(args);
-
-   return true;
+   tid = 1;
+#endif
+   return tid;
 }
 
 /*------------------------------------------------------------------------------
-|    log_disabled_t
+|    lc_reset_thread_id
 +-----------------------------------------------------------------------------*/
-inline bool log_disabled_t(const char* log_tag, NSString* format, ...)
+/**
+* @brief lc_reset_thread_id Forgets the id cached for the calling thread.
+*/
+inline void lc_reset_thread_id()
 {
-   LOG_UNUSED(log_tag);
-   LOG_UNUSED(format);
-
-   return true;
+   lc_thread_id_storage() = 0;
 }
 
 /*------------------------------------------------------------------------------
-|    log_disabled_v
+|    lc_thread_name_storage
 +-----------------------------------------------------------------------------*/
-inline bool log_disabled_v(NSString* format, va_list args)
+struct LC_ThreadName
 {
-   LOG_UNUSED(format);
-   LOG_UNUSED(args);
+   bool resolved;
+   char name[64];
+};
 
-   return true;
+inline LC_ThreadName& lc_thread_name_storage()
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local LC_ThreadName storage = { false, { 0 } };
+#else
+   static LC_ThreadName storage = { false, { 0 } };
+#endif // LC_LOGGING_DISABLE_THREADING
+   return storage;
 }
 
 /*------------------------------------------------------------------------------
-|    log_disabled
+|    lc_set_thread_name
 +-----------------------------------------------------------------------------*/
-inline bool log_disabled(NSString* format, ...)
+/**
+* @brief lc_set_thread_name Sets the name logged for the calling thread (truncated to
+* 63 bytes). NULL forgets it: it is looked up again on the next record.
+*/
+inline void lc_set_thread_name(const char* name)
 {
-   LOG_UNUSED(format);
-
-   return true;
+   LC_ThreadName& storage = lc_thread_name_storage();
+   storage.resolved = (name != NULL);
+   storage.name[0] = 0;
+   if (name) {
+      strncpy(storage.name, name, sizeof(storage.name) - 1);
+      storage.name[sizeof(storage.name) - 1] = 0;
+   }
 }
-#endif // defined(__APPLE__) && __OBJC__ == 1
-
-// Convenience macros. The same as using the inlined functions.
-#ifdef __GNUC__
-#define LOG_CRITICAL(tag, f, ...) \
-   log_critical_t(tag, f, ##__VA_ARGS__)
-#define LOG_ERROR(tag, f, ...) \
-   log_err_t(tag, f, ##__VA_ARGS__)
-#define LOG_WARNING(tag, f, ...) \
-   log_warn_t(tag, f, ##__VA_ARGS__)
-#define LOG_INFORMATION(tag, f, ...) \
-   log_info_t(tag, f, ##__VA_ARGS__)
-#define LOG_VERBOSE(tag, f, ...) \
-   log_verbose_t(tag, f, ##__VA_ARGS__)
-#define LOG_DEBUG(tag, f, ...) \
-   log_debug_t(tag, f, ##__VA_ARGS__)
-#endif
-
-#define log_func \
-   lightlogger::log_debug("Entering: %s.", __PRETTY_FUNCTION__)
-#define log_info_func \
-   lightlogger::log_info("Entering: %s.", __PRETTY_FUNCTION__)
-#define log_verbose_func \
-   lightlogger::log_verbose("Entering: %s.", __PRETTY_FUNCTION__)
-#define log_debug_func \
-   lightlogger::log_debug("Entering: %s.", __PRETTY_FUNCTION__)
-
-/* Unfortunately backtrace() is not supported by Bionic */
-#if !defined(__ANDROID__) && (defined(__linux__) || defined(_WIN32) || defined(_WIN32_WCE))
 
-#ifdef __linux__
 /*------------------------------------------------------------------------------
-|    log_stacktrace
+|    lc_thread_name
 +-----------------------------------------------------------------------------*/
 /**
-* Prints a demangled stack backtrace of the caller function. Remember to build adding the
-* flag -rdynamic.
-*
-* @param log_tag The log tag to be placed in the log line.
-* @param level The log level of the log.
-* @param max_frames The maximum number of lines of stack trace to log.
+* @brief lc_thread_name Returns the name of the calling thread, or an empty string.
+* Unless set with lc_set_thread_name(), it is the objectName() of the current QThread
+* in Qt applications. It is looked up on the first record of each thread only: name
+* QThreads before they log, or call lc_set_thread_name(NULL) after renaming them.
 */
-inline void log_stacktrace(const char* log_tag, LC_LogLevel level, unsigned int max_frames)
+inline const char* lc_thread_name()
 {
-   std::stringstream stream;
-   stream << std::endl;
-
-   // storage array for stack trace address data
-   void* addrlist[max_frames + 1];
-
-   // retrieve current stack addresses
-   int addrlen = backtrace(addrlist, (int)(sizeof(addrlist) / sizeof(void*)));
-
-   if (addrlen == 0) {
-      stream << "<empty, possibly corrupt>";
-      LC_Log(log_tag, level).printf("%s", stream.str().c_str());
-      return;
-   }
+   LC_ThreadName& storage = lc_thread_name_storage();
+   if (LC_LIKELY(storage.resolved))
+      return storage.name;
 
-   // resolve addresses into strings containing "filename(function+address)",
-   // this array must be free()-ed
-   char** symbollist = backtrace_symbols(addrlist, addrlen);
-
-   // allocate string which will be filled with the demangled function name
-   size_t funcnamesize = 256;
-   char* funcname = (char*) malloc(funcnamesize);
-
-   // iterate over the returned symbol lines. skip the first, it is the
-   // address of this function.
-   for (int i = 1; i < addrlen; i++) {
-      char* begin_name = 0, *begin_offset = 0, *end_offset = 0;
-
-      // find parentheses and +address offset surrounding the mangled name:
-      // ./module(function+0x15c) [0x8048a6d]
-      for (char* p = symbollist[i]; *p; ++p) {
-         if (*p == '(')
-            begin_name = p;
-         else if (*p == '+')
-            begin_offset = p;
-         else if (*p == ')' && begin_offset) {
-            end_offset = p;
-            break;
-         }
-      }
-
-      if (begin_name && begin_offset && end_offset && begin_name < begin_offset) {
-         *begin_name++ = '\0';
-         *begin_offset++ = '\0';
-         *end_offset = '\0';
-
-         // mangled name is now in [begin_name, begin_offset) and caller
-         // offset in [begin_offset, end_offset). now apply
-         // __cxa_demangle():
-
-         int status;
-         char* ret = abi::__cxa_demangle(
-            begin_name,
-            funcname, &funcnamesize, &status);
-         if (status == 0) {
-            funcname = ret; // use possibly realloc()-ed string
-            stream << "  " << symbollist[i] << ": "
-               << funcname << "+" << begin_offset << std::endl;
-         }
-         else
-            // demangling failed. Output function name as a C function with
-            // no arguments.
-            stream << "  " << symbollist[i] << ": "
-            << begin_name << "()+" << begin_offset << std::endl;
-      }
-      else
-         // couldn't parse the line? print the whole line.
-         stream << "  " << symbollist[i] << std::endl;
+   storage.resolved = true;
+#ifdef QT_CORE_LIB
+   if (QThread* thread = QThread::currentThread()) {
+      const QByteArray name = thread->objectName().toUtf8();
+      strncpy(storage.name, name.constData(), sizeof(storage.name) - 1);
+      storage.name[sizeof(storage.name) - 1] = 0;
    }
+#endif // QT_CORE_LIB
+   return storage.name;
+}
 
-   LC_Log(log_tag, level).printf("%s", stream.str().c_str());
+#ifdef QT_CORE_LIB
+#include <QtGlobal>
+#include <QString>
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 2, 0))
+#include <QLoggingCategory>
+#endif
 
-   free(funcname);
-   free(symbollist);
-}
-#else
 /*------------------------------------------------------------------------------
-|    log_stacktrace
+|    lc_qt_level
 +-----------------------------------------------------------------------------*/
-inline void log_stacktrace(const char* log_tag, LC_LogLevel level, unsigned int max_frames)
+inline LC_LogLevel lc_qt_level(QtMsgType type)
 {
-   unsigned int i;
-   void* stack = malloc(sizeof(void*) *max_frames);
-   unsigned short frames;
-   SYMBOL_INFO* symbol;
-   HANDLE process;
-
-   process = GetCurrentProcess();
-
-   SymInitialize(process, NULL, TRUE);
-
-   frames = CaptureStackBackTrace(0, max_frames, (PVOID*) stack, NULL);
-   symbol = (SYMBOL_INFO*) calloc(sizeof(SYMBOL_INFO) + 256 * sizeof(char) , 1);
-   symbol->MaxNameLen = 255;
-   symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
-
-   LC_Log logger(log_tag, level);
-   logger.stream() << std::endl;
-   for (i = 0; i < frames; i++) {
-      // intptr_t should be guaranteed to be able to keep a pointer on any
-      // platform. Anyway... anything can happen on Win :-(
-      DWORD64 addr = (DWORD64) (*(((intptr_t*) stack + i)));
-      SymFromAddr(process, addr, 0, symbol);
-      logger.stream() << (frames - i - 1) << ": "
-         << symbol->Name << " 0x" << (void*) symbol->Address << std::endl;
+   switch (type) {
+   case QtDebugMsg:
+      return LC_LOG_VERBOSE;
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
+   case QtInfoMsg:
+      return LC_LOG_INFO;
+#endif
+   case QtWarningMsg:
+      return LC_LOG_WARN;
+   case QtCriticalMsg:
+      return LC_LOG_ERROR;
+   case QtFatalMsg:
+      return LC_LOG_CRITICAL;
    }
-
-   free(symbol);
-   free(stack);
+   return LC_LOG_NONE;
 }
-#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
 
 /*------------------------------------------------------------------------------
-|    log_stacktrace
+|    lc_qt_accepts
 +-----------------------------------------------------------------------------*/
-inline void log_stacktrace(LC_LogLevel level, unsigned int max_frames)
+/**
+ * @brief lc_qt_accepts Returns true if a record of tag with level would be printed
+ * or recorded, so that Qt strings are not converted for nothing.
+ */
+inline bool lc_qt_accepts(const char* tag, LC_LogLevel level)
 {
-   log_stacktrace(LOG_TAG, level, max_frames);
+#ifdef ENABLE_FLIGHT_RECORDER
+   if (LC_FlightRecorder::instance().accepts(level))
+      return true;
+#endif // ENABLE_FLIGHT_RECORDER
+   if (!LC_Log::isOutputEnabled(level))
+      return false;
+
+   const LC_Tag* interned = LC_TagRegistry::intern(tag);
+   return !interned || level == LC_LOG_NONE || level <= interned->level();
 }
 
 /*------------------------------------------------------------------------------
-|    log_stacktrace
+|    lc_qt_log
 +-----------------------------------------------------------------------------*/
-inline void log_stacktrace(unsigned int max_frames)
+/**
+ * @brief lc_qt_log Logs s with logger. s is converted to UTF-8 in a buffer of the
+ * thread and logged as text, so '%' is not a conversion.
+ */
+inline void lc_qt_log(LC_Log& logger, const QString& s)
 {
-   log_stacktrace(LOG_TAG, LC_LOG_DEBUG, max_frames);
+   LC_RecordSlot* slot = LC_RecordPool::acquire();
+   slot->text.clear();
+   lc_append_utf16(slot->text, reinterpret_cast<const unsigned short*>(s.constData()), (size_t)s.size());
+   logger.printf("%s", slot->text.c_str());
+   LC_RecordPool::release(slot);
 }
 
 /*------------------------------------------------------------------------------
-|    log_stacktrace
+|    lc_qt_message
 +-----------------------------------------------------------------------------*/
-inline void log_stacktrace(const char* log_tag, unsigned int max_frames)
+/**
+ * @brief lc_qt_message Logs the Qt message s with tag. Messages that would not be
+ * printed nor recorded are dropped before s is converted; the default category is
+ * checked as QLoggingCategory::defaultCategory() says. The location of the context is
+ * set when Qt provides it (debug builds or QT_MESSAGELOGCONTEXT).
+ */
+inline void lc_qt_message(QtMsgType type, const QMessageLogContext& c, const QString& s, const char* tag)
 {
-   log_stacktrace(log_tag, LC_LOG_DEBUG, max_frames);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 2, 0))
+   if (c.category && !strcmp(c.category, "default"))
+      if (QLoggingCategory* category = QLoggingCategory::defaultCategory())
+         if (!category->isEnabled(type))
+            return;
+#endif
+
+   const LC_LogLevel level = lc_qt_level(type);
+   if (!lc_qt_accepts(tag, level))
+      return;
+
+   LC_Log logger(tag, level);
+   if (c.file)
+      logger.setLocation(c.file, c.line, c.function);
+   lc_qt_log(logger, s);
 }
-#endif // !defined(__ANDROID__) && (!defined(WINVER) || WINVER < 0x0602)
 
 /*------------------------------------------------------------------------------
-|    LC_Log::LC_Log
+|    log_handler
 +-----------------------------------------------------------------------------*/
-inline LC_Log::LC_Log(LC_LogColor color, bool nl) :
-    m_level(LC_LOG_NONE)
-  , m_log_tag(LOG_TAG)
-  , m_attrib(LC_LOG_ATTR_RESET)
-  , m_color(color)
-  , m_background(LC_BACK_COL_DEFAULT)
-  , m_nl(nl)
+/**
+ * @brief log_handler Function to handle Qt debugging output.
+ * @param type
+ * @param msg
+ */
+inline
+void log_handler(QtMsgType type, const QMessageLogContext& c, const QString& s)
 {
-   // Do nothing.
+   lc_qt_message(type, c, s, LOG_TAG);
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::LC_Log
+|    log_handler_with_category
 +-----------------------------------------------------------------------------*/
-inline LC_Log::LC_Log(const char* log_tag, LC_LogLevel level, bool nl) :
-    m_level(level)
-  , m_log_tag(log_tag)
-  , m_attrib(LC_LOG_ATTR_RESET)
-  , m_color(get_color_for_level(level))
-  , m_background(LC_BACK_COL_DEFAULT)
-  , m_nl(nl)
+/**
+ * @brief log_handler Function to handle Qt debugging output including the category.
+ * @param type
+ * @param msg
+ */
+inline
+void log_handler_with_category(QtMsgType type, const QMessageLogContext& c, const QString& s)
 {
-   // Do nothing.
+   lc_qt_message(type, c, s, c.category);
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::LC_Log
+|    LC_QtStream class
 +-----------------------------------------------------------------------------*/
-inline LC_Log::LC_Log(const char *log_tag, bool nl) :
-    m_level(LC_LOG_INFO)
-  , m_log_tag(log_tag)
-  , m_attrib(LC_LOG_ATTR_RESET)
-  , m_color(get_color_for_level(LC_LOG_INFO))
-  , m_background(LC_BACK_COL_DEFAULT)
-  , m_nl(nl)
+/**
+ * @brief The LC_QtStream class is the stream of a record for Qt types, returned by
+ * LC_Log::qstream(): logger.qstream() << QStringLiteral("size:") << size.
+ * QString is converted into the buffer of the record, QByteArray is copied as it is,
+ * and QVariant, QPoint, QPointF, QSize, QRect and QDateTime are written without
+ * building a QString. Nothing is converted if the record is disabled. Other values
+ * and manipulators go to LC_Log::stream().
+ */
+class LC_QtStream
 {
-    // Do nothing.
-}
+public:
+   explicit LC_QtStream(LC_Log& logger);
+
+   LC_QtStream& operator <<(const QString& s);
+   LC_QtStream& operator <<(QLatin1String s);
+   LC_QtStream& operator <<(QChar c);
+   LC_QtStream& operator <<(const QByteArray& s);
+   LC_QtStream& operator <<(const QVariant& value);
+   LC_QtStream& operator <<(const QPoint& p);
+   LC_QtStream& operator <<(const QPointF& p);
+   LC_QtStream& operator <<(const QSize& s);
+   LC_QtStream& operator <<(const QRect& r);
+   LC_QtStream& operator <<(const QDateTime& t);
+   LC_QtStream& operator <<(std::ostream& (*manipulator)(std::ostream&));
+   template<typename T>
+   LC_QtStream& operator <<(const T& value);
+
+private:
+   void appendNumber(long long value, int digits = 1);
+
+   // NULL if the record is disabled.
+   LC_RecordSlot* m_slot;
+};
 
 /*------------------------------------------------------------------------------
-|    LC_Log::LC_Log
+|    LC_QtStream::LC_QtStream
 +-----------------------------------------------------------------------------*/
-inline LC_Log::LC_Log(LC_LogLevel level, bool nl) :
-    m_level(level)
-  , m_log_tag(LOG_TAG)
-  , m_attrib(LC_LOG_ATTR_RESET)
-  , m_color(get_color_for_level(level))
-  , m_background(LC_BACK_COL_DEFAULT)
-  , m_nl(nl)
+inline LC_QtStream::LC_QtStream(LC_Log& logger) :
+   m_slot(NULL)
 {
-   // Do nothing.
+   if (!logger.isEnabled())
+      return;
+
+   logger.stream();
+   m_slot = logger.m_streamSlot;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::LC_Log
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline LC_Log::LC_Log(const char* log_tag, LC_LogAttrib attrib, LC_LogColor color, bool nl) :
-    m_level(LC_LOG_NONE)
-  , m_log_tag(log_tag)
-  , m_attrib(attrib)
-  , m_color(color)
-  , m_background(LC_BACK_COL_DEFAULT)
-  , m_nl(nl)
+inline LC_QtStream& LC_QtStream::operator <<(const QString& s)
 {
-    // Do nothing.
+   if (m_slot)
+      lc_append_utf16(m_slot->text, reinterpret_cast<const unsigned short*>(s.constData()), (size_t)s.size());
+   return *this;
 }
 
-inline LC_Log::LC_Log(const char* log_tag, LC_LogAttrib attrib, LC_LogColor color, LC_BackColor foreground, bool nl) :
-    m_level(LC_LOG_NONE)
-  , m_log_tag(log_tag)
-  , m_attrib(attrib)
-  , m_color(color)
-    , m_background(foreground)
-  , m_nl(nl)
+/*------------------------------------------------------------------------------
+|    LC_QtStream::operator <<
++-----------------------------------------------------------------------------*/
+inline LC_QtStream& LC_QtStream::operator <<(QLatin1String s)
 {
-    // Do nothing.
+   if (!m_slot)
+      return *this;
+
+   // Latin-1 is UTF-16 narrowed: widen the bytes above 0x7F.
+   for (int i = 0; i < s.size(); i++) {
+      const unsigned char c = (unsigned char)s.data()[i];
+      if (c < 0x80)
+         m_slot->text.push_back((char)c);
+      else {
+         m_slot->text.push_back((char)(0xC0 | (c >> 6)));
+         m_slot->text.push_back((char)(0x80 | (c & 0x3F)));
+      }
+   }
+   return *this;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::appendHeader
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline void LC_Log::prependHeader(std::string& s)
+inline LC_QtStream& LC_QtStream::operator <<(QChar c)
 {
-   if (LC_LIKELY(m_level != LC_LOG_NONE))
-      s.insert(0, toString(m_level) + ":\t ");
-   s.insert(0, lc_current_time() + " ");
+   if (m_slot)
+      lc_append_utf16(m_slot->text, reinterpret_cast<const unsigned short*>(&c), 1);
+   return *this;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::appendlog_tagIfNeeded
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline void LC_Log::prependLogTagIfNeeded(std::string& s)
+inline LC_QtStream& LC_QtStream::operator <<(const QByteArray& s)
 {
-   if (m_log_tag)
-      s.insert(0, std::string("[") + std::string(m_log_tag) + std::string("]: "));
+   if (m_slot)
+      m_slot->text.append(s.constData(), (size_t)s.size());
+   return *this;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::printf
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline void LC_Log::printf(const char* format, ...)
+/**
+ * @brief operator << Writes the types above and the numbers held by value without
+ * QVariant::toString(), which is used for the other types.
+ */
+inline LC_QtStream& LC_QtStream::operator <<(const QVariant& value)
 {
-   if (LC_LIKELY(m_level != LC_LOG_NONE)) {
-#ifdef BUILD_LOG_LEVEL_DEBUG
-      // Always return a valid stream.
-#elif defined(BUILD_LOG_LEVEL_VERBOSE)
-      if (m_level > LC_LOG_VERBOSE)
-         return;
-#elif defined(BUILD_LOG_LEVEL_INFORMATION)
-      if (m_level > LC_LOG_INFO)
-         return;
-#elif defined(BUILD_LOG_LEVEL_WARNING)
-      if (m_level > LC_LOG_WARN)
-         return;
-#elif defined(BUILD_LOG_LEVEL_ERROR)
-      if (m_level > LC_LOG_ERROR)
-         return;
-#elif defined(BUILD_LOG_LEVEL_CRITICAL)
-      if (m_level > LC_LOG_CRITICAL)
-         return;
-#endif
+   if (!m_slot)
+      return *this;
+
+   switch (value.userType()) {
+   case QMetaType::QString:
+      return *this << *static_cast<const QString*>(value.constData());
+   case QMetaType::QByteArray:
+      return *this << *static_cast<const QByteArray*>(value.constData());
+   case QMetaType::Bool:
+      m_slot->text.append(value.toBool() ? "true" : "false");
+      return *this;
+   case QMetaType::Int:
+   case QMetaType::LongLong:
+   case QMetaType::Short:
+   case QMetaType::Long:
+      m_slot->stream << value.toLongLong();
+      return *this;
+   case QMetaType::UInt:
+   case QMetaType::ULongLong:
+   case QMetaType::UShort:
+   case QMetaType::ULong:
+      m_slot->stream << value.toULongLong();
+      return *this;
+   case QMetaType::Float:
+   case QMetaType::Double:
+      m_slot->stream << value.toDouble();
+      return *this;
+   case QMetaType::QPoint:
+      return *this << *static_cast<const QPoint*>(value.constData());
+   case QMetaType::QPointF:
+      return *this << *static_cast<const QPointF*>(value.constData());
+   case QMetaType::QSize:
+      return *this << *static_cast<const QSize*>(value.constData());
+   case QMetaType::QRect:
+      return *this << *static_cast<const QRect*>(value.constData());
+   case QMetaType::QDateTime:
+      return *this << *static_cast<const QDateTime*>(value.constData());
+   default:
+      return *this << value.toString();
    }
-
-   VA_LIST_CONTEXT(format, this->printf(format, args));
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::printf
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline void LC_Log::printf(const char* format, va_list args)
+/**
+ * @brief operator << Points, sizes and rectangles are written as QDebug does.
+ */
+inline LC_QtStream& LC_QtStream::operator <<(const QPoint& p)
 {
-   if (LC_LIKELY(m_level != LC_LOG_NONE)) {
-#ifdef BUILD_LOG_LEVEL_DEBUG
-      // Always return a valid stream.
-#elif defined(BUILD_LOG_LEVEL_VERBOSE)
-      if (m_level > LC_LOG_VERBOSE)
-         return;
-#elif defined(BUILD_LOG_LEVEL_INFORMATION)
-      if (m_level > LC_LOG_INFO)
-         return;
-#elif defined(BUILD_LOG_LEVEL_WARNING)
-      if (m_level > LC_LOG_WARN)
-         return;
-#elif defined(BUILD_LOG_LEVEL_ERROR)
-      if (m_level > LC_LOG_ERROR)
-         return;
-#elif defined(BUILD_LOG_LEVEL_CRITICAL)
-      if (m_level > LC_LOG_CRITICAL)
-         return;
-#endif
-   }
-
-   m_string = format;
-
-   // Delegate log handling.
-   if (global_log_func)
-      global_log_func(*this, args);
+   if (!m_slot)
+      return *this;
+
+   m_slot->text.append("QPoint(");
+   appendNumber(p.x());
+   m_slot->text.push_back(',');
+   appendNumber(p.y());
+   m_slot->text.push_back(')');
+   return *this;
 }
 
-#if defined(__APPLE__) && (__OBJC__ == 1)
 /*------------------------------------------------------------------------------
-|    LC_Log::printf
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline void LC_Log::printf(NSString* format, ...)
+inline LC_QtStream& LC_QtStream::operator <<(const QPointF& p)
 {
-   if (LC_LIKELY(m_level != LC_LOG_NONE)) {
-#ifdef BUILD_LOG_LEVEL_DEBUG
-      // Always return a valid stream.
-#elif defined(BUILD_LOG_LEVEL_VERBOSE)
-      if (m_level > LC_LOG_VERBOSE)
-         return;
-#elif defined(BUILD_LOG_LEVEL_INFORMATION)
-      if (m_level > LC_LOG_INFO)
-         return;
-#elif defined(BUILD_LOG_LEVEL_WARNING)
-      if (m_level > LC_LOG_WARN)
-         return;
-#elif defined(BUILD_LOG_LEVEL_ERROR)
-      if (m_level > LC_LOG_ERROR)
-         return;
-#elif defined(BUILD_LOG_LEVEL_CRITICAL)
-      if (m_level > LC_LOG_CRITICAL)
-         return;
-#endif
-   }
-
-   VA_LIST_CONTEXT(format, printf(format, args));
+   if (!m_slot)
+      return *this;
+
+   m_slot->text.append("QPointF(");
+   m_slot->stream << p.x();
+   m_slot->text.push_back(',');
+   m_slot->stream << p.y();
+   m_slot->text.push_back(')');
+   return *this;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::printf
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline void LC_Log::printf(NSString* format, va_list args)
+inline LC_QtStream& LC_QtStream::operator <<(const QSize& s)
 {
-   if (LC_LIKELY(m_level != LC_LOG_NONE)) {
-#ifdef BUILD_LOG_LEVEL_DEBUG
-      // Always return a valid stream.
-#elif defined(BUILD_LOG_LEVEL_VERBOSE)
-      if (m_level > LC_LOG_VERBOSE)
-         return;
-#elif defined(BUILD_LOG_LEVEL_INFORMATION)
-      if (m_level > LC_LOG_INFO)
-         return;
-#elif defined(BUILD_LOG_LEVEL_WARNING)
-      if (m_level > LC_LOG_WARN)
-         return;
-#elif defined(BUILD_LOG_LEVEL_ERROR)
-      if (m_level > LC_LOG_ERROR)
-         return;
-#elif defined(BUILD_LOG_LEVEL_CRITICAL)
-      if (m_level > LC_LOG_CRITICAL)
-         return;
-#endif
-   }
-
-   // Build the NSString from the format. This includes NSString's in args.
-   NSString* s1 = [NSString stringWithUTF8String : m_string.str().c_str()];
-#if __has_feature(objc_arc)
-   NSString* s2 = [[NSString alloc] initWithFormat:format arguments : args];
-#else
-   NSString* s2 = [[[NSString alloc] initWithFormat:format arguments : args] autorelease];
-#endif // __has_feature(objc_arc)
-   NSString* s = [NSString stringWithFormat : @"%@%@", s1, s2];
-
-   printf([s cStringUsingEncoding : NSUTF8StringEncoding]);
+   if (!m_slot)
+      return *this;
+
+   m_slot->text.append("QSize(");
+   appendNumber(s.width());
+   m_slot->text.append(", ");
+   appendNumber(s.height());
+   m_slot->text.push_back(')');
+   return *this;
 }
-#endif // defined(__APPLE__) && (__OBJC__ == 1)
 
 /*------------------------------------------------------------------------------
-|    LC_Log::~LC_Log
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline LC_Log::~LC_Log()
+inline LC_QtStream& LC_QtStream::operator <<(const QRect& r)
 {
-   if (LC_LIKELY(m_level != LC_LOG_NONE)) {
-#ifdef BUILD_LOG_LEVEL_DEBUG
-      // Always return a valid stream.
-#elif defined(BUILD_LOG_LEVEL_VERBOSE)
-      if (m_level > LC_LOG_VERBOSE)
-         return;
-#elif defined(BUILD_LOG_LEVEL_INFORMATION)
-      if (m_level > LC_LOG_INFO)
-         return;
-#elif defined(BUILD_LOG_LEVEL_WARNING)
-      if (m_level > LC_LOG_WARN)
-         return;
-#elif defined(BUILD_LOG_LEVEL_ERROR)
-      if (m_level > LC_LOG_ERROR)
-         return;
-#elif defined(BUILD_LOG_LEVEL_CRITICAL)
-      if (m_level > LC_LOG_CRITICAL)
-         return;
-#endif
-   }
-
-   std::string s = m_stream.str();
-   if (s.empty())
-      return;
-   printf(s.c_str());
+   if (!m_slot)
+      return *this;
+
+   m_slot->text.append("QRect(");
+   appendNumber(r.x());
+   m_slot->text.push_back(',');
+   appendNumber(r.y());
+   m_slot->text.push_back(' ');
+   appendNumber(r.width());
+   m_slot->text.push_back('x');
+   appendNumber(r.height());
+   m_slot->text.push_back(')');
+   return *this;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::stream
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline std::ostream& LC_Log::stream()
+/**
+ * @brief operator << Writes t in ISO 8601 with milliseconds and the offset from UTC,
+ * "Z" for UTC.
+ */
+inline LC_QtStream& LC_QtStream::operator <<(const QDateTime& t)
 {
-   static LC_NullStream nullStream;
-
-   if (LC_LIKELY(m_level != LC_LOG_NONE)) {
-#ifdef BUILD_LOG_LEVEL_DEBUG
-      // Always return a valid stream.
-#elif defined(BUILD_LOG_LEVEL_VERBOSE)
-      if (m_level > LC_LOG_VERBOSE)
-         return nullStream;
-#elif defined(BUILD_LOG_LEVEL_INFORMATION)
-      if (m_level > LC_LOG_INFO)
-         return nullStream;
-#elif defined(BUILD_LOG_LEVEL_WARNING)
-      if (m_level > LC_LOG_WARN)
-         return nullStream;
-#elif defined(BUILD_LOG_LEVEL_ERROR)
-      if (m_level > LC_LOG_ERROR)
-         return nullStream;
-#elif defined(BUILD_LOG_LEVEL_CRITICAL)
-      if (m_level > LC_LOG_CRITICAL)
-         return nullStream;
-#endif
+   if (!m_slot)
+      return *this;
+   if (!t.isValid()) {
+      m_slot->text.append("invalid");
+      return *this;
    }
 
-   return m_stream;
+   const QDate date = t.date();
+   const QTime time = t.time();
+   appendNumber(date.year(), 4);
+   m_slot->text.push_back('-');
+   appendNumber(date.month(), 2);
+   m_slot->text.push_back('-');
+   appendNumber(date.day(), 2);
+   m_slot->text.push_back('T');
+   appendNumber(time.hour(), 2);
+   m_slot->text.push_back(':');
+   appendNumber(time.minute(), 2);
+   m_slot->text.push_back(':');
+   appendNumber(time.second(), 2);
+   m_slot->text.push_back('.');
+   appendNumber(time.msec(), 3);
+
+   const int offset = t.offsetFromUtc()/60;
+   if (t.timeSpec() == Qt::UTC || (t.timeSpec() == Qt::OffsetFromUTC && !offset))
+      m_slot->text.push_back('Z');
+   else {
+      m_slot->text.push_back(offset < 0 ? '-' : '+');
+      appendNumber((offset < 0 ? -offset : offset)/60, 2);
+      m_slot->text.push_back(':');
+      appendNumber((offset < 0 ? -offset : offset) % 60, 2);
+   }
+   return *this;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::toString
+|    LC_QtStream::operator <<
 +-----------------------------------------------------------------------------*/
-inline std::string LC_Log::toString(LC_LogLevel level)
+inline LC_QtStream& LC_QtStream::operator <<(std::ostream& (*manipulator)(std::ostream&))
 {
-   static const char* const buffer [] = {
-       "CRIT",
-       "ERR",
-       "WARN",
-       "INFO",
-       "VERB",
-       "DBG"
-   };
+   if (m_slot)
+      manipulator(m_slot->stream);
+   return *this;
+}
 
-   return buffer[level];
+/*------------------------------------------------------------------------------
+|    LC_QtStream::operator <<
++-----------------------------------------------------------------------------*/
+template<typename T>
+inline LC_QtStream& LC_QtStream::operator <<(const T& value)
+{
+   if (m_slot)
+      m_slot->stream << value;
+   return *this;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Log::fromString
+|    LC_QtStream::appendNumber
 +-----------------------------------------------------------------------------*/
-inline LC_LogLevel LC_Log::fromString(const std::string& level)
+/**
+ * @brief appendNumber Appends value with at least digits digits, zero padded.
+ */
+inline void LC_QtStream::appendNumber(long long value, int digits)
 {
-   if (level == "DEBUG")
-      return LC_LOG_DEBUG;
-   if (level == "VERBOSE")
-      return LC_LOG_VERBOSE;
-   if (level == "INFO")
-      return LC_LOG_INFO;
-   if (level == "WARNING")
-      return LC_LOG_WARN;
-   if (level == "ERROR")
-      return LC_LOG_ERROR;
-   if (level == "CRITICAL")
-      return LC_LOG_CRITICAL;
+   char buffer[24];
+   int i = sizeof(buffer);
+   unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+   do {
+      buffer[--i] = (char)('0' + magnitude % 10);
+      magnitude /= 10;
+   } while (magnitude || (int)sizeof(buffer) - i < digits);
+   if (value < 0)
+      buffer[--i] = '-';
+   m_slot->text.append(buffer + i, sizeof(buffer) - i);
+}
 
-   // TODO
-   //LC_Log().prependHeader(LC_LOG_WARN)
-   //   << "Unknown logging level '" << level << "'. Using INFO level as default.";
-   return LC_LOG_INFO;
+/*------------------------------------------------------------------------------
+|    LC_Log::qstream
++-----------------------------------------------------------------------------*/
+/**
+ * @brief qstream Returns the stream for Qt types of this record, see LC_QtStream.
+ */
+inline LC_QtStream LC_Log::qstream()
+{
+   return LC_QtStream(*this);
 }
 
+#endif // QT_CORE_LIB
+
+#ifdef QT_QML_LIB
+#ifndef LC_QML_QUEUE_LIMIT
+#define LC_QML_QUEUE_LIMIT 4096
+#endif
+
 /*------------------------------------------------------------------------------
-|    log_to_stdout
+|    LC_QMLLogger
 +-----------------------------------------------------------------------------*/
-inline void log_to_stdout(LC_Log& logger, va_list args)
+/**
+ * @brief The LC_QMLLogger class is the "logger" object of QML. Each method takes a
+ * message and up to 4 values, appended separated by spaces as console.log() does, e.g.
+ * logger.info("frame", n, elapsed). Nothing is built when the level is disabled; the
+ * *Enabled properties let scripts skip building the arguments too.
+ * Records are queued as QString, sharing the data of the caller, and converted and
+ * logged in batches by the writer thread of the logger, named "qml": the thread shown
+ * in the layouts is that one. At most LC_QML_QUEUE_LIMIT records wait, further ones
+ * are dropped and counted. critical() waits for the queue and writes its record on
+ * the calling thread, so it is never dropped. setBatched(false) logs on the calling
+ * thread instead.
+ */
+class LC_QMLLogger : public QObject
 {
-#ifdef COLORING_ENABLED
-   LC_LogAttrib attrib;
-   LC_LogColor  color;
-   LC_BackColor background;
-   if (LC_LIKELY(logger.m_level != LC_LOG_NONE)) {
-      attrib = LC_LOG_ATTR_RESET;
-      color = logger.m_color;
-      background = LC_BACK_COL_DEFAULT;
+   Q_OBJECT
+   Q_PROPERTY(bool debugEnabled READ isDebugEnabled)
+   Q_PROPERTY(bool verboseEnabled READ isVerboseEnabled)
+   Q_PROPERTY(bool infoEnabled READ isInfoEnabled)
+   Q_PROPERTY(bool warnEnabled READ isWarnEnabled)
+   Q_PROPERTY(bool errorEnabled READ isErrorEnabled)
+   Q_PROPERTY(bool criticalEnabled READ isCriticalEnabled)
+public:
+   static LC_QMLLogger& instance();
+   static void registerObject(QQmlContext* context);
+
+   bool isDebugEnabled() const { return lc_qt_accepts(LOG_TAG, LC_LOG_DEBUG); }
+   bool isVerboseEnabled() const { return lc_qt_accepts(LOG_TAG, LC_LOG_VERBOSE); }
+   bool isInfoEnabled() const { return lc_qt_accepts(LOG_TAG, LC_LOG_INFO); }
+   bool isWarnEnabled() const { return lc_qt_accepts(LOG_TAG, LC_LOG_WARN); }
+   bool isErrorEnabled() const { return lc_qt_accepts(LOG_TAG, LC_LOG_ERROR); }
+   bool isCriticalEnabled() const { return lc_qt_accepts(LOG_TAG, LC_LOG_CRITICAL); }
+
+   Q_INVOKABLE void debug(const QString& s, const QVariant& a1 = QVariant(), const QVariant& a2 = QVariant(),
+                          const QVariant& a3 = QVariant(), const QVariant& a4 = QVariant()) {
+      log(LC_LOG_DEBUG, s, a1, a2, a3, a4);
    }
-   else {
-      attrib = logger.m_attrib;
-      color = logger.m_color;
-      background = logger.m_background;
+
+   Q_INVOKABLE bool verbose(const QString& s, const QVariant& a1 = QVariant(), const QVariant& a2 = QVariant(),
+                            const QVariant& a3 = QVariant(), const QVariant& a4 = QVariant()) {
+      log(LC_LOG_VERBOSE, s, a1, a2, a3, a4);
+      return true;
    }
 
-   std::ostringstream sink;
-   if (logger.m_log_tag)
-      sink << "[" << logger.m_log_tag << "]: ";
-   if (LC_LIKELY(logger.m_level != LC_LOG_NONE))
-      sink << logger.toString(logger.m_level) << ":\t";
-   sink << lc_current_time() << " ";
-   sink << (char) 0x1B
-      << "[" << (int) attrib << ";"
-      << (int)color << "m";
-   sink << (char) 0x1B
-        << "[" << (int)background << "m";
-   sink << logger.m_string;
-   sink << (char) 0x1B
-      << "[" << (int) LC_LOG_ATTR_RESET << "m";
-   if (LC_LIKELY(logger.m_nl))
-       sink << std::endl;
-   std::string final = sink.str();
-#else
-   std::stringstream s;
-   s << logger.m_string;
-   if (logger.m_nl)
-      s << std::endl;
-   std::string final = s.str();
-#endif // COLORING_ENABLED
+   Q_INVOKABLE bool info(const QString& s, const QVariant& a1 = QVariant(), const QVariant& a2 = QVariant(),
+                         const QVariant& a3 = QVariant(), const QVariant& a4 = QVariant()) {
+      log(LC_LOG_INFO, s, a1, a2, a3, a4);
+      return true;
+   }
 
-   // I prefer to flush to avoid missing buffered logs in case of crash.
-   FILE* stdOut = stdout;
-   if (logger.m_level == LC_LOG_ERROR || logger.m_level == LC_LOG_CRITICAL)
-      stdOut = stderr;
-   ::vfprintf(stdOut, final.c_str(), args);
-   ::fflush(stdOut);
+   Q_INVOKABLE bool warn(const QString& s, const QVariant& a1 = QVariant(), const QVariant& a2 = QVariant(),
+                         const QVariant& a3 = QVariant(), const QVariant& a4 = QVariant()) {
+      log(LC_LOG_WARN, s, a1, a2, a3, a4);
+      return false;
+   }
+
+   Q_INVOKABLE bool error(const QString& s, const QVariant& a1 = QVariant(), const QVariant& a2 = QVariant(),
+                          const QVariant& a3 = QVariant(), const QVariant& a4 = QVariant()) {
+      log(LC_LOG_ERROR, s, a1, a2, a3, a4);
+      return false;
+   }
+
+   Q_INVOKABLE bool critical(const QString& s, const QVariant& a1 = QVariant(), const QVariant& a2 = QVariant(),
+                             const QVariant& a3 = QVariant(), const QVariant& a4 = QVariant()) {
+      log(LC_LOG_CRITICAL, s, a1, a2, a3, a4);
+      return false;
+   }
+
+   void setBatched(bool batched);
+   void flush();
+   unsigned long long dropped();
+
+private:
+   struct Record {
+      LC_LogLevel level;
+      QString text;
+   };
+
+   LC_QMLLogger();
+   ~LC_QMLLogger();
+   LC_QMLLogger(const LC_QMLLogger&);
+   LC_QMLLogger& operator =(const LC_QMLLogger&);
+
+   void log(LC_LogLevel level, const QString& s, const QVariant& a1, const QVariant& a2,
+            const QVariant& a3, const QVariant& a4);
+   static void appendValue(QString& out, const QVariant& value);
+   static void write(const Record& record);
+   void start();
+   void stop();
+   void run();
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* logger);
+   static void unlockAfterFork(void* logger);
+   static void resetAfterFork(void* logger);
+#endif
+#ifndef LC_LOGGING_DISABLE_THREADING
+   void adoptAfterFork();
+
+   // The writer thread and what it waits on. After fork() these belong to the parent
+   // and the child makes its own, see adoptAfterFork().
+   struct Writer {
+      std::thread thread;
+      std::condition_variable_any cond;
+      std::condition_variable_any drained;
+   };
+#endif
+
+   LC_Mutex m_mutex;
+#ifndef LC_LOGGING_DISABLE_THREADING
+   Writer* m_writer;
+   bool m_forked;
+#endif
+   bool m_running;
+   bool m_stopping;
+   bool m_busy;
+   bool m_batched;
+   std::vector<Record> m_queue;
+   unsigned long long m_dropped;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_QMLLogger::LC_QMLLogger
++-----------------------------------------------------------------------------*/
+inline LC_QMLLogger::LC_QMLLogger() :
+     QObject()
+#ifndef LC_LOGGING_DISABLE_THREADING
+   , m_writer(new Writer)
+   , m_forked(false)
+#endif
+   , m_running(false)
+   , m_stopping(false)
+   , m_busy(false)
+#ifndef LC_LOGGING_DISABLE_THREADING
+   , m_batched(true)
+#else
+   , m_batched(false)
+#endif
+   , m_dropped(0)
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_QMLLogger::lockForFork,
+                              &LC_QMLLogger::unlockAfterFork,
+                              &LC_QMLLogger::resetAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+
+   // Written before the statics used by the sinks are destroyed.
+   if (QCoreApplication* app = QCoreApplication::instance())
+      connect(app, &QCoreApplication::aboutToQuit, this, &LC_QMLLogger::flush);
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Output2File::stream
+|    LC_QMLLogger::~LC_QMLLogger
 +-----------------------------------------------------------------------------*/
-inline FILE*& file_stream()
+inline LC_QMLLogger::~LC_QMLLogger()
 {
-#ifdef _MSC_VER
-   static FILE* pStream = NULL;
-   if (!pStream)
-      if (errno_t err = fopen_s(&pStream, "output.log", "a"))
-         ::printf("Failed to open output.log: %d,", err);
-#else
-#ifndef CUSTOM_LOG_FILE
-#define CUSTOM_LOG_FILE "output.log"
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+   stop();
+#ifndef LC_LOGGING_DISABLE_THREADING
+   delete m_writer;
 #endif
-   static FILE* pStream = fopen("output.log", "a");
-#endif // _MSC_VER
-   return pStream;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Output2File::output
+|    LC_QMLLogger::instance
 +-----------------------------------------------------------------------------*/
-inline void log_to_file(LC_Log& logger, va_list args)
+inline LC_QMLLogger& LC_QMLLogger::instance()
 {
-   // Prepend.
-   std::string final = logger.m_string;
-   logger.prependHeader(final);
-   logger.prependLogTagIfNeeded(final);
-   final.append("\n");
-
-   FILE* pStream = file_stream();
-   if (!pStream)
-      return;
-
-   vfprintf(pStream, final.c_str(), args);
-   fflush(pStream);
+   static LC_QMLLogger instance;
+   return instance;
 }
 
-#ifdef ENABLE_MSVS_OUTPUT
-#include <memory>
 /*------------------------------------------------------------------------------
-|    string_format
+|    LC_QMLLogger::registerObject
 +-----------------------------------------------------------------------------*/
-inline std::string string_format(const std::string fmt_str, va_list ap)
+inline void LC_QMLLogger::registerObject(QQmlContext* context)
 {
-	size_t final_n, n = fmt_str.size() * 2;
-	std::string str;
-	std::unique_ptr<char[]> formatted;
-	while (1) {
-		formatted.reset(new char[n]);
-		strcpy_s(&formatted[0], n, fmt_str.c_str());
-		final_n = vsnprintf_s(&formatted[0], n, n - 1, fmt_str.c_str(), ap);
-		if (final_n < 0 || final_n >= n)
-			n += abs((long long)(final_n - n + 1));
-		else
-			break;
-	}
-	return std::string(formatted.get());
+   context->setContextProperty(QStringLiteral("logger"), &(instance()));
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Output2MSVS::printf
+|    LC_QMLLogger::setBatched
 +-----------------------------------------------------------------------------*/
-inline void log_to_msvs(LC_Log& logger, va_list args)
+/**
+ * @brief setBatched Sets whether records are written by the writer thread (default)
+ * or by the thread calling the logger. Ignored with LC_LOGGING_DISABLE_THREADING.
+ */
+inline void LC_QMLLogger::setBatched(bool batched)
 {
-   // Prepend.
-   std::string final = logger.m_string.str();
-   logger.prependHeader(final);
-   logger.prependLogTagIfNeeded(final);
-   final.append("\n");
+#ifndef LC_LOGGING_DISABLE_THREADING
+   {
+      // From now on log() writes directly, so nothing is queued after the writer
+      // thread is gone.
+      LC_MutexLocker locker(m_mutex);
+      m_batched = batched;
+      if (batched)
+         return;
+   }
+
+   stop();
 
-   OutputDebugStringA(string_format(final, args).c_str());
+   std::vector<Record> left;
+   {
+      LC_MutexLocker locker(m_mutex);
+      left.swap(m_queue);
+   }
+   for (size_t i = 0; i < left.size(); i++)
+      write(left[i]);
+#else
+   Q_UNUSED(batched);
+#endif
 }
-#endif // ENABLE_MSVS_OUTPUT
 
-#ifdef __ANDROID__
 /*------------------------------------------------------------------------------
-|    LC_OutputAndroid::printf
+|    LC_QMLLogger::flush
 +-----------------------------------------------------------------------------*/
-inline void log_to_logcat(LC_Log& logger, va_list args)
+/**
+ * @brief flush Waits until the queued records are written.
+ */
+inline void LC_QMLLogger::flush()
 {
-   static const android_LogPriority android_logPriority [] = {
-      // Do not mess with the order. Must map the LC_LogLevel enum.
-      ANDROID_LOG_FATAL,
-      ANDROID_LOG_ERROR,
-      ANDROID_LOG_WARN,
-      ANDROID_LOG_INFO,
-      ANDROID_LOG_VERBOSE,
-      ANDROID_LOG_DEBUG
-   };
-
-   android_LogPriority p = (logger.m_level > 5 || logger.m_level < 0) ? ANDROID_LOG_INFO : android_logPriority[logger.m_level];
-   __android_log_vprint(
-      p,
-      logger.m_log_tag,
-      logger.m_string.c_str(),
-      args);
+#ifndef LC_LOGGING_DISABLE_THREADING
+   std::unique_lock<LC_Mutex> locker(m_mutex);
+   if (m_forked)
+      adoptAfterFork();
+   while (m_running && (!m_queue.empty() || m_busy))
+      m_writer->drained.wait(locker);
+#endif
 }
-#endif // __ANDROID__
 
-#ifdef XCODE_COLORING_ENABLED
 /*------------------------------------------------------------------------------
-|    LC_Output2XCodeColors::printf
+|    LC_QMLLogger::dropped
 +-----------------------------------------------------------------------------*/
-inline void log_to_xcodecolors(LC_Log& logger, va_list args)
+/**
+ * @brief dropped Returns the number of records dropped because the queue was full.
+ */
+inline unsigned long long LC_QMLLogger::dropped()
 {
-#define XC_COL_ESC_MAC @"\033["
-#define XC_COL_ESC_IOS @"\xC2\xA0["
-
-#define XC_COL_ESC XC_COL_ESC_MAC
-
-#define XC_COL_RESET_FG XC_COL_ESC @"fg;" // Clear any foreground color
-#define XC_COL_RESET_BG XC_COL_ESC @"bg;" // Clear any background color
-#define XC_COL_RESET XC_COL_ESC @";"      // Clear any foreground or background color
-
-   std::string final = logger.m_string.str();
-   logger.prependHeader(final);
-   logger.prependLogTagIfNeeded(final);
-
-   const NSString* colorCode;
-   if (logger.m_level == LC_LOG_NONE)
-      colorCode = lc_xc_col((int)logger.m_color);
-   else
-      colorCode = getColorForLevel(logger.m_level);
-
-   NSString* s;
-#ifdef XCODE_COLORING_ENABLED
-   //if (checkEnv())
-      s = [NSString stringWithFormat : XC_COL_ESC @"%@%s" XC_COL_RESET @"\n", colorCode, final.c_str()];
-#else
-   //else
-      s = [NSString stringWithFormat : @"%s\n", final.c_str()];
-#endif // XCODE_COLORING_ENABLED
-
-   ::printf("%s", [s cStringUsingEncoding : NSUTF8StringEncoding]);
+   LC_MutexLocker locker(m_mutex);
+   return m_dropped;
 }
 
 /*------------------------------------------------------------------------------
-|    LC_Output2XCodeColors::checkEnv
+|    LC_QMLLogger::log
 +-----------------------------------------------------------------------------*/
-inline bool LC_Output2XCodeColors::checkEnv()
+inline void LC_QMLLogger::log(LC_LogLevel level, const QString& s, const QVariant& a1, const QVariant& a2,
+                              const QVariant& a3, const QVariant& a4)
 {
-   static bool checkPerformed = false;
-   static bool available = true;
-   if (checkPerformed)
-      return available;
+   if (!lc_qt_accepts(LOG_TAG, level))
+      return;
 
-#define XCODE_COLORS "XcodeColors"
+   Record record;
+   record.level = level;
+   record.text = s;
+   appendValue(record.text, a1);
+   appendValue(record.text, a2);
+   appendValue(record.text, a3);
+   appendValue(record.text, a4);
 
-   char* xcode_colors = getenv(XCODE_COLORS);
-   if (!(xcode_colors && (strcmp(xcode_colors, "YES") == 0))) {
-      NSLog(@"XCodeColors not available.");
-      checkPerformed = true;
-      available = false;
+#ifndef LC_LOGGING_DISABLE_THREADING
+   if (level == LC_LOG_CRITICAL)
+      flush();
+   else {
+      LC_MutexLocker locker(m_mutex);
+      if (m_forked)
+         adoptAfterFork();
+      // Not once the writer thread was asked to stop: it may be gone already.
+      if (m_batched && !m_stopping) {
+         if (m_queue.size() >= LC_QML_QUEUE_LIMIT) {
+            m_dropped++;
+            return;
+         }
+
+         m_queue.push_back(record);
+         if (!m_running)
+            start();
+         // Otherwise the writer is waiting only if the queue was empty.
+         else if (m_queue.size() == 1)
+            m_writer->cond.notify_one();
+         return;
+      }
    }
+#endif
 
-   return available;
+   write(record);
 }
 
 /*------------------------------------------------------------------------------
-|    LC_OutputXCodeColors::getColorForLevel
+|    LC_QMLLogger::appendValue
 +-----------------------------------------------------------------------------*/
-inline NSString* LC_Output2XCodeColors::getColorForLevel(LC_LogLevel level)
+/**
+ * @brief appendValue Appends a space and value, unless it is undefined. Arrays and
+ * objects are written as JSON.
+ */
+inline void LC_QMLLogger::appendValue(QString& out, const QVariant& value)
 {
-   switch (level) {
-   case LC_LOG_VERBOSE:
-      return @"fg0,0,0;";   // Black here. XCode is commonly on light bg.
-   case LC_LOG_DEBUG:
-      return @"fg0,0,255;";
-   case LC_LOG_INFO:
-      return @"fg34,139,34;";
-   case LC_LOG_NONE:
-      return @"fg0,0,0;";
-   case LC_LOG_WARN:
-      return @"fg255,165,0;";
-   case LC_LOG_ERROR:
-      return @"fg255,0,0;";
-   case LC_LOG_CRITICAL:
-      return @"fg255,0,0;";
-   default:
-      return @"fg0,0,255;";
-   }
+   if (!value.isValid())
+      return;
 
-   return nil;
+   out.append(QLatin1Char(' '));
+   const int type = value.userType();
+   if (type == QMetaType::QVariantList || type == QMetaType::QVariantMap)
+      out.append(QString::fromUtf8(QJsonDocument::fromVariant(value).toJson(QJsonDocument::Compact)));
+   else
+      out.append(value.toString());
 }
-#endif // XCODE_COLORING_ENABLED
 
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
-inline int gettimeofday(struct ::timeval * tp, struct timezone * tzp)
+/*------------------------------------------------------------------------------
+|    LC_QMLLogger::write
++-----------------------------------------------------------------------------*/
+inline void LC_QMLLogger::write(const Record& record)
 {
-    (void)tzp;
-
-    // Note: some broken versions only have 8 trailing zero's, the correct epoch has 9 trailing zero's
-    // This magic number is the number of 100 nanosecond intervals since January 1, 1601 (UTC)
-    // until 00:00:00 January 1, 1970
-    static const uint64_t EPOCH = ((uint64_t) 116444736000000000ULL);
-
-    SYSTEMTIME  system_time;
-    FILETIME    file_time;
-    uint64_t    time;
-
-    GetSystemTime( &system_time );
-    SystemTimeToFileTime( &system_time, &file_time );
-    time =  ((uint64_t)file_time.dwLowDateTime )      ;
-    time += ((uint64_t)file_time.dwHighDateTime) << 32;
-
-    tp->tv_sec  = (long) ((time - EPOCH) / 10000000L);
-    tp->tv_usec = (long) (system_time.wMilliseconds * 1000);
-    return 0;
+   LC_Log logger(LOG_TAG, record.level);
+   lc_qt_log(logger, record.text);
 }
-#else
-#include <sys/time.h>
-#endif // WIN32
 
 /*------------------------------------------------------------------------------
-|    lc_current_time
+|    LC_QMLLogger::start
 +-----------------------------------------------------------------------------*/
-inline std::string lc_current_time()
+/**
+ * @brief start Starts the writer thread. Called with m_mutex locked.
+ */
+inline void LC_QMLLogger::start()
 {
-   char buffer[11];
-   time_t t;
-   time(&t);
-
-#ifdef WIN32
-   struct tm timeinfo;
-   localtime_s(&timeinfo, &t);
-   strftime(buffer, sizeof(buffer), "%T", &timeinfo);
-#else
-   struct tm* timeinfo = localtime(&t);
-   strftime(buffer, sizeof(buffer), "%T", timeinfo);
+#ifndef LC_LOGGING_DISABLE_THREADING
+   m_stopping = false;
+   m_running = true;
+   m_writer->thread = std::thread(&LC_QMLLogger::run, this);
 #endif
+}
 
+/*------------------------------------------------------------------------------
+|    LC_QMLLogger::stop
++-----------------------------------------------------------------------------*/
+/**
+ * @brief stop Writes the queued records and stops the writer thread.
+ */
+inline void LC_QMLLogger::stop()
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   {
+      LC_MutexLocker locker(m_mutex);
+      if (m_forked)
+         adoptAfterFork();
+      if (!m_running || m_stopping)
+         return;
+      m_stopping = true;
+   }
 
-   struct timeval tv;
-   gettimeofday(&tv, 0);
-
-   char result[100] = { 0 };
-   std::snprintf(result, 100, "%s.%03ld", buffer, (long) tv.tv_usec / 1000);
+   m_writer->cond.notify_all();
+   m_writer->thread.join();
 
-   return result;
+   LC_MutexLocker locker(m_mutex);
+   m_running = false;
+   m_stopping = false;
+#endif
 }
 
-#ifdef QT_CORE_LIB
-#include <QtGlobal>
-#include <QString>
-
 /*------------------------------------------------------------------------------
-|    log_handler
+|    LC_QMLLogger::run
 +-----------------------------------------------------------------------------*/
 /**
- * @brief log_handler Function to handle Qt debugging output.
- * @param type
- * @param msg
+ * @brief run Body of the writer thread: takes the whole queue at once and writes it
+ * unlocked, so the callers only wait for the push.
  */
-inline
-void log_handler(QtMsgType type, const QMessageLogContext&, const QString& s)
+inline void LC_QMLLogger::run()
 {
-	switch (type) {
-	case QtDebugMsg:
-        log_verbose(qPrintable(s));
-		break;
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
-	case QtInfoMsg:
-        log_info(qPrintable(s));
-		break;
-#endif
-	case QtWarningMsg:
-        log_warn(qPrintable(s));
-		break;
-	case QtCriticalMsg:
-        log_err(qPrintable(s));
-		break;
-	case QtFatalMsg:
-        log_critical(qPrintable(s));
-		break;
-	}
+#ifndef LC_LOGGING_DISABLE_THREADING
+   lc_set_thread_name("qml");
+
+   std::vector<Record> batch;
+   std::unique_lock<LC_Mutex> locker(m_mutex);
+   for (;;) {
+      while (m_queue.empty() && !m_stopping)
+         m_writer->cond.wait(locker);
+      if (m_queue.empty())
+         break;
+
+      batch.swap(m_queue);
+      m_busy = true;
+      locker.unlock();
+
+      for (size_t i = 0; i < batch.size(); i++)
+         write(batch[i]);
+      batch.clear();
+
+      locker.lock();
+      m_busy = false;
+      if (m_queue.empty())
+         m_writer->drained.notify_all();
+   }
+#endif
 }
 
+#ifndef LC_LOGGING_DISABLE_THREADING
 /*------------------------------------------------------------------------------
-|    log_handler_with_category
+|    LC_QMLLogger::adoptAfterFork
 +-----------------------------------------------------------------------------*/
 /**
- * @brief log_handler Function to handle Qt debugging output including the category.
- * @param type
- * @param msg
+ * @brief adoptAfterFork Called with m_mutex locked the first time a child created with
+ * fork() uses the logger. The thread and the condition variables of the parent cannot
+ * be destroyed here, so they are left as they are and the child gets new ones; its
+ * writer thread is started with the next queued record.
  */
-inline
-void log_handler_with_category(QtMsgType type, const QMessageLogContext& c, const QString& s)
+inline void LC_QMLLogger::adoptAfterFork()
 {
-    switch (type) {
-    case QtDebugMsg:
-        log_verbose_t(c.category, qPrintable(s));
-        break;
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
-    case QtInfoMsg:
-        log_info_t(c.category, qPrintable(s));
-        break;
-#endif
-    case QtWarningMsg:
-        log_warn_t(c.category, qPrintable(s));
-        break;
-    case QtCriticalMsg:
-        log_err_t(c.category, qPrintable(s));
-        break;
-    case QtFatalMsg:
-        log_critical_t(c.category, qPrintable(s));
-        break;
-    }
+   m_forked = false;
+   m_writer = new Writer;
+   m_running = false;
+   m_stopping = false;
 }
+#endif
 
-#endif // QT_CORE_LIB
-
-#ifdef QT_QML_LIB
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
 /*------------------------------------------------------------------------------
-|    LC_QMLLogger
+|    LC_QMLLogger::lockForFork
 +-----------------------------------------------------------------------------*/
-class LC_QMLLogger : public QObject
+inline void LC_QMLLogger::lockForFork(void* logger)
 {
-   Q_OBJECT
-public:
-   static LC_QMLLogger& instance() {
-      static LC_QMLLogger instance;
-      return instance;
-   }
-
-   Q_INVOKABLE void debug(QString s) const {
-      FUNC(debug)(qPrintable(s));
-   }
-
-   Q_INVOKABLE bool verbose(QString s) const {
-      return FUNC(verbose)(qPrintable(s));
-   }
-
-   Q_INVOKABLE bool info(QString s) const {
-      return FUNC(info)(qPrintable(s));
-   }
-
-   Q_INVOKABLE bool warn(QString s) const {
-      return FUNC(warn)(qPrintable(s));
-   }
-
-   Q_INVOKABLE bool error(QString s) const {
-      return FUNC(err)(qPrintable(s));
-   }
+   static_cast<LC_QMLLogger*>(logger)->m_mutex.lock();
+}
 
-   Q_INVOKABLE bool critical(QString s) const {
-      return FUNC(err)(qPrintable(s));
-   }
+/*------------------------------------------------------------------------------
+|    LC_QMLLogger::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_QMLLogger::unlockAfterFork(void* logger)
+{
+   static_cast<LC_QMLLogger*>(logger)->m_mutex.unlock();
+}
 
-   static void registerObject(QQmlContext* context) {
-      context->setContextProperty(QStringLiteral("logger"), &(instance()));
-   }
+/*------------------------------------------------------------------------------
+|    LC_QMLLogger::resetAfterFork
++-----------------------------------------------------------------------------*/
+/**
+ * @brief resetAfterFork Runs in the child, where only async-signal-safe calls are
+ * allowed: the queue is written by the parent, so the child starts empty. The writer is
+ * set up again when the child first logs, see adoptAfterFork().
+ */
+inline void LC_QMLLogger::resetAfterFork(void* logger)
+{
+   LC_QMLLogger* self = static_cast<LC_QMLLogger*>(logger);
+   self->m_queue.clear();
+   self->m_busy = false;
+#ifndef LC_LOGGING_DISABLE_THREADING
+   self->m_forked = true;
+#endif
 
-private:
-   LC_QMLLogger() : QObject() {}
-};
+   self->m_mutex.unlock();
+}
+#endif
 #endif // QT_QML_LIB
 
 inline void log_to_default(LC_Log& logger, va_list args)
@@ -1857,5 +8621,6 @@ static std::once_flag log_info_once_flag;
 #undef LOG_UNUSED
 #undef LC_LIKELY
 #undef LC_UNLIKELY
+#undef LC_NOINLINE
 
 #endif // LC_LOGGING_H
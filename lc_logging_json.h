@@ -0,0 +1,642 @@
+/*
+ * Author:  Luca Carlon
+ * Company: -
+ * Date:    10.18.2026
+ *
+ * Copyright (c) 2013-2026, Luca Carlon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the author nor the
+ * names of its contributors may be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * Structured sinks writing one record per line as JSON (JSON Lines) or logfmt.
+ *
+ * Usage:
+ *    #include "lc_logging_json.h"
+ *    lightlogger::custom_log_func lightlogger::global_log_func = log_to_json;
+ *
+ * or log_to_logfmt. Records are written to stdout unless open() is called on
+ * LC_StructuredSink::json() or LC_StructuredSink::logfmt(). Each record has these
+ * fields, in this order; those that are not available are omitted:
+ *    ts    UTC time, ISO 8601 with microseconds;
+ *    level level as returned by LC_Log::toString();
+ *    tag   log tag;
+ *    file, line, func location in the sources (ENABLE_CODE_LOCATION);
+ *    tid   id of the thread as returned by lc_thread_id();
+ *    thread name of the thread as returned by lc_thread_name();
+ *    msg   the message;
+ *    the key-value fields of the context (LC_LogScope) and of log_*_kv(), typed:
+ *    numbers and booleans are not quoted in JSON, non-finite numbers are null;
+ *    stack the frames of log_stacktrace(): an array of strings in JSON, one string
+ *          with a frame per line in logfmt.
+ *
+ * Strings are escaped and invalid UTF-8 sequences are replaced by U+FFFD. Runs of
+ * characters that need no escaping are found 16 bytes at a time with SSE2 and 32 with
+ * AVX2 (build with -mavx2 or /arch:AVX2); other architectures use a scalar loop.
+ */
+
+#ifndef LC_LOGGING_JSON_H
+#define LC_LOGGING_JSON_H
+
+/*------------------------------------------------------------------------------
+|    includes
++-----------------------------------------------------------------------------*/
+#include "lc_logging.h"
+
+#include <string>
+#include <chrono>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LC_STRUCTURED_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace lightlogger {
+
+/*------------------------------------------------------------------------------
+|    definitions
++-----------------------------------------------------------------------------*/
+enum LC_StructuredFormat {
+   LC_STRUCTURED_JSON,
+   LC_STRUCTURED_LOGFMT
+};
+
+/*------------------------------------------------------------------------------
+|    lc_first_set_bit
++-----------------------------------------------------------------------------*/
+inline unsigned int lc_first_set_bit(unsigned int mask)
+{
+#ifdef _MSC_VER
+   unsigned long index;
+   _BitScanForward(&index, mask);
+   return (unsigned int)index;
+#else
+   return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    lc_plain_length
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_plain_length Returns the length of the prefix of s that can be copied to
+* the output as it is: printable ASCII except '"' and '\\'. With LOGFMT, ' ' and '='
+* also end the prefix, as they require the value to be quoted.
+*/
+template<bool LOGFMT>
+inline size_t lc_plain_length(const char* s, size_t n)
+{
+   size_t i = 0;
+
+   // Compared as signed bytes, both controls (< 0x20) and non-ASCII (>= 0x80) are
+   // less than 0x20.
+#ifdef __AVX2__
+   const __m256i quote256 = _mm256_set1_epi8('"');
+   const __m256i backslash256 = _mm256_set1_epi8('\\');
+   const __m256i space256 = _mm256_set1_epi8(' ');
+   const __m256i equal256 = _mm256_set1_epi8('=');
+   const __m256i limit256 = _mm256_set1_epi8(0x20);
+   for (; i + 32 <= n; i += 32) {
+      const __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+      __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote256), _mm256_cmpeq_epi8(v, backslash256));
+      m = _mm256_or_si256(m, _mm256_cmpgt_epi8(limit256, v));
+      if (LOGFMT)
+         m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, space256), _mm256_cmpeq_epi8(v, equal256)));
+      const unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+      if (mask)
+         return i + lc_first_set_bit(mask);
+   }
+#endif // __AVX2__
+
+#ifdef LC_STRUCTURED_SSE2
+   const __m128i quote = _mm_set1_epi8('"');
+   const __m128i backslash = _mm_set1_epi8('\\');
+   const __m128i space = _mm_set1_epi8(' ');
+   const __m128i equal = _mm_set1_epi8('=');
+   const __m128i limit = _mm_set1_epi8(0x20);
+   for (; i + 16 <= n; i += 16) {
+      const __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+      __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+      m = _mm_or_si128(m, _mm_cmplt_epi8(v, limit));
+      if (LOGFMT)
+         m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, equal)));
+      const unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+      if (mask)
+         return i + lc_first_set_bit(mask);
+   }
+#endif // LC_STRUCTURED_SSE2
+
+   for (; i < n; i++) {
+      const unsigned char c = (unsigned char)s[i];
+      if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\')
+         break;
+      if (LOGFMT && (c == ' ' || c == '='))
+         break;
+   }
+
+   return i;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_utf8_sequence_length
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_utf8_sequence_length Returns the length of the UTF-8 sequence starting
+* with the non-ASCII byte s[0], or 0 if the sequence is not valid (truncated,
+* overlong, surrogate or beyond U+10FFFF).
+*/
+inline size_t lc_utf8_sequence_length(const unsigned char* s, size_t n)
+{
+   size_t len;
+   if (s[0] >= 0xC2 && s[0] <= 0xDF)
+      len = 2;
+   else if (s[0] >= 0xE0 && s[0] <= 0xEF)
+      len = 3;
+   else if (s[0] >= 0xF0 && s[0] <= 0xF4)
+      len = 4;
+   else
+      return 0;
+
+   if (n < len)
+      return 0;
+   for (size_t i = 1; i < len; i++)
+      if ((s[i] & 0xC0) != 0x80)
+         return 0;
+
+   if (s[0] == 0xE0 && s[1] < 0xA0)
+      return 0;
+   if (s[0] == 0xED && s[1] > 0x9F)
+      return 0;
+   if (s[0] == 0xF0 && s[1] < 0x90)
+      return 0;
+   if (s[0] == 0xF4 && s[1] > 0x8F)
+      return 0;
+
+   return len;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_json_escape
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_json_escape Appends s to out escaped for a JSON string, without the
+* surrounding quotes.
+*/
+inline void lc_json_escape(std::string& out, const char* s, size_t n)
+{
+   static const char hex[] = "0123456789abcdef";
+
+   size_t i = 0;
+   while (i < n) {
+      const size_t plain = lc_plain_length<false>(s + i, n - i);
+      out.append(s + i, plain);
+      i += plain;
+      if (i >= n)
+         break;
+
+      const unsigned char c = (unsigned char)s[i];
+      if (c >= 0x80) {
+         const size_t len = lc_utf8_sequence_length((const unsigned char*)s + i, n - i);
+         if (len) {
+            out.append(s + i, len);
+            i += len;
+         }
+         else {
+            out.append("\xEF\xBF\xBD");
+            i++;
+         }
+         continue;
+      }
+
+      switch (c) {
+      case '"':  out.append("\\\""); break;
+      case '\\': out.append("\\\\"); break;
+      case '\n': out.append("\\n"); break;
+      case '\r': out.append("\\r"); break;
+      case '\t': out.append("\\t"); break;
+      case '\b': out.append("\\b"); break;
+      case '\f': out.append("\\f"); break;
+      default:
+         out.append("\\u00");
+         out.push_back(hex[c >> 4]);
+         out.push_back(hex[c & 0x0F]);
+         break;
+      }
+      i++;
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    lc_logfmt_value
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_logfmt_value Appends s to out as a logfmt value: as it is if possible,
+* quoted and escaped otherwise.
+*/
+inline void lc_logfmt_value(std::string& out, const char* s, size_t n)
+{
+   if (n && lc_plain_length<true>(s, n) == n) {
+      out.append(s, n);
+      return;
+   }
+
+   out.push_back('"');
+   lc_json_escape(out, s, n);
+   out.push_back('"');
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_StructuredSink class writes records as JSON Lines or logfmt. Use
+* json() or logfmt() and the log_to_* functions unless you need more outputs.
+*/
+class LC_StructuredSink
+{
+public:
+   explicit LC_StructuredSink(LC_StructuredFormat format);
+   ~LC_StructuredSink();
+
+   static LC_StructuredSink& json();
+   static LC_StructuredSink& logfmt();
+
+   static void format(std::string& out, LC_StructuredFormat format, LC_Log& logger, va_list args);
+
+   bool open(const char* path);
+   void setOutput(FILE* f);
+   void close();
+
+   void write(LC_Log& logger, va_list args);
+
+private:
+   LC_StructuredSink(const LC_StructuredSink&);
+   LC_StructuredSink& operator =(const LC_StructuredSink&);
+
+   static void appendKey(std::string& out, LC_StructuredFormat format, const char* key);
+   static void appendString(std::string& out, LC_StructuredFormat format, const char* key,
+                            const char* value, size_t size);
+   static void appendNumber(std::string& out, LC_StructuredFormat format, const char* key,
+                            unsigned long long value);
+   static void appendField(std::string& out, LC_StructuredFormat format, const LC_Field& field);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* sink);
+   static void unlockAfterFork(void* sink);
+#endif
+
+   LC_Mutex m_mutex;
+   LC_StructuredFormat m_format;
+   FILE* m_file;
+   bool m_owned;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::LC_StructuredSink
++-----------------------------------------------------------------------------*/
+inline LC_StructuredSink::LC_StructuredSink(LC_StructuredFormat format) :
+     m_format(format)
+   , m_file(stdout)
+   , m_owned(false)
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_StructuredSink::lockForFork,
+                              &LC_StructuredSink::unlockAfterFork,
+                              &LC_StructuredSink::unlockAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::~LC_StructuredSink
++-----------------------------------------------------------------------------*/
+inline LC_StructuredSink::~LC_StructuredSink()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+   close();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::json
++-----------------------------------------------------------------------------*/
+inline LC_StructuredSink& LC_StructuredSink::json()
+{
+   static LC_StructuredSink instance(LC_STRUCTURED_JSON);
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::logfmt
++-----------------------------------------------------------------------------*/
+inline LC_StructuredSink& LC_StructuredSink::logfmt()
+{
+   static LC_StructuredSink instance(LC_STRUCTURED_LOGFMT);
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::open
++-----------------------------------------------------------------------------*/
+/**
+* @brief open Appends the records to the file at path instead of stdout.
+* @return false if the file cannot be opened; the previous output is kept.
+*/
+inline bool LC_StructuredSink::open(const char* path)
+{
+   FILE* f = fopen(path, "a");
+   if (!f)
+      return false;
+
+   LC_MutexLocker locker(m_mutex);
+   if (m_owned && m_file)
+      fclose(m_file);
+   m_file = f;
+   m_owned = true;
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::setOutput
++-----------------------------------------------------------------------------*/
+/**
+* @brief setOutput Writes the records to f, which is not closed by the sink.
+*/
+inline void LC_StructuredSink::setOutput(FILE* f)
+{
+   LC_MutexLocker locker(m_mutex);
+   if (m_owned && m_file)
+      fclose(m_file);
+   m_file = f;
+   m_owned = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::close
++-----------------------------------------------------------------------------*/
+inline void LC_StructuredSink::close()
+{
+   LC_MutexLocker locker(m_mutex);
+   if (m_owned && m_file)
+      fclose(m_file);
+   m_file = NULL;
+   m_owned = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::appendKey
++-----------------------------------------------------------------------------*/
+inline void LC_StructuredSink::appendKey(std::string& out, LC_StructuredFormat format, const char* key)
+{
+   if (format == LC_STRUCTURED_JSON) {
+      out.append(out.empty() ? "{\"" : ",\"");
+      out.append(key);
+      out.append("\":");
+   }
+   else {
+      if (!out.empty())
+         out.push_back(' ');
+      out.append(key);
+      out.push_back('=');
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::appendString
++-----------------------------------------------------------------------------*/
+inline void LC_StructuredSink::appendString(std::string& out, LC_StructuredFormat format, const char* key,
+                                            const char* value, size_t size)
+{
+   appendKey(out, format, key);
+   if (format == LC_STRUCTURED_JSON) {
+      out.push_back('"');
+      lc_json_escape(out, value, size);
+      out.push_back('"');
+   }
+   else
+      lc_logfmt_value(out, value, size);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::appendNumber
++-----------------------------------------------------------------------------*/
+inline void LC_StructuredSink::appendNumber(std::string& out, LC_StructuredFormat format, const char* key,
+                                            unsigned long long value)
+{
+   char buffer[24];
+   const int size = snprintf(buffer, sizeof(buffer), "%llu", value);
+   appendKey(out, format, key);
+   out.append(buffer, (size_t)size);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::appendField
++-----------------------------------------------------------------------------*/
+inline void LC_StructuredSink::appendField(std::string& out, LC_StructuredFormat format, const LC_Field& field)
+{
+   const size_t keySize = strlen(field.key);
+   if (format == LC_STRUCTURED_JSON) {
+      out.append(",\"");
+      lc_json_escape(out, field.key, keySize);
+      out.append("\":");
+      if (field.type == LC_KV_STRING) {
+         out.push_back('"');
+         lc_json_escape(out, field.value.s.data, field.value.s.size);
+         out.push_back('"');
+      }
+      else if (field.type == LC_KV_DOUBLE && !std::isfinite(field.value.d))
+         out.append("null");
+      else
+         lc_append_field_value(out, field);
+      return;
+   }
+
+   // logfmt keys cannot be quoted.
+   out.push_back(' ');
+   for (size_t i = 0; i < keySize; i++) {
+      const unsigned char c = (unsigned char)field.key[i];
+      out.push_back((c <= ' ' || c == '=' || c == '"' || c == 0x7F) ? '_' : (char)c);
+   }
+   out.push_back('=');
+   if (field.type == LC_KV_STRING)
+      lc_logfmt_value(out, field.value.s.data, field.value.s.size);
+   else
+      lc_append_field_value(out, field);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::format
++-----------------------------------------------------------------------------*/
+/**
+* @brief format Appends logger to out as a single line, terminated by '\n'. out is
+* expected to be empty.
+*/
+inline void LC_StructuredSink::format(std::string& out, LC_StructuredFormat format, LC_Log& logger, va_list args)
+{
+   using namespace std::chrono;
+   LC_StageTimer timer(LC_STAGE_FORMAT);
+   char ts[64];
+   {
+      LC_StageTimer timestampTimer(LC_STAGE_TIMESTAMP);
+      const unsigned long long now = (unsigned long long)
+            duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+      struct tm timeinfo;
+      lc_utc_time((time_t)(now/1000000ULL), timeinfo);
+      snprintf(ts, sizeof(ts), "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ",
+               timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+               timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, (unsigned int)(now % 1000000ULL));
+   }
+   appendString(out, format, "ts", ts, strlen(ts));
+
+   if (logger.m_level != LC_LOG_NONE) {
+      const std::string level = LC_Log::toString(logger.m_level);
+      appendString(out, format, "level", level.data(), level.size());
+   }
+   if (logger.m_log_tag)
+      appendString(out, format, "tag", logger.m_log_tag, logger.tagLength());
+
+   if (logger.m_file) {
+      const char* file = lc_file_name(logger.m_file);
+      appendString(out, format, "file", file, strlen(file));
+      appendNumber(out, format, "line", (unsigned long long)logger.m_line);
+      if (logger.m_function)
+         appendString(out, format, "func", logger.m_function, strlen(logger.m_function));
+   }
+
+   appendNumber(out, format, "tid", lc_thread_id());
+   const char* thread = lc_thread_name();
+   if (*thread)
+      appendString(out, format, "thread", thread, strlen(thread));
+
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local std::string message;
+#else
+   static std::string message;
+#endif // LC_LOGGING_DISABLE_THREADING
+   message.clear();
+   lc_vformat(message, logger.message(), args);
+   appendString(out, format, "msg", message.data(), message.size());
+
+   logger.visitFields([&out, format](const LC_Field& field) { appendField(out, format, field); });
+
+   if (logger.m_stack) {
+      std::string frame;
+      if (format == LC_STRUCTURED_JSON)
+         out.append(",\"stack\":[");
+      else
+         message.clear();
+      for (unsigned int i = 0; i < logger.m_stack->size; i++) {
+         frame.clear();
+         LC_SymbolCache::instance().resolve(frame, logger.m_stack->frames[i]);
+         if (format == LC_STRUCTURED_JSON) {
+            out.append(i ? ",\"" : "\"");
+            lc_json_escape(out, frame.data(), frame.size());
+            out.push_back('"');
+         }
+         else
+            message.append(i ? "\n" : "").append(frame);
+      }
+      if (format == LC_STRUCTURED_JSON)
+         out.push_back(']');
+      else
+         appendString(out, format, "stack", message.data(), message.size());
+   }
+
+   if (format == LC_STRUCTURED_JSON)
+      out.push_back('}');
+   out.push_back('\n');
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_StructuredSink::lockForFork(void* sink)
+{
+   // Records are flushed as they are written: holding the lock is enough.
+   static_cast<LC_StructuredSink*>(sink)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_StructuredSink::unlockAfterFork(void* sink)
+{
+   static_cast<LC_StructuredSink*>(sink)->m_mutex.unlock();
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+/*------------------------------------------------------------------------------
+|    LC_StructuredSink::write
++-----------------------------------------------------------------------------*/
+inline void LC_StructuredSink::write(LC_Log& logger, va_list args)
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local std::string line;
+#else
+   static std::string line;
+#endif // LC_LOGGING_DISABLE_THREADING
+   line.clear();
+   format(line, m_format, logger, args);
+
+   // A single fwrite per record keeps lines whole with concurrent writers.
+   const LC_MetricsSink sink = (m_format == LC_STRUCTURED_JSON) ? LC_SINK_JSON : LC_SINK_LOGFMT;
+   LC_StageTimer timer(LC_STAGE_WRITE);
+   LC_MutexLocker locker(m_mutex);
+   if (!m_file) {
+      lc_metrics_write(sink, 0, false, 0);
+      return;
+   }
+   const bool written = fwrite(line.data(), 1, line.size(), m_file) == line.size();
+   lc_metrics_write(sink, line.size(), fflush(m_file) == 0 && written);
+}
+
+/*------------------------------------------------------------------------------
+|    log_to_json
++-----------------------------------------------------------------------------*/
+inline void log_to_json(LC_Log& logger, va_list args)
+{
+   LC_StructuredSink::json().write(logger, args);
+}
+
+/*------------------------------------------------------------------------------
+|    log_to_logfmt
++-----------------------------------------------------------------------------*/
+inline void log_to_logfmt(LC_Log& logger, va_list args)
+{
+   LC_StructuredSink::logfmt().write(logger, args);
+}
+
+}
+
+#endif // LC_LOGGING_JSON_H
@@ -0,0 +1,1452 @@
+/*
+ * Author:  Luca Carlon
+ * Company: -
+ * Date:    10.18.2026
+ *
+ * Copyright (c) 2013-2026, Luca Carlon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the author nor the
+ * names of its contributors may be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Network sink streaming records to a collector over TCP or UDP.
+ *
+ * Usage:
+ *    #include "lc_logging_net.h"
+ *    lightlogger::custom_log_func lightlogger::global_log_func = log_to_net;
+ *    ...
+ *    LC_NetSink::instance().setSpool("/var/spool/app.log", 4*1024*1024);
+ *    LC_NetSink::instance().start("collector.lan", 5170);
+ *
+ * Producers only format the record and append it to a bounded in-memory queue: all
+ * the I/O happens on a writer thread. When the queue is full records are dropped and
+ * counted. The writer sends the queue when it reaches the batch size or when the
+ * oldest record is older than the batch delay.
+ *
+ * Framing:
+ * - LC_NET_FRAME_TEXT: one line per record, with the layout of log_to_file by
+ *   default (see setLayout()). Newlines in the message are escaped as "\n".
+ * - LC_NET_FRAME_BINARY: 32 bit big endian length of the rest of the frame, followed
+ *   by version (1 byte), level (1 byte, 255 for none), tag length (16 bit), time in us
+ *   since epoch (64 bit), tag and message. See LC_NetSink::decode().
+ *
+ * When the collector cannot be reached the writer reconnects with exponential backoff
+ * and, if a spool file was set, appends the batches to it. Past the configured size the
+ * oldest records in the spool are dropped. The spool is sent before any new record
+ * once the connection is back. An incomplete frame at its end, e.g. left by a crash,
+ * is cut away when the writer starts.
+ *
+ * After fork() the child starts with an empty queue. Its own writer thread, connection
+ * and spool file (the path with ".<pid>" appended) are set up when it first uses the
+ * sink, see LC_ForkGuard.
+ *
+ * LC_NetCollector is a loopback server recording the frames it receives, so the sink
+ * can be tested without a real collector.
+ *
+ * Not available if LC_LOGGING_DISABLE_THREADING is defined.
+ */
+
+#ifndef LC_LOGGING_NET_H
+#define LC_LOGGING_NET_H
+
+/*------------------------------------------------------------------------------
+|    includes
++-----------------------------------------------------------------------------*/
+#include "lc_logging.h"
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE) && !defined(LC_LOGGING_DISABLE_THREADING)
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <new>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace lightlogger {
+
+/*------------------------------------------------------------------------------
+|    definitions
++-----------------------------------------------------------------------------*/
+enum LC_NetProtocol {
+   LC_NET_TCP,
+   LC_NET_UDP
+};
+
+enum LC_NetFraming {
+   LC_NET_FRAME_TEXT,
+   LC_NET_FRAME_BINARY
+};
+
+struct LC_NetRecord {
+   LC_LogLevel level;
+   unsigned long long timestamp;
+   std::string tag;
+   std::string message;
+};
+
+#define LC_NET_FRAME_VERSION     1
+#define LC_NET_FRAME_HEADER_SIZE 16
+
+// Frames in the spool that are larger are considered corrupt.
+#ifndef LC_NET_MAX_FRAME
+#define LC_NET_MAX_FRAME (16*1024*1024)
+#endif
+
+/*------------------------------------------------------------------------------
+|    lc_net_frame_size
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_net_frame_size Returns the size of the first frame in data or 0 if data
+* does not contain a full frame.
+*/
+inline size_t lc_net_frame_size(const char* data, size_t size, LC_NetFraming framing)
+{
+   if (framing == LC_NET_FRAME_TEXT) {
+      const char* nl = (const char*)memchr(data, '\n', size);
+      return nl ? (size_t)(nl - data) + 1 : 0;
+   }
+
+   if (size < 4)
+      return 0;
+   const unsigned char* p = (const unsigned char*)data;
+   const size_t length = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | (size_t)p[3];
+   return (size >= length + 4) ? length + 4 : 0;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_net_frame_corrupt
++-----------------------------------------------------------------------------*/
+/**
+* @brief lc_net_frame_corrupt Returns true if data, which does not contain a full
+* frame, cannot be the beginning of a frame of at most LC_NET_MAX_FRAME bytes.
+*/
+inline bool lc_net_frame_corrupt(const char* data, size_t size, LC_NetFraming framing)
+{
+   if (framing == LC_NET_FRAME_TEXT || size < 4)
+      return size >= LC_NET_MAX_FRAME;
+
+   const unsigned char* p = (const unsigned char*)data;
+   const size_t length = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | (size_t)p[3];
+   return length + 4 > LC_NET_MAX_FRAME;
+}
+
+/*------------------------------------------------------------------------------
+|    lc_net_append_be
++-----------------------------------------------------------------------------*/
+inline void lc_net_append_be(std::string& out, unsigned long long value, int bytes)
+{
+   for (int i = bytes - 1; i >= 0; i--)
+      out.push_back((char)((value >> (8*i)) & 0xFF));
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_NetSink class streams records to a collector from a writer thread.
+* Configure it before calling start().
+*/
+class LC_NetSink
+{
+public:
+   LC_NetSink();
+   ~LC_NetSink();
+
+   static LC_NetSink& instance();
+   static bool decode(const char* frame, size_t size, LC_NetRecord& record);
+
+   bool start(const std::string& host, unsigned short port,
+              LC_NetProtocol protocol = LC_NET_TCP,
+              LC_NetFraming framing = LC_NET_FRAME_TEXT);
+   void stop();
+
+   void setBatching(size_t maxBytes, unsigned int maxDelayMs);
+   void setQueueLimit(size_t bytes);
+   void setReconnectBackoff(unsigned int minMs, unsigned int maxMs);
+   void setSpool(const std::string& path, size_t maxBytes);
+   void setLayout(const char* pattern);
+
+   void write(LC_Log& logger, va_list args);
+   bool flush(unsigned int timeoutMs);
+
+   bool isConnected();
+   unsigned long long sent();
+   unsigned long long dropped();
+   unsigned long long spooled();
+
+private:
+   LC_NetSink(const LC_NetSink&);
+   LC_NetSink& operator =(const LC_NetSink&);
+
+   typedef std::chrono::steady_clock Clock;
+
+   void buildFrame(std::string& out, LC_Log& logger, va_list args);
+   void run();
+   bool connectSocket();
+   void closeSocket();
+   bool peerClosed();
+   bool sendAll(const char* data, size_t size);
+   bool sendFrames(const char* data, size_t size);
+   void spool(const std::string& data, size_t records);
+   bool replaySpool();
+   size_t scanSpool(int fd, size_t from, size_t cut, size_t& boundary, unsigned long long& records);
+   void repairSpool();
+   bool trimSpool(size_t bytes);
+   void adoptAfterFork(bool restart);
+   static void lockForFork(void* sink);
+   static void unlockAfterFork(void* sink);
+   static void resetAfterFork(void* sink);
+
+   // The writer thread and what it waits on. After fork() these belong to the parent
+   // and the child makes its own, see adoptAfterFork().
+   struct Writer {
+      std::thread thread;
+      std::condition_variable_any cond;
+      std::condition_variable_any drained;
+   };
+
+   LC_Mutex m_mutex;
+   Writer* m_writer;
+   bool m_forked;
+   bool m_running;
+   bool m_stopping;
+   bool m_flushRequested;
+   bool m_busy;
+
+   std::string m_host;
+   unsigned short m_port;
+   LC_NetProtocol m_protocol;
+   LC_NetFraming m_framing;
+   LC_Layout m_layout;
+   size_t m_batchBytes;
+   unsigned int m_batchDelay;
+   size_t m_queueLimit;
+   unsigned int m_backoffMin;
+   unsigned int m_backoffMax;
+   std::string m_spoolPath;
+   size_t m_spoolLimit;
+   size_t m_maxDatagram;
+
+   std::string m_queue;
+   size_t m_queueRecords;
+   Clock::time_point m_queueStart;
+
+   // Owned by the writer thread.
+   int m_fd;
+   bool m_connected;
+   unsigned int m_backoff;
+   Clock::time_point m_nextAttempt;
+   size_t m_spoolSize;
+   size_t m_spoolOffset;
+
+   unsigned long long m_sent;
+   unsigned long long m_dropped;
+   unsigned long long m_spooled;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::LC_NetSink
++-----------------------------------------------------------------------------*/
+inline LC_NetSink::LC_NetSink() :
+     m_writer(new Writer)
+   , m_forked(false)
+   , m_running(false)
+   , m_stopping(false)
+   , m_flushRequested(false)
+   , m_busy(false)
+   , m_port(0)
+   , m_protocol(LC_NET_TCP)
+   , m_framing(LC_NET_FRAME_TEXT)
+   , m_layout(LC_FILE_PATTERN)
+   , m_batchBytes(16*1024)
+   , m_batchDelay(100)
+   , m_queueLimit(1024*1024)
+   , m_backoffMin(100)
+   , m_backoffMax(30000)
+   , m_spoolLimit(0)
+   , m_maxDatagram(1400)
+   , m_queueRecords(0)
+   , m_fd(-1)
+   , m_connected(false)
+   , m_backoff(100)
+   , m_spoolSize(0)
+   , m_spoolOffset(0)
+   , m_sent(0)
+   , m_dropped(0)
+   , m_spooled(0)
+{
+   LC_ForkHandler handler = { &LC_NetSink::lockForFork,
+                              &LC_NetSink::unlockAfterFork,
+                              &LC_NetSink::resetAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::~LC_NetSink
++-----------------------------------------------------------------------------*/
+inline LC_NetSink::~LC_NetSink()
+{
+   LC_ForkGuard::instance().remove(this);
+   stop();
+   delete m_writer;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::instance
++-----------------------------------------------------------------------------*/
+inline LC_NetSink& LC_NetSink::instance()
+{
+   static LC_NetSink instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::start
++-----------------------------------------------------------------------------*/
+/**
+* @brief start Starts the writer thread. The connection is established by the writer,
+* so this never waits for the collector.
+* @return false if the sink was already started.
+*/
+inline bool LC_NetSink::start(const std::string& host, unsigned short port, LC_NetProtocol protocol, LC_NetFraming framing)
+{
+   LC_MutexLocker locker(m_mutex);
+   if (m_forked)
+      adoptAfterFork(true);
+   if (m_running)
+      return false;
+
+   m_host = host;
+   m_port = port;
+   m_protocol = protocol;
+   m_framing = framing;
+   m_stopping = false;
+   m_backoff = m_backoffMin;
+   m_nextAttempt = Clock::now();
+
+   // Data left in the spool by a previous run is sent as well.
+   m_spoolSize = 0;
+   m_spoolOffset = 0;
+   struct stat st;
+   if (!m_spoolPath.empty() && ::stat(m_spoolPath.c_str(), &st) == 0)
+      m_spoolSize = (size_t)st.st_size;
+
+   m_running = true;
+   m_writer->thread = std::thread(&LC_NetSink::run, this);
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::stop
++-----------------------------------------------------------------------------*/
+/**
+* @brief stop Sends or spools what is queued and stops the writer thread.
+*/
+inline void LC_NetSink::stop()
+{
+   {
+      LC_MutexLocker locker(m_mutex);
+      if (m_forked)
+         adoptAfterFork(false);
+      if (!m_running)
+         return;
+      m_stopping = true;
+   }
+
+   m_writer->cond.notify_all();
+   m_writer->thread.join();
+
+   LC_MutexLocker locker(m_mutex);
+   m_running = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::setBatching
++-----------------------------------------------------------------------------*/
+/**
+* @brief setBatching Sets when the writer sends the queued records.
+* @param maxBytes The queue is sent as soon as it holds this many bytes.
+* @param maxDelayMs Max time a record waits in the queue.
+*/
+inline void LC_NetSink::setBatching(size_t maxBytes, unsigned int maxDelayMs)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_batchBytes = maxBytes ? maxBytes : 1;
+   m_batchDelay = maxDelayMs;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::setQueueLimit
++-----------------------------------------------------------------------------*/
+/**
+* @brief setQueueLimit Sets the max size of the in-memory queue. Records not fitting
+* are dropped.
+*/
+inline void LC_NetSink::setQueueLimit(size_t bytes)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_queueLimit = bytes;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::setReconnectBackoff
++-----------------------------------------------------------------------------*/
+/**
+* @brief setReconnectBackoff Sets the delay before the first reconnection attempt and
+* the max delay it doubles up to.
+*/
+inline void LC_NetSink::setReconnectBackoff(unsigned int minMs, unsigned int maxMs)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_backoffMin = minMs ? minMs : 1;
+   m_backoffMax = std::max(m_backoffMin, maxMs);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::setSpool
++-----------------------------------------------------------------------------*/
+/**
+* @brief setSpool Sets the file used to keep records while the collector is down.
+* @param path Path of the spool file. An empty path disables spooling.
+* @param maxBytes Max size of the spool. The oldest records are dropped to make room
+* for new batches; batches larger than that are dropped.
+*/
+inline void LC_NetSink::setSpool(const std::string& path, size_t maxBytes)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_spoolPath = path;
+   m_spoolLimit = maxBytes;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::setLayout
++-----------------------------------------------------------------------------*/
+/**
+* @brief setLayout Sets the pattern of the text frames, see LC_Layout. Call it
+* before start().
+*/
+inline void LC_NetSink::setLayout(const char* pattern)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_layout.setPattern(pattern);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::isConnected
++-----------------------------------------------------------------------------*/
+inline bool LC_NetSink::isConnected()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_connected;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::sent
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_NetSink::sent()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_sent;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::dropped
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_NetSink::dropped()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_dropped;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::spooled
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_NetSink::spooled()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_spooled;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::write
++-----------------------------------------------------------------------------*/
+inline void LC_NetSink::write(LC_Log& logger, va_list args)
+{
+   // Format out of the lock: producers only contend on the append.
+   static thread_local std::string frame;
+   frame.clear();
+   buildFrame(frame, logger, args);
+
+   bool wake;
+   {
+      LC_StageTimer timer(LC_STAGE_WRITE);
+      LC_MutexLocker locker(m_mutex);
+      if (m_forked)
+         adoptAfterFork(true);
+      if (!m_running || m_queue.size() + frame.size() > m_queueLimit) {
+         m_dropped++;
+         lc_metrics_write(LC_SINK_NET, 0, false, 0);
+         return;
+      }
+
+      if (m_queue.empty())
+         m_queueStart = Clock::now();
+      m_queue.append(frame);
+      m_queueRecords++;
+      wake = m_queue.size() >= m_batchBytes;
+      lc_metrics_write(LC_SINK_NET, frame.size(), true, 0);
+      lc_metrics_queue(LC_SINK_NET, m_queueRecords);
+   }
+
+   if (wake)
+      m_writer->cond.notify_one();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::flush
++-----------------------------------------------------------------------------*/
+/**
+* @brief flush Asks the writer to send the queue now and waits for it.
+* @return true if the queue was handled within timeoutMs. Handled means sent, spooled
+* or dropped.
+*/
+inline bool LC_NetSink::flush(unsigned int timeoutMs)
+{
+   LC_MutexLocker locker(m_mutex);
+   if (m_forked)
+      adoptAfterFork(true);
+   if (!m_running)
+      return m_queue.empty();
+
+   m_flushRequested = true;
+   m_writer->cond.notify_one();
+   const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+   while (!m_queue.empty() || m_busy || m_flushRequested) {
+      if (m_writer->drained.wait_until(m_mutex, deadline) == std::cv_status::timeout)
+         return m_queue.empty() && !m_busy;
+   }
+
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::decode
++-----------------------------------------------------------------------------*/
+/**
+* @brief decode Decodes a frame produced with LC_NET_FRAME_BINARY.
+*/
+inline bool LC_NetSink::decode(const char* frame, size_t size, LC_NetRecord& record)
+{
+   if (size < LC_NET_FRAME_HEADER_SIZE || lc_net_frame_size(frame, size, LC_NET_FRAME_BINARY) != size)
+      return false;
+
+   const unsigned char* p = (const unsigned char*)frame;
+   if (p[4] != LC_NET_FRAME_VERSION)
+      return false;
+
+   record.level = (p[5] == 255) ? LC_LOG_NONE : (LC_LogLevel)p[5];
+   const size_t tagSize = ((size_t)p[6] << 8) | (size_t)p[7];
+   record.timestamp = 0;
+   for (int i = 8; i < 16; i++)
+      record.timestamp = (record.timestamp << 8) | p[i];
+   if (LC_NET_FRAME_HEADER_SIZE + tagSize > size)
+      return false;
+
+   record.tag.assign(frame + LC_NET_FRAME_HEADER_SIZE, tagSize);
+   record.message.assign(frame + LC_NET_FRAME_HEADER_SIZE + tagSize, size - LC_NET_FRAME_HEADER_SIZE - tagSize);
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::buildFrame
++-----------------------------------------------------------------------------*/
+inline void LC_NetSink::buildFrame(std::string& out, LC_Log& logger, va_list args)
+{
+   LC_StageTimer timer(LC_STAGE_FORMAT);
+   if (m_framing == LC_NET_FRAME_TEXT) {
+      // Formatted in place; newlines in the record are then escaped from the end,
+      // so that no temporary is needed.
+      const size_t start = out.size();
+      m_layout.format(out, logger, args);
+      const size_t newlines = (size_t)std::count(out.begin() + start, out.end(), '\n');
+      if (newlines) {
+         size_t from = out.size();
+         size_t to = from + newlines;
+         out.resize(to);
+         while (from > start) {
+            const char c = out[--from];
+            if (c == '\n') {
+               out[--to] = 'n';
+               out[--to] = '\\';
+            }
+            else
+               out[--to] = c;
+         }
+      }
+      out.push_back('\n');
+      return;
+   }
+
+   struct timeval tv;
+   gettimeofday(&tv, 0);
+   const size_t tagSize = std::min(logger.tagLength(), (size_t)0xFFFF);
+
+   out.append(4, '\0');
+   out.push_back((char)LC_NET_FRAME_VERSION);
+   out.push_back((char)((logger.m_level > LC_LOG_DEBUG) ? 255 : logger.m_level));
+   lc_net_append_be(out, tagSize, 2);
+   lc_net_append_be(out, (unsigned long long)tv.tv_sec*1000000ULL + (unsigned long long)tv.tv_usec, 8);
+   out.append(logger.m_log_tag ? logger.m_log_tag : "", tagSize);
+   lc_vformat(out, logger.m_string.c_str(), args);
+   logger.appendFields(out);
+   logger.appendStackTrace(out);
+
+   const size_t length = out.size() - 4;
+   for (int i = 0; i < 4; i++)
+      out[i] = (char)((length >> (8*(3 - i))) & 0xFF);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::run
++-----------------------------------------------------------------------------*/
+inline void LC_NetSink::run()
+{
+   std::string batch;
+   size_t batchRecords;
+
+   repairSpool();
+
+   m_mutex.lock();
+   for (;;) {
+      // Wait for a full batch, an expired batch, a reconnection or a stop.
+      for (;;) {
+         if (m_stopping || m_flushRequested || m_queue.size() >= m_batchBytes)
+            break;
+
+         const Clock::time_point now = Clock::now();
+         const bool pendingSpool = m_spoolSize > m_spoolOffset;
+         Clock::time_point wake = Clock::time_point::max();
+         if (!m_queue.empty())
+            wake = m_queueStart + std::chrono::milliseconds(m_batchDelay);
+         if (pendingSpool)
+            wake = std::min(wake, m_connected ? now : m_nextAttempt);
+         if (wake <= now)
+            break;
+
+         if (wake == Clock::time_point::max())
+            m_writer->cond.wait(m_mutex);
+         else
+            m_writer->cond.wait_until(m_mutex, wake);
+      }
+
+      batch.swap(m_queue);
+      m_queue.clear();
+      batchRecords = m_queueRecords;
+      m_queueRecords = 0;
+      const bool stopping = m_stopping;
+      m_flushRequested = false;
+      m_busy = true;
+      m_mutex.unlock();
+
+      const Clock::time_point now = Clock::now();
+      if (m_connected && peerClosed())
+         closeSocket();
+      if (!m_connected && (now >= m_nextAttempt || stopping)) {
+         if (connectSocket())
+            m_backoff = m_backoffMin;
+         else {
+            m_nextAttempt = now + std::chrono::milliseconds(m_backoff);
+            m_backoff = std::min(m_backoff*2, m_backoffMax);
+         }
+      }
+
+      bool sent = false;
+      if (m_connected && replaySpool())
+         sent = batch.empty() || sendFrames(batch.data(), batch.size());
+      if (!sent && m_connected) {
+         closeSocket();
+         m_nextAttempt = Clock::now() + std::chrono::milliseconds(m_backoff);
+      }
+      if (!sent && !batch.empty())
+         spool(batch, batchRecords);
+
+      if (sent && !batch.empty())
+         lc_metrics_flush(LC_SINK_NET);
+
+      m_mutex.lock();
+      if (sent)
+         m_sent += batchRecords;
+      m_busy = false;
+      m_writer->drained.notify_all();
+      if (stopping && m_queue.empty())
+         break;
+   }
+
+   m_mutex.unlock();
+   closeSocket();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_NetSink::lockForFork(void* sink)
+{
+   static_cast<LC_NetSink*>(sink)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_NetSink::unlockAfterFork(void* sink)
+{
+   static_cast<LC_NetSink*>(sink)->m_mutex.unlock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::resetAfterFork
++-----------------------------------------------------------------------------*/
+/**
+* @brief resetAfterFork Runs in the child, where only async-signal-safe calls are
+* allowed: the queue and the batch being sent belong to the parent, which sends them,
+* so they are dropped, and the connection of the parent is closed. The writer is set
+* up again when the child first uses the sink, see adoptAfterFork().
+*/
+inline void LC_NetSink::resetAfterFork(void* sink)
+{
+   LC_NetSink* self = static_cast<LC_NetSink*>(sink);
+   self->m_queue.clear();
+   self->m_queueRecords = 0;
+   self->m_flushRequested = false;
+   self->m_busy = false;
+
+   if (self->m_fd >= 0)
+      ::close(self->m_fd);
+   self->m_fd = -1;
+   self->m_connected = false;
+
+   self->m_forked = true;
+   self->m_mutex.unlock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::adoptAfterFork
++-----------------------------------------------------------------------------*/
+/**
+* @brief adoptAfterFork Called with the lock held the first time a child created with
+* fork() uses the sink. The writer thread of the parent does not exist here and the
+* condition variables may have been in use when fork() was called, so they cannot be
+* destroyed: they are left as they are and the child gets new ones. The child also
+* gets its own spool file, suffixed with the pid.
+* @param restart If true and the parent was running, the writer thread is started.
+*/
+inline void LC_NetSink::adoptAfterFork(bool restart)
+{
+   m_forked = false;
+   m_writer = new Writer;
+   m_backoff = m_backoffMin;
+   m_nextAttempt = Clock::now();
+
+   if (!m_spoolPath.empty()) {
+      char pid[24];
+      snprintf(pid, sizeof(pid), ".%lu", (unsigned long)getpid());
+      m_spoolPath.append(pid);
+   }
+   m_spoolSize = 0;
+   m_spoolOffset = 0;
+
+   if (restart && m_running && !m_stopping) {
+      m_writer->thread = std::thread(&LC_NetSink::run, this);
+      return;
+   }
+
+   m_running = false;
+   m_stopping = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::connectSocket
++-----------------------------------------------------------------------------*/
+inline bool LC_NetSink::connectSocket()
+{
+   struct addrinfo hints;
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = (m_protocol == LC_NET_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+
+   char port[8];
+   snprintf(port, sizeof(port), "%u", (unsigned int)m_port);
+
+   struct addrinfo* result = NULL;
+   if (getaddrinfo(m_host.c_str(), port, &hints, &result) != 0)
+      return false;
+
+   for (struct addrinfo* ai = result; ai && m_fd < 0; ai = ai->ai_next) {
+      m_fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (m_fd < 0)
+         continue;
+      fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+
+      // Connect with a timeout, then keep the socket blocking with a send timeout:
+      // only the writer thread waits on it.
+      const int flags = fcntl(m_fd, F_GETFL, 0);
+      fcntl(m_fd, F_SETFL, flags | O_NONBLOCK);
+      int r = ::connect(m_fd, ai->ai_addr, ai->ai_addrlen);
+      if (r != 0 && errno == EINPROGRESS) {
+         struct pollfd pfd;
+         pfd.fd = m_fd;
+         pfd.events = POLLOUT;
+         pfd.revents = 0;
+         int error = 0;
+         socklen_t len = sizeof(error);
+         if (::poll(&pfd, 1, 2000) == 1
+               && getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0
+               && error == 0)
+            r = 0;
+      }
+      fcntl(m_fd, F_SETFL, flags);
+
+      if (r != 0) {
+         ::close(m_fd);
+         m_fd = -1;
+         continue;
+      }
+
+      struct timeval timeout;
+      timeout.tv_sec = 2;
+      timeout.tv_usec = 0;
+      setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+      int one = 1;
+      setsockopt(m_fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+   }
+
+   freeaddrinfo(result);
+
+   LC_MutexLocker locker(m_mutex);
+   m_connected = m_fd >= 0;
+   return m_connected;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::closeSocket
++-----------------------------------------------------------------------------*/
+inline void LC_NetSink::closeSocket()
+{
+   if (m_fd >= 0)
+      ::close(m_fd);
+   m_fd = -1;
+
+   LC_MutexLocker locker(m_mutex);
+   m_connected = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::peerClosed
++-----------------------------------------------------------------------------*/
+/**
+* @brief peerClosed Checks if the collector closed the connection. Without this the
+* first batch after the collector went away would be accepted by the kernel and lost.
+*/
+inline bool LC_NetSink::peerClosed()
+{
+   if (m_protocol != LC_NET_TCP)
+      return false;
+
+   struct pollfd pfd;
+   pfd.fd = m_fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   if (::poll(&pfd, 1, 0) <= 0)
+      return false;
+   if (pfd.revents & (POLLERR | POLLHUP))
+      return true;
+
+   char c;
+   const ssize_t r = ::recv(m_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+   return r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::sendAll
++-----------------------------------------------------------------------------*/
+inline bool LC_NetSink::sendAll(const char* data, size_t size)
+{
+   while (size > 0) {
+      const ssize_t r = ::send(m_fd, data, size, MSG_NOSIGNAL);
+      if (r < 0) {
+         if (errno == EINTR)
+            continue;
+         return false;
+      }
+      data += r;
+      size -= (size_t)r;
+   }
+
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::sendFrames
++-----------------------------------------------------------------------------*/
+/**
+* @brief sendFrames Sends complete frames. Over UDP frames are packed in datagrams of
+* at most m_maxDatagram bytes; bigger frames are sent alone.
+*/
+inline bool LC_NetSink::sendFrames(const char* data, size_t size)
+{
+   if (m_protocol == LC_NET_TCP)
+      return sendAll(data, size);
+
+   size_t start = 0;
+   size_t end = 0;
+   while (end < size) {
+      const size_t frame = lc_net_frame_size(data + end, size - end, m_framing);
+      if (frame == 0)
+         return false;
+      if (end > start && end + frame - start > m_maxDatagram) {
+         if (::send(m_fd, data + start, end - start, MSG_NOSIGNAL) < 0)
+            return false;
+         start = end;
+      }
+      end += frame;
+   }
+
+   return end == start || ::send(m_fd, data + start, end - start, MSG_NOSIGNAL) >= 0;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::spool
++-----------------------------------------------------------------------------*/
+inline void LC_NetSink::spool(const std::string& data, size_t records)
+{
+   bool stored = false;
+   if (!m_spoolPath.empty() && data.size() <= m_spoolLimit && m_spoolSize + data.size() > m_spoolLimit)
+      trimSpool(m_spoolSize + data.size() - m_spoolLimit);
+   if (!m_spoolPath.empty() && m_spoolSize + data.size() <= m_spoolLimit) {
+      const int fd = ::open(m_spoolPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (fd >= 0) {
+         size_t written = 0;
+         while (written < data.size()) {
+            const ssize_t r = ::write(fd, data.data() + written, data.size() - written);
+            if (r < 0 && errno == EINTR)
+               continue;
+            if (r <= 0)
+               break;
+            written += (size_t)r;
+         }
+
+         stored = written == data.size();
+         if (stored)
+            m_spoolSize += data.size();
+         else if (ftruncate(fd, (off_t)m_spoolSize) != 0) {
+            // A partial frame would corrupt the spool and it cannot be cut away:
+            // stop spooling.
+            m_spoolSize = m_spoolLimit;
+         }
+         ::close(fd);
+      }
+   }
+
+   if (!stored)
+      lc_metrics_flush(LC_SINK_NET, records);
+
+   LC_MutexLocker locker(m_mutex);
+   if (stored)
+      m_spooled += records;
+   else
+      m_dropped += records;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::replaySpool
++-----------------------------------------------------------------------------*/
+/**
+* @brief replaySpool Sends the content of the spool and empties it.
+* @return true if the spool is empty when returning.
+*/
+inline bool LC_NetSink::replaySpool()
+{
+   if (m_spoolSize <= m_spoolOffset)
+      return true;
+
+   const int fd = ::open(m_spoolPath.c_str(), O_RDONLY);
+   if (fd < 0) {
+      m_spoolSize = m_spoolOffset = 0;
+      return true;
+   }
+
+   std::vector<char> buffer(64*1024);
+   size_t pending = 0;
+   unsigned long long records = 0;
+   bool ok = true;
+   if (lseek(fd, (off_t)m_spoolOffset, SEEK_SET) < 0)
+      ok = false;
+
+   while (ok) {
+      const ssize_t r = ::read(fd, &buffer[pending], buffer.size() - pending);
+      if (r < 0 && errno == EINTR)
+         continue;
+      if (r <= 0)
+         break;
+      pending += (size_t)r;
+
+      // Only send whole frames: the remaining bytes are kept for the next read.
+      size_t frames = 0;
+      for (size_t f; (f = lc_net_frame_size(&buffer[frames], pending - frames, m_framing)) > 0; records++)
+         frames += f;
+      if (frames == 0) {
+         if (lc_net_frame_corrupt(&buffer[0], pending, m_framing)) {
+            // Nothing after it can be framed: drop the rest of the spool.
+            pending = 0;
+            m_spoolOffset = m_spoolSize;
+            break;
+         }
+         if (pending == buffer.size())
+            buffer.resize(buffer.size()*2);
+         continue;
+      }
+
+      ok = sendFrames(&buffer[0], frames);
+      if (ok) {
+         m_spoolOffset += frames;
+         memmove(&buffer[0], &buffer[frames], pending - frames);
+         pending -= frames;
+      }
+   }
+
+   ::close(fd);
+   // An incomplete frame at the end would be prepended to the next batch spooled.
+   if (ok && pending)
+      m_spoolOffset = m_spoolSize;
+   if (ok && m_spoolOffset >= m_spoolSize) {
+      if (truncate(m_spoolPath.c_str(), 0) == 0)
+         m_spoolSize = m_spoolOffset = 0;
+   }
+
+   LC_MutexLocker locker(m_mutex);
+   if (ok)
+      m_sent += records;
+   return ok && m_spoolSize == 0;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::scanSpool
++-----------------------------------------------------------------------------*/
+/**
+* @brief scanSpool Reads the frames of the spool file fd starting at offset from.
+* @param cut Offset where boundary is searched from.
+* @param boundary Set to the end of the frame containing cut, or to the returned
+* offset if that frame is not complete.
+* @param records Set to the number of frames before boundary.
+* @return The end of the last complete frame: what follows is incomplete or corrupt.
+*/
+inline size_t LC_NetSink::scanSpool(int fd, size_t from, size_t cut, size_t& boundary, unsigned long long& records)
+{
+   boundary = from;
+   records = 0;
+   if (lseek(fd, (off_t)from, SEEK_SET) < 0)
+      return from;
+
+   std::vector<char> buffer(64*1024);
+   size_t position = from;
+   size_t pending = 0;
+   for (;;) {
+      const ssize_t r = ::read(fd, &buffer[pending], buffer.size() - pending);
+      if (r < 0 && errno == EINTR)
+         continue;
+      if (r <= 0)
+         break;
+      pending += (size_t)r;
+
+      size_t used = 0;
+      for (size_t f; (f = lc_net_frame_size(&buffer[used], pending - used, m_framing)) > 0; used += f) {
+         if (position + used < cut) {
+            boundary = position + used + f;
+            records++;
+         }
+      }
+      memmove(&buffer[0], &buffer[used], pending - used);
+      position += used;
+      pending -= used;
+
+      if (lc_net_frame_corrupt(&buffer[0], pending, m_framing))
+         break;
+      if (pending == buffer.size())
+         buffer.resize(buffer.size()*2);
+   }
+
+   boundary = std::min(std::max(boundary, cut), position);
+   return position;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::repairSpool
++-----------------------------------------------------------------------------*/
+/**
+* @brief repairSpool Cuts away what follows the last complete frame of the spool, e.g.
+* a frame that was being written when the process crashed. New batches are appended
+* after it, so it would break the framing of the whole spool.
+*/
+inline void LC_NetSink::repairSpool()
+{
+   if (m_spoolSize == 0)
+      return;
+
+   const int fd = ::open(m_spoolPath.c_str(), O_RDWR);
+   if (fd < 0) {
+      m_spoolSize = m_spoolOffset = 0;
+      return;
+   }
+
+   size_t boundary;
+   unsigned long long records;
+   const size_t end = scanSpool(fd, 0, 0, boundary, records);
+   if (end < m_spoolSize) {
+      if (ftruncate(fd, (off_t)end) == 0)
+         m_spoolSize = end;
+      else if (::unlink(m_spoolPath.c_str()) == 0)
+         m_spoolSize = 0;
+      else
+         // Neither can be cut away: do not spool.
+         m_spoolSize = m_spoolLimit;
+   }
+   ::close(fd);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetSink::trimSpool
++-----------------------------------------------------------------------------*/
+/**
+* @brief trimSpool Drops the oldest frames of the spool, at least bytes bytes, by
+* copying the others to a new file.
+* @return false if the spool was left as it was.
+*/
+inline bool LC_NetSink::trimSpool(size_t bytes)
+{
+   const int fd = ::open(m_spoolPath.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   size_t boundary;
+   unsigned long long records;
+   const size_t end = scanSpool(fd, m_spoolOffset, m_spoolOffset + bytes, boundary, records);
+   const std::string path = m_spoolPath + ".tmp";
+   const int out = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   bool ok = out >= 0 && lseek(fd, (off_t)boundary, SEEK_SET) >= 0;
+
+   char buffer[64*1024];
+   size_t copied = 0;
+   while (ok && boundary + copied < end) {
+      const ssize_t r = ::read(fd, buffer, std::min(sizeof(buffer), end - boundary - copied));
+      if (r < 0 && errno == EINTR)
+         continue;
+      ok = r > 0;
+      for (ssize_t written = 0; ok && written < r; ) {
+         const ssize_t w = ::write(out, buffer + written, (size_t)(r - written));
+         if (w < 0 && errno == EINTR)
+            continue;
+         ok = w > 0;
+         written += w;
+      }
+      if (ok)
+         copied += (size_t)r;
+   }
+
+   ::close(fd);
+   if (out >= 0)
+      ::close(out);
+   if (!ok || ::rename(path.c_str(), m_spoolPath.c_str()) != 0) {
+      ::unlink(path.c_str());
+      return false;
+   }
+
+   m_spoolSize = copied;
+   m_spoolOffset = 0;
+   lc_metrics_flush(LC_SINK_NET, records);
+
+   LC_MutexLocker locker(m_mutex);
+   m_dropped += records;
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    log_to_net
++-----------------------------------------------------------------------------*/
+inline void log_to_net(LC_Log& logger, va_list args)
+{
+   LC_NetSink::instance().write(logger, args);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetCollector class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_NetCollector class is a loopback server recording the frames sent by
+* LC_NetSink. Text frames are stored without the trailing newline, binary frames as
+* they were received, so they can be decoded with LC_NetSink::decode().
+*/
+class LC_NetCollector
+{
+public:
+   LC_NetCollector(LC_NetProtocol protocol = LC_NET_TCP,
+                   LC_NetFraming framing = LC_NET_FRAME_TEXT,
+                   unsigned short port = 0);
+   ~LC_NetCollector();
+
+   bool isValid() const { return m_listener >= 0; }
+   unsigned short port() const { return m_port; }
+
+   std::vector<std::string> frames();
+   bool waitForFrames(size_t count, unsigned int timeoutMs);
+   void stop();
+
+private:
+   LC_NetCollector(const LC_NetCollector&);
+   LC_NetCollector& operator =(const LC_NetCollector&);
+
+   void run();
+   void consume(std::string& buffer);
+
+   LC_NetProtocol m_protocol;
+   LC_NetFraming m_framing;
+   int m_listener;
+   int m_wakeup[2];
+   unsigned short m_port;
+   std::thread m_thread;
+
+   LC_Mutex m_mutex;
+   std::condition_variable_any m_cond;
+   std::vector<std::string> m_frames;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_NetCollector::LC_NetCollector
++-----------------------------------------------------------------------------*/
+/**
+* @brief LC_NetCollector Binds 127.0.0.1 and starts serving.
+* @param port Port to listen on. 0 picks a free one, see port().
+*/
+inline LC_NetCollector::LC_NetCollector(LC_NetProtocol protocol, LC_NetFraming framing, unsigned short port) :
+     m_protocol(protocol)
+   , m_framing(framing)
+   , m_listener(-1)
+   , m_port(0)
+{
+   m_wakeup[0] = m_wakeup[1] = -1;
+
+   const int fd = ::socket(AF_INET, protocol == LC_NET_TCP ? SOCK_STREAM : SOCK_DGRAM, 0);
+   if (fd < 0)
+      return;
+
+   int one = 1;
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port = htons(port);
+   socklen_t len = sizeof(addr);
+   if (::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+         || (protocol == LC_NET_TCP && ::listen(fd, 8) != 0)
+         || getsockname(fd, (struct sockaddr*)&addr, &len) != 0
+         || pipe(m_wakeup) != 0) {
+      ::close(fd);
+      return;
+   }
+
+   m_listener = fd;
+   m_port = ntohs(addr.sin_port);
+   m_thread = std::thread(&LC_NetCollector::run, this);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetCollector::~LC_NetCollector
++-----------------------------------------------------------------------------*/
+inline LC_NetCollector::~LC_NetCollector()
+{
+   stop();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetCollector::stop
++-----------------------------------------------------------------------------*/
+/**
+* @brief stop Closes the listener and all the connections. The sink sees the
+* collector going down.
+*/
+inline void LC_NetCollector::stop()
+{
+   if (m_listener < 0)
+      return;
+
+   const char c = 0;
+   if (::write(m_wakeup[1], &c, 1) == 1)
+      m_thread.join();
+   else
+      m_thread.detach();
+
+   ::close(m_listener);
+   ::close(m_wakeup[0]);
+   ::close(m_wakeup[1]);
+   m_listener = -1;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetCollector::frames
++-----------------------------------------------------------------------------*/
+inline std::vector<std::string> LC_NetCollector::frames()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_frames;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetCollector::waitForFrames
++-----------------------------------------------------------------------------*/
+/**
+* @brief waitForFrames Waits until at least count frames were received.
+*/
+inline bool LC_NetCollector::waitForFrames(size_t count, unsigned int timeoutMs)
+{
+   LC_MutexLocker locker(m_mutex);
+   const std::chrono::steady_clock::time_point deadline =
+         std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+   while (m_frames.size() < count) {
+      if (m_cond.wait_until(m_mutex, deadline) == std::cv_status::timeout)
+         return m_frames.size() >= count;
+   }
+
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetCollector::consume
++-----------------------------------------------------------------------------*/
+inline void LC_NetCollector::consume(std::string& buffer)
+{
+   size_t offset = 0;
+   size_t frame;
+   LC_MutexLocker locker(m_mutex);
+   while ((frame = lc_net_frame_size(buffer.data() + offset, buffer.size() - offset, m_framing)) > 0) {
+      const size_t size = (m_framing == LC_NET_FRAME_TEXT) ? frame - 1 : frame;
+      m_frames.push_back(buffer.substr(offset, size));
+      offset += frame;
+   }
+
+   buffer.erase(0, offset);
+   m_cond.notify_all();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_NetCollector::run
++-----------------------------------------------------------------------------*/
+inline void LC_NetCollector::run()
+{
+   std::vector<int> clients;
+   std::vector<std::string> buffers;
+   std::vector<char> chunk(64*1024);
+
+   for (;;) {
+      std::vector<struct pollfd> fds(2 + clients.size());
+      fds[0].fd = m_wakeup[0];
+      fds[1].fd = m_listener;
+      for (size_t i = 0; i < clients.size(); i++)
+         fds[2 + i].fd = clients[i];
+      for (size_t i = 0; i < fds.size(); i++) {
+         fds[i].events = POLLIN;
+         fds[i].revents = 0;
+      }
+
+      if (::poll(&fds[0], fds.size(), -1) < 0) {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+      if (fds[0].revents)
+         break;
+
+      if (fds[1].revents & POLLIN) {
+         if (m_protocol == LC_NET_TCP) {
+            const int client = ::accept(m_listener, NULL, NULL);
+            if (client >= 0) {
+               clients.push_back(client);
+               buffers.push_back(std::string());
+            }
+         }
+         else {
+            const ssize_t r = ::recv(m_listener, &chunk[0], chunk.size(), 0);
+            if (r > 0) {
+               std::string datagram(&chunk[0], (size_t)r);
+               consume(datagram);
+            }
+         }
+      }
+
+      // Only the clients polled: one accepted above has no entry in fds.
+      for (size_t i = fds.size() - 2; i-- > 0;) {
+         if (!fds[2 + i].revents)
+            continue;
+         const ssize_t r = ::recv(clients[i], &chunk[0], chunk.size(), 0);
+         if (r > 0) {
+            buffers[i].append(&chunk[0], (size_t)r);
+            consume(buffers[i]);
+            continue;
+         }
+         if (r < 0 && errno == EINTR)
+            continue;
+         ::close(clients[i]);
+         clients.erase(clients.begin() + (long)i);
+         buffers.erase(buffers.begin() + (long)i);
+      }
+   }
+
+   for (size_t i = 0; i < clients.size(); i++)
+      ::close(clients[i]);
+}
+
+}
+
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE) && !defined(LC_LOGGING_DISABLE_THREADING)
+
+#endif // LC_LOGGING_NET_H
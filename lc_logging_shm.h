@@ -0,0 +1,653 @@
+/*
+ * Author:  Luca Carlon
+ * Company: -
+ * Date:    10.18.2026
+ *
+ * Copyright (c) 2013-2026, Luca Carlon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the author nor the
+ * names of its contributors may be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Sink publishing records into a POSIX shared-memory ring, and the reader used to
+ * consume them from another process (see tools/lc_logtail).
+ *
+ * Usage:
+ *    #include "lc_logging_shm.h"
+ *    lightlogger::custom_log_func lightlogger::global_log_func = log_to_shm;
+ *    ...
+ *    LC_ShmSink::instance().open("/myapp.log");
+ *
+ * The producer formats the record and copies it into the ring: it never does any
+ * I/O and never waits for readers. Readers that fall behind are overrun: they detect
+ * it through the sequence numbers and resume from the oldest record still available.
+ *
+ * Layout: a LC_ShmHeader of LC_SHM_HEADER_SIZE bytes followed by the ring. The ring
+ * contains LC_ShmRecord headers, each followed by the tag and the message. Positions
+ * are 64 bit and never wrap; the offset in the ring is position % capacity. A record
+ * never crosses the end of the ring: the writer fills the gap with a padding record,
+ * or leaves it empty when it is smaller than a LC_ShmRecord.
+ *
+ * Only one process can write a segment: a child created with fork() unmaps the segment
+ * of the parent, without removing it, and logs nothing until it opens its own (see
+ * LC_ForkGuard). With glibc older than 2.34 link -lrt.
+ */
+
+#ifndef LC_LOGGING_SHM_H
+#define LC_LOGGING_SHM_H
+
+/*------------------------------------------------------------------------------
+|    includes
++-----------------------------------------------------------------------------*/
+#include "lc_logging.h"
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE) && !defined(__ANDROID__)
+#include <string>
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace lightlogger {
+
+/*------------------------------------------------------------------------------
+|    definitions
++-----------------------------------------------------------------------------*/
+#define LC_SHM_MAGIC        "LCSHMLOG"
+#define LC_SHM_VERSION      1
+#define LC_SHM_HEADER_SIZE  256
+#define LC_SHM_PADDING      -1
+
+#ifndef LC_SHM_MAX_RECORD
+#define LC_SHM_MAX_RECORD   4096
+#endif
+// Largest record: header, tag of up to 255 bytes and message, rounded up to 8.
+#define LC_SHM_RECORD_LIMIT ((sizeof(LC_ShmRecord) + 255 + LC_SHM_MAX_RECORD + 7) & ~(size_t)7)
+
+/*------------------------------------------------------------------------------
+|    LC_ShmHeader struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_ShmHeader struct is at the beginning of the segment. head and tail are
+* on their own cache lines: head is where the next record will be written, tail is the
+* oldest record not yet overwritten. The writer moves tail before overwriting data and
+* moves head after a record is complete.
+*/
+struct LC_ShmHeader {
+   char magic[8];
+   unsigned int version;
+   unsigned int headerSize;
+   unsigned long long capacity;
+   unsigned int maxRecord;
+   unsigned int pid;
+   char reserved1[32];
+   std::atomic<unsigned long long> tail;
+   char reserved2[56];
+   std::atomic<unsigned long long> head;
+   char reserved3[56];
+   std::atomic<unsigned long long> sequence;
+   char reserved4[56];
+};
+
+/*------------------------------------------------------------------------------
+|    LC_ShmRecord struct
++-----------------------------------------------------------------------------*/
+struct LC_ShmRecord {
+   unsigned int size;           // Size of the record, header included. Multiple of 8.
+   unsigned int length;         // Size of the message.
+   unsigned long long sequence;
+   unsigned long long time;     // us since epoch.
+   int level;                   // LC_LogLevel or LC_SHM_PADDING.
+   unsigned short tagLength;
+   unsigned short reserved;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_ShmEntry struct
++-----------------------------------------------------------------------------*/
+struct LC_ShmEntry {
+   unsigned long long sequence;
+   unsigned long long time;
+   LC_LogLevel level;
+   std::string tag;
+   std::string message;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_ShmSink class publishes records in a shared-memory segment.
+*/
+class LC_ShmSink
+{
+public:
+   LC_ShmSink();
+   ~LC_ShmSink();
+
+   static LC_ShmSink& instance();
+
+   bool open(const char* name, size_t capacity = 4*1024*1024);
+   void close(bool unlink = true);
+   bool isOpen();
+
+   void write(LC_Log& logger, va_list args);
+
+private:
+   LC_ShmSink(const LC_ShmSink&);
+   LC_ShmSink& operator =(const LC_ShmSink&);
+
+   void ensureFree(unsigned long long size);
+
+   static void lockForFork(void* sink);
+   static void unlockAfterFork(void* sink);
+   static void detachAfterFork(void* sink);
+
+   LC_Mutex m_mutex;
+   std::string m_name;
+   LC_ShmHeader* m_header;
+   char* m_ring;
+   size_t m_mapSize;
+   unsigned long long m_capacity;
+   unsigned long long m_head;
+   unsigned long long m_tail;
+   unsigned long long m_sequence;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::LC_ShmSink
++-----------------------------------------------------------------------------*/
+inline LC_ShmSink::LC_ShmSink() :
+     m_header(NULL)
+   , m_ring(NULL)
+   , m_mapSize(0)
+   , m_capacity(0)
+   , m_head(0)
+   , m_tail(0)
+   , m_sequence(0)
+{
+   LC_ForkHandler handler = { &LC_ShmSink::lockForFork,
+                              &LC_ShmSink::unlockAfterFork,
+                              &LC_ShmSink::detachAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::~LC_ShmSink
++-----------------------------------------------------------------------------*/
+inline LC_ShmSink::~LC_ShmSink()
+{
+   LC_ForkGuard::instance().remove(this);
+   close();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::instance
++-----------------------------------------------------------------------------*/
+inline LC_ShmSink& LC_ShmSink::instance()
+{
+   static LC_ShmSink instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::open
++-----------------------------------------------------------------------------*/
+/**
+* @brief open Creates the segment, replacing any existing one with the same name.
+* @param name Name for shm_open(), e.g. "/myapp.log".
+* @param capacity Size of the ring, rounded up to a power of two and to at least four
+* records of the largest size.
+*/
+inline bool LC_ShmSink::open(const char* name, size_t capacity)
+{
+   LC_MutexLocker locker(m_mutex);
+   if (m_header)
+      return false;
+
+   unsigned long long ringSize = 4096;
+   while (ringSize < capacity || ringSize < 4*LC_SHM_RECORD_LIMIT)
+      ringSize <<= 1;
+
+   shm_unlink(name);
+   const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+   if (fd < 0)
+      return false;
+
+   const size_t mapSize = LC_SHM_HEADER_SIZE + (size_t)ringSize;
+   void* p = MAP_FAILED;
+   if (ftruncate(fd, (off_t)mapSize) == 0)
+      p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (p == MAP_FAILED) {
+      shm_unlink(name);
+      return false;
+   }
+
+   m_name = name;
+   m_mapSize = mapSize;
+   m_capacity = ringSize;
+   m_head = m_tail = m_sequence = 0;
+   m_ring = (char*)p + LC_SHM_HEADER_SIZE;
+   m_header = new (p) LC_ShmHeader;
+   m_header->version = LC_SHM_VERSION;
+   m_header->headerSize = LC_SHM_HEADER_SIZE;
+   m_header->capacity = ringSize;
+   m_header->maxRecord = LC_SHM_MAX_RECORD;
+   m_header->pid = (unsigned int)getpid();
+   m_header->tail.store(0, std::memory_order_relaxed);
+   m_header->head.store(0, std::memory_order_relaxed);
+   m_header->sequence.store(0, std::memory_order_relaxed);
+
+   // Readers check the magic last.
+   std::atomic_thread_fence(std::memory_order_release);
+   memcpy(m_header->magic, LC_SHM_MAGIC, sizeof(m_header->magic));
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::close
++-----------------------------------------------------------------------------*/
+/**
+* @brief close Unmaps the segment.
+* @param unlink If true the segment is also removed. Readers that have it mapped
+* keep reading what is in it.
+*/
+inline void LC_ShmSink::close(bool unlink)
+{
+   LC_MutexLocker locker(m_mutex);
+   if (!m_header)
+      return;
+
+   munmap(m_header, m_mapSize);
+   if (unlink)
+      shm_unlink(m_name.c_str());
+   m_header = NULL;
+   m_ring = NULL;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::isOpen
++-----------------------------------------------------------------------------*/
+inline bool LC_ShmSink::isOpen()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_header != NULL;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::ensureFree
++-----------------------------------------------------------------------------*/
+/**
+* @brief ensureFree Moves the tail until size bytes after the head are free.
+*/
+inline void LC_ShmSink::ensureFree(unsigned long long size)
+{
+   const unsigned long long tail = m_tail;
+   while (m_head + size - m_tail > m_capacity) {
+      const unsigned long long offset = m_tail & (m_capacity - 1);
+      if (m_capacity - offset < sizeof(LC_ShmRecord))
+         m_tail += m_capacity - offset;
+      else
+         m_tail += ((const LC_ShmRecord*)(m_ring + offset))->size;
+   }
+
+   if (m_tail != tail)
+      m_header->tail.store(m_tail, std::memory_order_release);
+   // The data must not be overwritten before readers can see the new tail.
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::write
++-----------------------------------------------------------------------------*/
+inline void LC_ShmSink::write(LC_Log& logger, va_list args)
+{
+   LC_StageTimer timer(LC_STAGE_FORMAT);
+   char message[LC_SHM_MAX_RECORD];
+   va_list copy;
+   va_copy(copy, args);
+   int length = vsnprintf(message, sizeof(message), logger.m_string.c_str(), copy);
+   va_end(copy);
+   if (length < 0)
+      return;
+   if ((size_t)length >= sizeof(message))
+      length = (int)sizeof(message) - 1;
+   if (logger.hasFields() || logger.m_stack) {
+      std::string fields;
+      logger.appendFields(fields);
+      logger.appendStackTrace(fields);
+      const size_t size = std::min(fields.size(), sizeof(message) - 1 - (size_t)length);
+      memcpy(message + length, fields.data(), size);
+      length += (int)size;
+   }
+
+   struct timeval tv;
+   gettimeofday(&tv, 0);
+
+   LC_ShmRecord record;
+   record.length = (unsigned int)length;
+   record.time = (unsigned long long)tv.tv_sec*1000000ULL + (unsigned long long)tv.tv_usec;
+   record.level = (int)logger.m_level;
+   record.tagLength = (unsigned short)std::min(logger.tagLength(), (size_t)255);
+   record.reserved = 0;
+   record.size = (unsigned int)((sizeof(record) + record.tagLength + record.length + 7) & ~(size_t)7);
+
+   LC_StageTimer writeTimer(LC_STAGE_WRITE);
+   LC_MutexLocker locker(m_mutex);
+   lc_metrics_write(LC_SINK_SHM, record.size, m_header != NULL, 0);
+   if (!m_header)
+      return;
+
+   // ensureFree() never returns for a record larger than the ring. open() makes the
+   // ring large enough; cut the message in case the limits were changed.
+   if (record.size > m_capacity/4) {
+      record.length = (unsigned int)(m_capacity/4 - sizeof(record) - record.tagLength) & ~7U;
+      record.size = (unsigned int)((sizeof(record) + record.tagLength + record.length + 7) & ~(size_t)7);
+   }
+
+   unsigned long long offset = m_head & (m_capacity - 1);
+   if (m_capacity - offset < record.size) {
+      // Not enough room before the end of the ring: pad and restart at 0.
+      const unsigned long long gap = m_capacity - offset;
+      ensureFree(gap);
+      if (gap >= sizeof(LC_ShmRecord)) {
+         LC_ShmRecord padding;
+         memset(&padding, 0, sizeof(padding));
+         padding.size = (unsigned int)gap;
+         padding.level = LC_SHM_PADDING;
+         memcpy(m_ring + offset, &padding, sizeof(padding));
+      }
+      m_head += gap;
+      m_header->head.store(m_head, std::memory_order_release);
+      offset = 0;
+   }
+
+   ensureFree(record.size);
+   record.sequence = m_sequence++;
+   char* p = m_ring + offset;
+   memcpy(p, &record, sizeof(record));
+   memcpy(p + sizeof(record), logger.m_log_tag, record.tagLength);
+   memcpy(p + sizeof(record) + record.tagLength, message, record.length);
+
+   m_head += record.size;
+   m_header->sequence.store(m_sequence, std::memory_order_relaxed);
+   m_header->head.store(m_head, std::memory_order_release);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_ShmSink::lockForFork(void* sink)
+{
+   static_cast<LC_ShmSink*>(sink)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_ShmSink::unlockAfterFork(void* sink)
+{
+   static_cast<LC_ShmSink*>(sink)->m_mutex.unlock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmSink::detachAfterFork
++-----------------------------------------------------------------------------*/
+/**
+* @brief detachAfterFork Runs in the child: the segment still belongs to the parent,
+* which keeps writing head and sequence, so the child unmaps it without removing it
+* and drops its records until open() is called again.
+*/
+inline void LC_ShmSink::detachAfterFork(void* context)
+{
+   LC_ShmSink* sink = static_cast<LC_ShmSink*>(context);
+   if (sink->m_header)
+      munmap(sink->m_header, sink->m_mapSize);
+   sink->m_header = NULL;
+   sink->m_ring = NULL;
+   sink->m_mutex.unlock();
+}
+
+/*------------------------------------------------------------------------------
+|    log_to_shm
++-----------------------------------------------------------------------------*/
+inline void log_to_shm(LC_Log& logger, va_list args)
+{
+   LC_ShmSink::instance().write(logger, args);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmReader class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_ShmReader class reads the records published by a LC_ShmSink, possibly
+* from another process. It never writes to the segment.
+*/
+class LC_ShmReader
+{
+public:
+   LC_ShmReader();
+   ~LC_ShmReader();
+
+   bool open(const char* name);
+   void close();
+   bool isOpen() const { return m_header != NULL; }
+   unsigned int producerPid() const { return m_header ? m_header->pid : 0; }
+
+   void seekToStart();
+   void seekToEnd();
+   bool next(LC_ShmEntry& entry);
+
+   unsigned long long lost() const { return m_lost; }
+
+private:
+   LC_ShmReader(const LC_ShmReader&);
+   LC_ShmReader& operator =(const LC_ShmReader&);
+
+   const LC_ShmHeader* m_header;
+   const char* m_ring;
+   size_t m_mapSize;
+   unsigned long long m_capacity;
+   unsigned long long m_position;
+   unsigned long long m_expected;
+   bool m_synced;
+   unsigned long long m_lost;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_ShmReader::LC_ShmReader
++-----------------------------------------------------------------------------*/
+inline LC_ShmReader::LC_ShmReader() :
+     m_header(NULL)
+   , m_ring(NULL)
+   , m_mapSize(0)
+   , m_capacity(0)
+   , m_position(0)
+   , m_expected(0)
+   , m_synced(false)
+   , m_lost(0)
+{
+   // Do nothing.
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmReader::~LC_ShmReader
++-----------------------------------------------------------------------------*/
+inline LC_ShmReader::~LC_ShmReader()
+{
+   close();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmReader::open
++-----------------------------------------------------------------------------*/
+/**
+* @brief open Maps the segment read-only and positions the reader on the oldest
+* record. Fails if the segment was not created by a compatible version.
+*/
+inline bool LC_ShmReader::open(const char* name)
+{
+   close();
+
+   const int fd = shm_open(name, O_RDONLY, 0);
+   if (fd < 0)
+      return false;
+
+   struct stat st;
+   void* p = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && (size_t)st.st_size > LC_SHM_HEADER_SIZE)
+      p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (p == MAP_FAILED)
+      return false;
+
+   const LC_ShmHeader* header = (const LC_ShmHeader*)p;
+   std::atomic_thread_fence(std::memory_order_acquire);
+   if (memcmp(header->magic, LC_SHM_MAGIC, sizeof(header->magic)) != 0
+         || header->version != LC_SHM_VERSION
+         || header->headerSize != LC_SHM_HEADER_SIZE
+         || header->capacity + LC_SHM_HEADER_SIZE > (unsigned long long)st.st_size) {
+      munmap(p, (size_t)st.st_size);
+      return false;
+   }
+
+   m_header = header;
+   m_ring = (const char*)p + LC_SHM_HEADER_SIZE;
+   m_mapSize = (size_t)st.st_size;
+   m_capacity = header->capacity;
+   m_lost = 0;
+   seekToStart();
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmReader::close
++-----------------------------------------------------------------------------*/
+inline void LC_ShmReader::close()
+{
+   if (!m_header)
+      return;
+
+   munmap((void*)m_header, m_mapSize);
+   m_header = NULL;
+   m_ring = NULL;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmReader::seekToStart
++-----------------------------------------------------------------------------*/
+inline void LC_ShmReader::seekToStart()
+{
+   m_position = m_header ? m_header->tail.load(std::memory_order_acquire) : 0;
+   m_synced = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmReader::seekToEnd
++-----------------------------------------------------------------------------*/
+inline void LC_ShmReader::seekToEnd()
+{
+   m_position = m_header ? m_header->head.load(std::memory_order_acquire) : 0;
+   m_synced = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_ShmReader::next
++-----------------------------------------------------------------------------*/
+/**
+* @brief next Reads the next record.
+* @return false if there is no new record. When the writer overran the reader, the
+* reader skips to the oldest available record and the number of skipped records is
+* added to lost().
+*/
+inline bool LC_ShmReader::next(LC_ShmEntry& entry)
+{
+   if (!m_header)
+      return false;
+
+   for (;;) {
+      const unsigned long long head = m_header->head.load(std::memory_order_acquire);
+      if (m_position >= head)
+         return false;
+
+      unsigned long long tail = m_header->tail.load(std::memory_order_acquire);
+      if (m_position < tail)
+         m_position = tail;
+
+      const unsigned long long offset = m_position & (m_capacity - 1);
+      if (m_capacity - offset < sizeof(LC_ShmRecord)) {
+         m_position += m_capacity - offset;
+         continue;
+      }
+
+      LC_ShmRecord record;
+      memcpy(&record, m_ring + offset, sizeof(record));
+      const bool valid = record.size >= sizeof(record) && record.size <= m_capacity - offset
+            && sizeof(record) + record.tagLength + record.length <= record.size;
+      if (valid && record.level != LC_SHM_PADDING) {
+         entry.tag.assign(m_ring + offset + sizeof(record), record.tagLength);
+         entry.message.assign(m_ring + offset + sizeof(record) + record.tagLength, record.length);
+      }
+
+      // If the tail moved past this record while it was copied, the copy may be torn.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      tail = m_header->tail.load(std::memory_order_relaxed);
+      if (m_position < tail) {
+         m_position = tail;
+         continue;
+      }
+      if (!valid) {
+         // Should never happen with a single writer: start again from the newest.
+         m_position = head;
+         m_synced = false;
+         continue;
+      }
+
+      m_position += record.size;
+      if (record.level == LC_SHM_PADDING)
+         continue;
+
+      if (m_synced && record.sequence > m_expected)
+         m_lost += record.sequence - m_expected;
+      m_synced = true;
+      m_expected = record.sequence + 1;
+
+      entry.sequence = record.sequence;
+      entry.time = record.time;
+      entry.level = (LC_LogLevel)record.level;
+      return true;
+   }
+}
+
+}
+
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE) && !defined(__ANDROID__)
+
+#endif // LC_LOGGING_SHM_H
@@ -0,0 +1,931 @@
+/*
+ * Author:  Luca Carlon
+ * Company: -
+ * Date:    10.18.2026
+ *
+ * Copyright (c) 2013-2026, Luca Carlon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the author nor the
+ * names of its contributors may be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Syslog and journald sink writing datagrams to a local Unix socket.
+ *
+ * Usage:
+ *    #include "lc_logging_syslog.h"
+ *    lightlogger::custom_log_func lightlogger::global_log_func = log_to_syslog;
+ *
+ * By default records are sent as RFC 5424 to /dev/log. Call
+ * LC_SyslogSink::instance().open(NULL, LC_SYSLOG_JOURNALD) to use the journald
+ * native protocol on /run/systemd/journal/socket instead. The log tag is used as
+ * the identifier (APP-NAME or SYSLOG_IDENTIFIER).
+ *
+ * Records are batched and sent with sendmmsg() where available. A batch is sent when
+ * it is full, when the oldest record is older than the flush interval, when a record
+ * of level error or critical is logged, or on flush(). There is no timer thread: call
+ * flush(true) periodically to bound how long a quiet process holds its last records.
+ * If the socket buffer is full, the sink waits for the socket to become writable for
+ * at most the backpressure timeout and drops what is left afterwards. While the
+ * daemon is down, a connection is attempted at most once per reconnect interval and
+ * the records are dropped meanwhile; drops are counted by dropped() and the metrics.
+ *
+ * After fork() the child drops the records still pending, which the parent sends,
+ * and connects its own socket when it logs first (see LC_ForkGuard).
+ *
+ * LC_DatagramRecorder can be bound to any path and used as a stand-in for the daemon.
+ */
+
+#ifndef LC_LOGGING_SYSLOG_H
+#define LC_LOGGING_SYSLOG_H
+
+/*------------------------------------------------------------------------------
+|    includes
++-----------------------------------------------------------------------------*/
+#include "lc_logging.h"
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace lightlogger {
+
+/*------------------------------------------------------------------------------
+|    definitions
++-----------------------------------------------------------------------------*/
+enum LC_SyslogFormat {
+   LC_SYSLOG_RFC5424,
+   LC_SYSLOG_JOURNALD
+};
+
+// Values from RFC 5424. <syslog.h> is not included as its macros clash with the
+// LOG_* macros of lc_logging.h.
+enum LC_SyslogFacility {
+   LC_SYSLOG_FAC_KERN =   0,
+   LC_SYSLOG_FAC_USER =   1,
+   LC_SYSLOG_FAC_DAEMON = 3,
+   LC_SYSLOG_FAC_LOCAL0 = 16,
+   LC_SYSLOG_FAC_LOCAL1 = 17,
+   LC_SYSLOG_FAC_LOCAL2 = 18,
+   LC_SYSLOG_FAC_LOCAL3 = 19,
+   LC_SYSLOG_FAC_LOCAL4 = 20,
+   LC_SYSLOG_FAC_LOCAL5 = 21,
+   LC_SYSLOG_FAC_LOCAL6 = 22,
+   LC_SYSLOG_FAC_LOCAL7 = 23
+};
+
+#define LC_SYSLOG_PATH   "/dev/log"
+#define LC_JOURNALD_PATH "/run/systemd/journal/socket"
+
+/*------------------------------------------------------------------------------
+|    lc_monotonic_ms
++-----------------------------------------------------------------------------*/
+inline unsigned long long lc_monotonic_ms()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec*1000ULL + (unsigned long long)ts.tv_nsec/1000000ULL;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_SyslogSink class sends records to syslog or journald. Use instance()
+* and log_to_syslog() unless you need more than one socket.
+*/
+class LC_SyslogSink
+{
+public:
+   LC_SyslogSink();
+   ~LC_SyslogSink();
+
+   static LC_SyslogSink& instance();
+   static int toSeverity(LC_LogLevel level);
+
+   bool open(const char* path = NULL, LC_SyslogFormat format = LC_SYSLOG_RFC5424);
+   void close();
+   bool isOpen();
+
+   void setIdentifier(const std::string& identifier);
+   void setFacility(LC_SyslogFacility facility);
+   void setBatchSize(size_t size);
+   void setFlushInterval(unsigned int ms);
+   void setBackpressureTimeout(unsigned int ms);
+   void setReconnectInterval(unsigned int ms);
+
+   void write(LC_Log& logger, va_list args);
+   void flush(bool overdueOnly = false);
+
+   unsigned long long sent();
+   unsigned long long dropped();
+
+private:
+   LC_SyslogSink(const LC_SyslogSink&);
+   LC_SyslogSink& operator =(const LC_SyslogSink&);
+
+   bool connectSocket();
+   bool reconnect();
+   void closeSocket();
+   bool waitWritable(unsigned long long deadline);
+   void flushLocked();
+   void appendIdentifier(std::string& out, const char* tag, bool rfc5424);
+   void buildRfc5424(std::string& out, LC_Log& logger);
+   void buildJournald(std::string& out, LC_Log& logger);
+   static void appendStructuredData(std::string& out, LC_Log& logger);
+   static void appendJournaldField(std::string& out, const char* name, const char* data, size_t size);
+
+   static void lockForFork(void* sink);
+   static void unlockAfterFork(void* sink);
+   static void resetAfterFork(void* sink);
+
+   LC_Mutex m_mutex;
+   int m_fd;
+   std::string m_path;
+   LC_SyslogFormat m_format;
+   std::string m_identifier;
+   std::string m_hostname;
+   LC_SyslogFacility m_facility;
+   size_t m_batchSize;
+   unsigned int m_flushInterval;
+   unsigned int m_backpressureTimeout;
+   unsigned int m_reconnectInterval;
+   unsigned long long m_lastFailure;
+
+   std::string m_message;
+   std::vector<std::string> m_pending;
+   size_t m_count;
+   unsigned long long m_batchStart;
+   unsigned long long m_sent;
+   unsigned long long m_dropped;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::LC_SyslogSink
++-----------------------------------------------------------------------------*/
+inline LC_SyslogSink::LC_SyslogSink() :
+     m_fd(-1)
+   , m_path(LC_SYSLOG_PATH)
+   , m_format(LC_SYSLOG_RFC5424)
+   , m_facility(LC_SYSLOG_FAC_USER)
+   , m_batchSize(32)
+   , m_flushInterval(200)
+   , m_backpressureTimeout(100)
+   , m_reconnectInterval(1000)
+   , m_lastFailure(0)
+   , m_count(0)
+   , m_batchStart(0)
+   , m_sent(0)
+   , m_dropped(0)
+{
+#ifdef __GLIBC__
+   m_identifier = program_invocation_short_name;
+#else
+   m_identifier = "lightlogger";
+#endif
+
+   char hostname[256] = { 0 };
+   if (gethostname(hostname, sizeof(hostname) - 1) == 0 && hostname[0])
+      m_hostname = hostname;
+   else
+      m_hostname = "-";
+
+   LC_ForkHandler handler = { &LC_SyslogSink::lockForFork,
+                              &LC_SyslogSink::unlockAfterFork,
+                              &LC_SyslogSink::resetAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::~LC_SyslogSink
++-----------------------------------------------------------------------------*/
+inline LC_SyslogSink::~LC_SyslogSink()
+{
+   LC_ForkGuard::instance().remove(this);
+   close();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::instance
++-----------------------------------------------------------------------------*/
+inline LC_SyslogSink& LC_SyslogSink::instance()
+{
+   static LC_SyslogSink instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::toSeverity
++-----------------------------------------------------------------------------*/
+/**
+* @brief toSeverity Maps a LC_LogLevel to a syslog severity. Records with no level
+* (formatted logs) are notices.
+*/
+inline int LC_SyslogSink::toSeverity(LC_LogLevel level)
+{
+   static const int severities [] = {
+      // Do not mess with the order. Must map the LC_LogLevel enum.
+      2, // LOG_CRIT
+      3, // LOG_ERR
+      4, // LOG_WARNING
+      6, // LOG_INFO
+      6, // LOG_INFO
+      7  // LOG_DEBUG
+   };
+
+   return (level > LC_LOG_DEBUG || level < 0) ? 5 : severities[level];
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::open
++-----------------------------------------------------------------------------*/
+/**
+* @brief open Connects the sink to the daemon socket.
+* @param path The socket path. If NULL the default path for format is used.
+* @param format The datagram format.
+* @return true if the socket could be connected.
+*/
+inline bool LC_SyslogSink::open(const char* path, LC_SyslogFormat format)
+{
+   LC_MutexLocker locker(m_mutex);
+   flushLocked();
+   closeSocket();
+
+   m_format = format;
+   if (path)
+      m_path = path;
+   else
+      m_path = (format == LC_SYSLOG_JOURNALD) ? LC_JOURNALD_PATH : LC_SYSLOG_PATH;
+
+   m_lastFailure = 0;
+   if (connectSocket())
+      return true;
+   m_lastFailure = lc_monotonic_ms();
+   return false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::close
++-----------------------------------------------------------------------------*/
+inline void LC_SyslogSink::close()
+{
+   LC_MutexLocker locker(m_mutex);
+   flushLocked();
+   closeSocket();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::isOpen
++-----------------------------------------------------------------------------*/
+inline bool LC_SyslogSink::isOpen()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_fd >= 0;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::setIdentifier
++-----------------------------------------------------------------------------*/
+/**
+* @brief setIdentifier Sets the identifier used for records with no log tag.
+*/
+inline void LC_SyslogSink::setIdentifier(const std::string& identifier)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_identifier = identifier;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::setFacility
++-----------------------------------------------------------------------------*/
+inline void LC_SyslogSink::setFacility(LC_SyslogFacility facility)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_facility = facility;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::setBatchSize
++-----------------------------------------------------------------------------*/
+/**
+* @brief setBatchSize Sets the max number of records sent with a single syscall. 1
+* disables batching.
+*/
+inline void LC_SyslogSink::setBatchSize(size_t size)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_batchSize = size ? size : 1;
+   if (m_count >= m_batchSize)
+      flushLocked();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::setFlushInterval
++-----------------------------------------------------------------------------*/
+/**
+* @brief setFlushInterval Sets the max age in ms of a pending record. The age is
+* checked when a record is written and by flush(true): there is no timer thread.
+*/
+inline void LC_SyslogSink::setFlushInterval(unsigned int ms)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_flushInterval = ms;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::setBackpressureTimeout
++-----------------------------------------------------------------------------*/
+/**
+* @brief setBackpressureTimeout Sets how long in ms a flush waits for a full socket
+* buffer to drain before dropping the remaining records. 0 drops immediately.
+*/
+inline void LC_SyslogSink::setBackpressureTimeout(unsigned int ms)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_backpressureTimeout = ms;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::setReconnectInterval
++-----------------------------------------------------------------------------*/
+/**
+* @brief setReconnectInterval Sets how long in ms the sink waits after failing to
+* connect before trying again. The records logged meanwhile are dropped.
+*/
+inline void LC_SyslogSink::setReconnectInterval(unsigned int ms)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_reconnectInterval = ms;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::sent
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_SyslogSink::sent()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_sent;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::dropped
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_SyslogSink::dropped()
+{
+   LC_MutexLocker locker(m_mutex);
+   return m_dropped;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::write
++-----------------------------------------------------------------------------*/
+inline void LC_SyslogSink::write(LC_Log& logger, va_list args)
+{
+   LC_MutexLocker locker(m_mutex);
+   if (m_fd < 0 && !reconnect()) {
+      m_dropped++;
+      lc_metrics_write(LC_SINK_SYSLOG, 0, false, 0);
+      return;
+   }
+
+   {
+      LC_StageTimer timer(LC_STAGE_FORMAT);
+      m_message.clear();
+      lc_vformat(m_message, logger.m_string.c_str(), args);
+      logger.appendStackTrace(m_message);
+
+      if (m_count >= m_pending.size())
+         m_pending.resize(m_count + 1);
+      std::string& datagram = m_pending[m_count++];
+      datagram.clear();
+      if (m_format == LC_SYSLOG_JOURNALD)
+         buildJournald(datagram, logger);
+      else
+         buildRfc5424(datagram, logger);
+      lc_metrics_write(LC_SINK_SYSLOG, datagram.size(), true, 0);
+      lc_metrics_queue(LC_SINK_SYSLOG, m_count);
+   }
+
+   const unsigned long long now = lc_monotonic_ms();
+   if (m_count == 1)
+      m_batchStart = now;
+
+   if (m_count >= m_batchSize
+         || logger.m_level <= LC_LOG_ERROR
+         || now - m_batchStart >= m_flushInterval)
+      flushLocked();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::flush
++-----------------------------------------------------------------------------*/
+/**
+* @brief flush Sends the pending records.
+* @param overdueOnly If true, they are sent only if the oldest is older than the flush
+* interval. As the age is otherwise checked only when a record is written, call this
+* from a timer so that a quiet process does not hold its last records.
+*/
+inline void LC_SyslogSink::flush(bool overdueOnly)
+{
+   LC_MutexLocker locker(m_mutex);
+   if (overdueOnly && (m_count == 0 || lc_monotonic_ms() - m_batchStart < m_flushInterval))
+      return;
+   flushLocked();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::connectSocket
++-----------------------------------------------------------------------------*/
+inline bool LC_SyslogSink::connectSocket()
+{
+   struct sockaddr_un addr;
+   if (m_path.size() >= sizeof(addr.sun_path))
+      return false;
+
+   m_fd = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+   if (m_fd < 0)
+      return false;
+   fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   memcpy(addr.sun_path, m_path.c_str(), m_path.size());
+   if (::connect(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      closeSocket();
+      return false;
+   }
+
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::reconnect
++-----------------------------------------------------------------------------*/
+/**
+* @brief reconnect Connects the socket unless the last attempt failed less than the
+* reconnect interval ago, so that a daemon that is down does not cost a socket() and
+* a connect() per record.
+*/
+inline bool LC_SyslogSink::reconnect()
+{
+   const unsigned long long now = lc_monotonic_ms();
+   if (m_lastFailure && now - m_lastFailure < m_reconnectInterval)
+      return false;
+
+   if (connectSocket()) {
+      m_lastFailure = 0;
+      return true;
+   }
+
+   m_lastFailure = now;
+   return false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::closeSocket
++-----------------------------------------------------------------------------*/
+inline void LC_SyslogSink::closeSocket()
+{
+   if (m_fd >= 0)
+      ::close(m_fd);
+   m_fd = -1;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::waitWritable
++-----------------------------------------------------------------------------*/
+inline bool LC_SyslogSink::waitWritable(unsigned long long deadline)
+{
+   for (;;) {
+      const unsigned long long now = lc_monotonic_ms();
+      if (now >= deadline)
+         return false;
+
+      struct pollfd pfd;
+      pfd.fd = m_fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      const int r = ::poll(&pfd, 1, (int)(deadline - now));
+      if (r > 0)
+         return (pfd.revents & POLLOUT) != 0;
+      if (r == 0 || errno != EINTR)
+         return false;
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::flushLocked
++-----------------------------------------------------------------------------*/
+inline void LC_SyslogSink::flushLocked()
+{
+   if (m_count == 0)
+      return;
+
+   LC_StageTimer timer(LC_STAGE_WRITE);
+   if (m_fd < 0 && !reconnect()) {
+      lc_metrics_flush(LC_SINK_SYSLOG, m_count);
+      m_dropped += m_count;
+      m_count = 0;
+      return;
+   }
+
+   const unsigned long long deadline = lc_monotonic_ms() + m_backpressureTimeout;
+   bool reconnected = false;
+   size_t done = 0;
+   size_t rejected = 0;
+
+#ifdef __linux__
+   struct iovec iovecs[64];
+   struct mmsghdr headers[64];
+#endif
+
+   while (done < m_count) {
+      int r;
+#ifdef __linux__
+      const size_t n = std::min(m_count - done, sizeof(headers)/sizeof(headers[0]));
+      memset(headers, 0, n*sizeof(headers[0]));
+      for (size_t i = 0; i < n; i++) {
+         std::string& d = m_pending[done + i];
+         iovecs[i].iov_base = &d[0];
+         iovecs[i].iov_len = d.size();
+         headers[i].msg_hdr.msg_iov = &iovecs[i];
+         headers[i].msg_hdr.msg_iovlen = 1;
+      }
+      r = ::sendmmsg(m_fd, headers, (unsigned int)n, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+      const std::string& d = m_pending[done];
+      r = (::send(m_fd, d.data(), d.size(), MSG_DONTWAIT) < 0) ? -1 : 1;
+#endif
+      if (r > 0) {
+         done += (size_t)r;
+         m_sent += (unsigned long long)r;
+         continue;
+      }
+
+      if (errno == EINTR)
+         continue;
+      if ((errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) && waitWritable(deadline))
+         continue;
+      if (errno == EMSGSIZE) {
+         // Record does not fit a datagram: drop it and go on with the others.
+         m_dropped++;
+         rejected++;
+         done++;
+         continue;
+      }
+      if ((errno == ECONNREFUSED || errno == ENOTCONN || errno == ENOENT) && !reconnected) {
+         // Daemon restarted.
+         reconnected = true;
+         closeSocket();
+         if (reconnect())
+            continue;
+      }
+
+      break;
+   }
+
+   m_dropped += m_count - done;
+   lc_metrics_flush(LC_SINK_SYSLOG, m_count - done + rejected);
+   m_count = 0;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::appendIdentifier
++-----------------------------------------------------------------------------*/
+inline void LC_SyslogSink::appendIdentifier(std::string& out, const char* tag, bool rfc5424)
+{
+   const char* ident = (tag && tag[0]) ? tag : m_identifier.c_str();
+   const size_t start = out.size();
+   for (const char* c = ident; *c; c++) {
+      // RFC 5424 APP-NAME is up to 48 printable chars with no spaces.
+      if (rfc5424 && out.size() - start >= 48)
+         break;
+      const bool printable = *c > 32 && *c < 127;
+      out.push_back((printable || (!rfc5424 && *c == ' ')) ? *c : '_');
+   }
+   if (out.size() == start)
+      out.push_back('-');
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::buildRfc5424
++-----------------------------------------------------------------------------*/
+/**
+* @brief buildRfc5424 Builds <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID - - MSG.
+*/
+inline void LC_SyslogSink::buildRfc5424(std::string& out, LC_Log& logger)
+{
+   struct timeval tv;
+   gettimeofday(&tv, 0);
+   struct tm t;
+   lc_utc_time((time_t)tv.tv_sec, t);
+
+   char header[96];
+   const int n = snprintf(header, sizeof(header), "<%d>1 %04d-%02d-%02dT%02d:%02d:%02d.%06ldZ ",
+                          (int)m_facility*8 + toSeverity(logger.m_level),
+                          t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+                          t.tm_hour, t.tm_min, t.tm_sec, (long)tv.tv_usec);
+   out.append(header, (size_t)n);
+   out.append(m_hostname);
+   out.push_back(' ');
+   appendIdentifier(out, logger.m_log_tag, true);
+
+   char pid[32];
+   const int p = snprintf(pid, sizeof(pid), " %ld - ", (long)getpid());
+   out.append(pid, (size_t)p);
+   appendStructuredData(out, logger);
+   out.push_back(' ');
+   out.append(m_message);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::appendStructuredData
++-----------------------------------------------------------------------------*/
+/**
+* @brief appendStructuredData Appends the key-value fields of logger as an RFC 5424
+* SD-ELEMENT, or the nil value if there are none. Characters not allowed in names
+* are replaced by '_'.
+*/
+inline void LC_SyslogSink::appendStructuredData(std::string& out, LC_Log& logger)
+{
+   if (!logger.hasFields()) {
+      out.push_back('-');
+      return;
+   }
+
+   // 32473 is the private enterprise number reserved for documentation (RFC 5612).
+   out.append("[fields@32473");
+   logger.visitFields([&out](const LC_Field& field) {
+      out.push_back(' ');
+      for (size_t j = 0; field.key[j] && j < 32; j++) {
+         const char c = field.key[j];
+         out.push_back((c > 32 && c < 127 && c != '=' && c != ']' && c != '"') ? c : '_');
+      }
+      out.append("=\"");
+
+      std::string value;
+      lc_append_field_value(value, field);
+      for (size_t j = 0; j < value.size(); j++) {
+         if (value[j] == '"' || value[j] == '\\' || value[j] == ']')
+            out.push_back('\\');
+         out.push_back(value[j]);
+      }
+      out.push_back('"');
+   });
+   out.push_back(']');
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::buildJournald
++-----------------------------------------------------------------------------*/
+/**
+* @brief buildJournald Builds a datagram of the journald native protocol. Key-value
+* fields become journal fields.
+*/
+inline void LC_SyslogSink::buildJournald(std::string& out, LC_Log& logger)
+{
+   char fields[96];
+   const int n = snprintf(fields, sizeof(fields), "PRIORITY=%d\nSYSLOG_FACILITY=%d\nSYSLOG_PID=%ld\n",
+                          toSeverity(logger.m_level), (int)m_facility, (long)getpid());
+   out.append(fields, (size_t)n);
+   out.append("SYSLOG_IDENTIFIER=");
+   appendIdentifier(out, logger.m_log_tag, false);
+   out.push_back('\n');
+
+   appendJournaldField(out, "MESSAGE", m_message.data(), m_message.size());
+
+   // Field names are upper case letters, digits and '_', not starting with '_' or a
+   // digit, which are reserved or invalid.
+   logger.visitFields([&out](const LC_Field& field) {
+      std::string name;
+      for (size_t j = 0; field.key[j] && name.size() < 64; j++) {
+         const char c = field.key[j];
+         if (c >= 'a' && c <= 'z')
+            name.push_back((char)(c - 'a' + 'A'));
+         else if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+            name.push_back(c);
+         else
+            name.push_back('_');
+      }
+      if (name.empty() || name[0] == '_' || (name[0] >= '0' && name[0] <= '9'))
+         name.insert(0, "F");
+
+      std::string value;
+      lc_append_field_value(value, field);
+      appendJournaldField(out, name.c_str(), value.data(), value.size());
+   });
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::appendJournaldField
++-----------------------------------------------------------------------------*/
+/**
+* @brief appendJournaldField Appends a field of the journald native protocol. Values
+* with newlines are length-prefixed, as required by the protocol.
+*/
+inline void LC_SyslogSink::appendJournaldField(std::string& out, const char* name, const char* data, size_t size)
+{
+   out.append(name);
+   if (memchr(data, '\n', size) == NULL) {
+      out.push_back('=');
+      out.append(data, size);
+   }
+   else {
+      out.push_back('\n');
+      unsigned long long length = size;
+      for (int i = 0; i < 8; i++) {
+         out.push_back((char)(length & 0xFF));
+         length >>= 8;
+      }
+      out.append(data, size);
+   }
+   out.push_back('\n');
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_SyslogSink::lockForFork(void* sink)
+{
+   static_cast<LC_SyslogSink*>(sink)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_SyslogSink::unlockAfterFork(void* sink)
+{
+   static_cast<LC_SyslogSink*>(sink)->m_mutex.unlock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_SyslogSink::resetAfterFork
++-----------------------------------------------------------------------------*/
+/**
+* @brief resetAfterFork Runs in the child: the pending records are a copy of the ones
+* the parent sends, so they are dropped without counting them. The inherited socket is
+* closed and a new one is connected on the next write.
+*/
+inline void LC_SyslogSink::resetAfterFork(void* context)
+{
+   LC_SyslogSink* sink = static_cast<LC_SyslogSink*>(context);
+   sink->m_pending.clear();
+   sink->m_count = 0;
+   sink->m_batchStart = 0;
+   sink->closeSocket();
+   sink->m_mutex.unlock();
+}
+
+/*------------------------------------------------------------------------------
+|    log_to_syslog
++-----------------------------------------------------------------------------*/
+inline void log_to_syslog(LC_Log& logger, va_list args)
+{
+   LC_SyslogSink::instance().write(logger, args);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_DatagramRecorder class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_DatagramRecorder class binds a Unix datagram socket and records what
+* it receives. It can be used in place of the syslog or journald daemon to check what
+* LC_SyslogSink sends.
+*/
+class LC_DatagramRecorder
+{
+public:
+   LC_DatagramRecorder(const std::string& path, int receiveBuffer = 0);
+   ~LC_DatagramRecorder();
+
+   bool isValid() const { return m_fd >= 0; }
+   const std::string& path() const { return m_path; }
+
+   size_t collect(int timeoutMs = 0);
+   const std::vector<std::string>& records() const { return m_records; }
+   void clear() { m_records.clear(); }
+
+private:
+   LC_DatagramRecorder(const LC_DatagramRecorder&);
+   LC_DatagramRecorder& operator =(const LC_DatagramRecorder&);
+
+   int m_fd;
+   std::string m_path;
+   std::vector<std::string> m_records;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_DatagramRecorder::LC_DatagramRecorder
++-----------------------------------------------------------------------------*/
+/**
+* @brief LC_DatagramRecorder Binds the socket.
+* @param path Path of the socket. Any existing file is removed.
+* @param receiveBuffer Size of the receive buffer. A small value can be used to make
+* the socket fill quickly. 0 keeps the system default.
+*/
+inline LC_DatagramRecorder::LC_DatagramRecorder(const std::string& path, int receiveBuffer) :
+     m_fd(-1)
+   , m_path(path)
+{
+   struct sockaddr_un addr;
+   if (path.size() >= sizeof(addr.sun_path))
+      return;
+
+   m_fd = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+   if (m_fd < 0)
+      return;
+   if (receiveBuffer > 0)
+      setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+
+   ::unlink(path.c_str());
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   memcpy(addr.sun_path, path.c_str(), path.size());
+   if (::bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      ::close(m_fd);
+      m_fd = -1;
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    LC_DatagramRecorder::~LC_DatagramRecorder
++-----------------------------------------------------------------------------*/
+inline LC_DatagramRecorder::~LC_DatagramRecorder()
+{
+   if (m_fd < 0)
+      return;
+   ::close(m_fd);
+   ::unlink(m_path.c_str());
+}
+
+/*------------------------------------------------------------------------------
+|    LC_DatagramRecorder::collect
++-----------------------------------------------------------------------------*/
+/**
+* @brief collect Reads all the datagrams currently queued on the socket.
+* @param timeoutMs Time to wait for the first datagram if none is queued.
+* @return The number of datagrams read.
+*/
+inline size_t LC_DatagramRecorder::collect(int timeoutMs)
+{
+   if (m_fd < 0)
+      return 0;
+
+   size_t count = 0;
+   std::vector<char> buffer(256*1024);
+   for (;;) {
+      struct pollfd pfd;
+      pfd.fd = m_fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      const int r = ::poll(&pfd, 1, count ? 0 : timeoutMs);
+      if (r < 0 && errno == EINTR)
+         continue;
+      if (r <= 0)
+         break;
+
+      const ssize_t size = ::recv(m_fd, &buffer[0], buffer.size(), MSG_DONTWAIT);
+      if (size < 0)
+         break;
+      m_records.push_back(std::string(&buffer[0], (size_t)size));
+      count++;
+   }
+
+   return count;
+}
+
+}
+
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+#endif // LC_LOGGING_SYSLOG_H
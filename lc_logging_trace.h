@@ -0,0 +1,745 @@
+/*
+ * Author:  Luca Carlon
+ * Company: -
+ * Date:    10.18.2026
+ *
+ * Copyright (c) 2013-2026, Luca Carlon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the author nor the
+ * names of its contributors may be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * Scoped timing of code regions, written as Chrome trace events (JSON Array Format) to
+ * be opened with chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Usage:
+ *    #define ENABLE_TRACE_EVENTS
+ *    #include "lc_logging_trace.h"
+ *    ...
+ *    LC_TraceSink::instance().open("trace.json");
+ *    ...
+ *    void decode() {
+ *       LC_TRACE_FUNC;
+ *       ...
+ *       {
+ *          LC_TRACE_SCOPE("decode.header");
+ *          ...
+ *       }
+ *    }
+ *    ...
+ *    LC_TraceSink::instance().close();
+ *
+ * Each scope becomes a complete event ("ph":"X") with its begin and duration, the
+ * process and thread ids, the tag (LOG_TAG or LC_TRACE_SCOPE_T) as category and the
+ * nesting depth as argument. Names and tags are not copied: they must be literals or
+ * outlive the sink. Threads named with lc_set_thread_name() get a thread_name event.
+ *
+ * Events are appended to a buffer of the thread without locks and written when it is
+ * full (LC_TRACE_BUFFER_EVENTS, 1024 by default), when the thread exits and on flush()
+ * and close(). The file is valid JSON once closed; the viewers also accept it when the
+ * process ended without closing it.
+ *
+ * Without ENABLE_TRACE_EVENTS the macros compile to nothing. With it, a scope costs a
+ * single branch while the sink is closed or disabled with setEnabled(false), and two
+ * reads of the steady clock otherwise. Children created with fork() do not trace until
+ * open() is called again.
+ */
+
+#ifndef LC_LOGGING_TRACE_H
+#define LC_LOGGING_TRACE_H
+
+/*------------------------------------------------------------------------------
+|    includes
++-----------------------------------------------------------------------------*/
+#include "lc_logging.h"
+#include "lc_logging_json.h"
+
+#include <string>
+#include <chrono>
+#ifndef LC_LOGGING_DISABLE_THREADING
+#include <atomic>
+#endif
+
+namespace lightlogger {
+
+/*------------------------------------------------------------------------------
+|    definitions
++-----------------------------------------------------------------------------*/
+#ifndef LC_TRACE_BUFFER_EVENTS
+#define LC_TRACE_BUFFER_EVENTS 1024
+#endif
+
+#define LC_TRACE_CONCAT_(a, b) a ## b
+#define LC_TRACE_CONCAT(a, b) LC_TRACE_CONCAT_(a, b)
+
+#ifdef ENABLE_TRACE_EVENTS
+#define LC_TRACE_SCOPE_T(tag, name) \
+   lightlogger::LC_TraceScope LC_TRACE_CONCAT(lc_trace_scope_, __LINE__)(tag, name)
+#else
+#define LC_TRACE_SCOPE_T(tag, name) \
+   do {} while (0)
+#endif // ENABLE_TRACE_EVENTS
+#define LC_TRACE_SCOPE(name) \
+   LC_TRACE_SCOPE_T(LOG_TAG, name)
+#define LC_TRACE_FUNC \
+   LC_TRACE_SCOPE_T(LOG_TAG, __PRETTY_FUNCTION__)
+
+/*------------------------------------------------------------------------------
+|    LC_TraceEvent struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_TraceEvent struct is a scope that ended. Times are in ns, begin is
+* read from the steady clock.
+*/
+struct LC_TraceEvent {
+   const char* name;
+   const char* tag;
+   unsigned long long begin;
+   unsigned long long duration;
+   unsigned int depth;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_TraceBuffer struct
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_TraceBuffer struct holds the events of a thread. Only the thread
+* appends; it publishes count after writing the event, so that flush() can write the
+* events of running threads. written, the events already in the file, and the list
+* are protected by the lock of the sink.
+*/
+struct LC_TraceBuffer
+{
+   LC_TraceBuffer();
+   ~LC_TraceBuffer();
+
+   void append(const LC_TraceEvent& event);
+
+   LC_TraceEvent events[LC_TRACE_BUFFER_EVENTS];
+#ifndef LC_LOGGING_DISABLE_THREADING
+   std::atomic<unsigned int> count;
+#else
+   unsigned int count;
+#endif
+   unsigned int written;
+   unsigned int depth;
+
+   unsigned long long tid;
+   char name[64];
+   // Id of the file the thread_name event was written to.
+   unsigned int named;
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   pthread_t owner;
+#endif
+
+   LC_TraceBuffer* prev;
+   LC_TraceBuffer* next;
+
+private:
+   LC_TraceBuffer(const LC_TraceBuffer&);
+   LC_TraceBuffer& operator =(const LC_TraceBuffer&);
+};
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_TraceSink class writes the events of LC_TraceScope as Chrome trace
+* events. Use instance(): the scopes always go to it.
+*/
+class LC_TraceSink
+{
+public:
+   static LC_TraceSink& instance();
+   static LC_TraceBuffer& local();
+   static unsigned long long now();
+
+   bool open(const char* path);
+   void setOutput(FILE* f);
+   void close();
+   void flush();
+
+   static bool isEnabled();
+   void setEnabled(bool enable);
+
+private:
+   friend struct LC_TraceBuffer;
+
+   LC_TraceSink();
+   ~LC_TraceSink();
+   LC_TraceSink(const LC_TraceSink&);
+   LC_TraceSink& operator =(const LC_TraceSink&);
+
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static std::atomic<bool>& enabled();
+#else
+   static bool& enabled();
+#endif
+   static unsigned long long processId();
+   static void appendNumber(std::string& out, unsigned long long value, int digits);
+
+   void start(FILE* f, bool owned);
+   void stop();
+   void add(LC_TraceBuffer* buffer);
+   void remove(LC_TraceBuffer* buffer);
+   void writeLocked(LC_TraceBuffer* buffer, unsigned int count);
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   static void lockForFork(void* sink);
+   static void unlockAfterFork(void* sink);
+   static void resetAfterFork(void* sink);
+#endif
+
+   LC_Mutex m_mutex;
+   LC_TraceBuffer* m_threads;
+   FILE* m_file;
+   bool m_owned;
+   bool m_first;
+   bool m_requested;
+   unsigned int m_fileId;
+   std::string m_out;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_TraceScope class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The LC_TraceScope class records an event spanning its lifetime. Use the
+* LC_TRACE_* macros, which compile it out without ENABLE_TRACE_EVENTS.
+*/
+class LC_TraceScope
+{
+public:
+   LC_TraceScope(const char* log_tag, const char* name);
+   ~LC_TraceScope();
+
+private:
+   LC_TraceScope(const LC_TraceScope&);
+   LC_TraceScope& operator =(const LC_TraceScope&);
+
+   LC_TraceBuffer* m_buffer;
+   const char* m_tag;
+   const char* m_name;
+   unsigned long long m_begin;
+};
+
+/*------------------------------------------------------------------------------
+|    LC_TraceBuffer::LC_TraceBuffer
++-----------------------------------------------------------------------------*/
+inline LC_TraceBuffer::LC_TraceBuffer() :
+     count(0)
+   , written(0)
+   , depth(0)
+   , tid(lc_thread_id())
+   , named(0)
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   , owner(pthread_self())
+#endif
+   , prev(NULL)
+   , next(NULL)
+{
+   strncpy(name, lc_thread_name(), sizeof(name) - 1);
+   name[sizeof(name) - 1] = 0;
+   LC_TraceSink::instance().add(this);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceBuffer::~LC_TraceBuffer
++-----------------------------------------------------------------------------*/
+inline LC_TraceBuffer::~LC_TraceBuffer()
+{
+   LC_TraceSink::instance().remove(this);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceBuffer::append
++-----------------------------------------------------------------------------*/
+inline void LC_TraceBuffer::append(const LC_TraceEvent& event)
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   unsigned int n = count.load(std::memory_order_relaxed);
+#else
+   unsigned int n = count;
+#endif
+   if (n == LC_TRACE_BUFFER_EVENTS) {
+      LC_TraceSink& sink = LC_TraceSink::instance();
+      LC_MutexLocker locker(sink.m_mutex);
+      strncpy(name, lc_thread_name(), sizeof(name) - 1);
+      name[sizeof(name) - 1] = 0;
+      sink.writeLocked(this, n);
+      written = 0;
+      n = 0;
+#ifndef LC_LOGGING_DISABLE_THREADING
+      count.store(0, std::memory_order_relaxed);
+#else
+      count = 0;
+#endif
+   }
+
+   events[n] = event;
+#ifndef LC_LOGGING_DISABLE_THREADING
+   count.store(n + 1, std::memory_order_release);
+#else
+   count = n + 1;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::LC_TraceSink
++-----------------------------------------------------------------------------*/
+inline LC_TraceSink::LC_TraceSink() :
+     m_threads(NULL)
+   , m_file(NULL)
+   , m_owned(false)
+   , m_first(true)
+   , m_requested(true)
+   , m_fileId(0)
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkHandler handler = { &LC_TraceSink::lockForFork,
+                              &LC_TraceSink::unlockAfterFork,
+                              &LC_TraceSink::resetAfterFork,
+                              this };
+   LC_ForkGuard::instance().add(handler);
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::~LC_TraceSink
++-----------------------------------------------------------------------------*/
+inline LC_TraceSink::~LC_TraceSink()
+{
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+   LC_ForkGuard::instance().remove(this);
+#endif
+   close();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::instance
++-----------------------------------------------------------------------------*/
+inline LC_TraceSink& LC_TraceSink::instance()
+{
+   static LC_TraceSink instance;
+   return instance;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::local
++-----------------------------------------------------------------------------*/
+/**
+* @brief local Returns the buffer of the calling thread.
+*/
+inline LC_TraceBuffer& LC_TraceSink::local()
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   static thread_local LC_TraceBuffer buffer;
+#else
+   static LC_TraceBuffer buffer;
+#endif
+   return buffer;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::now
++-----------------------------------------------------------------------------*/
+/**
+* @brief now Returns the steady clock in ns. On Linux it is read through the vDSO,
+* without a system call.
+*/
+inline unsigned long long LC_TraceSink::now()
+{
+   return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::enabled
++-----------------------------------------------------------------------------*/
+/**
+* @brief enabled The flag checked by every scope. It is constant-initialized, so
+* reading it needs no guard.
+*/
+#ifndef LC_LOGGING_DISABLE_THREADING
+inline std::atomic<bool>& LC_TraceSink::enabled()
+{
+   static std::atomic<bool> enabled(false);
+   return enabled;
+}
+#else
+inline bool& LC_TraceSink::enabled()
+{
+   static bool enabled = false;
+   return enabled;
+}
+#endif // LC_LOGGING_DISABLE_THREADING
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::isEnabled
++-----------------------------------------------------------------------------*/
+/**
+* @brief isEnabled Returns true if the sink is open and not disabled.
+*/
+inline bool LC_TraceSink::isEnabled()
+{
+#ifndef LC_LOGGING_DISABLE_THREADING
+   return enabled().load(std::memory_order_relaxed);
+#else
+   return enabled();
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::setEnabled
++-----------------------------------------------------------------------------*/
+/**
+* @brief setEnabled Pauses and resumes tracing while the sink is open. Scopes that
+* already began are still written.
+*/
+inline void LC_TraceSink::setEnabled(bool enable)
+{
+   LC_MutexLocker locker(m_mutex);
+   m_requested = enable;
+   enabled() = enable && m_file;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::processId
++-----------------------------------------------------------------------------*/
+inline unsigned long long LC_TraceSink::processId()
+{
+#if defined(_WIN32) || defined(_WIN32_WCE)
+   return (unsigned long long)GetCurrentProcessId();
+#else
+   return (unsigned long long)getpid();
+#endif
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::appendNumber
++-----------------------------------------------------------------------------*/
+inline void LC_TraceSink::appendNumber(std::string& out, unsigned long long value, int digits)
+{
+   char buffer[24];
+   int i = sizeof(buffer);
+   do {
+      buffer[--i] = (char)('0' + value % 10);
+      value /= 10;
+      digits--;
+   } while ((value || digits > 0) && i > 0);
+   out.append(buffer + i, sizeof(buffer) - i);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::open
++-----------------------------------------------------------------------------*/
+/**
+* @brief open Writes the events to a new file at path. The previous output is closed.
+* @return false if the file cannot be created; the previous output is kept.
+*/
+inline bool LC_TraceSink::open(const char* path)
+{
+   FILE* f = fopen(path, "w");
+   if (!f)
+      return false;
+
+   start(f, true);
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::setOutput
++-----------------------------------------------------------------------------*/
+/**
+* @brief setOutput Writes the events to f, which is not closed by the sink.
+*/
+inline void LC_TraceSink::setOutput(FILE* f)
+{
+   start(f, false);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::close
++-----------------------------------------------------------------------------*/
+/**
+* @brief close Writes the pending events of all the threads and terminates the file.
+*/
+inline void LC_TraceSink::close()
+{
+   LC_MutexLocker locker(m_mutex);
+   stop();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::flush
++-----------------------------------------------------------------------------*/
+/**
+* @brief flush Writes the pending events of all the threads.
+*/
+inline void LC_TraceSink::flush()
+{
+   LC_MutexLocker locker(m_mutex);
+   for (LC_TraceBuffer* b = m_threads; b; b = b->next) {
+#ifndef LC_LOGGING_DISABLE_THREADING
+      writeLocked(b, b->count.load(std::memory_order_acquire));
+#else
+      writeLocked(b, b->count);
+#endif
+   }
+   if (m_file)
+      fflush(m_file);
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::start
++-----------------------------------------------------------------------------*/
+inline void LC_TraceSink::start(FILE* f, bool owned)
+{
+   LC_MutexLocker locker(m_mutex);
+   stop();
+
+   // The events of the previous file that were not written are dropped.
+   for (LC_TraceBuffer* b = m_threads; b; b = b->next) {
+#ifndef LC_LOGGING_DISABLE_THREADING
+      b->written = b->count.load(std::memory_order_acquire);
+#else
+      b->written = b->count;
+#endif
+   }
+
+   m_file = f;
+   m_owned = owned;
+   m_first = true;
+   m_fileId++;
+   fputs("[", m_file);
+   enabled() = m_requested;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::stop
++-----------------------------------------------------------------------------*/
+inline void LC_TraceSink::stop()
+{
+   enabled() = false;
+   if (!m_file)
+      return;
+
+   for (LC_TraceBuffer* b = m_threads; b; b = b->next) {
+#ifndef LC_LOGGING_DISABLE_THREADING
+      writeLocked(b, b->count.load(std::memory_order_acquire));
+#else
+      writeLocked(b, b->count);
+#endif
+   }
+   fputs("\n]\n", m_file);
+   if (m_owned)
+      fclose(m_file);
+   else
+      fflush(m_file);
+   m_file = NULL;
+   m_owned = false;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::add
++-----------------------------------------------------------------------------*/
+inline void LC_TraceSink::add(LC_TraceBuffer* buffer)
+{
+   LC_MutexLocker locker(m_mutex);
+   buffer->next = m_threads;
+   if (m_threads)
+      m_threads->prev = buffer;
+   m_threads = buffer;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::remove
++-----------------------------------------------------------------------------*/
+/**
+* @brief remove Called when a thread exits: its pending events are written.
+*/
+inline void LC_TraceSink::remove(LC_TraceBuffer* buffer)
+{
+   LC_MutexLocker locker(m_mutex);
+#ifndef LC_LOGGING_DISABLE_THREADING
+   writeLocked(buffer, buffer->count.load(std::memory_order_relaxed));
+#else
+   writeLocked(buffer, buffer->count);
+#endif
+   if (m_file)
+      fflush(m_file);
+   if (buffer->prev)
+      buffer->prev->next = buffer->next;
+   else if (m_threads == buffer)
+      m_threads = buffer->next;
+   if (buffer->next)
+      buffer->next->prev = buffer->prev;
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::writeLocked
++-----------------------------------------------------------------------------*/
+/**
+* @brief writeLocked Writes the events of buffer from written to count, in a single
+* fwrite(). Called with m_mutex held.
+*/
+inline void LC_TraceSink::writeLocked(LC_TraceBuffer* buffer, unsigned int count)
+{
+   if (!m_file || buffer->written >= count) {
+      buffer->written = count;
+      return;
+   }
+
+   const unsigned long long pid = processId();
+   m_out.clear();
+   if (buffer->named != m_fileId && buffer->name[0]) {
+      m_out.append(m_first ? "\n" : ",\n");
+      m_first = false;
+      m_out.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":");
+      appendNumber(m_out, pid, 1);
+      m_out.append(",\"tid\":");
+      appendNumber(m_out, buffer->tid, 1);
+      m_out.append(",\"args\":{\"name\":\"");
+      lc_json_escape(m_out, buffer->name, strlen(buffer->name));
+      m_out.append("\"}}");
+   }
+   buffer->named = m_fileId;
+
+   for (unsigned int i = buffer->written; i < count; i++) {
+      const LC_TraceEvent& e = buffer->events[i];
+      m_out.append(m_first ? "\n" : ",\n");
+      m_first = false;
+      m_out.append("{\"name\":\"");
+      lc_json_escape(m_out, e.name, strlen(e.name));
+      if (e.tag) {
+         m_out.append("\",\"cat\":\"");
+         lc_json_escape(m_out, e.tag, strlen(e.tag));
+      }
+      // Microseconds, with ns as decimals.
+      m_out.append("\",\"ph\":\"X\",\"ts\":");
+      appendNumber(m_out, e.begin / 1000, 1);
+      m_out.push_back('.');
+      appendNumber(m_out, e.begin % 1000, 3);
+      m_out.append(",\"dur\":");
+      appendNumber(m_out, e.duration / 1000, 1);
+      m_out.push_back('.');
+      appendNumber(m_out, e.duration % 1000, 3);
+      m_out.append(",\"pid\":");
+      appendNumber(m_out, pid, 1);
+      m_out.append(",\"tid\":");
+      appendNumber(m_out, buffer->tid, 1);
+      m_out.append(",\"args\":{\"depth\":");
+      appendNumber(m_out, e.depth, 1);
+      m_out.append("}}");
+   }
+   buffer->written = count;
+   fwrite(m_out.data(), 1, m_out.size(), m_file);
+}
+
+#if !defined(_WIN32) && !defined(_WIN32_WCE)
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::lockForFork
++-----------------------------------------------------------------------------*/
+inline void LC_TraceSink::lockForFork(void* sink)
+{
+   static_cast<LC_TraceSink*>(sink)->m_mutex.lock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::unlockAfterFork
++-----------------------------------------------------------------------------*/
+inline void LC_TraceSink::unlockAfterFork(void* sink)
+{
+   static_cast<LC_TraceSink*>(sink)->m_mutex.unlock();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceSink::resetAfterFork
++-----------------------------------------------------------------------------*/
+/**
+* @brief resetAfterFork In the child only the thread that called fork() exists: the
+* buffers of the others are forgotten and the pending events, which belong to the
+* parent, are dropped. The file is left to the parent.
+*/
+inline void LC_TraceSink::resetAfterFork(void* context)
+{
+   LC_TraceSink* sink = static_cast<LC_TraceSink*>(context);
+   LC_TraceBuffer* self = NULL;
+   for (LC_TraceBuffer* b = sink->m_threads; b; b = b->next) {
+      if (pthread_equal(b->owner, pthread_self()))
+         self = b;
+   }
+
+   sink->m_threads = self;
+   if (self) {
+      self->prev = NULL;
+      self->next = NULL;
+      self->count = 0;
+      self->written = 0;
+      self->tid = lc_thread_id();
+   }
+
+   enabled() = false;
+   if (sink->m_owned && sink->m_file)
+      fclose(sink->m_file);
+   sink->m_file = NULL;
+   sink->m_owned = false;
+   sink->m_mutex.unlock();
+}
+#endif // !defined(_WIN32) && !defined(_WIN32_WCE)
+
+/*------------------------------------------------------------------------------
+|    LC_TraceScope::LC_TraceScope
++-----------------------------------------------------------------------------*/
+inline LC_TraceScope::LC_TraceScope(const char* log_tag, const char* name) :
+     m_buffer(NULL)
+   , m_tag(log_tag)
+   , m_name(name)
+   , m_begin(0)
+{
+   if (!LC_TraceSink::isEnabled())
+      return;
+
+   m_buffer = &LC_TraceSink::local();
+   m_buffer->depth++;
+   m_begin = LC_TraceSink::now();
+}
+
+/*------------------------------------------------------------------------------
+|    LC_TraceScope::~LC_TraceScope
++-----------------------------------------------------------------------------*/
+inline LC_TraceScope::~LC_TraceScope()
+{
+   if (!m_buffer)
+      return;
+
+   const unsigned long long end = LC_TraceSink::now();
+   m_buffer->depth--;
+   LC_TraceEvent event = { m_name, m_tag, m_begin, end - m_begin, m_buffer->depth };
+   m_buffer->append(event);
+}
+
+}
+
+#endif // LC_LOGGING_TRACE_H
@@ -34,16 +34,12 @@
  +-----------------------------------------------------------------------------*/
 #ifndef __ANDROID__
 #include <QGuiApplication>
-#include <QElapsedTimer>
 #if defined(QT_QML_LIB) && defined(QT_QUICK_LIB)
 #include <QtQuick/QQuickView>
 #include <QQmlEngine>
 #endif
 #endif
 
-#include <QElapsedTimer>
-#include <QDateTime>
-
 #define COLORING_ENABLED
 #include "lc_logging.h"
 lightlogger::custom_log_func lightlogger::global_log_func = log_to_stdout;
@@ -108,32 +104,6 @@ int main(int argc, char** argv)
    QGuiApplication a(argc, argv);
 #endif
 
-#if 0
-   QElapsedTimer timer;
-   timer.start();
-
-   // Test with lc_logging.
-   for (int i = 0; i < 100000; i++)
-      log_verbose("Test: %d.", i);
-   qDebug("Result lc_logging: %lld.", timer.elapsed());
-
-   // Test with printf.
-   timer.restart();
-   for (int i = 0; i < 100000; i++) {
-      fprintf(stdout, "- DEBUG:%s: Test: %d.\n", lc_current_time().c_str(), i);
-      fflush(stdout);
-   }
-   qDebug("Result printf: %lld.", timer.elapsed());
-
-   // Test with qDebug.
-   timer.restart();
-   for (int i = 0; i < 100000; i++) {
-      qDebug("- DEBUG:%s: Test: %d.\n", lc_current_time().c_str(), i);
-      fflush(stderr);
-   }
-   qDebug("Result qDebug: %lld.", timer.elapsed());
-#endif
-
 #ifdef __GNUC__
    LOG_CRITICAL("MyTag", "Oooops!");
 #endif
@@ -177,6 +147,14 @@ int main(int argc, char** argv)
        logger.stream() << "Blue text on bright magenta";
    }
 
+#ifdef QT_CORE_LIB
+   {
+      lightlogger::LC_Log logger(lightlogger::LC_LOG_INFO);
+      logger.qstream() << QStringLiteral("Qt types using stream: ") << QPoint(1, 2) << " "
+                       << QDateTime::currentDateTime() << " " << QVariant(QSize(3, 4));
+   }
+#endif
+
    // TODO
    //{
    //   lightlogger::LC_Log<lightlogger::LC_Output2Std> logger(lightlogger::LC_LOG_DEBUG);
@@ -215,18 +193,6 @@ int main(int argc, char** argv)
    assert(log_err("") == false);
    assert(log_critical("") == false);
 
-   QString dateTime = QDateTime::currentDateTime().toString();
-   QElapsedTimer timer;
-   timer.start();
-   for (int i = 0; i < 1E5; i++) {
-       lightlogger::LC_Log(lightlogger::LC_FORG_COL_MAGENTA)
-           .printf("This is a test log, %s %s: %s",
-                   "testing the performance of the log call.",
-                   "Timestamp",
-                   qPrintable(dateTime));
-   }
-   qInfo() << "Time:" << timer.elapsed();
-
    return 0;
 }
 #endif
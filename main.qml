@@ -13,8 +13,9 @@ Rectangle {
     Component.onCompleted: {
         var i = 1;
 
-        logger.verbose("Some verbose message from QML!");
-        logger.info("Some info message from QML: Qt is number " + i + ".");
+        if (logger.verboseEnabled)
+            logger.verbose("Some verbose message from QML!");
+        logger.info("Some info message from QML: Qt is number", i);
         logger.warn("Some dangerous warning message from QML! >:-)");
     }
 }
@@ -0,0 +1,631 @@
+/*
+ * Author:  Luca Carlon
+ * Company: -
+ * Date:    10.18.2026
+ *
+ * Copyright (c) 2013-2026, Luca Carlon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the author nor the
+ * names of its contributors may be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Measures the cost of a log call for each sink and feature, with 1 to N producer
+ * threads. Every call is timed: results report throughput and latency percentiles, one
+ * JSON object per line (case, threads), so runs can be compared between releases.
+ *
+ * Records are written to /dev/null unless -d is given, so the numbers are the cost of
+ * the logger, not of the terminal. The net and syslog sinks send to LC_NetCollector
+ * and LC_DatagramRecorder; their latency is the time to queue a record.
+ *
+ * The unwind_* cases capture stack traces 32 calls deep and also report the cost per
+ * frame of each unwinder.
+ *
+ * Heap allocations made by the producers are counted through replaced malloc(),
+ * calloc() and realloc() (operator new elsewhere than glibc) and reported per call.
+ * With -a the exit status is 2 if a case that should not allocate once warmed up does.
+ *
+ * Linux only, no Qt required.
+ */
+
+/*------------------------------------------------------------------------------
+|    includes
++-----------------------------------------------------------------------------*/
+#include <cerrno>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+
+#include "lc_logging.h"
+#include "lc_logging_json.h"
+#include "lc_logging_net.h"
+#include "lc_logging_shm.h"
+#include "lc_logging_syslog.h"
+lightlogger::custom_log_func lightlogger::global_log_func = lightlogger::log_to_stdout;
+
+using namespace lightlogger;
+
+typedef std::chrono::steady_clock Clock;
+
+#define BENCH_TAG "Bench"
+#define BENCH_PLAIN_PATTERN "%([%tag]: %)%T.%ms %(%L:\t %)<%t%(:%N%)> %m"
+#define BENCH_LOCATION_PATTERN "%([%tag]: %)%T.%ms %(%L:\t %)<%t%(:%N%)> %([%loc] %)%m"
+#define BENCH_COLOR_PATTERN "%([%tag]: %)%T.%ms %(%L:\t %)<%t%(:%N%)> %c%m%r"
+
+/*------------------------------------------------------------------------------
+|    Options
++-----------------------------------------------------------------------------*/
+struct Options {
+   unsigned int iterations;
+   unsigned int maxThreads;
+   const char* filter;
+   const char* destination;
+   bool checkAllocations;
+};
+
+static Options options = { 20000, 8, NULL, "/dev/null", false };
+static FILE* records = NULL;
+
+/*------------------------------------------------------------------------------
+|    allocation counting
++-----------------------------------------------------------------------------*/
+// Allocations of the calling thread. Trivially initialized, so it can be used by
+// malloc() before main().
+static thread_local unsigned long long allocations = 0;
+
+#ifdef __GLIBC__
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+   allocations++;
+   return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+   allocations++;
+   return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* p, size_t size)
+{
+   allocations++;
+   return __libc_realloc(p, size);
+}
+#else
+void* operator new(size_t size)
+{
+   allocations++;
+   if (void* p = malloc(size ? size : 1))
+      return p;
+   throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+   free(p);
+}
+#endif // __GLIBC__
+
+/*------------------------------------------------------------------------------
+|    Case
++-----------------------------------------------------------------------------*/
+/**
+* A benchmark case: setup() selects the sink and its options, call() is timed once per
+* iteration, teardown() flushes and restores the defaults. unwind is set for the cases
+* timing a single unwinder, whose frames are counted. allocates is set for the cases
+* that may allocate after the warm-up, which -a does not check.
+*/
+struct Case {
+   const char* name;
+   void (*setup)();
+   void (*call)(unsigned int i);
+   void (*teardown)();
+   lc_unwind_func unwind;
+   bool allocates;
+};
+
+static lc_unwind_func defaultUnwinder = NULL;
+static LC_NetCollector* collector = NULL;
+static LC_DatagramRecorder* recorder = NULL;
+static std::atomic<bool> recording(false);
+static std::thread recorderThread;
+
+/*------------------------------------------------------------------------------
+|    calls
++-----------------------------------------------------------------------------*/
+static void call_disabled(unsigned int i)
+{
+   log_debug_t(BENCH_TAG, "This is a test log, %s %u.", "testing the performance of the log call", i);
+}
+
+static void call_printf(unsigned int i)
+{
+   LC_Log(BENCH_TAG, LC_LOG_INFO).printf("This is a test log, %s %u.",
+                                         "testing the performance of the log call", i);
+}
+
+static void call_stream(unsigned int i)
+{
+   LC_Log(BENCH_TAG, LC_LOG_INFO).stream()
+         << "This is a test log, " << "testing the performance of the log call " << i << ".";
+}
+
+static void call_location(unsigned int i)
+{
+   LC_Log logger(BENCH_TAG, LC_LOG_INFO);
+   logger.setLocation(__FILE__, __LINE__, __FUNCTION__);
+   logger.printf("This is a test log, %s %u.", "testing the performance of the log call", i);
+}
+
+static void call_color(unsigned int i)
+{
+   LC_Log(BENCH_TAG, LC_LOG_ATTR_UNDERLINE, LC_FORG_COL_MAGENTA)
+         .printf("This is a test log, %s %u.", "testing the performance of the log call", i);
+}
+
+static void call_fields(unsigned int i)
+{
+   log_info_kv_t(BENCH_TAG, "This is a test log.", kv("iteration", i), kv("feature", "fields"));
+}
+
+__attribute__((noinline)) static void call_stacktrace(unsigned int i)
+{
+   (void)i;
+   log_stacktrace(BENCH_TAG, LC_LOG_INFO, 16);
+}
+
+/*------------------------------------------------------------------------------
+|    unwind_nested
++-----------------------------------------------------------------------------*/
+__attribute__((noinline)) static unsigned int unwind_nested(lc_unwind_func unwind, unsigned int depth)
+{
+   if (depth) {
+      const unsigned int count = unwind_nested(unwind, depth - 1);
+      // Keeps the recursion from becoming a loop or a tail call.
+      __asm__ __volatile__("" ::: "memory");
+      return count;
+   }
+
+   void* frames[LC_MAX_STACK_FRAMES];
+   return unwind(frames, LC_MAX_STACK_FRAMES);
+}
+
+static std::atomic<lc_unwind_func> currentUnwinder(NULL);
+static std::atomic<unsigned long long> unwoundFrames(0);
+
+static void call_unwind(unsigned int i)
+{
+   (void)i;
+   unwoundFrames += unwind_nested(currentUnwinder.load(std::memory_order_relaxed), 32);
+}
+
+/*------------------------------------------------------------------------------
+|    setups
++-----------------------------------------------------------------------------*/
+static void setup_plain()
+{
+   stdout_layout().setPattern(BENCH_PLAIN_PATTERN);
+   global_log_func = log_to_stdout;
+}
+
+static void setup_location()
+{
+   stdout_layout().setPattern(BENCH_LOCATION_PATTERN);
+   global_log_func = log_to_stdout;
+}
+
+static void setup_color()
+{
+   // The records go to a file, which gets no colors by default.
+   lc_set_color_mode(LC_COLORS_ALWAYS);
+   stdout_layout().setPattern(BENCH_COLOR_PATTERN);
+   global_log_func = log_to_stdout;
+}
+
+static void setup_file()
+{
+   file_stream() = records;
+   global_log_func = log_to_file;
+}
+
+static void setup_json()
+{
+   LC_StructuredSink::json().setOutput(records);
+   global_log_func = log_to_json;
+}
+
+static void setup_logfmt()
+{
+   LC_StructuredSink::logfmt().setOutput(records);
+   global_log_func = log_to_logfmt;
+}
+
+static void setup_stacktrace_full()
+{
+   setup_file();
+   LC_StackTraceTable::instance().setEnabled(false);
+}
+
+#ifdef ENABLE_FLIGHT_RECORDER
+static void setup_flight_recorder()
+{
+   LC_FlightRecorder::instance().setEnabled(true);
+   global_log_func = NULL;
+}
+#endif // ENABLE_FLIGHT_RECORDER
+
+static void setup_shm()
+{
+   char name[64];
+   snprintf(name, sizeof(name), "/lc_bench.%d", (int)getpid());
+   if (!LC_ShmSink::instance().open(name))
+      fprintf(stderr, "Failed to open shared memory %s.\n", name);
+   global_log_func = log_to_shm;
+}
+
+static void setup_net()
+{
+   collector = new LC_NetCollector;
+   if (!collector->isValid())
+      fprintf(stderr, "Failed to listen on the loopback: %s.\n", strerror(errno));
+   LC_NetSink::instance().start("127.0.0.1", collector->port());
+   global_log_func = log_to_net;
+}
+
+static void record()
+{
+   // Keeps the socket buffer from filling up.
+   while (recording) {
+      recorder->collect(50);
+      recorder->clear();
+   }
+}
+
+static void setup_syslog()
+{
+   char path[64];
+   snprintf(path, sizeof(path), "/tmp/lc_bench.%d.sock", (int)getpid());
+   recorder = new LC_DatagramRecorder(path);
+   if (!recorder->isValid() || !LC_SyslogSink::instance().open(path))
+      fprintf(stderr, "Failed to open %s: %s.\n", path, strerror(errno));
+   recording = true;
+   recorderThread = std::thread(record);
+   global_log_func = log_to_syslog;
+}
+
+/*------------------------------------------------------------------------------
+|    teardowns
++-----------------------------------------------------------------------------*/
+static void teardown_none()
+{
+   // Do nothing.
+}
+
+static void teardown_stacktrace()
+{
+   LC_StackTraceTable::instance().setEnabled(true);
+   LC_StackTraceTable::instance().clear();
+}
+
+#ifdef ENABLE_FLIGHT_RECORDER
+static void teardown_flight_recorder()
+{
+   LC_FlightRecorder::instance().setEnabled(false);
+   LC_FlightRecorder::instance().clear();
+}
+#endif // ENABLE_FLIGHT_RECORDER
+
+static void teardown_shm()
+{
+   LC_ShmSink::instance().close();
+}
+
+static void teardown_net()
+{
+   LC_NetSink::instance().flush(10000);
+   LC_NetSink::instance().stop();
+   delete collector;
+   collector = NULL;
+}
+
+static void teardown_syslog()
+{
+   LC_SyslogSink::instance().flush();
+   LC_SyslogSink::instance().close();
+   recording = false;
+   recorderThread.join();
+   delete recorder;
+   recorder = NULL;
+}
+
+static void teardown_unwind()
+{
+   lc_unwinder() = defaultUnwinder;
+}
+
+static const Case cases[] = {
+   { "disabled",          setup_plain,           call_disabled,   teardown_none,       NULL, false },
+   { "stdout_printf",     setup_plain,           call_printf,     teardown_none,       NULL, false },
+   { "stdout_stream",     setup_plain,           call_stream,     teardown_none,       NULL, false },
+   { "stdout_location",   setup_location,        call_location,   teardown_none,       NULL, false },
+   { "stdout_color",      setup_color,           call_color,      teardown_none,       NULL, false },
+   { "file",              setup_file,            call_printf,     teardown_none,       NULL, false },
+   { "file_fields",       setup_file,            call_fields,     teardown_none,       NULL, false },
+   { "json",              setup_json,            call_fields,     teardown_none,       NULL, false },
+   { "logfmt",            setup_logfmt,          call_fields,     teardown_none,       NULL, false },
+#ifdef ENABLE_FLIGHT_RECORDER
+   { "flight_recorder",   setup_flight_recorder, call_printf,     teardown_flight_recorder, NULL, false },
+#endif
+   { "shm",               setup_shm,             call_printf,     teardown_shm,        NULL, false },
+   // The queue of the net sink grows to its high-water mark while the case runs.
+   { "net",               setup_net,             call_printf,     teardown_net,        NULL, true },
+   { "syslog",            setup_syslog,          call_printf,     teardown_syslog,     NULL, false },
+   { "stacktrace",        setup_file,            call_stacktrace, teardown_stacktrace, NULL, false },
+   { "stacktrace_full",   setup_stacktrace_full, call_stacktrace, teardown_stacktrace, NULL, false },
+   { "unwind_backtrace",  teardown_none,         call_unwind,     teardown_unwind,     lc_unwind_backtrace, false },
+   { "unwind_frame_pointers", teardown_none,     call_unwind,     teardown_unwind,     lc_unwind_frame_pointers, false },
+#ifdef LC_USE_LIBUNWIND
+   { "unwind_libunwind",  teardown_none,         call_unwind,     teardown_unwind,     lc_unwind_libunwind, false },
+#endif
+};
+
+/*------------------------------------------------------------------------------
+|    Result
++-----------------------------------------------------------------------------*/
+struct Result {
+   double seconds;
+   unsigned long long calls;
+   unsigned long long frames;
+   std::atomic<unsigned long long> allocations;
+   std::vector<uint32_t> latencies;
+};
+
+/*------------------------------------------------------------------------------
+|    produce
++-----------------------------------------------------------------------------*/
+/**
+* @brief produce Body of a producer thread: waits for all the others, then times each
+* call.
+*/
+static void produce(const Case& c, unsigned int count, std::atomic<unsigned int>& ready,
+                    unsigned int threads, uint32_t* latencies,
+                    std::atomic<unsigned long long>* allocated)
+{
+   ready++;
+   while (ready.load() < threads)
+      std::this_thread::yield();
+
+   // The first call of a thread warms up its buffers: it is timed, but its
+   // allocations are not counted.
+   unsigned long long before = allocations;
+   for (unsigned int i = 0; i < count; i++) {
+      const Clock::time_point start = Clock::now();
+      c.call(i);
+      const Clock::time_point end = Clock::now();
+      const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      latencies[i] = (uint32_t)std::min(ns, (long long)UINT32_MAX);
+      if (i == 0)
+         before = allocations;
+   }
+   if (allocated)
+      *allocated += allocations - before;
+}
+
+/*------------------------------------------------------------------------------
+|    run
++-----------------------------------------------------------------------------*/
+static void run(const Case& c, unsigned int threads, Result& result)
+{
+   c.setup();
+   if (c.unwind) {
+      lc_unwinder() = c.unwind;
+      currentUnwinder = c.unwind;
+   }
+
+   // Warm-up: first-use initialization, caches, connections.
+   std::vector<uint32_t> warmup(std::max(options.iterations/10, 1u));
+   std::atomic<unsigned int> ready(0);
+   produce(c, (unsigned int)warmup.size(), ready, 1, &warmup[0], NULL);
+   unwoundFrames = 0;
+   result.allocations = 0;
+
+   result.latencies.assign((size_t)options.iterations*threads, 0);
+   ready = 0;
+   std::vector<std::thread> producers;
+   const Clock::time_point start = Clock::now();
+   for (unsigned int t = 0; t < threads; t++)
+      producers.push_back(std::thread(produce, std::cref(c), options.iterations, std::ref(ready),
+                                      threads, &result.latencies[(size_t)t*options.iterations],
+                                      &result.allocations));
+   for (size_t t = 0; t < producers.size(); t++)
+      producers[t].join();
+   result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+   result.calls = (unsigned long long)options.iterations*threads;
+   result.frames = unwoundFrames;
+
+   c.teardown();
+}
+
+/*------------------------------------------------------------------------------
+|    percentile
++-----------------------------------------------------------------------------*/
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+{
+   const size_t i = (size_t)(p*(double)(sorted.size() - 1) + 0.5);
+   return sorted[std::min(i, sorted.size() - 1)];
+}
+
+/*------------------------------------------------------------------------------
+|    report
++-----------------------------------------------------------------------------*/
+static void report(FILE* out, const Case& c, unsigned int threads, Result& result)
+{
+   std::vector<uint32_t>& l = result.latencies;
+   std::sort(l.begin(), l.end());
+
+   unsigned long long sum = 0;
+   for (size_t i = 0; i < l.size(); i++)
+      sum += l[i];
+
+   const double throughput = result.seconds > 0 ? (double)result.calls/result.seconds : 0;
+   const double allocs = (double)result.allocations/(double)result.calls;
+   fprintf(out, "{\"case\":\"%s\",\"threads\":%u,\"calls\":%llu,\"seconds\":%.6f,"
+                "\"calls_per_sec\":%.0f,\"mean_ns\":%.1f,\"p50_ns\":%u,\"p99_ns\":%u,"
+                "\"p999_ns\":%u,\"max_ns\":%u,\"allocs_per_call\":%.3f",
+           c.name, threads, result.calls, result.seconds, throughput,
+           (double)sum/(double)l.size(), percentile(l, 0.5), percentile(l, 0.99),
+           percentile(l, 0.999), l.back(), allocs);
+   if (c.unwind && result.frames)
+      fprintf(out, ",\"frames_per_call\":%.1f,\"ns_per_frame\":%.2f",
+              (double)result.frames/(double)result.calls, (double)sum/(double)result.frames);
+   fprintf(out, "}\n");
+   fflush(out);
+
+   fprintf(stderr, "%-22s %3u threads %12.0f calls/s  p50 %7u ns  p99 %7u ns  p99.9 %8u ns"
+                   "  %6.2f allocs\n",
+           c.name, threads, throughput, percentile(l, 0.5), percentile(l, 0.99),
+           percentile(l, 0.999), allocs);
+}
+
+/*------------------------------------------------------------------------------
+|    timer_overhead
++-----------------------------------------------------------------------------*/
+/**
+* @brief timer_overhead Returns the median cost of the two clock reads around each call,
+* included in every latency.
+*/
+static uint32_t timer_overhead()
+{
+   std::vector<uint32_t> l(100000);
+   for (size_t i = 0; i < l.size(); i++) {
+      const Clock::time_point start = Clock::now();
+      const Clock::time_point end = Clock::now();
+      l[i] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+   }
+   std::sort(l.begin(), l.end());
+   return percentile(l, 0.5);
+}
+
+/*------------------------------------------------------------------------------
+|    usage
++-----------------------------------------------------------------------------*/
+static void usage(const char* name)
+{
+   fprintf(stderr,
+           "Usage: %s [options]\n"
+           "  -i <count>  calls per thread (%u by default)\n"
+           "  -t <count>  max number of producer threads, runs 1, 2, 4... up to it (%u)\n"
+           "  -c <name>   run only the cases whose name contains name\n"
+           "  -d <file>   append the records to file instead of /dev/null\n"
+           "  -o <file>   write the results to file instead of stdout\n"
+           "  -a          exit with status 2 if a case that should not allocate does\n"
+           "  -l          list the cases\n"
+           "Results are printed as one JSON object per line, a summary on stderr.\n",
+           name, options.iterations, options.maxThreads);
+}
+
+/*------------------------------------------------------------------------------
+|    main
++-----------------------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+   const char* output = NULL;
+   const size_t caseCount = sizeof(cases)/sizeof(cases[0]);
+
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-i") && i + 1 < argc)
+         options.iterations = (unsigned int)std::max(atoi(argv[++i]), 1);
+      else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+         options.maxThreads = (unsigned int)std::max(atoi(argv[++i]), 1);
+      else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+         options.filter = argv[++i];
+      else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+         options.destination = argv[++i];
+      else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+         output = argv[++i];
+      else if (!strcmp(argv[i], "-a"))
+         options.checkAllocations = true;
+      else if (!strcmp(argv[i], "-l")) {
+         for (size_t c = 0; c < caseCount; c++)
+            fprintf(stdout, "%s\n", cases[c].name);
+         return 0;
+      }
+      else {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   // Results go to the original stdout, records to the destination: log_to_stdout
+   // writes to descriptor 1.
+   FILE* out = output ? fopen(output, "w") : fdopen(dup(STDOUT_FILENO), "w");
+   const int fd = ::open(options.destination, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+   if (!out || fd < 0) {
+      fprintf(stderr, "Failed to open %s: %s.\n", out ? options.destination : output, strerror(errno));
+      return 1;
+   }
+   fflush(stdout);
+   dup2(fd, STDOUT_FILENO);
+   records = fdopen(fd, "a");
+
+   defaultUnwinder = lc_unwinder();
+#ifdef ENABLE_FLIGHT_RECORDER
+   LC_FlightRecorder::instance().setEnabled(false);
+#endif
+
+   fprintf(out, "{\"benchmark\":\"lc_bench\",\"compiler\":\"%s\",\"cpus\":%u,"
+                "\"iterations\":%u,\"timer_ns\":%u,\"time\":%lld}\n",
+#ifdef __VERSION__
+           __VERSION__,
+#else
+           "",
+#endif
+           std::thread::hardware_concurrency(), options.iterations, timer_overhead(),
+           (long long)time(NULL));
+
+   int status = 0;
+   for (size_t c = 0; c < caseCount; c++) {
+      if (options.filter && !strstr(cases[c].name, options.filter))
+         continue;
+
+      for (unsigned int threads = 1; ; threads = std::min(threads*2, options.maxThreads)) {
+         Result result;
+         run(cases[c], threads, result);
+         report(out, cases[c], threads, result);
+         if (options.checkAllocations && !cases[c].allocates && result.allocations) {
+            fprintf(stderr, "%s allocated %llu times with %u threads after the warm-up.\n",
+                    cases[c].name, result.allocations.load(), threads);
+            status = 2;
+         }
+         if (threads == options.maxThreads)
+            break;
+      }
+   }
+
+   fclose(out);
+   return status;
+}
@@ -0,0 +1,34 @@
+#
+# Author:  Luca Carlon
+# Company: -
+# Date:    10.18.2026
+#
+
+QT       -= core gui
+CONFIG   += console c++11 release
+CONFIG   -= app_bundle qt debug
+
+TARGET   = lc_bench
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES  += lc_bench.cpp
+HEADERS  += ../../lc_logging.h \
+    ../../lc_logging_json.h \
+    ../../lc_logging_net.h \
+    ../../lc_logging_shm.h \
+    ../../lc_logging_syslog.h
+
+DEFINES  += BUILD_LOG_LEVEL_INFORMATION ENABLE_FLIGHT_RECORDER
+
+# Frame pointers for the unwind_frame_pointers case, symbols for the stack traces.
+QMAKE_CXXFLAGS += -fno-omit-frame-pointer
+QMAKE_LFLAGS   += -rdynamic
+LIBS     += -lrt -ldl -lpthread
+
+# Also measures libunwind when its headers are installed.
+exists(/usr/include/libunwind.h) {
+DEFINES  += LC_USE_LIBUNWIND
+LIBS     += -lunwind
+}
@@ -0,0 +1,809 @@
+/*
+ * Author:  Luca Carlon
+ * Company: -
+ * Date:    10.18.2026
+ *
+ * Copyright (c) 2013-2026, Luca Carlon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the author nor the
+ * names of its contributors may be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Checks that records stay whole when many threads log at once, and across fork().
+ * Each record carries the index of its writer, a sequence number, a payload whose
+ * length depends on both and a checksum. A record torn or interleaved with another
+ * does not match its checksum, a record lost or written twice breaks the sequence of
+ * its writer.
+ *
+ * The stress check (-s) has 1 to 64 producer threads log to the line sinks, once
+ * through a file opened with O_APPEND and once through a pipe, and reads everything
+ * back. The fork check (-f) has the producers log to each sink while the main thread
+ * forks children that log and exit; a child that hangs or dies fails the check. The
+ * net, syslog and shm records are read back through LC_NetCollector,
+ * LC_DatagramRecorder and LC_ShmReader; those a sink drops by design when its reader
+ * falls behind must account for every missing one. Without -s or -f both run.
+ *
+ * Results are printed as one JSON object per line (check, sink, threads) with the
+ * throughput of the stress runs. The exit status is 2 if a check fails.
+ *
+ * Linux only, no Qt required.
+ */
+
+/*------------------------------------------------------------------------------
+|    includes
++-----------------------------------------------------------------------------*/
+#include <cerrno>
+#include <climits>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "lc_logging.h"
+#include "lc_logging_json.h"
+#include "lc_logging_net.h"
+#include "lc_logging_shm.h"
+#include "lc_logging_syslog.h"
+lightlogger::custom_log_func lightlogger::global_log_func = lightlogger::log_to_stdout;
+
+using namespace lightlogger;
+
+typedef std::chrono::steady_clock Clock;
+
+#define CHECK_TAG "Check"
+#define CHECK_PATTERN "%([%tag]: %)%T.%ms %(%L:\t %)<%t> %m"
+#define CHECK_FORKS       16
+#define CHECK_CHILD_LINES 100
+
+/*------------------------------------------------------------------------------
+|    Options
++-----------------------------------------------------------------------------*/
+struct Options {
+   unsigned int iterations;
+   unsigned int maxThreads;
+   const char* filter;
+   bool stress;
+   bool fork;
+};
+
+static Options options = { 2000, 64, NULL, false, false };
+static FILE* records = NULL;
+
+/*------------------------------------------------------------------------------
+|    Verified
++-----------------------------------------------------------------------------*/
+struct Verified {
+   unsigned long long lines;
+   unsigned long long corrupt;
+   unsigned long long missing;
+   unsigned long long unordered;
+};
+
+/*------------------------------------------------------------------------------
+|    checksum
++-----------------------------------------------------------------------------*/
+static uint32_t checksum(unsigned int writer, unsigned int sequence, const char* payload, size_t size)
+{
+   // FNV-1a.
+   uint32_t h = (2166136261u ^ writer)*16777619u;
+   h = (h ^ sequence)*16777619u;
+   for (size_t i = 0; i < size; i++)
+      h = (h ^ (unsigned char)payload[i])*16777619u;
+   return h;
+}
+
+/*------------------------------------------------------------------------------
+|    call_checked
++-----------------------------------------------------------------------------*/
+static void call_checked(unsigned int writer, unsigned int sequence)
+{
+   char payload[256];
+   const size_t size = 16 + (writer*31 + sequence*17) % 224;
+   for (size_t i = 0; i < size; i++)
+      payload[i] = (char)('a' + (writer + sequence + i) % 26);
+   payload[size] = 0;
+
+   LC_Log(CHECK_TAG, LC_LOG_INFO).printf("check w=%u s=%u c=%08x p=%s;", writer, sequence,
+                                         checksum(writer, sequence, payload, size), payload);
+}
+
+/*------------------------------------------------------------------------------
+|    produce
++-----------------------------------------------------------------------------*/
+/**
+* @brief produce Body of a producer thread: logs up to count records, stopping early
+* when stop is set, and stores how many in produced.
+*/
+static void produce(unsigned int writer, unsigned int count, const std::atomic<bool>& stop,
+                    unsigned int* produced)
+{
+   unsigned int i = 0;
+   for (; i < count && !stop.load(std::memory_order_relaxed); i++)
+      call_checked(writer, i);
+   *produced = i;
+}
+
+/*------------------------------------------------------------------------------
+|    verify_line
++-----------------------------------------------------------------------------*/
+/**
+* @brief verify_line Checks a record read back, where writer w logged expected[w]
+* records and the next one expected from it is next[w].
+*/
+static void verify_line(const std::string& line, const std::vector<unsigned int>& expected,
+                        std::vector<unsigned int>& next, Verified& v)
+{
+   v.lines++;
+
+   const size_t at = line.find("check w=");
+   unsigned int writer = 0;
+   unsigned int sequence = 0;
+   unsigned int sum = 0;
+   int payload = 0;
+   if (at == std::string::npos
+         || line.find("check w=", at + 1) != std::string::npos
+         || sscanf(line.c_str() + at, "check w=%u s=%u c=%x p=%n", &writer, &sequence, &sum, &payload) != 3
+         || !payload
+         || writer >= expected.size()) {
+      v.corrupt++;
+      return;
+   }
+
+   const char* p = line.c_str() + at + payload;
+   const char* last = strchr(p, ';');
+   if (!last || checksum(writer, sequence, p, (size_t)(last - p)) != sum) {
+      v.corrupt++;
+      return;
+   }
+
+   // Each writer logs in order, with a single write per record.
+   if (sequence < next[writer])
+      v.unordered++;
+   else {
+      v.missing += sequence - next[writer];
+      next[writer] = sequence + 1;
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    verify
++-----------------------------------------------------------------------------*/
+/**
+* @brief verify Checks the lines of data, where writer w logged expected[w] records.
+*/
+static Verified verify(const std::string& data, const std::vector<unsigned int>& expected)
+{
+   Verified v = { 0, 0, 0, 0 };
+   std::vector<unsigned int> next(expected.size(), 0);
+   for (size_t begin = 0, end; begin < data.size(); begin = end + 1) {
+      end = data.find('\n', begin);
+      if (end == std::string::npos)
+         end = data.size();
+      if (end > begin)
+         verify_line(std::string(data, begin, end - begin), expected, next, v);
+   }
+
+   for (size_t w = 0; w < expected.size(); w++) {
+      if (next[w] < expected[w])
+         v.missing += expected[w] - next[w];
+      else if (next[w] > expected[w])
+         v.unordered += next[w] - expected[w];
+   }
+
+   return v;
+}
+
+/*------------------------------------------------------------------------------
+|    Capture class
++-----------------------------------------------------------------------------*/
+/**
+* @brief The Capture class collects what a checked sink writes, in a temporary file
+* opened with O_APPEND like the log files or through a pipe read by a thread.
+*/
+class Capture
+{
+public:
+   Capture() : m_file(NULL), m_pipe(-1) {}
+   ~Capture() { close(); }
+
+   bool open(bool pipe);
+   std::string close();
+
+   FILE* file() const { return m_file; }
+
+private:
+   Capture(const Capture&);
+   Capture& operator =(const Capture&);
+
+   void read();
+
+   FILE* m_file;
+   int m_pipe;
+   std::string m_path;
+   std::string m_data;
+   std::thread m_thread;
+};
+
+/*------------------------------------------------------------------------------
+|    Capture::open
++-----------------------------------------------------------------------------*/
+bool Capture::open(bool pipe)
+{
+   if (pipe) {
+      int fds[2];
+      if (pipe2(fds, O_CLOEXEC) != 0)
+         return false;
+
+      m_pipe = fds[0];
+      m_file = fdopen(fds[1], "a");
+      if (!m_file) {
+         ::close(fds[1]);
+         return false;
+      }
+      m_thread = std::thread(&Capture::read, this);
+      return true;
+   }
+
+   char path[64];
+   snprintf(path, sizeof(path), "/tmp/lc_check.%d", (int)getpid());
+   const int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+   if (fd < 0)
+      return false;
+
+   m_path = path;
+   m_file = fdopen(fd, "a");
+   return m_file != NULL;
+}
+
+/*------------------------------------------------------------------------------
+|    Capture::close
++-----------------------------------------------------------------------------*/
+/**
+* @brief close Closes the output and returns what was written to it.
+*/
+std::string Capture::close()
+{
+   std::string data;
+   if (m_file)
+      fclose(m_file);
+   m_file = NULL;
+   if (m_pipe >= 0) {
+      // The reader gets the end of file once the write end is closed.
+      if (m_thread.joinable())
+         m_thread.join();
+      ::close(m_pipe);
+      m_pipe = -1;
+      data.swap(m_data);
+      return data;
+   }
+   if (m_path.empty())
+      return data;
+
+   if (FILE* f = fopen(m_path.c_str(), "r")) {
+      char buffer[64*1024];
+      size_t size;
+      while ((size = fread(buffer, 1, sizeof(buffer), f)) > 0)
+         data.append(buffer, size);
+      fclose(f);
+   }
+   ::unlink(m_path.c_str());
+   m_path.clear();
+   return data;
+}
+
+/*------------------------------------------------------------------------------
+|    Capture::read
++-----------------------------------------------------------------------------*/
+void Capture::read()
+{
+   char buffer[64*1024];
+   for (;;) {
+      const ssize_t size = ::read(m_pipe, buffer, sizeof(buffer));
+      if (size > 0)
+         m_data.append(buffer, (size_t)size);
+      else if (size == 0 || errno != EINTR)
+         break;
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    CheckedSink
++-----------------------------------------------------------------------------*/
+/**
+* A sink the checks log to. attach() routes it to f when captured is set, otherwise to
+* its local endpoint; detach() restores the defaults and returns what the endpoint
+* received, one record per line. dropped() is the number of records the sink or the
+* endpoint dropped by design since attach(), which are expected to be missing. Fork
+* children call finish() before exiting; their records are expected only if inherited
+* is set. alive() is checked once the children are gone: the parent must still own the
+* sink.
+*/
+struct CheckedSink {
+   const char* name;
+   void (*attach)(FILE* f);
+   std::string (*detach)();
+   void (*finish)();
+   bool (*alive)();
+   unsigned long long (*dropped)();
+   bool captured;
+   bool inherited;
+};
+
+// What the endpoint of the sink attached received, and the thread receiving it.
+static std::string received;
+static std::atomic<bool> receiving(false);
+static std::thread receiver;
+static unsigned long long droppedBefore = 0;
+
+static void receive(void (*body)())
+{
+   received.clear();
+   receiving = true;
+   receiver = std::thread(body);
+}
+
+static std::string stop_receiving()
+{
+   receiving = false;
+   receiver.join();
+   std::string data;
+   data.swap(received);
+   return data;
+}
+
+static void attach_file(FILE* f)
+{
+   file_stream() = f;
+   global_log_func = log_to_file;
+}
+
+static std::string detach_file()
+{
+   file_stream() = records;
+   return std::string();
+}
+
+static void attach_stdout(FILE* f)
+{
+   stdout_layout().setPattern(CHECK_PATTERN);
+   dup2(fileno(f), STDOUT_FILENO);
+   global_log_func = log_to_stdout;
+}
+
+static std::string detach_stdout()
+{
+   dup2(fileno(records), STDOUT_FILENO);
+   return std::string();
+}
+
+static void attach_json(FILE* f)
+{
+   LC_StructuredSink::json().setOutput(f);
+   global_log_func = log_to_json;
+}
+
+static std::string detach_json()
+{
+   LC_StructuredSink::json().setOutput(records);
+   return std::string();
+}
+
+static LC_ShmReader* reader = NULL;
+static unsigned long long lost = 0;
+
+static void shm_name(char* name, size_t size)
+{
+   snprintf(name, size, "/lc_check.%d", (int)getpid());
+}
+
+static void read_shm()
+{
+   // Follows the producers closely, so that the ring is seldom overrun. The records
+   // overwritten are counted from the sequence, which starts at 0 when the sink opens:
+   // the reader itself does not count those lost before it first read one.
+   LC_ShmEntry entry;
+   unsigned long long sequence = 0;
+   lost = 0;
+   for (bool last = false; !last;) {
+      last = !receiving;
+      while (reader->next(entry)) {
+         lost += entry.sequence - sequence;
+         sequence = entry.sequence + 1;
+         received.append(entry.message).append(1, '\n');
+      }
+      if (!last)
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+}
+
+static void attach_shm(FILE*)
+{
+   char name[64];
+   shm_name(name, sizeof(name));
+   reader = new LC_ShmReader;
+   if (!LC_ShmSink::instance().open(name) || !reader->open(name))
+      fprintf(stderr, "Failed to open shared memory %s.\n", name);
+   receive(read_shm);
+   global_log_func = log_to_shm;
+}
+
+static std::string detach_shm()
+{
+   const std::string data = stop_receiving();
+   LC_ShmSink::instance().close();
+   delete reader;
+   reader = NULL;
+   return data;
+}
+
+static bool alive_shm()
+{
+   // The children must not remove the segment or create their own.
+   char name[64];
+   shm_name(name, sizeof(name));
+   LC_ShmReader check;
+   return check.open(name) && check.producerPid() == (unsigned int)getpid();
+}
+
+static unsigned long long dropped_shm()
+{
+   // The records the reader was overrun by.
+   return lost;
+}
+
+static LC_NetCollector* collector = NULL;
+
+static void attach_net(FILE*)
+{
+   collector = new LC_NetCollector;
+   if (!collector->isValid())
+      fprintf(stderr, "Failed to listen on the loopback: %s.\n", strerror(errno));
+   droppedBefore = LC_NetSink::instance().dropped();
+   LC_NetSink::instance().start("127.0.0.1", collector->port());
+   global_log_func = log_to_net;
+}
+
+static std::string detach_net()
+{
+   LC_NetSink::instance().flush(10000);
+   LC_NetSink::instance().stop();
+
+   // The collector may still be reading what was sent: wait until nothing arrives for
+   // a while.
+   size_t count = 0;
+   while (collector->waitForFrames(count + 1, 200))
+      count++;
+
+   std::string data;
+   const std::vector<std::string> frames = collector->frames();
+   for (size_t i = 0; i < frames.size(); i++)
+      data.append(frames[i]).append(1, '\n');
+   delete collector;
+   collector = NULL;
+   return data;
+}
+
+static void finish_net()
+{
+   LC_NetSink::instance().flush(2000);
+}
+
+static unsigned long long dropped_net()
+{
+   return LC_NetSink::instance().dropped() - droppedBefore;
+}
+
+static LC_DatagramRecorder* recorder = NULL;
+
+static void record()
+{
+   // Keeps the socket buffer from filling up.
+   for (bool last = false; !last;) {
+      last = !receiving;
+      recorder->collect(last ? 0 : 50);
+      const std::vector<std::string>& datagrams = recorder->records();
+      for (size_t i = 0; i < datagrams.size(); i++)
+         received.append(datagrams[i]).append(1, '\n');
+      recorder->clear();
+   }
+}
+
+static void attach_syslog(FILE*)
+{
+   char path[64];
+   snprintf(path, sizeof(path), "/tmp/lc_check.%d.sock", (int)getpid());
+   recorder = new LC_DatagramRecorder(path);
+   droppedBefore = LC_SyslogSink::instance().dropped();
+   if (!recorder->isValid() || !LC_SyslogSink::instance().open(path))
+      fprintf(stderr, "Failed to open %s: %s.\n", path, strerror(errno));
+   receive(record);
+   global_log_func = log_to_syslog;
+}
+
+static std::string detach_syslog()
+{
+   LC_SyslogSink::instance().flush();
+   LC_SyslogSink::instance().close();
+   const std::string data = stop_receiving();
+   delete recorder;
+   recorder = NULL;
+   return data;
+}
+
+static void finish_syslog()
+{
+   LC_SyslogSink::instance().flush();
+}
+
+static unsigned long long dropped_syslog()
+{
+   return LC_SyslogSink::instance().dropped() - droppedBefore;
+}
+
+static const CheckedSink stressSinks[] = {
+   { "file",   attach_file,   detach_file,   NULL, NULL, NULL, true, true },
+   { "stdout", attach_stdout, detach_stdout, NULL, NULL, NULL, true, true },
+   { "json",   attach_json,   detach_json,   NULL, NULL, NULL, true, true },
+};
+
+// The children detach from the shared memory, the parent owns the ring.
+static const CheckedSink forkSinks[] = {
+   { "file",   attach_file,   detach_file,   NULL,          NULL,      NULL,           true,  true },
+   { "json",   attach_json,   detach_json,   NULL,          NULL,      NULL,           true,  true },
+   { "shm",    attach_shm,    detach_shm,    NULL,          alive_shm, dropped_shm,    false, false },
+   { "net",    attach_net,    detach_net,    finish_net,    NULL,      dropped_net,    false, true },
+   { "syslog", attach_syslog, detach_syslog, finish_syslog, NULL,      dropped_syslog, false, true },
+};
+
+/*------------------------------------------------------------------------------
+|    check_stress
++-----------------------------------------------------------------------------*/
+/**
+* @brief check_stress Has threads producers log options.iterations records each to
+* sink, through a file or a pipe, and reads them back.
+* @return true if every record was read back whole and once.
+*/
+static bool check_stress(FILE* out, const CheckedSink& sink, unsigned int threads, bool pipe)
+{
+   const char* output = pipe ? "pipe" : "file";
+   Capture capture;
+   if (!capture.open(pipe)) {
+      fprintf(stderr, "Failed to create the %s for %s: %s.\n", output, sink.name, strerror(errno));
+      return false;
+   }
+   sink.attach(capture.file());
+
+   std::atomic<bool> stop(false);
+   std::vector<unsigned int> expected(threads, 0);
+   std::vector<std::thread> producers;
+   const Clock::time_point start = Clock::now();
+   for (unsigned int t = 0; t < threads; t++)
+      producers.push_back(std::thread(produce, t, options.iterations, std::cref(stop), &expected[t]));
+   for (size_t t = 0; t < producers.size(); t++)
+      producers[t].join();
+   const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+   sink.detach();
+   const std::string data = capture.close();
+   const Verified v = verify(data, expected);
+   const unsigned long long count = (unsigned long long)options.iterations*threads;
+   const double throughput = seconds > 0 ? (double)count/seconds : 0;
+   const double megabytes = seconds > 0 ? (double)data.size()/seconds/1e6 : 0;
+
+   fprintf(out, "{\"check\":\"stress\",\"sink\":\"%s\",\"output\":\"%s\",\"threads\":%u,"
+                "\"records\":%llu,\"seconds\":%.6f,\"records_per_sec\":%.0f,\"mb_per_sec\":%.1f,"
+                "\"lines\":%llu,\"corrupt\":%llu,\"missing\":%llu,\"unordered\":%llu}\n",
+           sink.name, output, threads, count, seconds, throughput, megabytes,
+           v.lines, v.corrupt, v.missing, v.unordered);
+   fflush(out);
+   fprintf(stderr, "stress %-6s %-4s %3u threads %10.0f records/s %7.1f MB/s  %llu corrupt"
+                   "  %llu missing  %llu unordered\n",
+           sink.name, output, threads, throughput, megabytes, v.corrupt, v.missing, v.unordered);
+
+   return !v.corrupt && !v.missing && !v.unordered;
+}
+
+/*------------------------------------------------------------------------------
+|    fork_child
++-----------------------------------------------------------------------------*/
+/**
+* @brief fork_child Forks a child that logs CHECK_CHILD_LINES records as writer and
+* exits.
+* @return 0 if the child exited in time with status 0, 1 if it failed, 2 if it hung
+* and was killed.
+*/
+static int fork_child(const CheckedSink& sink, unsigned int writer)
+{
+   const pid_t pid = fork();
+   if (pid < 0)
+      return 1;
+   if (pid == 0) {
+      for (unsigned int i = 0; i < CHECK_CHILD_LINES; i++)
+         call_checked(writer, i);
+      if (sink.finish)
+         sink.finish();
+      // Static destructors would join threads that only exist in the parent.
+      _exit(0);
+   }
+
+   const Clock::time_point deadline = Clock::now() + std::chrono::seconds(10);
+   for (;;) {
+      int status = 0;
+      const pid_t r = waitpid(pid, &status, WNOHANG);
+      if (r == pid)
+         return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : 1;
+      if (r < 0 && errno != EINTR)
+         return 1;
+      if (Clock::now() > deadline) {
+         kill(pid, SIGKILL);
+         waitpid(pid, &status, 0);
+         return 2;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+}
+
+/*------------------------------------------------------------------------------
+|    check_fork
++-----------------------------------------------------------------------------*/
+/**
+* @brief check_fork Forks CHECK_FORKS children while threads producers log to sink.
+* @return true if no child hung or failed and every record of the parent and of the
+* children was read back whole and once, except those the sink dropped.
+*/
+static bool check_fork(FILE* out, const CheckedSink& sink, unsigned int threads)
+{
+   Capture capture;
+   if (sink.captured && !capture.open(false)) {
+      fprintf(stderr, "Failed to create the output of %s: %s.\n", sink.name, strerror(errno));
+      return false;
+   }
+   sink.attach(capture.file());
+
+   std::atomic<bool> stop(false);
+   std::vector<unsigned int> expected(threads + CHECK_FORKS, sink.inherited ? CHECK_CHILD_LINES : 0);
+   std::vector<std::thread> producers;
+   for (unsigned int t = 0; t < threads; t++)
+      producers.push_back(std::thread(produce, t, UINT_MAX, std::cref(stop), &expected[t]));
+
+   unsigned int hung = 0;
+   unsigned int failed = 0;
+   for (unsigned int k = 0; k < CHECK_FORKS; k++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      const int r = fork_child(sink, threads + k);
+      hung += r == 2;
+      failed += r == 1;
+   }
+   stop = true;
+   for (size_t t = 0; t < producers.size(); t++)
+      producers[t].join();
+   if (sink.alive && !sink.alive())
+      failed++;
+
+   std::string data = sink.detach();
+   if (sink.captured)
+      data = capture.close();
+   const unsigned long long dropped = sink.dropped ? sink.dropped() : 0;
+   const Verified v = verify(data, expected);
+
+   fprintf(out, "{\"check\":\"fork\",\"sink\":\"%s\",\"threads\":%u,\"forks\":%u,\"hung\":%u,"
+                "\"failed\":%u,\"lines\":%llu,\"corrupt\":%llu,\"missing\":%llu,\"dropped\":%llu,"
+                "\"unordered\":%llu}\n",
+           sink.name, threads, CHECK_FORKS, hung, failed, v.lines, v.corrupt, v.missing, dropped,
+           v.unordered);
+   fflush(out);
+   fprintf(stderr, "fork %-8s %3u threads  %2u hung  %2u failed  %9llu lines  %llu corrupt"
+                   "  %llu missing  %llu dropped  %llu unordered\n",
+           sink.name, threads, hung, failed, v.lines, v.corrupt, v.missing, dropped, v.unordered);
+
+   return !hung && !failed && !v.corrupt && v.missing == dropped && !v.unordered;
+}
+
+/*------------------------------------------------------------------------------
+|    usage
++-----------------------------------------------------------------------------*/
+static void usage(const char* name)
+{
+   fprintf(stderr,
+           "Usage: %s [options]\n"
+           "  -i <count>  records per thread (%u by default)\n"
+           "  -t <count>  max number of producer threads, runs 1, 2, 4... up to it (%u)\n"
+           "  -c <name>   check only the sinks whose name contains name\n"
+           "  -o <file>   write the results to file instead of stdout\n"
+           "  -s          run the stress check only\n"
+           "  -f          run the fork check only\n"
+           "Results are printed as one JSON object per line, a summary on stderr.\n",
+           name, options.iterations, options.maxThreads);
+}
+
+/*------------------------------------------------------------------------------
+|    main
++-----------------------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+   const char* output = NULL;
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-i") && i + 1 < argc)
+         options.iterations = (unsigned int)std::max(atoi(argv[++i]), 1);
+      else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+         options.maxThreads = (unsigned int)std::max(atoi(argv[++i]), 1);
+      else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+         options.filter = argv[++i];
+      else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+         output = argv[++i];
+      else if (!strcmp(argv[i], "-s"))
+         options.stress = true;
+      else if (!strcmp(argv[i], "-f"))
+         options.fork = true;
+      else {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   // Results go to the original stdout; records logged between checks are discarded.
+   FILE* out = output ? fopen(output, "w") : fdopen(dup(STDOUT_FILENO), "w");
+   const int fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+   if (!out || fd < 0) {
+      fprintf(stderr, "Failed to open %s: %s.\n", out ? "/dev/null" : output, strerror(errno));
+      return 1;
+   }
+   fflush(stdout);
+   dup2(fd, STDOUT_FILENO);
+   records = fdopen(fd, "a");
+
+   if (!options.stress && !options.fork)
+      options.stress = options.fork = true;
+
+   int status = 0;
+   for (size_t s = 0; options.stress && s < sizeof(stressSinks)/sizeof(stressSinks[0]); s++) {
+      if (options.filter && !strstr(stressSinks[s].name, options.filter))
+         continue;
+
+      for (unsigned int threads = 1; ; threads = std::min(threads*2, options.maxThreads)) {
+         if (!check_stress(out, stressSinks[s], threads, false))
+            status = 2;
+         if (!check_stress(out, stressSinks[s], threads, true))
+            status = 2;
+         if (threads == options.maxThreads)
+            break;
+      }
+   }
+
+   for (size_t s = 0; options.fork && s < sizeof(forkSinks)/sizeof(forkSinks[0]); s++) {
+      if (options.filter && !strstr(forkSinks[s].name, options.filter))
+         continue;
+
+      for (unsigned int threads = 1; ; threads = std::min(threads*2, options.maxThreads)) {
+         if (!check_fork(out, forkSinks[s], threads))
+            status = 2;
+         if (threads == options.maxThreads)
+            break;
+      }
+   }
+
+   fclose(out);
+   return status;
+}
@@ -0,0 +1,24 @@
+#
+# Author:  Luca Carlon
+# Company: -
+# Date:    10.18.2026
+#
+
+QT       -= core gui
+CONFIG   += console c++11 release
+CONFIG   -= app_bundle qt debug
+
+TARGET   = lc_check
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES  += lc_check.cpp
+HEADERS  += ../../lc_logging.h \
+    ../../lc_logging_json.h \
+    ../../lc_logging_net.h \
+    ../../lc_logging_shm.h \
+    ../../lc_logging_syslog.h
+
+DEFINES  += BUILD_LOG_LEVEL_INFORMATION
+LIBS     += -lrt -lpthread
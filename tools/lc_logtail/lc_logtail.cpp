@@ -0,0 +1,175 @@
+/*
+ * Author:  Luca Carlon
+ * Company: -
+ * Date:    10.18.2026
+ *
+ * Copyright (c) 2013-2026, Luca Carlon
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * * Neither the name of the author nor the
+ * names of its contributors may be used to endorse or promote products
+ * derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Reads the records published by LC_ShmSink and prints them with the layout used by
+ * log_to_file. Records lost because the reader was overrun are reported on stderr.
+ */
+
+/*------------------------------------------------------------------------------
+|    includes
++-----------------------------------------------------------------------------*/
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <sys/types.h>
+#include <signal.h>
+
+#include "lc_logging_shm.h"
+lightlogger::custom_log_func lightlogger::global_log_func = lightlogger::log_to_stdout;
+
+using namespace lightlogger;
+
+/*------------------------------------------------------------------------------
+|    usage
++-----------------------------------------------------------------------------*/
+static void usage(const char* name)
+{
+   fprintf(stderr,
+           "Usage: %s [options] <shm name>\n"
+           "  -f          follow: wait for new records until the producer exits\n"
+           "  -n          print only records published from now on\n"
+           "  -l <level>  most verbose level to print: CRITICAL, ERROR, WARNING, INFO,\n"
+           "              VERBOSE or DEBUG\n"
+           "  -t <tag>    print only records with this tag\n"
+           "  -o <file>   append to file instead of writing to stdout\n",
+           name);
+}
+
+/*------------------------------------------------------------------------------
+|    print_entry
++-----------------------------------------------------------------------------*/
+static void print_entry(FILE* out, const LC_ShmEntry& entry)
+{
+   const time_t secs = (time_t)(entry.time/1000000ULL);
+   struct tm timeinfo;
+   localtime_r(&secs, &timeinfo);
+   char buffer[16];
+   strftime(buffer, sizeof(buffer), "%H:%M:%S", &timeinfo);
+
+   if (!entry.tag.empty())
+      fprintf(out, "[%s]: ", entry.tag.c_str());
+   fprintf(out, "%s.%03u ", buffer, (unsigned int)((entry.time/1000ULL) % 1000ULL));
+   if (entry.level >= LC_LOG_CRITICAL && entry.level <= LC_LOG_DEBUG)
+      fprintf(out, "%s:\t ", LC_Log::toString(entry.level).c_str());
+   fwrite(entry.message.data(), 1, entry.message.size(), out);
+   fputc('\n', out);
+}
+
+/*------------------------------------------------------------------------------
+|    main
++-----------------------------------------------------------------------------*/
+int main(int argc, char** argv)
+{
+   bool follow = false;
+   bool fromNow = false;
+   LC_LogLevel threshold = LC_LOG_DEBUG;
+   const char* tag = NULL;
+   const char* output = NULL;
+   const char* name = NULL;
+
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-f"))
+         follow = true;
+      else if (!strcmp(argv[i], "-n"))
+         fromNow = true;
+      else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+         threshold = LC_Log::fromString(argv[++i]);
+      else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+         tag = argv[++i];
+      else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+         output = argv[++i];
+      else if (argv[i][0] != '-' && !name)
+         name = argv[i];
+      else {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   if (!name) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   LC_ShmReader reader;
+   if (!reader.open(name)) {
+      fprintf(stderr, "Failed to open %s: not found or incompatible version.\n", name);
+      return 1;
+   }
+   if (fromNow)
+      reader.seekToEnd();
+
+   FILE* out = output ? fopen(output, "a") : stdout;
+   if (!out) {
+      fprintf(stderr, "Failed to open %s: %s.\n", output, strerror(errno));
+      return 1;
+   }
+
+   LC_ShmEntry entry;
+   unsigned long long lost = 0;
+   unsigned int idle = 0;
+   for (;;) {
+      if (!reader.next(entry)) {
+         fflush(out);
+         if (!follow)
+            break;
+
+         // Stop when the producer is gone and everything was read.
+         const pid_t pid = (pid_t)reader.producerPid();
+         if (kill(pid, 0) != 0 && errno == ESRCH)
+            break;
+
+         // Back off up to 20 ms while idle.
+         struct timespec ts;
+         ts.tv_sec = 0;
+         ts.tv_nsec = (idle < 20 ? ++idle : idle)*1000000L;
+         nanosleep(&ts, NULL);
+         continue;
+      }
+
+      idle = 0;
+      if (reader.lost() != lost) {
+         fprintf(stderr, "--- lc_logtail: %llu records lost ---\n", reader.lost() - lost);
+         lost = reader.lost();
+      }
+
+      if (entry.level != LC_LOG_NONE && entry.level > threshold)
+         continue;
+      if (tag && entry.tag != tag)
+         continue;
+      print_entry(out, entry);
+   }
+
+   if (out != stdout)
+      fclose(out);
+   return 0;
+}
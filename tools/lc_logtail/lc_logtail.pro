@@ -0,0 +1,22 @@
+#
+# Author:  Luca Carlon
+# Company: -
+# Date:    10.18.2026
+#
+
+QT       -= core gui
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+
+TARGET   = lc_logtail
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES  += lc_logtail.cpp
+HEADERS  += ../../lc_logging.h \
+    ../../lc_logging_shm.h
+
+linux {
+LIBS     += -lrt
+}